@@ -0,0 +1,27 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Count memory allocations (malloc, calloc, realloc and objects) by installing a malloc logger, the hook used by memory
+ * analysis tools. Allocations are counted when made, whether or not they are freed afterwards
+ */
+@interface AllocationCounter : NSObject
+
+/**
+ * Execute a block on the main thread, returning the number of allocations it made. Allocations made by other threads
+ * are ignored, so that measurements are not disturbed by background activity
+ */
++ (NSUInteger)allocationCountForBlock:(void (^)(void))block;
+
+/**
+ * Execute a block on the main thread, returning the number of allocations made by all threads while it runs. Use for
+ * operations involving background queues, e.g. network requests, and run them in isolation
+ */
++ (NSUInteger)allThreadsAllocationCountForBlock:(void (^)(void))block;
+
+@end
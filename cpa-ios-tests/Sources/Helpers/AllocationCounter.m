@@ -0,0 +1,74 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "AllocationCounter.h"
+
+#import <pthread.h>
+
+// Malloc logger hook, exported by libmalloc but not declared in public headers
+typedef void (malloc_logger_t)(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t numberOfHotFramesToSkip);
+extern malloc_logger_t *malloc_logger;
+
+// Constants
+static const uint32_t AllocationCounterMallocLogTypeAllocate = 2;
+
+// Globals
+static malloc_logger_t *s_previousMallocLogger = NULL;
+static NSUInteger s_allocationCount = 0;
+static BOOL s_countsAllThreads = NO;
+
+// Static functions
+static void AllocationCounterMallocLogger(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t numberOfHotFramesToSkip);
+
+@implementation AllocationCounter
+
+#pragma mark Class methods
+
++ (NSUInteger)allocationCountForBlock:(void (^)(void))block
+{
+    return [self allocationCountForBlock:block allThreads:NO];
+}
+
++ (NSUInteger)allThreadsAllocationCountForBlock:(void (^)(void))block
+{
+    return [self allocationCountForBlock:block allThreads:YES];
+}
+
+/**
+ * Execute a block on the main thread, returning the number of allocations made by the main thread or by all threads
+ */
++ (NSUInteger)allocationCountForBlock:(void (^)(void))block allThreads:(BOOL)allThreads
+{
+    NSParameterAssert([NSThread isMainThread]);
+    NSParameterAssert(block);
+    
+    s_allocationCount = 0;
+    s_countsAllThreads = allThreads;
+    s_previousMallocLogger = malloc_logger;
+    malloc_logger = AllocationCounterMallocLogger;
+    
+    block();
+    
+    malloc_logger = s_previousMallocLogger;
+    s_previousMallocLogger = NULL;
+    return s_allocationCount;
+}
+
+@end
+
+#pragma mark Static functions
+
+static void AllocationCounterMallocLogger(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t numberOfHotFramesToSkip)
+{
+    // Reallocations are logged as both allocations and deallocations
+    if ((type & AllocationCounterMallocLogTypeAllocate) && (s_countsAllThreads || pthread_main_np())) {
+        __sync_fetch_and_add(&s_allocationCount, 1);
+    }
+    
+    if (s_previousMallocLogger) {
+        s_previousMallocLogger(type, arg1, arg2, arg3, result, numberOfHotFramesToSkip);
+    }
+}
@@ -0,0 +1,61 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * An in-process stand-in for an authorization provider, answering client registration and client token requests made
+ * to its host. Unlike HTTPStub, responses are not read from files but built from requests: Each registration creates
+ * a new client, and tokens are delivered for any domain to registered clients only (otherwise an invalid_client error
+ * is returned, as a real authorization provider would)
+ *
+ * Latency and errors can be injected to simulate real network conditions. Errors are spread evenly among requests
+ * so that runs are reproducible. Since stubs installed last are checked first, the stand-in must be installed after
+ * any HTTPStub
+ */
+@interface AuthorizationProviderStub : NSObject
+
+/**
+ * Create a stand-in answering requests made to the host of the specified URL
+ */
+- (instancetype)initWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL;
+
+/**
+ * The authorization provider URL
+ */
+@property (nonatomic, readonly) NSURL *authorizationProviderURL;
+
+/**
+ * The time elapsed before a response is received (default: 0)
+ */
+@property (atomic) NSTimeInterval latency;
+
+/**
+ * The fraction (between 0 and 1) of requests failing (default: 0)
+ */
+@property (atomic) double errorRate;
+
+/**
+ * The HTTP status code with which failing requests are answered. Set to 0 to simulate lost network connections
+ * instead (default: 503)
+ */
+@property (atomic) NSInteger errorStatusCode;
+
+/**
+ * Start and stop answering requests
+ */
+- (void)install;
+- (void)remove;
+
+/**
+ * The number of requests received since the stand-in was created, the number of those which failed because of
+ * error injection, and the number of registered clients
+ */
+@property (atomic, readonly) NSUInteger requestCount;
+@property (atomic, readonly) NSUInteger injectedErrorCount;
+@property (atomic, readonly) NSUInteger clientCount;
+
+@end
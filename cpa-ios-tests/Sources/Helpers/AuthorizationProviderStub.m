@@ -0,0 +1,197 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "AuthorizationProviderStub.h"
+
+#import "HTTPStub.h"
+#import "OHHTTPStubs.h"
+#import "OHHTTPStubsResponse+JSON.h"
+
+@interface AuthorizationProviderStub ()
+
+@property (nonatomic) NSURL *authorizationProviderURL;
+
+// Weak references to stub descriptors suffice, see OHHTTPStubs.h
+@property (nonatomic, weak) id<OHHTTPStubsDescriptor> stubDescriptor;
+
+// Must be accessed within a @synchronized(self) block
+@property (nonatomic) NSMutableDictionary<NSString *, NSString *> *clientSecrets;
+
+@property (atomic) NSUInteger requestCount;
+@property (atomic) NSUInteger injectedErrorCount;
+
+@end
+
+@implementation AuthorizationProviderStub
+
+#pragma mark Object creation and destruction
+
+- (instancetype)initWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(authorizationProviderURL);
+    
+    if (self = [super init]) {
+        self.authorizationProviderURL = authorizationProviderURL;
+        self.errorStatusCode = 503;
+        self.clientSecrets = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self remove];
+}
+
+#pragma mark Accessors and mutators
+
+- (NSUInteger)clientCount
+{
+    @synchronized(self) {
+        return self.clientSecrets.count;
+    }
+}
+
+#pragma mark Installation
+
+- (void)install
+{
+    if (self.stubDescriptor) {
+        return;
+    }
+    
+    // Request bodies are only available once HTTPStub has been initialized
+    [HTTPStub class];
+    
+    NSString *host = self.authorizationProviderURL.host;
+    __weak __typeof(self) weakSelf = self;
+    self.stubDescriptor = [OHHTTPStubs stubRequestsPassingTest:^(NSURLRequest *request) {
+        return [request.URL.host isEqualToString:host];
+    } withStubResponse:^(NSURLRequest *request) {
+        return [weakSelf responseForRequest:request];
+    }];
+}
+
+- (void)remove
+{
+    if (! self.stubDescriptor) {
+        return;
+    }
+    
+    [OHHTTPStubs removeStub:self.stubDescriptor];
+    self.stubDescriptor = nil;
+}
+
+#pragma mark Responses
+
+- (OHHTTPStubsResponse *)responseForRequest:(NSURLRequest *)request
+{
+    BOOL injectingError = NO;
+    @synchronized(self) {
+        NSUInteger requestCount = self.requestCount;
+        self.requestCount = requestCount + 1;
+        
+        // Fail a request each time the expected number of errors reaches the next integer
+        double errorRate = fmin(fmax(self.errorRate, 0.), 1.);
+        injectingError = floor((requestCount + 1) * errorRate) > floor(requestCount * errorRate);
+        if (injectingError) {
+            self.injectedErrorCount += 1;
+        }
+    }
+    
+    NSTimeInterval latency = self.latency;
+    if (injectingError) {
+        NSInteger errorStatusCode = self.errorStatusCode;
+        if (errorStatusCode == 0) {
+            NSDictionary *userInfo = @{ NSLocalizedDescriptionKey : @"An injected network error has occurred" };
+            NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:userInfo];
+            
+            // Error responses are delayed by their response time
+            return [[OHHTTPStubsResponse responseWithError:error] responseTime:latency];
+        }
+        else {
+            return [[self responseWithError:@"temporarily_unavailable" statusCode:errorStatusCode] requestTime:latency responseTime:0.];
+        }
+    }
+    
+    return [[self responseForValidRequest:request] requestTime:latency responseTime:0.];
+}
+
+- (OHHTTPStubsResponse *)responseForValidRequest:(NSURLRequest *)request
+{
+    NSData *bodyData = [HTTPStub bodyDataForRequest:request];
+    NSDictionary *body = bodyData ? [NSJSONSerialization JSONObjectWithData:bodyData options:0 error:NULL] : nil;
+    if (! [request.HTTPMethod isEqualToString:@"POST"] || ! [body isKindOfClass:[NSDictionary class]]) {
+        return [self responseWithError:@"invalid_request" statusCode:400];
+    }
+    
+    NSString *path = request.URL.path;
+    if ([path isEqualToString:@"/register"]) {
+        NSString *clientIdentifier = nil;
+        NSString *clientSecret = [[NSUUID UUID].UUIDString stringByReplacingOccurrencesOfString:@"-" withString:@""].lowercaseString;
+        @synchronized(self) {
+            clientIdentifier = @(self.clientSecrets.count + 1).stringValue;
+            self.clientSecrets[clientIdentifier] = clientSecret;
+        }
+        
+        return [OHHTTPStubsResponse responseWithJSONObject:@{ @"client_id" : clientIdentifier,
+                                                              @"client_secret" : clientSecret }
+                                                statusCode:201
+                                                   headers:nil];
+    }
+    else if ([path isEqualToString:@"/token"]) {
+        NSString *clientIdentifier = body[@"client_id"];
+        NSString *clientSecret = body[@"client_secret"];
+        NSString *domain = body[@"domain"];
+        if (! [body[@"grant_type"] isEqualToString:@"http://tech.ebu.ch/cpa/1.0/client_credentials"] || ! domain) {
+            return [self responseWithError:@"invalid_request" statusCode:400];
+        }
+        
+        BOOL clientValid = NO;
+        @synchronized(self) {
+            clientValid = clientIdentifier && [self.clientSecrets[clientIdentifier] isEqualToString:clientSecret];
+        }
+        if (! clientValid) {
+            return [self responseWithError:@"invalid_client" statusCode:400];
+        }
+        
+        NSString *accessToken = [[NSUUID UUID].UUIDString stringByReplacingOccurrencesOfString:@"-" withString:@""].lowercaseString;
+        return [OHHTTPStubsResponse responseWithJSONObject:@{ @"access_token" : accessToken,
+                                                              @"token_type" : @"bearer",
+                                                              @"expires_in" : @2591999,
+                                                              @"domain" : domain,
+                                                              @"domain_display_name" : domain }
+                                                statusCode:200
+                                                   headers:@{ @"Cache-Control" : @"no-store" }];
+    }
+    else {
+        return [self responseWithError:@"invalid_request" statusCode:404];
+    }
+}
+
+- (OHHTTPStubsResponse *)responseWithError:(NSString *)error statusCode:(NSInteger)statusCode
+{
+    NSParameterAssert(error);
+    
+    return [OHHTTPStubsResponse responseWithJSONObject:@{ @"error" : error }
+                                            statusCode:(int)statusCode
+                                               headers:nil];
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; authorizationProviderURL: %@; latency: %@; errorRate: %@; requestCount: %@>",
+            [self class],
+            self,
+            self.authorizationProviderURL,
+            @(self.latency),
+            @(self.errorRate),
+            @(self.requestCount)];
+}
+
+@end
@@ -50,6 +50,17 @@ OBJC_EXPORT NSString * const HTTPStubNetworkConnectionLost;
  */
 + (void)removeAllStubs;
 
+/**
+ * Return the number of requests which have been answered by the stub with the given name since it was installed
+ */
++ (NSUInteger)numberOfRequestsForStubWithName:(NSString *)name;
+
+/**
+ * Return the body of a request received by a stub, nil if none. NSURLSession moves bodies to streams before requests
+ * reach URL protocols, HTTPStub therefore keeps a copy of them
+ */
++ (NSData *)bodyDataForRequest:(NSURLRequest *)request;
+
 /**
  * The stub name
  */
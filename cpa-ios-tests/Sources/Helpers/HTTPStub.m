@@ -10,10 +10,15 @@
 #import "NSBundle+Tests.h"
 #import "OHHTTPStubs.h"
 
+#import <objc/runtime.h>
+
 NSString * const HTTPStubNetworkConnectionLost = @"HTTPStubNetworkConnectionLost_reserved";
 
+static NSString * const HTTPStubBodyPropertyKey = @"HTTPStubBody";
+
 static __weak id<OHHTTPStubsDescriptor> s_defaultStubDescriptor = nil;
 static NSMutableDictionary *s_stubDescriptors = nil;
+static NSCountedSet *s_stubActivations = nil;
 
 @interface HTTPStub ()
 
@@ -24,6 +29,12 @@ static NSMutableDictionary *s_stubDescriptors = nil;
 
 @end
 
+@interface NSMutableURLRequest (HTTPStub)
+
+- (void)httpstub_setHTTPBody:(NSData *)HTTPBody;
+
+@end
+
 @implementation HTTPStub
 
 #pragma mark Class methods
@@ -34,7 +45,13 @@ static NSMutableDictionary *s_stubDescriptors = nil;
         return;
     }
     
+    // NSURLSession moves request bodies to streams before requests reach URL protocols. Keep a copy of bodies so that
+    // they can be matched against stubs
+    method_exchangeImplementations(class_getInstanceMethod([NSMutableURLRequest class], @selector(setHTTPBody:)),
+                                   class_getInstanceMethod([NSMutableURLRequest class], @selector(httpstub_setHTTPBody:)));
+    
     s_stubDescriptors = [NSMutableDictionary dictionary];
+    s_stubActivations = [NSCountedSet set];
 }
 
 + (NSArray *)availableStubNames
@@ -80,6 +97,7 @@ static NSMutableDictionary *s_stubDescriptors = nil;
         stubDescriptor = [OHHTTPStubs stubRequestsPassingTest:^(NSURLRequest *request) {
             return [stub matchesRequest:request];
         } withStubResponse:^(NSURLRequest *request) {
+            [self recordActivationOfStubWithName:name];
             return stub.response;
         }];
     }
@@ -87,6 +105,8 @@ static NSMutableDictionary *s_stubDescriptors = nil;
         stubDescriptor = [OHHTTPStubs stubRequestsPassingTest:^(NSURLRequest *request) {
             return YES;
         } withStubResponse:^(NSURLRequest *request) {
+            [self recordActivationOfStubWithName:name];
+            
             NSDictionary *userInfo = @{ NSLocalizedDescriptionKey : @"A stubbed network error has occurred" };
             NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:userInfo];
             return [OHHTTPStubsResponse responseWithError:error];
@@ -109,6 +129,12 @@ static NSMutableDictionary *s_stubDescriptors = nil;
     [OHHTTPStubs removeStub:stubDescriptor];
     [s_stubDescriptors removeObjectForKey:name];
     
+    @synchronized(s_stubActivations) {
+        while ([s_stubActivations countForObject:name] != 0) {
+            [s_stubActivations removeObject:name];
+        }
+    }
+    
     if (s_stubDescriptors.count == 0) {
         [OHHTTPStubs removeStub:s_defaultStubDescriptor];
     }
@@ -121,6 +147,30 @@ static NSMutableDictionary *s_stubDescriptors = nil;
     }
 }
 
++ (NSUInteger)numberOfRequestsForStubWithName:(NSString *)name
+{
+    NSParameterAssert(name);
+    
+    // Stub responses are built on background threads
+    @synchronized(s_stubActivations) {
+        return [s_stubActivations countForObject:name];
+    }
+}
+
++ (NSData *)bodyDataForRequest:(NSURLRequest *)request
+{
+    NSParameterAssert(request);
+    
+    return request.HTTPBody ?: [NSURLProtocol propertyForKey:HTTPStubBodyPropertyKey inRequest:request];
+}
+
++ (void)recordActivationOfStubWithName:(NSString *)name
+{
+    @synchronized(s_stubActivations) {
+        [s_stubActivations addObject:name];
+    }
+}
+
 #pragma mark Object creation and destruction
 
 - (instancetype)initWithName:(NSString *)name
@@ -179,7 +229,12 @@ static NSMutableDictionary *s_stubDescriptors = nil;
 
 - (BOOL)matchesBodyOfRequest:(NSURLRequest *)request
 {
-    NSDictionary *requestBodyDictionary = [NSJSONSerialization JSONObjectWithData:request.HTTPBody options:0 error:NULL];
+    NSData *requestBodyData = [HTTPStub bodyDataForRequest:request];
+    if (! requestBodyData) {
+        return NO;
+    }
+    
+    NSDictionary *requestBodyDictionary = [NSJSONSerialization JSONObjectWithData:requestBodyData options:0 error:NULL];
     NSDictionary *bodyDictionary = [NSJSONSerialization JSONObjectWithData:self.requestStubFile.bodyData options:0 error:NULL];
     return [requestBodyDictionary isEqualToDictionary:bodyDictionary];
 }
@@ -205,3 +260,21 @@ static NSMutableDictionary *s_stubDescriptors = nil;
 
 @end
 
+@implementation NSMutableURLRequest (HTTPStub)
+
+#pragma mark Swizzled methods
+
+- (void)httpstub_setHTTPBody:(NSData *)HTTPBody
+{
+    if (HTTPBody) {
+        [NSURLProtocol setProperty:HTTPBody forKey:HTTPStubBodyPropertyKey inRequest:self];
+    }
+    else {
+        [NSURLProtocol removePropertyForKey:HTTPStubBodyPropertyKey inRequest:self];
+    }
+    
+    // Call the original implementation
+    [self httpstub_setHTTPBody:HTTPBody];
+}
+
+@end
@@ -0,0 +1,27 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPAProvider.h"
+
+#import <XCTest/XCTest.h>
+
+/**
+ * Provider fixture shared by test cases. Responses are delivered by HTTPStub stubs
+ */
+@interface XCTestCase (Provider)
+
+/**
+ * Return a provider for the test authorization provider, without identity. Requests are retried quickly, with a fresh
+ * retry budget and without circuit breaker, so that tests do not influence each other
+ */
+- (CPAProvider *)testProvider;
+
+/**
+ * Request a short-lived client token for the cpa.rts.ch domain with the specified provider, and wait until it expires
+ */
+- (CPAToken *)requestExpiredClientTokenWithProvider:(CPAProvider *)provider;
+
+@end
@@ -0,0 +1,58 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "XCTestCase+Provider.h"
+
+#import "HTTPStub.h"
+
+static NSTimeInterval kConnectionTimeOut = 60;
+
+@implementation XCTestCase (Provider)
+
+- (CPAProvider *)testProvider
+{
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    CPAProvider *provider = [[CPAProvider alloc] initWithAuthorizationProviderURL:authorizationProviderURL];
+    [provider discardIdentity];
+    
+    CPARetryPolicy *retryPolicy = [[CPARetryPolicy alloc] init];
+    retryPolicy.baseDelay = 0.01;
+    provider.retryPolicy = retryPolicy;
+    provider.circuitBreaker = nil;
+    return provider;
+}
+
+- (CPAToken *)requestExpiredClientTokenWithProvider:(CPAProvider *)provider
+{
+    NSParameterAssert(provider);
+    
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider_short_lived"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token (short-lived)"];
+    
+    __block CPAToken *token = nil;
+    [provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *receivedToken, NSError *error) {
+        XCTAssertNil(error);
+        token = receivedToken;
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"expired == YES"] evaluatedWithObject:token handler:nil];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    [HTTPStub removeStubWithName:@"request_client_token_provider_short_lived"];
+    return token;
+}
+
+@end
@@ -0,0 +1,537 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "AllocationCounter.h"
+#import "AuthorizationProviderStub.h"
+#import "CPAKeyChainTokenStore.h"
+#import "CPALatencyHistogram.h"
+#import "CPAMemoryTokenStore.h"
+#import "CPAProvider.h"
+#import "CPARequestBuilder.h"
+#import "CPAResponse.h"
+#import "CPARetryPolicy.h"
+#import "CPAStatelessRequest.h"
+#import "HTTPStub.h"
+#import "HTTPStubFile.h"
+#import "NSBundle+Tests.h"
+#import "NSURLSession+CPAExtensions.h"
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+
+static NSTimeInterval kConnectionTimeOut = 60;
+
+// Benchmark parameters. The latency is the one of the stand-in authorization provider
+static const NSUInteger kBenchmarkIterationCount = 100;
+static const NSUInteger kBenchmarkCacheHitIterationCount = 10000;
+static const NSUInteger kBenchmarkMicroIterationCount = 1000;
+static const NSUInteger kBenchmarkDomainCount = 8;
+static const NSTimeInterval kBenchmarkLatency = 0.005;
+static const double kBenchmarkErrorRate = 0.1;
+
+// Types
+typedef void (^BenchmarkCompletionBlock)(NSError *error);
+typedef void (^BenchmarkOperationBlock)(BenchmarkCompletionBlock completionBlock);
+typedef void (^BenchmarkMicroOperationBlock)(NSUInteger operationIndex);
+
+// Results of all benchmarks run, written as JSON once all of them are over
+static NSMutableDictionary<NSString *, NSDictionary *> *s_results = nil;
+
+/**
+ * Benchmarks of the token pipeline, run against an in-process authorization provider stand-in. Results (latency
+ * percentiles, throughput and allocations for each scenario) are written as JSON to the file whose path is given by
+ * the CPA_BENCHMARK_RESULTS_PATH environment variable (by default cpa-benchmark-results.json in the temporary
+ * directory), so that runs can be compared to detect regressions
+ */
+@interface CPABenchmarkTestCase : XCTestCase
+
+@property (nonatomic) NSURL *authorizationProviderURL;
+@property (nonatomic) AuthorizationProviderStub *authorizationProviderStub;
+
+@end
+
+@implementation CPABenchmarkTestCase
+
+#pragma mark Class setup and teardown
+
++ (void)setUp
+{
+    s_results = [NSMutableDictionary dictionary];
+}
+
++ (void)tearDown
+{
+    NSString *resultsFilePath = [NSProcessInfo processInfo].environment[@"CPA_BENCHMARK_RESULTS_PATH"] ?: [NSTemporaryDirectory() stringByAppendingPathComponent:@"cpa-benchmark-results.json"];
+    
+    UIDevice *device = [UIDevice currentDevice];
+    NSDictionary *results = @{ @"date" : @([NSDate date].timeIntervalSince1970),
+                               @"device" : @{ @"model" : device.model,
+                                              @"system_version" : device.systemVersion },
+                               @"parameters" : @{ @"latency" : @(kBenchmarkLatency),
+                                                  @"error_rate" : @(kBenchmarkErrorRate),
+                                                  @"domain_count" : @(kBenchmarkDomainCount) },
+                               @"scenarios" : [s_results copy] };
+    NSData *resultsData = [NSJSONSerialization dataWithJSONObject:results options:NSJSONWritingPrettyPrinted error:NULL];
+    if ([resultsData writeToFile:resultsFilePath atomically:YES]) {
+        NSLog(@"Benchmark results written to %@", resultsFilePath);
+    }
+    else {
+        NSLog(@"Benchmark results could not be written to %@", resultsFilePath);
+    }
+}
+
+#pragma mark Setup and teardown
+
+- (void)setUp
+{
+    // Use a dedicated authorization provider URL, so that other tests are not affected by session or retry settings
+    self.authorizationProviderURL = [NSURL URLWithString:@"https://benchmark.cpa.rts.ch"];
+    
+    CPARetryPolicy *retryPolicy = [[CPARetryPolicy alloc] init];
+    retryPolicy.baseDelay = 0.01;
+    [CPAStatelessRequest setRetryPolicy:retryPolicy forAuthorizationProviderURL:self.authorizationProviderURL];
+    
+    self.authorizationProviderStub = [[AuthorizationProviderStub alloc] initWithAuthorizationProviderURL:self.authorizationProviderURL];
+    self.authorizationProviderStub.latency = kBenchmarkLatency;
+    [self.authorizationProviderStub install];
+}
+
+- (void)tearDown
+{
+    [self.authorizationProviderStub remove];
+    self.authorizationProviderStub = nil;
+}
+
+#pragma mark Helpers
+
+- (CPAProvider *)benchmarkProvider
+{
+    // Keep tokens in memory, so that results do not depend on keychain performance
+    CPAProvider *provider = [[CPAProvider alloc] initWithAuthorizationProviderURL:self.authorizationProviderURL
+                                                                       tokenStore:[[CPAMemoryTokenStore alloc] init]
+                                                                 tokenStorageMode:CPATokenStorageModeSingleItem];
+    
+    // Retry quickly, with a fresh budget for each benchmark
+    CPARetryPolicy *retryPolicy = [[CPARetryPolicy alloc] init];
+    retryPolicy.baseDelay = 0.01;
+    provider.retryPolicy = retryPolicy;
+    
+    return provider;
+}
+
+- (void)requestTokensForDomains:(NSArray<NSString *> *)domains withProvider:(CPAProvider *)provider
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client tokens"];
+    
+    [provider requestTokensForDomains:domains withType:CPATokenTypeClient completionBlock:^(NSDictionary<NSString *, CPAToken *> *tokens, NSDictionary<NSString *, NSError *> *errors) {
+        XCTAssertEqual(errors.count, 0);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+}
+
+/**
+ * Run an operation the specified number of times, one after the other, and record its results under the given name.
+ * The preparation block (optional) is called before each operation, outside measurements. The operation must call
+ * its completion block when done, either synchronously or on the main thread
+ *
+ * Allocations made by all threads during each operation are counted, including memory freed before the operation is
+ * over. Since background activity unrelated to the operation is counted as well, scenarios must run in isolation
+ */
+- (NSDictionary *)runBenchmarkWithName:(NSString *)name
+                        iterationCount:(NSUInteger)iterationCount
+                      preparationBlock:(void (^)(void))preparationBlock
+                        operationBlock:(BenchmarkOperationBlock)operationBlock
+{
+    NSParameterAssert(name);
+    NSParameterAssert(operationBlock);
+    
+    CPALatencyHistogram *histogram = [[CPALatencyHistogram alloc] init];
+    __block NSUInteger failureCount = 0;
+    NSTimeInterval totalDuration = 0.;
+    NSUInteger startRequestCount = self.authorizationProviderStub.requestCount;
+    NSUInteger startInjectedErrorCount = self.authorizationProviderStub.injectedErrorCount;
+    
+    NSUInteger allocationCount = 0;
+    
+    for (NSUInteger i = 0; i < iterationCount; ++i) {
+        @autoreleasepool {
+            preparationBlock ? preparationBlock() : nil;
+            
+            __block BOOL finished = NO;
+            NSTimeInterval startTime = [NSProcessInfo processInfo].systemUptime;
+            allocationCount += [AllocationCounter allThreadsAllocationCountForBlock:^{
+                operationBlock(^(NSError *error) {
+                    [histogram recordDuration:[NSProcessInfo processInfo].systemUptime - startTime];
+                    if (error) {
+                        failureCount += 1;
+                    }
+                    finished = YES;
+                });
+                
+                // Completion blocks are called on the main thread, run the main loop until the operation is over
+                NSDate *timeoutDate = [NSDate dateWithTimeIntervalSinceNow:kConnectionTimeOut];
+                while (! finished && [timeoutDate timeIntervalSinceNow] > 0.) {
+                    [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:timeoutDate];
+                }
+            }];
+            XCTAssertTrue(finished, @"The operation did not complete in time");
+            
+            totalDuration += [NSProcessInfo processInfo].systemUptime - startTime;
+        }
+    }
+    
+    double allocationCountPerIteration = (iterationCount != 0) ? (double)allocationCount / iterationCount : 0.;
+    
+    NSDictionary *result = @{ @"iterations" : @(iterationCount),
+                              @"failures" : @(failureCount),
+                              @"latency" : @{ @"p50" : @([histogram durationAtPercentile:50.]),
+                                              @"p90" : @([histogram durationAtPercentile:90.]),
+                                              @"p99" : @([histogram durationAtPercentile:99.]),
+                                              @"mean" : @(histogram.meanDuration),
+                                              @"maximum" : @(histogram.maximumDuration) },
+                              @"throughput" : @((totalDuration > 0.) ? iterationCount / totalDuration : 0.),
+                              @"allocations" : @{ @"count" : @(allocationCountPerIteration) },
+                              @"requests" : @(self.authorizationProviderStub.requestCount - startRequestCount),
+                              @"injected_errors" : @(self.authorizationProviderStub.injectedErrorCount - startInjectedErrorCount) };
+    s_results[name] = result;
+    
+    NSLog(@"Benchmark %@: p50 %.3f ms, p99 %.3f ms, %.1f operations/s, %.0f allocations per operation", name,
+          [histogram durationAtPercentile:50.] * 1000., [histogram durationAtPercentile:99.] * 1000.,
+          [result[@"throughput"] doubleValue], allocationCountPerIteration);
+    
+    return result;
+}
+
+/**
+ * Perform the specified number of passes, each calling the operation block for all operation indices, and record results
+ * under the given name. The latency is the one of a whole pass (single operations are too fast to be measured accurately),
+ * while durations and allocations are reported per operation. Allocations are counted exactly
+ */
+- (NSDictionary *)runMicroBenchmarkWithName:(NSString *)name
+                             iterationCount:(NSUInteger)iterationCount
+                             operationCount:(NSUInteger)operationCount
+                             operationBlock:(BenchmarkMicroOperationBlock)operationBlock
+{
+    NSParameterAssert(name);
+    NSParameterAssert(operationBlock);
+    
+    CPALatencyHistogram *histogram = [[CPALatencyHistogram alloc] init];
+    __block NSTimeInterval totalDuration = 0.;
+    
+    NSUInteger allocationCount = [AllocationCounter allocationCountForBlock:^{
+        for (NSUInteger i = 0; i < iterationCount; ++i) {
+            @autoreleasepool {
+                NSTimeInterval startTime = [NSProcessInfo processInfo].systemUptime;
+                for (NSUInteger j = 0; j < operationCount; ++j) {
+                    operationBlock(j);
+                }
+                NSTimeInterval duration = [NSProcessInfo processInfo].systemUptime - startTime;
+                [histogram recordDuration:duration];
+                totalDuration += duration;
+            }
+        }
+    }];
+    
+    NSUInteger totalOperationCount = iterationCount * operationCount;
+    NSDictionary *result = @{ @"iterations" : @(iterationCount),
+                              @"operations" : @(operationCount),
+                              @"latency" : @{ @"p50" : @([histogram durationAtPercentile:50.]),
+                                              @"p90" : @([histogram durationAtPercentile:90.]),
+                                              @"p99" : @([histogram durationAtPercentile:99.]),
+                                              @"mean" : @(histogram.meanDuration),
+                                              @"maximum" : @(histogram.maximumDuration) },
+                              @"duration" : @((totalOperationCount != 0) ? totalDuration / totalOperationCount : 0.),
+                              @"throughput" : @((totalDuration > 0.) ? totalOperationCount / totalDuration : 0.),
+                              @"allocations" : @{ @"count" : @((totalOperationCount != 0) ? (double)allocationCount / totalOperationCount : 0.) } };
+    s_results[name] = result;
+    
+    NSLog(@"Benchmark %@: %.3f us and %.1f allocations per operation", name, [result[@"duration"] doubleValue] * 1000000.,
+          [result[@"allocations"][@"count"] doubleValue]);
+    
+    return result;
+}
+
+#pragma mark Benchmarks
+
+- (void)testColdRegisterBenchmark
+{
+    // Each iteration uses a new provider without identity, which must register before requesting a token
+    __block CPAProvider *provider = nil;
+    NSDictionary *result = [self runBenchmarkWithName:@"cold_register" iterationCount:kBenchmarkIterationCount preparationBlock:^{
+        provider = [self benchmarkProvider];
+    } operationBlock:^(BenchmarkCompletionBlock completionBlock) {
+        [provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+            completionBlock(error);
+        }];
+    }];
+    XCTAssertEqualObjects(result[@"failures"], @0);
+    XCTAssertEqual(self.authorizationProviderStub.clientCount, kBenchmarkIterationCount);
+}
+
+- (void)testWarmRefreshBenchmark
+{
+    // A token is already available, and is therefore refreshed
+    CPAProvider *provider = [self benchmarkProvider];
+    [self requestTokensForDomains:@[@"cpa.rts.ch"] withProvider:provider];
+    
+    NSDictionary *result = [self runBenchmarkWithName:@"warm_refresh" iterationCount:kBenchmarkIterationCount preparationBlock:nil operationBlock:^(BenchmarkCompletionBlock completionBlock) {
+        [provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+            completionBlock(error);
+        }];
+    }];
+    XCTAssertEqualObjects(result[@"failures"], @0);
+    XCTAssertEqual(self.authorizationProviderStub.clientCount, 1);
+}
+
+- (void)testWarmRefreshWithErrorsBenchmark
+{
+    CPAProvider *provider = [self benchmarkProvider];
+    [self requestTokensForDomains:@[@"cpa.rts.ch"] withProvider:provider];
+    
+    // Errors are spread evenly and transient. They are hidden by retries, whose cost is measured
+    self.authorizationProviderStub.errorRate = kBenchmarkErrorRate;
+    
+    NSDictionary *result = [self runBenchmarkWithName:@"warm_refresh_with_errors" iterationCount:kBenchmarkIterationCount preparationBlock:nil operationBlock:^(BenchmarkCompletionBlock completionBlock) {
+        [provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+            completionBlock(error);
+        }];
+    }];
+    XCTAssertEqualObjects(result[@"failures"], @0);
+    XCTAssertTrue(self.authorizationProviderStub.injectedErrorCount > 0);
+}
+
+- (void)testMultiDomainBenchmark
+{
+    NSMutableArray<NSString *> *domains = [NSMutableArray array];
+    for (NSUInteger i = 0; i < kBenchmarkDomainCount; ++i) {
+        [domains addObject:[NSString stringWithFormat:@"domain%@.cpa.rts.ch", @(i)]];
+    }
+    
+    CPAProvider *provider = [self benchmarkProvider];
+    [self requestTokensForDomains:domains withProvider:provider];
+    
+    NSDictionary *result = [self runBenchmarkWithName:@"multi_domain" iterationCount:kBenchmarkIterationCount preparationBlock:nil operationBlock:^(BenchmarkCompletionBlock completionBlock) {
+        [provider requestTokensForDomains:domains withType:CPATokenTypeClient completionBlock:^(NSDictionary<NSString *, CPAToken *> *tokens, NSDictionary<NSString *, NSError *> *errors) {
+            completionBlock(errors.allValues.firstObject);
+        }];
+    }];
+    XCTAssertEqualObjects(result[@"failures"], @0);
+}
+
+- (void)testCacheHitBenchmark
+{
+    CPAProvider *provider = [self benchmarkProvider];
+    [self requestTokensForDomains:@[@"cpa.rts.ch"] withProvider:provider];
+    
+    NSUInteger requestCount = self.authorizationProviderStub.requestCount;
+    NSDictionary *result = [self runBenchmarkWithName:@"cache_hit" iterationCount:kBenchmarkCacheHitIterationCount preparationBlock:nil operationBlock:^(BenchmarkCompletionBlock completionBlock) {
+        CPAToken *token = [provider tokenForDomain:@"cpa.rts.ch"];
+        completionBlock(token ? nil : [NSError errorWithDomain:@"BenchmarkErrorDomain" code:0 userInfo:nil]);
+    }];
+    XCTAssertEqualObjects(result[@"failures"], @0);
+    
+    // Served from the cache only
+    XCTAssertEqual(self.authorizationProviderStub.requestCount, requestCount);
+}
+
+- (void)testLaunchBenchmark
+{
+    NSMutableArray<NSString *> *domains = [NSMutableArray array];
+    for (NSUInteger i = 0; i < kBenchmarkDomainCount; ++i) {
+        [domains addObject:[NSString stringWithFormat:@"domain%@.cpa.rts.ch", @(i)]];
+    }
+    
+    // Launches read the keychain, as applications do. Use a dedicated service so that other tests are not affected
+    CPAKeyChainTokenStore *tokenStore = [[CPAKeyChainTokenStore alloc] initWithService:@"ch.ebu.cpa.benchmark" accessGroup:nil];
+    CPAProvider *provider = [[CPAProvider alloc] initWithAuthorizationProviderURL:self.authorizationProviderURL
+                                                                       tokenStore:tokenStore
+                                                                 tokenStorageMode:CPATokenStorageModeItemPerDomain];
+    [self requestTokensForDomains:domains withProvider:provider];
+    
+    // Each iteration simulates an application launch, measuring the time spent on the main thread by the first lookups.
+    // Without warm-up, the token store is read when tokens are first needed
+    __block CPAProvider *launchProvider = nil;
+    NSDictionary *coldResult = [self runBenchmarkWithName:@"launch_lookup_cold" iterationCount:kBenchmarkIterationCount preparationBlock:^{
+        launchProvider = [[CPAProvider alloc] initWithAuthorizationProviderURL:self.authorizationProviderURL tokenStore:tokenStore tokenStorageMode:CPATokenStorageModeItemPerDomain];
+    } operationBlock:^(BenchmarkCompletionBlock completionBlock) {
+        for (NSString *domain in domains) {
+            [launchProvider tokenForDomain:domain];
+        }
+        completionBlock(nil);
+    }];
+    
+    // With warm-up, the store is read in the background while the rest of the application launches
+    NSDictionary *warmResult = [self runBenchmarkWithName:@"launch_lookup_warm" iterationCount:kBenchmarkIterationCount preparationBlock:^{
+        launchProvider = [[CPAProvider alloc] initWithAuthorizationProviderURL:self.authorizationProviderURL tokenStore:tokenStore tokenStorageMode:CPATokenStorageModeItemPerDomain];
+        [launchProvider warmUp];
+        while (! launchProvider.warmedUp) {
+            [NSThread sleepForTimeInterval:0.001];
+        }
+    } operationBlock:^(BenchmarkCompletionBlock completionBlock) {
+        for (NSString *domain in domains) {
+            [launchProvider tokenForDomain:domain];
+        }
+        completionBlock(launchProvider.tokenCacheMissCount == 0 ? nil : [NSError errorWithDomain:@"BenchmarkErrorDomain" code:0 userInfo:nil]);
+    }];
+    XCTAssertEqualObjects(warmResult[@"failures"], @0);
+    
+    // Cost of starting warm-up on the main thread
+    [self runBenchmarkWithName:@"launch_warm_up_start" iterationCount:kBenchmarkIterationCount preparationBlock:nil operationBlock:^(BenchmarkCompletionBlock completionBlock) {
+        CPAProvider *startupProvider = [[CPAProvider alloc] initWithAuthorizationProviderURL:self.authorizationProviderURL tokenStore:tokenStore tokenStorageMode:CPATokenStorageModeItemPerDomain];
+        [startupProvider warmUp];
+        completionBlock(nil);
+    }];
+    
+    XCTAssertTrue([warmResult[@"latency"][@"p50"] doubleValue] < [coldResult[@"latency"][@"p50"] doubleValue]);
+    
+    [provider discardIdentity];
+}
+
+- (void)testStatelessClientTokenBenchmark
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Register client"];
+    
+    __block NSString *clientIdentifier = nil;
+    __block NSString *clientSecret = nil;
+    [CPAStatelessRequest registerClientWithAuthorizationProviderURL:self.authorizationProviderURL clientName:@"cpa-ios-tests-runner" softwareIdentifier:@"ch.ebu.cpa-ios-tests-runner" softwareVersion:@"0.1" completionQueue:nil completionBlock:^(NSString *registeredClientIdentifier, NSString *registeredClientSecret, NSError *error) {
+        XCTAssertNil(error);
+        clientIdentifier = registeredClientIdentifier;
+        clientSecret = registeredClientSecret;
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    NSDictionary *result = [self runBenchmarkWithName:@"stateless_client_token" iterationCount:kBenchmarkIterationCount preparationBlock:nil operationBlock:^(BenchmarkCompletionBlock completionBlock) {
+        [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:self.authorizationProviderURL clientIdentifier:clientIdentifier clientSecret:clientSecret domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+            completionBlock(error);
+        }];
+    }];
+    XCTAssertEqualObjects(result[@"failures"], @0);
+}
+
+- (void)testResponseDecodingBenchmark
+{
+    NSMutableArray<NSData *> *responseBodies = [NSMutableArray array];
+    NSMutableArray<Class> *responseClasses = [NSMutableArray array];
+    for (NSString *stubName in [HTTPStub availableStubNames]) {
+        NSString *stubDirectory = [@"Stubs" stringByAppendingPathComponent:stubName];
+        NSString *responseFilePath = [[NSBundle testBundle] pathForResource:@"response" ofType:nil inDirectory:stubDirectory];
+        [responseBodies addObject:[[HTTPStubFile alloc] initWithFilePath:responseFilePath].bodyData];
+        
+        if ([stubName hasPrefix:@"register_"]) {
+            [responseClasses addObject:[CPAClientRegistrationResponse class]];
+        }
+        else if ([stubName hasPrefix:@"request_code"]) {
+            [responseClasses addObject:[CPAUserCodeResponse class]];
+        }
+        else {
+            [responseClasses addObject:[CPATokenResponse class]];
+        }
+    }
+    
+    NSDictionary<NSString *, NSArray<NSString *> *> *keys = @{ NSStringFromClass([CPAClientRegistrationResponse class]) : @[@"client_id", @"client_secret"],
+                                                               NSStringFromClass([CPAUserCodeResponse class]) : @[@"device_code", @"user_code", @"verification_uri", @"interval", @"expires_in"],
+                                                               NSStringFromClass([CPATokenResponse class]) : @[@"user_name", @"access_token", @"token_type", @"domain_display_name", @"expires_in"] };
+    
+    // Former decoding path, through an intermediate JSON dictionary from which fields are then extracted
+    NSDictionary *dictionaryResult = [self runMicroBenchmarkWithName:@"response_decoding_dictionary" iterationCount:kBenchmarkMicroIterationCount operationCount:responseBodies.count operationBlock:^(NSUInteger operationIndex) {
+        NSDictionary *responseDictionary = CPAJSONDictionaryFromData(responseBodies[operationIndex], NULL);
+        for (NSString *key in keys[NSStringFromClass(responseClasses[operationIndex])]) {
+            [responseDictionary objectForKey:key];
+        }
+    }];
+    
+    NSDictionary *typedResult = [self runMicroBenchmarkWithName:@"response_decoding_typed" iterationCount:kBenchmarkMicroIterationCount operationCount:responseBodies.count operationBlock:^(NSUInteger operationIndex) {
+        [responseClasses[operationIndex] responseWithData:responseBodies[operationIndex]];
+    }];
+    
+    XCTAssertTrue([typedResult[@"allocations"][@"count"] doubleValue] < [dictionaryResult[@"allocations"][@"count"] doubleValue]);
+}
+
+- (void)testRequestConstructionBenchmark
+{
+    NSString *clientIdentifier = @"407";
+    NSString *clientSecret = @"f9f1c336a59219e05a59eecb40eb49eb";
+    NSString *deviceCode = @"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1";
+    NSString *domain = @"cpa.rts.ch";
+    
+    // Former construction path, building each request from scratch and serializing a dictionary as body. The four
+    // operations correspond to the four kinds of requests
+    NSDictionary *serializationResult = [self runMicroBenchmarkWithName:@"request_construction_serialization" iterationCount:kBenchmarkMicroIterationCount operationCount:4 operationBlock:^(NSUInteger operationIndex) {
+        NSString *endpoint = nil;
+        NSDictionary<NSString *, NSString *> *requestDictionary = nil;
+        switch (operationIndex) {
+            case 0:
+                endpoint = @"register";
+                requestDictionary = @{ @"client_name" : @"CPA Benchmark",
+                                       @"software_id" : @"ch.ebu.cpa.benchmark",
+                                       @"software_version" : @"1.0" };
+                break;
+            
+            case 1:
+                endpoint = @"associate";
+                requestDictionary = @{ @"client_id" : clientIdentifier,
+                                       @"client_secret" : clientSecret,
+                                       @"domain" : domain };
+                break;
+            
+            case 2:
+                endpoint = @"token";
+                requestDictionary = @{ @"grant_type" : @"http://tech.ebu.ch/cpa/1.0/device_code",
+                                       @"device_code" : deviceCode,
+                                       @"client_id" : clientIdentifier,
+                                       @"client_secret" : clientSecret,
+                                       @"domain" : domain };
+                break;
+            
+            default:
+                endpoint = @"token";
+                requestDictionary = @{ @"grant_type" : @"http://tech.ebu.ch/cpa/1.0/client_credentials",
+                                       @"client_id" : clientIdentifier,
+                                       @"client_secret" : clientSecret,
+                                       @"domain" : domain };
+                break;
+        }
+        
+        NSURL *URL = [self.authorizationProviderURL URLByAppendingPathComponent:endpoint];
+        NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:URL];
+        [request setHTTPMethod:@"POST"];
+        [request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+        [request setHTTPBody:[NSJSONSerialization dataWithJSONObject:requestDictionary options:0 error:NULL]];
+    }];
+    
+    CPARequestBuilder *requestBuilder = [[CPARequestBuilder alloc] initWithAuthorizationProviderURL:self.authorizationProviderURL];
+    NSDictionary *builderResult = [self runMicroBenchmarkWithName:@"request_construction_builder" iterationCount:kBenchmarkMicroIterationCount operationCount:4 operationBlock:^(NSUInteger operationIndex) {
+        switch (operationIndex) {
+            case 0:
+                [requestBuilder registrationRequestWithClientName:@"CPA Benchmark" softwareIdentifier:@"ch.ebu.cpa.benchmark" softwareVersion:@"1.0"];
+                break;
+            
+            case 1:
+                [requestBuilder userCodeRequestWithClientIdentifier:clientIdentifier clientSecret:clientSecret domain:domain];
+                break;
+            
+            case 2:
+                [requestBuilder userTokenRequestWithDeviceCode:deviceCode clientIdentifier:clientIdentifier clientSecret:clientSecret domain:domain];
+                break;
+            
+            default:
+                [requestBuilder clientTokenRequestWithClientIdentifier:clientIdentifier clientSecret:clientSecret domain:domain];
+                break;
+        }
+    }];
+    
+    XCTAssertTrue([builderResult[@"allocations"][@"count"] doubleValue] < [serializationResult[@"allocations"][@"count"] doubleValue]);
+}
+
+@end
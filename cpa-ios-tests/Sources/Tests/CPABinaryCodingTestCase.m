@@ -0,0 +1,153 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPABinaryCoding.h"
+#import "CPAIdentity+Private.h"
+#import "CPAToken+Private.h"
+
+#import <XCTest/XCTest.h>
+
+@interface CPABinaryCodingTestCase : XCTestCase
+
+@property (nonatomic) CPAToken *token;
+
+@end
+
+@implementation CPABinaryCodingTestCase
+
+#pragma mark Setup and teardown
+
+- (void)setUp
+{
+    self.token = [[CPAToken alloc] initWithValue:@"614bc2b750852c79fbd8edfa8f9f4561"
+                                          domain:@"cpa.rts.ch"
+                                      domainName:@"RTS - HbbTV demo"
+                                        userName:@"james@nowhere.com"
+                                  expirationDate:[NSDate dateWithTimeIntervalSinceReferenceDate:451267200.5]];
+}
+
+#pragma mark Tests
+
+- (void)testToken
+{
+    NSData *data = [self.token binaryRepresentation];
+    XCTAssertTrue([CPABinaryReader isBinaryRecordData:data]);
+    
+    CPAToken *token = [CPAToken tokenWithStoredData:data];
+    XCTAssertEqualObjects(token.value, self.token.value);
+    XCTAssertEqualObjects(token.domain, self.token.domain);
+    XCTAssertEqualObjects(token.domainName, self.token.domainName);
+    XCTAssertEqualObjects(token.userName, self.token.userName);
+    XCTAssertEqualObjects(token.expirationDate, self.token.expirationDate);
+    XCTAssertEqual(token.type, CPATokenTypeUser);
+}
+
+- (void)testClientToken
+{
+    CPAToken *clientToken = [[CPAToken alloc] initWithValue:@"5ba522aa04f23a9075da61f6d859e347"
+                                                     domain:@"cpa.rts.ch"
+                                                 domainName:@"RTS - HbbTV demo éèà"
+                                                   userName:nil
+                                             expirationDate:[NSDate date]];
+    
+    CPAToken *token = [CPAToken tokenWithStoredData:[clientToken binaryRepresentation]];
+    XCTAssertEqualObjects(token.domainName, clientToken.domainName);
+    XCTAssertNil(token.userName);
+    XCTAssertEqual(token.type, CPATokenTypeClient);
+}
+
+- (void)testIdentity
+{
+    CPAIdentity *identity = [[CPAIdentity alloc] initWithIdentifier:@"407" secret:@"f9f1c336a59219e05a59eecb40eb49eb"];
+    
+    CPAIdentity *decodedIdentity = [CPAIdentity identityWithStoredData:[identity binaryRepresentation]];
+    XCTAssertEqualObjects(decodedIdentity.identifier, identity.identifier);
+    XCTAssertEqualObjects(decodedIdentity.secret, identity.secret);
+    
+    // Records of another type are rejected
+    XCTAssertNil([CPAToken tokenWithStoredData:[identity binaryRepresentation]]);
+}
+
+- (void)testKeyedArchiveMigration
+{
+    NSData *archivedData = [NSKeyedArchiver archivedDataWithRootObject:self.token];
+    XCTAssertFalse([CPABinaryReader isBinaryRecordData:archivedData]);
+    
+    CPAToken *token = [CPAToken tokenWithStoredData:archivedData];
+    XCTAssertEqualObjects(token.value, self.token.value);
+    XCTAssertEqualObjects(token.expirationDate, self.token.expirationDate);
+    
+    CPAIdentity *identity = [[CPAIdentity alloc] initWithIdentifier:@"407" secret:@"f9f1c336a59219e05a59eecb40eb49eb"];
+    CPAIdentity *unarchivedIdentity = [CPAIdentity identityWithStoredData:[NSKeyedArchiver archivedDataWithRootObject:identity]];
+    XCTAssertEqualObjects(unarchivedIdentity.identifier, identity.identifier);
+}
+
+- (void)testInvalidData
+{
+    NSData *data = [self.token binaryRepresentation];
+    
+    // Truncated (shorter data cannot be told from a keyed archive)
+    for (NSUInteger length = 3; length < data.length; ++length) {
+        XCTAssertNil([CPAToken tokenWithStoredData:[data subdataWithRange:NSMakeRange(0, length)]]);
+    }
+    
+    // More recent format version
+    NSMutableData *futureData = [data mutableCopy];
+    ((uint8_t *)futureData.mutableBytes)[1] = CPABinaryCodingVersion + 1;
+    XCTAssertNil([CPAToken tokenWithStoredData:futureData]);
+}
+
+- (void)testRepresentationSize
+{
+    NSUInteger binaryLength = [self.token binaryRepresentation].length;
+    NSUInteger archivedLength = [NSKeyedArchiver archivedDataWithRootObject:self.token].length;
+    NSLog(@"Token size: %@ bytes (binary), %@ bytes (keyed archive)", @(binaryLength), @(archivedLength));
+    XCTAssertTrue(binaryLength * 4 < archivedLength);
+}
+
+#pragma mark Performance tests
+
+- (void)testBinaryEncodingPerformance
+{
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 10000; ++i) {
+            [self.token binaryRepresentation];
+        }
+    }];
+}
+
+- (void)testKeyedArchivingPerformance
+{
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 10000; ++i) {
+            [NSKeyedArchiver archivedDataWithRootObject:self.token];
+        }
+    }];
+}
+
+- (void)testBinaryDecodingPerformance
+{
+    NSData *data = [self.token binaryRepresentation];
+    
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 10000; ++i) {
+            [CPAToken tokenWithStoredData:data];
+        }
+    }];
+}
+
+- (void)testKeyedUnarchivingPerformance
+{
+    NSData *data = [NSKeyedArchiver archivedDataWithRootObject:self.token];
+    
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 10000; ++i) {
+            [NSKeyedUnarchiver unarchiveObjectWithData:data];
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,150 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPADeviceCodePoller.h"
+#import "CPAErrors.h"
+#import "CPAStatelessRequest.h"
+#import "HTTPStub.h"
+
+#import <XCTest/XCTest.h>
+
+static NSTimeInterval kConnectionTimeOut = 60;
+
+@interface CPADeviceCodePollerTestCase : XCTestCase
+
+@end
+
+@implementation CPADeviceCodePollerTestCase
+
+#pragma mark Setup and teardown
+
+- (void)setUp
+{
+    // Poll with the default retry policy, which must let the poller deal with slow down requests itself
+    [CPAStatelessRequest setRetryPolicy:nil forAuthorizationProviderURL:[NSURL URLWithString:@"https://cpa.rts.ch"]];
+}
+
+- (void)tearDown
+{
+    [CPAStatelessRequest setRetryPolicy:nil forAuthorizationProviderURL:[NSURL URLWithString:@"https://cpa.rts.ch"]];
+    [HTTPStub removeAllStubs];
+}
+
+#pragma mark Helpers
+
+- (CPADeviceCodePoller *)deviceCodePollerWithPollingInterval:(NSTimeInterval)pollingInterval expiresInSeconds:(NSInteger)expiresInSeconds
+{
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    return [[CPADeviceCodePoller alloc] initWithAuthorizationProviderURL:authorizationProviderURL
+                                                              deviceCode:@"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1"
+                                                        clientIdentifier:@"407"
+                                                            clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb"
+                                                                  domain:@"cpa.rts.ch"
+                                                         pollingInterval:pollingInterval
+                                                        expiresInSeconds:expiresInSeconds];
+}
+
+#pragma mark Tests
+
+- (void)testPolling
+{
+    [HTTPStub installStubWithName:@"request_user_token_authorization_pending"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Poll for user token"];
+    
+    CPADeviceCodePoller *deviceCodePoller = [self deviceCodePollerWithPollingInterval:0.1 expiresInSeconds:60];
+    [deviceCodePoller startWithDelay:0. completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertTrue([NSThread isMainThread]);
+        XCTAssertEqualObjects(accessToken, @"614bc2b750852c79fbd8edfa8f9f4561");
+        XCTAssertEqualObjects(userName, @"james@nowhere.com");
+        [expectation fulfill];
+    }];
+    
+    // Authorize after a few polls. The most recently installed stub is used
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [HTTPStub installStubWithName:@"request_user_token"];
+    });
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertTrue([HTTPStub numberOfRequestsForStubWithName:@"request_user_token_authorization_pending"] >= 2);
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_user_token"], 1);
+}
+
+- (void)testExpiration
+{
+    [HTTPStub installStubWithName:@"request_user_token_authorization_pending"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Poll for user token (expiration)"];
+    
+    NSDate *startDate = [NSDate date];
+    CPADeviceCodePoller *deviceCodePoller = [self deviceCodePollerWithPollingInterval:0.2 expiresInSeconds:1];
+    [deviceCodePoller startWithDelay:0. completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        XCTAssertEqualObjects(error.domain, CPAErrorDomain);
+        XCTAssertEqual(error.code, CPAErrorAuthorizationRequestExpired);
+        XCTAssertNil(accessToken);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    NSTimeInterval duration = [[NSDate date] timeIntervalSinceDate:startDate];
+    XCTAssertTrue(duration >= 1. && duration < 2.);
+}
+
+- (void)testSlowDown
+{
+    [HTTPStub installStubWithName:@"request_user_token_slow_down"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Poll for user token (slow down)"];
+    
+    CPADeviceCodePoller *deviceCodePoller = [self deviceCodePollerWithPollingInterval:0.1 expiresInSeconds:60];
+    [deviceCodePoller startWithDelay:0. completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        XCTAssertEqual(error.code, CPAErrorAuthorizationCancelled);
+        [expectation fulfill];
+    }];
+    
+    // The interval is increased by 5 seconds when the AP asks to slow down
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"pollingInterval > 5."] evaluatedWithObject:deviceCodePoller handler:^{
+        [deviceCodePoller cancel];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // The poll is not retried sooner, even though the retry policy retries slow down answers of other requests
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_user_token_slow_down"], 1);
+}
+
+- (void)testCancel
+{
+    [HTTPStub installStubWithName:@"request_user_token_authorization_pending"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Poll for user token (cancel)"];
+    
+    CPADeviceCodePoller *deviceCodePoller = [self deviceCodePollerWithPollingInterval:0.1 expiresInSeconds:60];
+    [deviceCodePoller startWithDelay:1. completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        XCTAssertEqualObjects(error.domain, CPAErrorDomain);
+        XCTAssertEqual(error.code, CPAErrorAuthorizationCancelled);
+        [expectation fulfill];
+    }];
+    [deviceCodePoller cancel];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // Cancelled before the first poll
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_user_token_authorization_pending"], 0);
+}
+
+@end
@@ -0,0 +1,119 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPALatencyHistogram.h"
+
+#import <XCTest/XCTest.h>
+
+@interface CPALatencyHistogramTestCase : XCTestCase
+
+@end
+
+@implementation CPALatencyHistogramTestCase
+
+#pragma mark Tests
+
+- (void)testEmptyHistogram
+{
+    CPALatencyHistogram *histogram = [[CPALatencyHistogram alloc] init];
+    XCTAssertEqual(histogram.count, 0);
+    XCTAssertEqual(histogram.minimumDuration, 0.);
+    XCTAssertEqual(histogram.maximumDuration, 0.);
+    XCTAssertEqual(histogram.meanDuration, 0.);
+    XCTAssertEqual([histogram durationAtPercentile:50.], 0.);
+    XCTAssertEqualObjects([histogram dictionaryRepresentation][@"buckets"], @[]);
+}
+
+- (void)testRecording
+{
+    CPALatencyHistogram *histogram = [[CPALatencyHistogram alloc] init];
+    
+    // 1 ms to 1 s, by steps of 1 ms
+    for (NSUInteger i = 1; i <= 1000; ++i) {
+        [histogram recordDuration:i / 1000.];
+    }
+    [histogram recordDuration:-1.];
+    
+    XCTAssertEqual(histogram.count, 1000);
+    XCTAssertEqualWithAccuracy(histogram.minimumDuration, 0.001, 0.000001);
+    XCTAssertEqualWithAccuracy(histogram.maximumDuration, 1., 0.000001);
+    XCTAssertEqualWithAccuracy(histogram.meanDuration, 0.5005, 0.000001);
+    
+    // Percentiles are accurate to 1/64
+    XCTAssertEqualWithAccuracy([histogram durationAtPercentile:50.], 0.5, 0.5 / 64.);
+    XCTAssertEqualWithAccuracy([histogram durationAtPercentile:90.], 0.9, 0.9 / 64.);
+    XCTAssertEqualWithAccuracy([histogram durationAtPercentile:99.], 0.99, 0.99 / 64.);
+    XCTAssertEqualWithAccuracy([histogram durationAtPercentile:100.], 1., 0.000001);
+    XCTAssertEqualWithAccuracy([histogram durationAtPercentile:0.], 0.001, 0.001 / 64.);
+    
+    [histogram reset];
+    XCTAssertEqual(histogram.count, 0);
+    XCTAssertEqual(histogram.maximumDuration, 0.);
+}
+
+- (void)testLongDurations
+{
+    CPALatencyHistogram *histogram = [[CPALatencyHistogram alloc] init];
+    [histogram recordDuration:2. * 60. * 60.];
+    XCTAssertEqual(histogram.count, 1);
+    XCTAssertEqualWithAccuracy(histogram.maximumDuration, 60. * 60., 0.000001);
+}
+
+- (void)testSnapshots
+{
+    CPALatencyHistogram *histogram = [[CPALatencyHistogram alloc] init];
+    [histogram recordDuration:0.1];
+    
+    CPALatencyHistogram *snapshot = [histogram copy];
+    [histogram recordDuration:0.2];
+    XCTAssertEqual(snapshot.count, 1);
+    XCTAssertEqual(histogram.count, 2);
+    
+    [snapshot addDurationsFromHistogram:histogram];
+    XCTAssertEqual(snapshot.count, 3);
+    XCTAssertEqualWithAccuracy(snapshot.minimumDuration, 0.1, 0.000001);
+    XCTAssertEqualWithAccuracy(snapshot.maximumDuration, 0.2, 0.000001);
+}
+
+- (void)testDictionaryRepresentation
+{
+    CPALatencyHistogram *histogram = [[CPALatencyHistogram alloc] init];
+    [histogram recordDuration:0.01];
+    [histogram recordDuration:0.01];
+    [histogram recordDuration:0.5];
+    
+    NSDictionary *dictionary = [histogram dictionaryRepresentation];
+    XCTAssertTrue([NSJSONSerialization isValidJSONObject:dictionary]);
+    XCTAssertEqualObjects(dictionary[@"count"], @3);
+    
+    NSArray<NSDictionary *> *buckets = dictionary[@"buckets"];
+    XCTAssertEqual(buckets.count, 2);
+    XCTAssertEqualObjects(buckets.firstObject[@"count"], @2);
+    XCTAssertEqualObjects(buckets.lastObject[@"count"], @1);
+}
+
+- (void)testConcurrentRecording
+{
+    CPALatencyHistogram *histogram = [[CPALatencyHistogram alloc] init];
+    dispatch_apply(1000, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+        [histogram recordDuration:(i + 1) / 1000.];
+    });
+    XCTAssertEqual(histogram.count, 1000);
+}
+
+#pragma mark Performance tests
+
+- (void)testRecordingPerformance
+{
+    CPALatencyHistogram *histogram = [[CPALatencyHistogram alloc] init];
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 100000; ++i) {
+            [histogram recordDuration:(i % 5000) / 1000.];
+        }
+    }];
+}
+
+@end
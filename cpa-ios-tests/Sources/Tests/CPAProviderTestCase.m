@@ -0,0 +1,922 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPAErrors.h"
+#import "CPAKeyChainTokenStore.h"
+#import "CPAProvider.h"
+#import "HTTPStub.h"
+#import "XCTestCase+Provider.h"
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+
+static NSTimeInterval kConnectionTimeOut = 60;
+
+@interface CPAProviderTestCase : XCTestCase
+
+@property (nonatomic) CPAProvider *provider;
+
+@end
+
+@implementation CPAProviderTestCase
+
+#pragma mark Setup and teardown
+
+- (void)setUp
+{
+    self.provider = [self testProvider];
+}
+
+- (void)tearDown
+{
+    [self.provider discardIdentity];
+    [HTTPStub removeAllStubs];
+}
+
+#pragma mark Helpers
+
+- (void)requestClientToken
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token"];
+    
+    [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertNotNil(token);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+}
+
+- (void)requestClientTokensForDomains:(NSArray<NSString *> *)domains withProvider:(CPAProvider *)provider
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider_srf"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client tokens"];
+    
+    [provider requestTokensForDomains:domains withType:CPATokenTypeClient completionBlock:^(NSDictionary<NSString *,CPAToken *> *tokens, NSDictionary<NSString *,NSError *> *errors) {
+        XCTAssertEqual(errors.count, 0);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+}
+
+- (void)waitForTimeInterval:(NSTimeInterval)timeInterval
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Wait"];
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeInterval * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [expectation fulfill];
+    });
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+}
+
+#pragma mark Tests
+
+- (void)testTokenCache
+{
+    XCTAssertNil([self.provider tokenForDomain:@"cpa.rts.ch"]);
+    XCTAssertEqual(self.provider.tokenCacheMissCount, 1);
+    
+    // Known not to have any token, no keychain access is needed anymore
+    XCTAssertNil([self.provider tokenForDomain:@"cpa.rts.ch"]);
+    XCTAssertEqual(self.provider.tokenCacheHitCount, 1);
+    
+    [self requestClientToken];
+    
+    // The received token has been written through the cache
+    NSUInteger missCount = self.provider.tokenCacheMissCount;
+    CPAToken *token = [self.provider tokenForDomain:@"cpa.rts.ch"];
+    XCTAssertEqualObjects(token.value, @"5ba522aa04f23a9075da61f6d859e347");
+    XCTAssertEqual(self.provider.tokenCacheMissCount, missCount);
+    
+    // After a purge, the token is read again from the keychain
+    [self.provider purgeTokenCache];
+    CPAToken *keyChainToken = [self.provider tokenForDomain:@"cpa.rts.ch"];
+    XCTAssertEqualObjects(keyChainToken.value, token.value);
+    XCTAssertEqual(self.provider.tokenCacheMissCount, missCount + 1);
+    
+    [self.provider discardTokenForDomain:@"cpa.rts.ch"];
+    XCTAssertNil([self.provider tokenForDomain:@"cpa.rts.ch"]);
+    XCTAssertEqual(self.provider.tokenCacheMissCount, missCount + 1);
+}
+
+- (void)testWarmUp
+{
+    [self requestClientToken];
+    
+    CPAProvider *provider = [[CPAProvider alloc] initWithAuthorizationProviderURL:self.provider.authorizationProviderURL];
+    XCTAssertFalse(provider.warmedUp);
+    [provider warmUp];
+    
+    // The lookup waits for warm-up instead of reading the keychain itself
+    XCTAssertEqualObjects([provider tokenForDomain:@"cpa.rts.ch"].value, @"5ba522aa04f23a9075da61f6d859e347");
+    XCTAssertTrue(provider.warmedUp);
+    XCTAssertEqual(provider.tokenCacheMissCount, 0);
+    
+    // The identity has been read as well. Refreshing the token does not access the keychain before storing the new token
+    NSUInteger operationCount = provider.tokenStoreOperationCount;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Refresh client token"];
+    
+    [provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertNil(error);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertEqual(provider.tokenStoreOperationCount, operationCount + 1);
+    
+    // Warm-up must be performed again once the cache has been purged
+    [provider purgeTokenCache];
+    XCTAssertFalse(provider.warmedUp);
+}
+
+- (void)testTokenCacheDiscardIdentity
+{
+    [self requestClientToken];
+    XCTAssertNotNil([self.provider tokenForDomain:@"cpa.rts.ch"]);
+    
+    [self.provider discardIdentity];
+    XCTAssertNil([self.provider tokenForDomain:@"cpa.rts.ch"]);
+}
+
+- (void)testConcurrentTokenRequests
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider"];
+    
+    XCTestExpectation *expectation1 = [self expectationWithDescription:@"Request client token (1)"];
+    XCTestExpectation *expectation2 = [self expectationWithDescription:@"Request client token (2)"];
+    
+    __block CPAToken *token1 = nil;
+    [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertNil(error);
+        token1 = token;
+        [expectation1 fulfill];
+    }];
+    
+    __block CPAToken *token2 = nil;
+    [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertNil(error);
+        token2 = token;
+        [expectation2 fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // Both requests have been served by a single round trip to the AP
+    XCTAssertNotNil(token1);
+    XCTAssertEqual(token1, token2);
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"register_client_provider"], 1);
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token_provider"], 1);
+}
+
+- (void)testConcurrentTokenRequestsNetworkError
+{
+    [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
+    
+    XCTestExpectation *expectation1 = [self expectationWithDescription:@"Request client token (1, network error)"];
+    XCTestExpectation *expectation2 = [self expectationWithDescription:@"Request client token (2, network error)"];
+    
+    [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertEqual(error.code, NSURLErrorNetworkConnectionLost);
+        XCTAssertNil(token);
+        [expectation1 fulfill];
+    }];
+    
+    [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertEqual(error.code, NSURLErrorNetworkConnectionLost);
+        XCTAssertNil(token);
+        [expectation2 fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // A single registration request has been made. It is not retried, since the AP might have processed it
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:HTTPStubNetworkConnectionLost], 1);
+}
+
+- (void)testBatchTokenRequests
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider_srf"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client tokens"];
+    
+    NSArray<NSString *> *domains = @[@"cpa.rts.ch", @"cpa.srf.ch", @"cpa.rts.ch"];
+    [self.provider requestTokensForDomains:domains withType:CPATokenTypeClient completionBlock:^(NSDictionary<NSString *,CPAToken *> *tokens, NSDictionary<NSString *,NSError *> *errors) {
+        XCTAssertEqual(tokens.count, 2);
+        XCTAssertEqual(errors.count, 0);
+        XCTAssertEqualObjects(tokens[@"cpa.rts.ch"].value, @"5ba522aa04f23a9075da61f6d859e347");
+        XCTAssertEqualObjects(tokens[@"cpa.srf.ch"].value, @"0b3a3d2ef4a04a8fa6ae1d43b0a3c0b2");
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // A single identity has been registered for all domains
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"register_client_provider"], 1);
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token_provider"], 1);
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token_provider_srf"], 1);
+    XCTAssertEqualObjects([self.provider tokenForDomain:@"cpa.srf.ch"].value, @"0b3a3d2ef4a04a8fa6ae1d43b0a3c0b2");
+}
+
+- (void)testBatchTokenRequestsNetworkError
+{
+    [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client tokens (network error)"];
+    
+    [self.provider requestTokensForDomains:@[@"cpa.rts.ch", @"cpa.srf.ch"] withType:CPATokenTypeClient completionBlock:^(NSDictionary<NSString *,CPAToken *> *tokens, NSDictionary<NSString *,NSError *> *errors) {
+        XCTAssertEqual(tokens.count, 0);
+        XCTAssertEqual(errors.count, 2);
+        XCTAssertEqual(errors[@"cpa.srf.ch"].code, NSURLErrorNetworkConnectionLost);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // A single registration request has been made. It is not retried, since the AP might have processed it
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:HTTPStubNetworkConnectionLost], 1);
+}
+
+- (void)testUserTokenWithUserCode
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_code"];
+    [HTTPStub installStubWithName:@"request_user_token"];
+    
+    XCTestExpectation *userCodeExpectation = [self expectationWithDescription:@"User code"];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request user token (user code)"];
+    
+    [self.provider requestUserTokenForDomain:@"cpa.rts.ch" userCodeBlock:^(NSString *userCode, NSURL *verificationURL) {
+        XCTAssertEqualObjects(userCode, @"KjaCtqSC");
+        XCTAssertEqualObjects(verificationURL, [NSURL URLWithString:@"https://cpa.rts.ch"]);
+        [userCodeExpectation fulfill];
+    } completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqual(token.type, CPATokenTypeUser);
+        XCTAssertEqualObjects(token.value, @"614bc2b750852c79fbd8edfa8f9f4561");
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+}
+
+- (void)testUserTokenWithUserCodeCancellation
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_code"];
+    [HTTPStub installStubWithName:@"request_user_token_authorization_pending"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request user token (user code, cancelled)"];
+    
+    [self.provider requestUserTokenForDomain:@"cpa.rts.ch" userCodeBlock:^(NSString *userCode, NSURL *verificationURL) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            [self.provider cancelTokenRequestForDomain:@"cpa.rts.ch" withType:CPATokenTypeUser];
+        });
+    } completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertEqualObjects(error.domain, CPAErrorDomain);
+        XCTAssertEqual(error.code, CPAErrorAuthorizationCancelled);
+        XCTAssertNil(token);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertNil([self.provider tokenForDomain:@"cpa.rts.ch"]);
+}
+
+- (void)testCancelTokenRequest
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider"];
+    
+    CPARequestHandle *requestHandle = [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTFail(@"The completion block of a cancelled request must not be called");
+    }];
+    [requestHandle cancel];
+    XCTAssertTrue(requestHandle.cancelled);
+    
+    [self waitForTimeInterval:1.];
+    
+    XCTAssertNil([self.provider tokenForDomain:@"cpa.rts.ch"]);
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token_provider"], 0);
+}
+
+- (void)testCancelCoalescedTokenRequest
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token"];
+    
+    CPARequestHandle *requestHandle1 = [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTFail(@"The completion block of a cancelled request must not be called");
+    }];
+    [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqualObjects(token.value, @"5ba522aa04f23a9075da61f6d859e347");
+        [expectation fulfill];
+    }];
+    
+    // The token is still retrieved on behalf of the second request
+    [requestHandle1 cancel];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token_provider"], 1);
+    XCTAssertNotNil([self.provider tokenForDomain:@"cpa.rts.ch"]);
+}
+
+- (void)testCancelBatchTokenRequests
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider_srf"];
+    
+    CPARequestHandle *requestHandle = [self.provider requestTokensForDomains:@[@"cpa.rts.ch", @"cpa.srf.ch"] withType:CPATokenTypeClient completionBlock:^(NSDictionary<NSString *,CPAToken *> *tokens, NSDictionary<NSString *,NSError *> *errors) {
+        XCTFail(@"The completion block of a cancelled request must not be called");
+    }];
+    [requestHandle cancel];
+    
+    [self waitForTimeInterval:1.];
+    
+    XCTAssertNil([self.provider tokenForDomain:@"cpa.rts.ch"]);
+    XCTAssertNil([self.provider tokenForDomain:@"cpa.srf.ch"]);
+}
+
+- (void)testCancelUserTokenRequestWhilePolling
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_code"];
+    [HTTPStub installStubWithName:@"request_user_token_authorization_pending"];
+    
+    XCTestExpectation *userCodeExpectation = [self expectationWithDescription:@"User code"];
+    
+    __block CPARequestHandle *requestHandle = nil;
+    requestHandle = [self.provider requestUserTokenForDomain:@"cpa.rts.ch" userCodeBlock:^(NSString *userCode, NSURL *verificationURL) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            [requestHandle cancel];
+            [userCodeExpectation fulfill];
+        });
+    } completionBlock:^(CPAToken *token, NSError *error) {
+        XCTFail(@"The completion block of a cancelled request must not be called");
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // Polling would have started after the interval received with the code (5 seconds)
+    [self waitForTimeInterval:6.];
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_user_token_authorization_pending"], 0);
+    XCTAssertNil([self.provider tokenForDomain:@"cpa.rts.ch"]);
+}
+
+- (void)testStaleWhileRevalidate
+{
+    self.provider.staleTokenGraceInterval = 60.;
+    CPAToken *staleToken = [self requestExpiredClientTokenWithProvider:self.provider];
+    
+    [HTTPStub installStubWithName:@"request_client_token_provider"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token (stale)"];
+    
+    // The expired token is served right away
+    [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqual(token, staleToken);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // It is replaced once refreshed in the background
+    [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(CPAProvider *provider, NSDictionary<NSString *, id> *bindings) {
+        return [provider tokenForDomain:@"cpa.rts.ch"] != nil;
+    }] evaluatedWithObject:self.provider handler:nil];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertEqualObjects([self.provider tokenForDomain:@"cpa.rts.ch"].value, @"5ba522aa04f23a9075da61f6d859e347");
+}
+
+- (void)testStaleWhileRevalidateNetworkError
+{
+    self.provider.staleTokenGraceInterval = 60.;
+    CPAToken *staleToken = [self requestExpiredClientTokenWithProvider:self.provider];
+    
+    [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token (stale, network error)"];
+    
+    // The authorization provider is unreachable. The expired token is served without error
+    [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqual(token, staleToken);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+}
+
+- (void)testStaleWhileRevalidateFailedRefresh
+{
+    self.provider.staleTokenGraceInterval = 60.;
+    CPAToken *staleToken = [self requestExpiredClientTokenWithProvider:self.provider];
+    
+    CPATracer *tracer = [[CPATracer alloc] init];
+    self.provider.tracer = tracer;
+    
+    [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
+    
+    XCTestExpectation *expectation1 = [self expectationWithDescription:@"Request client token (stale, failed refresh)"];
+    
+    [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertEqual(token, staleToken);
+        [expectation1 fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // Wait until the background refresh has failed
+    [self waitForTimeInterval:2.];
+    
+    NSUInteger refreshRequestCount = [HTTPStub numberOfRequestsForStubWithName:HTTPStubNetworkConnectionLost];
+    XCTAssertTrue(refreshRequestCount > 0);
+    
+    // The refresh is traced as part of the stale token request
+    NSArray<CPATraceSpan *> *spans = tracer.spans;
+    CPATraceSpan *staleSpan = [spans filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"name == %@", @"requestToken"]].firstObject;
+    CPATraceSpan *refreshSpan = [spans filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"name == %@", @"automaticRefresh"]].firstObject;
+    XCTAssertEqualObjects(staleSpan.attributes[@"stale"], @YES);
+    XCTAssertNotNil(refreshSpan.error);
+    XCTAssertEqual(refreshSpan.parentSpanIdentifier, staleSpan.spanIdentifier);
+    
+    XCTestExpectation *expectation2 = [self expectationWithDescription:@"Request client token (stale, refresh not retried)"];
+    
+    // The stale token is still served, but the refresh is not attempted again before the retry interval has elapsed
+    [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertEqual(token, staleToken);
+        [expectation2 fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    [self waitForTimeInterval:1.];
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:HTTPStubNetworkConnectionLost], refreshRequestCount);
+}
+
+- (void)testStaleWhileRevalidatePurge
+{
+    self.provider.staleTokenGraceInterval = 60.;
+    CPAToken *staleToken = [self requestExpiredClientTokenWithProvider:self.provider];
+    
+    // Tokens which can still be served stale are not purged
+    [self.provider purgeExpiredTokens];
+    [self waitForTimeInterval:0.5];
+    
+    XCTAssertEqual([self.provider allTokens].count, 1);
+    XCTAssertEqual(self.provider.purgedTokenCount, 0);
+    
+    [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token (stale, after purge)"];
+    
+    [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqual(token, staleToken);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // Once the grace interval has elapsed, the token is purged
+    self.provider.staleTokenGraceInterval = 0.;
+    [self.provider purgeExpiredTokens];
+    
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"allTokens.@count == 0"] evaluatedWithObject:self.provider handler:nil];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertEqual(self.provider.purgedTokenCount, 1);
+}
+
+- (void)testStaleWhileRevalidateDisabled
+{
+    CPAToken *expiredToken = [self requestExpiredClientTokenWithProvider:self.provider];
+    
+    [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token (network error)"];
+    
+    // By default, the request waits for the authorization provider
+    [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertEqual(error.code, NSURLErrorNetworkConnectionLost);
+        XCTAssertNil(token);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertTrue(expiredToken.expired);
+}
+
+- (void)testCompletionQueue
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider"];
+    
+    dispatch_queue_t completionQueue = dispatch_queue_create("ch.ebu.cpa.tests", DISPATCH_QUEUE_SERIAL);
+    self.provider.completionQueue = completionQueue;
+    XCTAssertEqual(self.provider.completionQueue, completionQueue);
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token (completion queue)"];
+    
+    [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertFalse([NSThread isMainThread]);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    self.provider.completionQueue = nil;
+    XCTAssertEqual(self.provider.completionQueue, dispatch_get_main_queue());
+}
+
+- (void)testTokenRefreshScheduling
+{
+    [self requestClientToken];
+    CPAToken *token = [self.provider tokenForDomain:@"cpa.rts.ch"];
+    
+    // Received tokens are valid for about 30 days. Use a larger margin to trigger a refresh immediately
+    self.provider.tokenRefreshMargin = 31. * 24. * 60. * 60.;
+    [self.provider startTokenRefreshScheduling];
+    XCTAssertTrue(self.provider.schedulingTokenRefresh);
+    
+    [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(CPAProvider *provider, NSDictionary *bindings) {
+        return [provider tokenForDomain:@"cpa.rts.ch"] != token;
+    }] evaluatedWithObject:self.provider handler:nil];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    [self.provider stopTokenRefreshScheduling];
+    XCTAssertFalse(self.provider.schedulingTokenRefresh);
+    
+    // The refreshed token has replaced the previous one
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token_provider"], 2);
+    CPAToken *refreshedToken = [self.provider tokenForDomain:@"cpa.rts.ch"];
+    XCTAssertEqualObjects(refreshedToken.value, token.value);
+    XCTAssertEqual([token.expirationDate compare:refreshedToken.expirationDate], NSOrderedAscending);
+}
+
+- (void)testConcurrentAccess
+{
+    [self requestClientToken];
+    
+    // Do not block the main thread, which is busy dispatching work below
+    self.provider.completionQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Concurrent access"];
+    
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_apply(1000, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+        switch (i % 4) {
+            case 0: {
+                CPAToken *token = [self.provider tokenForDomain:@"cpa.rts.ch"];
+                XCTAssertEqualObjects(token.value, @"5ba522aa04f23a9075da61f6d859e347");
+                break;
+            }
+                
+            case 1: {
+                [self.provider purgeTokenCache];
+                break;
+            }
+                
+            case 2: {
+                dispatch_group_enter(group);
+                [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+                    XCTAssertNil(error);
+                    XCTAssertEqualObjects(token.value, @"5ba522aa04f23a9075da61f6d859e347");
+                    dispatch_group_leave(group);
+                }];
+                break;
+            }
+                
+            default: {
+                XCTAssertNil([self.provider tokenForDomain:@"unknown.domain"]);
+                break;
+            }
+        }
+    });
+    
+    dispatch_group_notify(group, dispatch_get_main_queue(), ^{
+        [expectation fulfill];
+    });
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    CPAToken *token = [self.provider tokenForDomain:@"cpa.rts.ch"];
+    XCTAssertEqualObjects(token.value, @"5ba522aa04f23a9075da61f6d859e347");
+    XCTAssertTrue(self.provider.tokenCacheHitCount + self.provider.tokenCacheMissCount >= 500);
+}
+
+- (void)testAllTokens
+{
+    [self requestClientTokensForDomains:@[@"cpa.srf.ch", @"cpa.rts.ch"] withProvider:self.provider];
+    [self.provider purgeTokenCache];
+    
+    // Read at once
+    NSUInteger operationCount = self.provider.tokenStoreOperationCount;
+    NSArray<CPAToken *> *tokens = [self.provider allTokens];
+    XCTAssertEqualObjects([tokens valueForKey:@"domain"], (@[@"cpa.rts.ch", @"cpa.srf.ch"]));
+    XCTAssertEqual(self.provider.tokenStoreOperationCount, operationCount + 1);
+    
+    // Tokens are now kept in memory
+    NSUInteger tokenCacheHitCount = self.provider.tokenCacheHitCount;
+    XCTAssertEqual([self.provider tokenForDomain:@"cpa.srf.ch"], tokens[1]);
+    XCTAssertEqual(self.provider.tokenCacheHitCount, tokenCacheHitCount + 1);
+    
+    NSArray<CPAToken *> *srfTokens = [self.provider tokensMatchingPredicate:[NSPredicate predicateWithFormat:@"domain ENDSWITH %@", @"srf.ch"]];
+    XCTAssertEqualObjects([srfTokens valueForKey:@"domain"], @[@"cpa.srf.ch"]);
+    
+    NSArray<CPAToken *> *userTokens = [self.provider tokensMatchingPredicate:[NSPredicate predicateWithFormat:@"type == %@", @(CPATokenTypeUser)]];
+    XCTAssertEqual(userTokens.count, 0);
+    
+    [self.provider discardIdentity];
+    XCTAssertEqual([self.provider allTokens].count, 0);
+}
+
+- (void)testExpiredTokens
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider_short_lived"];
+    [HTTPStub installStubWithName:@"request_client_token_provider_srf"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client tokens"];
+    
+    [self.provider requestTokensForDomains:@[@"cpa.rts.ch", @"cpa.srf.ch"] withType:CPATokenTypeClient completionBlock:^(NSDictionary<NSString *,CPAToken *> *tokens, NSDictionary<NSString *,NSError *> *errors) {
+        XCTAssertEqual(tokens.count, 2);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // Leeway
+    XCTAssertNotNil([self.provider tokenForDomain:@"cpa.srf.ch" validForTimeInterval:24. * 60. * 60.]);
+    XCTAssertNil([self.provider tokenForDomain:@"cpa.srf.ch" validForTimeInterval:31. * 24. * 60. * 60.]);
+    XCTAssertEqual(self.provider.expiredTokenCount, 1);
+    
+    // Wait until the short-lived token expires
+    CPAToken *token = [self.provider tokenForDomain:@"cpa.rts.ch"];
+    XCTAssertNotNil(token);
+    
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"expired == YES"] evaluatedWithObject:token handler:nil];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertNil([self.provider tokenForDomain:@"cpa.rts.ch"]);
+    XCTAssertEqual(self.provider.expiredTokenCount, 2);
+    XCTAssertEqual([self.provider allTokens].count, 2);
+    
+    // Automatic purge
+    self.provider.expiredTokenPurgeInterval = 0.1;
+    
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"allTokens.@count == 1"] evaluatedWithObject:self.provider handler:nil];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    self.provider.expiredTokenPurgeInterval = 0.;
+    XCTAssertEqual(self.provider.purgedTokenCount, 1);
+    XCTAssertNotNil([self.provider tokenForDomain:@"cpa.srf.ch"]);
+}
+
+- (void)testSingleItemStorage
+{
+    CPAProvider *provider = [[CPAProvider alloc] initWithAuthorizationProviderURL:self.provider.authorizationProviderURL
+                                                                       tokenStore:[[CPAKeyChainTokenStore alloc] init]
+                                                                 tokenStorageMode:CPATokenStorageModeSingleItem];
+    [self requestClientTokensForDomains:@[@"cpa.rts.ch", @"cpa.srf.ch"] withProvider:provider];
+    
+    // Write pending changes
+    [provider purgeTokenCache];
+    
+    // All tokens are read at once
+    CPAProvider *otherProvider = [[CPAProvider alloc] initWithAuthorizationProviderURL:self.provider.authorizationProviderURL
+                                                                            tokenStore:[[CPAKeyChainTokenStore alloc] init]
+                                                                      tokenStorageMode:CPATokenStorageModeSingleItem];
+    XCTAssertEqualObjects([otherProvider tokenForDomain:@"cpa.rts.ch"].value, @"5ba522aa04f23a9075da61f6d859e347");
+    XCTAssertEqualObjects([otherProvider tokenForDomain:@"cpa.srf.ch"].value, @"0b3a3d2ef4a04a8fa6ae1d43b0a3c0b2");
+    XCTAssertNil([otherProvider tokenForDomain:@"unknown.domain"]);
+    XCTAssertEqual(otherProvider.tokenStoreOperationCount, 1);
+    
+    [otherProvider discardTokenForDomain:@"cpa.srf.ch"];
+    [otherProvider purgeTokenCache];
+    
+    [provider purgeTokenCache];
+    XCTAssertNotNil([provider tokenForDomain:@"cpa.rts.ch"]);
+    XCTAssertNil([provider tokenForDomain:@"cpa.srf.ch"]);
+    
+    [provider discardIdentity];
+    [otherProvider purgeTokenCache];
+    XCTAssertNil([otherProvider tokenForDomain:@"cpa.rts.ch"]);
+}
+
+- (void)testSingleItemStorageImport
+{
+    [self requestClientToken];
+    
+    // Items saved with one item per domain are imported
+    CPAProvider *provider = [[CPAProvider alloc] initWithAuthorizationProviderURL:self.provider.authorizationProviderURL
+                                                                       tokenStore:[[CPAKeyChainTokenStore alloc] init]
+                                                                 tokenStorageMode:CPATokenStorageModeSingleItem];
+    XCTAssertEqualObjects([provider tokenForDomain:@"cpa.rts.ch"].value, @"5ba522aa04f23a9075da61f6d859e347");
+    
+    [self.provider purgeTokenCache];
+    XCTAssertNil([self.provider tokenForDomain:@"cpa.rts.ch"]);
+    
+    // The identity has been imported as well
+    [self requestClientTokensForDomains:@[@"cpa.srf.ch"] withProvider:provider];
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"register_client_provider"], 1);
+    
+    [provider discardIdentity];
+}
+
+- (void)testTracing
+{
+    CPATracer *tracer = [[CPATracer alloc] init];
+    self.provider.tracer = tracer;
+    
+    // No identity is available yet. A client must be registered first
+    [self requestClientToken];
+    
+    NSArray<CPATraceSpan *> *spans = tracer.spans;
+    NSArray<NSString *> *spanNames = [spans valueForKey:@"name"];
+    XCTAssertEqualObjects(spanNames.lastObject, @"requestToken");
+    XCTAssertTrue([spanNames containsObject:@"readIdentity"]);
+    XCTAssertTrue([spanNames containsObject:@"register"]);
+    XCTAssertTrue([spanNames containsObject:@"storeIdentity"]);
+    XCTAssertTrue([spanNames containsObject:@"readToken"]);
+    XCTAssertTrue([spanNames containsObject:@"requestClientToken"]);
+    XCTAssertTrue([spanNames containsObject:@"storeToken"]);
+    XCTAssertFalse([spanNames containsObject:@"refresh"]);
+    
+    // All spans belong to the same trace, and are children of the token request span
+    CPATraceSpan *rootSpan = spans.lastObject;
+    XCTAssertEqual(rootSpan.parentSpanIdentifier, 0);
+    XCTAssertEqualObjects(rootSpan.attributes[@"domain"], @"cpa.rts.ch");
+    XCTAssertNil(rootSpan.error);
+    for (CPATraceSpan *span in spans) {
+        XCTAssertEqual(span.traceIdentifier, rootSpan.spanIdentifier);
+        XCTAssertTrue(span.duration >= 0.);
+        if (span != rootSpan) {
+            XCTAssertEqual(span.parentSpanIdentifier, rootSpan.spanIdentifier);
+            XCTAssertTrue(span.startTime >= rootSpan.startTime);
+        }
+    }
+    
+    // A token is now available and is refreshed
+    [tracer reset];
+    [self requestClientToken];
+    
+    spanNames = [tracer.spans valueForKey:@"name"];
+    XCTAssertTrue([spanNames containsObject:@"refresh"]);
+    XCTAssertFalse([spanNames containsObject:@"register"]);
+    
+    NSDictionary *trace = [NSJSONSerialization JSONObjectWithData:[tracer chromeTraceJSONData] options:0 error:NULL];
+    NSArray<NSDictionary *> *events = trace[@"traceEvents"];
+    XCTAssertEqual(events.count, spanNames.count);
+    XCTAssertEqualObjects(events.lastObject[@"name"], @"requestToken");
+    XCTAssertEqualObjects(events.lastObject[@"ph"], @"X");
+}
+
+#pragma mark Performance tests
+
+- (void)testTokenStorageModes
+{
+    NSArray<NSString *> *domains = @[@"cpa.rts.ch", @"cpa.srf.ch"];
+    NSUInteger iterationCount = 100;
+    
+    NSMutableDictionary<NSNumber *, NSNumber *> *operationCounts = [NSMutableDictionary dictionary];
+    for (NSNumber *storageMode in @[@(CPATokenStorageModeItemPerDomain), @(CPATokenStorageModeSingleItem)]) {
+        CPAProvider *provider = [[CPAProvider alloc] initWithAuthorizationProviderURL:self.provider.authorizationProviderURL
+                                                                           tokenStore:[[CPAKeyChainTokenStore alloc] init]
+                                                                     tokenStorageMode:storageMode.integerValue];
+        [self requestClientTokensForDomains:domains withProvider:provider];
+        [provider purgeTokenCache];
+        
+        // Simulate application startups, reading all tokens
+        NSUInteger operationCount = 0;
+        CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+        for (NSUInteger i = 0; i < iterationCount; ++i) {
+            CPAProvider *startupProvider = [[CPAProvider alloc] initWithAuthorizationProviderURL:self.provider.authorizationProviderURL
+                                                                                      tokenStore:[[CPAKeyChainTokenStore alloc] init]
+                                                                                tokenStorageMode:storageMode.integerValue];
+            [startupProvider startTokenRefreshScheduling];
+            [startupProvider stopTokenRefreshScheduling];
+            for (NSString *domain in domains) {
+                XCTAssertNotNil([startupProvider tokenForDomain:domain]);
+            }
+            XCTAssertNil([startupProvider tokenForDomain:@"unknown.domain"]);
+            operationCount += startupProvider.tokenStoreOperationCount;
+        }
+        CFAbsoluteTime duration = CFAbsoluteTimeGetCurrent() - startTime;
+        
+        operationCounts[storageMode] = @(operationCount);
+        NSLog(@"Storage mode %@: %@ keychain operations per startup, %.3f ms per startup", storageMode, @(operationCount / iterationCount),
+              duration * 1000. / iterationCount);
+        
+        [provider discardIdentity];
+        [HTTPStub removeAllStubs];
+    }
+    
+    XCTAssertTrue(operationCounts[@(CPATokenStorageModeSingleItem)].unsignedIntegerValue < operationCounts[@(CPATokenStorageModeItemPerDomain)].unsignedIntegerValue);
+}
+
+- (void)testTokenForDomainCachedPerformance
+{
+    [self requestClientToken];
+    
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 1000; ++i) {
+            [self.provider tokenForDomain:@"cpa.rts.ch"];
+        }
+    }];
+}
+
+- (void)testTokenForDomainUncachedPerformance
+{
+    [self requestClientToken];
+    
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 1000; ++i) {
+            [self.provider purgeTokenCache];
+            [self.provider tokenForDomain:@"cpa.rts.ch"];
+        }
+    }];
+}
+
+@end
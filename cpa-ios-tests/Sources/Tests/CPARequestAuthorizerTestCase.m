@@ -0,0 +1,352 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPAProvider.h"
+#import "CPARequestAuthorizer.h"
+#import "HTTPStub.h"
+#import "OHHTTPStubs.h"
+#import "XCTestCase+Provider.h"
+
+#import <XCTest/XCTest.h>
+
+static NSTimeInterval kConnectionTimeOut = 60;
+
+static NSString * const kServiceURLString = @"https://service.rts.ch/resource";
+static NSString * const kInitialTokenValue = @"5ba522aa04f23a9075da61f6d859e347";
+static NSString * const kRenewedTokenValue = @"8d0c4f7e1b6a4935a2e7c3f9b51d8e20";
+
+@interface CPARequestAuthorizerTestCase : XCTestCase
+
+@property (nonatomic) CPAProvider *provider;
+@property (nonatomic) CPARequestAuthorizer *requestAuthorizer;
+
+// Authorization header values received by the service stub. Must be accessed within a @synchronized(self) block
+@property (nonatomic) NSMutableArray<NSString *> *receivedAuthorizations;
+
+@property (nonatomic, weak) id<OHHTTPStubsDescriptor> serviceStubDescriptor;
+
+@end
+
+@implementation CPARequestAuthorizerTestCase
+
+#pragma mark Setup and teardown
+
+- (void)setUp
+{
+    self.provider = [self testProvider];
+    
+    self.requestAuthorizer = [[CPARequestAuthorizer alloc] initWithProvider:self.provider];
+    [self.requestAuthorizer setDomain:@"cpa.rts.ch" withType:CPATokenTypeClient forHost:@"service.rts.ch"];
+    
+    self.receivedAuthorizations = [NSMutableArray array];
+}
+
+- (void)tearDown
+{
+    [self.provider discardIdentity];
+    [HTTPStub removeAllStubs];
+    
+    if (self.serviceStubDescriptor) {
+        [OHHTTPStubs removeStub:self.serviceStubDescriptor];
+    }
+}
+
+#pragma mark Helpers
+
+/**
+ * Install a stub for the service, accepting requests authorized with the specified token values (401 otherwise) and
+ * recording the authorization headers received. Must be installed after HTTPStub stubs so that it is checked first
+ */
+- (void)installServiceStubAcceptingTokenValues:(NSArray<NSString *> *)tokenValues
+{
+    self.serviceStubDescriptor = [OHHTTPStubs stubRequestsPassingTest:^BOOL(NSURLRequest *request) {
+        return [request.URL.host isEqualToString:@"service.rts.ch"];
+    } withStubResponse:^OHHTTPStubsResponse *(NSURLRequest *request) {
+        NSString *authorization = [request valueForHTTPHeaderField:@"Authorization"] ?: @"";
+        @synchronized(self) {
+            [self.receivedAuthorizations addObject:authorization];
+        }
+        
+        BOOL accepted = [tokenValues containsObject:[authorization stringByReplacingOccurrencesOfString:@"Bearer " withString:@""]];
+        return [OHHTTPStubsResponse responseWithData:[NSData data] statusCode:accepted ? 200 : 401 headers:nil];
+    }];
+}
+
+- (NSArray<NSString *> *)authorizations
+{
+    @synchronized(self) {
+        return [self.receivedAuthorizations copy];
+    }
+}
+
+- (void)requestClientToken
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token"];
+    
+    [self.provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqualObjects(token.value, kInitialTokenValue);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    [HTTPStub removeStubWithName:@"request_client_token_provider"];
+}
+
+#pragma mark Tests
+
+- (void)testDomains
+{
+    XCTAssertEqualObjects([self.requestAuthorizer domainForHost:@"service.rts.ch"], @"cpa.rts.ch");
+    XCTAssertEqualObjects([self.requestAuthorizer domainForHost:@"SERVICE.rts.ch"], @"cpa.rts.ch");
+    XCTAssertNil([self.requestAuthorizer domainForHost:@"www.rts.ch"]);
+    
+    [self.requestAuthorizer setDomain:nil withType:CPATokenTypeClient forHost:@"service.rts.ch"];
+    XCTAssertNil([self.requestAuthorizer domainForHost:@"service.rts.ch"]);
+}
+
+- (void)testAuthorizedRequest
+{
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:kServiceURLString]];
+    
+    // No token available yet
+    XCTAssertNil([[self.requestAuthorizer authorizedRequestWithRequest:request] valueForHTTPHeaderField:@"Authorization"]);
+    
+    [self requestClientToken];
+    
+    NSString *expectedAuthorization = [@"Bearer " stringByAppendingString:kInitialTokenValue];
+    XCTAssertEqualObjects([[self.requestAuthorizer authorizedRequestWithRequest:request] valueForHTTPHeaderField:@"Authorization"], expectedAuthorization);
+    
+    // Requests to other hosts are left untouched
+    NSURLRequest *otherRequest = [NSURLRequest requestWithURL:[NSURL URLWithString:@"https://www.rts.ch"]];
+    XCTAssertEqual([self.requestAuthorizer authorizedRequestWithRequest:otherRequest], otherRequest);
+}
+
+- (void)testRequestWithToken
+{
+    [self requestClientToken];
+    [self installServiceStubAcceptingTokenValues:@[kInitialTokenValue]];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request"];
+    
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:kServiceURLString]];
+    [self.requestAuthorizer dataTaskWithRequest:request completionBlock:^(NSData *data, NSURLResponse *response, NSError *error) {
+        XCTAssertTrue([NSThread isMainThread]);
+        XCTAssertNil(error);
+        XCTAssertEqual(((NSHTTPURLResponse *)response).statusCode, 200);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertEqualObjects([self authorizations], @[[@"Bearer " stringByAppendingString:kInitialTokenValue]]);
+}
+
+- (void)testRequestWithoutToken
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider_renewed"];
+    [self installServiceStubAcceptingTokenValues:@[kRenewedTokenValue]];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request"];
+    
+    // The token is requested first
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:kServiceURLString]];
+    [self.requestAuthorizer dataTaskWithRequest:request completionBlock:^(NSData *data, NSURLResponse *response, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqual(((NSHTTPURLResponse *)response).statusCode, 200);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token_provider_renewed"], 1);
+    XCTAssertEqual([self authorizations].count, 1);
+}
+
+- (void)testRefreshOnUnauthorized
+{
+    [self requestClientToken];
+    
+    // The service only accepts the renewed token
+    [HTTPStub installStubWithName:@"request_client_token_provider_renewed"];
+    [self installServiceStubAcceptingTokenValues:@[kRenewedTokenValue]];
+    
+    static const NSUInteger kRequestCount = 3;
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:kServiceURLString]];
+    for (NSUInteger i = 0; i < kRequestCount; ++i) {
+        XCTestExpectation *expectation = [self expectationWithDescription:[NSString stringWithFormat:@"Request %@", @(i)]];
+        [self.requestAuthorizer dataTaskWithRequest:request completionBlock:^(NSData *data, NSURLResponse *response, NSError *error) {
+            XCTAssertNil(error);
+            XCTAssertEqual(((NSHTTPURLResponse *)response).statusCode, 200);
+            [expectation fulfill];
+        }];
+    }
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // Rejected requests wait for a single refresh and are replayed once
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token_provider_renewed"], 1);
+    XCTAssertEqual([self authorizations].count, 2 * kRequestCount);
+    XCTAssertEqualObjects([self.provider tokenForDomain:@"cpa.rts.ch"].value, kRenewedTokenValue);
+    
+    // Further requests use the renewed token directly
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request with renewed token"];
+    [self.requestAuthorizer dataTaskWithRequest:request completionBlock:^(NSData *data, NSURLResponse *response, NSError *error) {
+        XCTAssertEqual(((NSHTTPURLResponse *)response).statusCode, 200);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertEqual([self authorizations].count, 2 * kRequestCount + 1);
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token_provider_renewed"], 1);
+}
+
+- (void)testReplayOnce
+{
+    [self requestClientToken];
+    
+    // The service rejects all tokens
+    [HTTPStub installStubWithName:@"request_client_token_provider_renewed"];
+    [self installServiceStubAcceptingTokenValues:@[]];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request"];
+    
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:kServiceURLString]];
+    [self.requestAuthorizer dataTaskWithRequest:request completionBlock:^(NSData *data, NSURLResponse *response, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqual(((NSHTTPURLResponse *)response).statusCode, 401);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    NSArray<NSString *> *expectedAuthorizations = @[[@"Bearer " stringByAppendingString:kInitialTokenValue],
+                                                    [@"Bearer " stringByAppendingString:kRenewedTokenValue]];
+    XCTAssertEqualObjects([self authorizations], expectedAuthorizations);
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token_provider_renewed"], 1);
+}
+
+- (void)testRefreshOnUnauthorizedStaleToken
+{
+    self.provider.staleTokenGraceInterval = 60.;
+    [self requestExpiredClientTokenWithProvider:self.provider];
+    
+    // The service only accepts the renewed token, not the expired one served while being refreshed
+    [HTTPStub installStubWithName:@"request_client_token_provider_renewed"];
+    [self installServiceStubAcceptingTokenValues:@[kRenewedTokenValue]];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request with stale token"];
+    
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:kServiceURLString]];
+    [self.requestAuthorizer dataTaskWithRequest:request completionBlock:^(NSData *data, NSURLResponse *response, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqual(((NSHTTPURLResponse *)response).statusCode, 200);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // The rejected stale token is replaced, and the request replayed once
+    NSArray<NSString *> *expectedAuthorizations = @[[@"Bearer " stringByAppendingString:kInitialTokenValue],
+                                                    [@"Bearer " stringByAppendingString:kRenewedTokenValue]];
+    XCTAssertEqualObjects([self authorizations], expectedAuthorizations);
+    XCTAssertEqualObjects([self.provider tokenForDomain:@"cpa.rts.ch"].value, kRenewedTokenValue);
+}
+
+- (void)testRefreshNetworkError
+{
+    [self requestClientToken];
+    
+    [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
+    [self installServiceStubAcceptingTokenValues:@[kRenewedTokenValue]];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request"];
+    
+    // The token error is returned, and the request is not replayed
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:kServiceURLString]];
+    [self.requestAuthorizer dataTaskWithRequest:request completionBlock:^(NSData *data, NSURLResponse *response, NSError *error) {
+        XCTAssertNotNil(error);
+        XCTAssertNil(response);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertEqual([self authorizations].count, 1);
+}
+
+- (void)testUnmappedHost
+{
+    [self requestClientToken];
+    
+    [self.requestAuthorizer setDomain:nil withType:CPATokenTypeClient forHost:@"service.rts.ch"];
+    [self installServiceStubAcceptingTokenValues:@[kInitialTokenValue]];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request"];
+    
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:kServiceURLString]];
+    [self.requestAuthorizer dataTaskWithRequest:request completionBlock:^(NSData *data, NSURLResponse *response, NSError *error) {
+        XCTAssertEqual(((NSHTTPURLResponse *)response).statusCode, 401);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // Sent without authorization, and not replayed
+    XCTAssertEqualObjects([self authorizations], @[@""]);
+}
+
+- (void)testCancel
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider_renewed"];
+    [self installServiceStubAcceptingTokenValues:@[kRenewedTokenValue]];
+    
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:kServiceURLString]];
+    CPARequestHandle *requestHandle = [self.requestAuthorizer dataTaskWithRequest:request completionBlock:^(NSData *data, NSURLResponse *response, NSError *error) {
+        XCTFail(@"The completion block must not be called when the request is cancelled");
+    }];
+    [requestHandle cancel];
+    XCTAssertTrue(requestHandle.cancelled);
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Wait"];
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(2. * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [expectation fulfill];
+    });
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // The service has not been reached
+    XCTAssertEqual([self authorizations].count, 0);
+}
+
+@end
@@ -0,0 +1,117 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPARequestBuilder.h"
+
+#import <XCTest/XCTest.h>
+
+@interface CPARequestBuilderTestCase : XCTestCase
+
+@property (nonatomic) CPARequestBuilder *requestBuilder;
+
+@end
+
+@implementation CPARequestBuilderTestCase
+
+#pragma mark Setup and teardown
+
+- (void)setUp
+{
+    self.requestBuilder = [[CPARequestBuilder alloc] initWithAuthorizationProviderURL:[NSURL URLWithString:@"https://cpa.rts.ch"]];
+}
+
+#pragma mark Helpers
+
+- (NSDictionary *)bodyDictionaryForRequest:(NSURLRequest *)request
+{
+    return [NSJSONSerialization JSONObjectWithData:request.HTTPBody options:0 error:NULL];
+}
+
+#pragma mark Tests
+
+- (void)testRegistrationRequest
+{
+    NSURLRequest *request = [self.requestBuilder registrationRequestWithClientName:@"CPA Tests" softwareIdentifier:@"ch.ebu.cpa.tests" softwareVersion:@"1.0"];
+    XCTAssertEqualObjects(request.URL, [NSURL URLWithString:@"https://cpa.rts.ch/register"]);
+    XCTAssertEqualObjects(request.HTTPMethod, @"POST");
+    XCTAssertEqualObjects(request.allHTTPHeaderFields, @{ @"Content-Type" : @"application/json" });
+    
+    NSDictionary *expectedBodyDictionary = @{ @"client_name" : @"CPA Tests",
+                                              @"software_id" : @"ch.ebu.cpa.tests",
+                                              @"software_version" : @"1.0" };
+    XCTAssertEqualObjects([self bodyDictionaryForRequest:request], expectedBodyDictionary);
+}
+
+- (void)testUserCodeRequest
+{
+    NSURLRequest *request = [self.requestBuilder userCodeRequestWithClientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch"];
+    XCTAssertEqualObjects(request.URL, [NSURL URLWithString:@"https://cpa.rts.ch/associate"]);
+    XCTAssertEqualObjects(request.HTTPMethod, @"POST");
+    
+    NSDictionary *expectedBodyDictionary = @{ @"client_id" : @"407",
+                                              @"client_secret" : @"f9f1c336a59219e05a59eecb40eb49eb",
+                                              @"domain" : @"cpa.rts.ch" };
+    XCTAssertEqualObjects([self bodyDictionaryForRequest:request], expectedBodyDictionary);
+}
+
+- (void)testTokenRequests
+{
+    NSURLRequest *userTokenRequest = [self.requestBuilder userTokenRequestWithDeviceCode:@"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1" clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch"];
+    XCTAssertEqualObjects(userTokenRequest.URL, [NSURL URLWithString:@"https://cpa.rts.ch/token"]);
+    
+    NSDictionary *expectedUserTokenBodyDictionary = @{ @"grant_type" : @"http://tech.ebu.ch/cpa/1.0/device_code",
+                                                       @"device_code" : @"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1",
+                                                       @"client_id" : @"407",
+                                                       @"client_secret" : @"f9f1c336a59219e05a59eecb40eb49eb",
+                                                       @"domain" : @"cpa.rts.ch" };
+    XCTAssertEqualObjects([self bodyDictionaryForRequest:userTokenRequest], expectedUserTokenBodyDictionary);
+    
+    NSURLRequest *clientTokenRequest = [self.requestBuilder clientTokenRequestWithClientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch"];
+    XCTAssertEqualObjects(clientTokenRequest.URL, [NSURL URLWithString:@"https://cpa.rts.ch/token"]);
+    
+    NSDictionary *expectedClientTokenBodyDictionary = @{ @"grant_type" : @"http://tech.ebu.ch/cpa/1.0/client_credentials",
+                                                         @"client_id" : @"407",
+                                                         @"client_secret" : @"f9f1c336a59219e05a59eecb40eb49eb",
+                                                         @"domain" : @"cpa.rts.ch" };
+    XCTAssertEqualObjects([self bodyDictionaryForRequest:clientTokenRequest], expectedClientTokenBodyDictionary);
+}
+
+- (void)testIndependentRequests
+{
+    // Requests built from the same prototype must not share any state
+    NSMutableURLRequest *request1 = [[self.requestBuilder clientTokenRequestWithClientIdentifier:@"1" clientSecret:@"secret1" domain:@"cpa.rts.ch"] mutableCopy];
+    [request1 setValue:@"value" forHTTPHeaderField:@"X-Test"];
+    
+    NSURLRequest *request2 = [self.requestBuilder clientTokenRequestWithClientIdentifier:@"2" clientSecret:@"secret2" domain:@"cpa.rts.ch"];
+    XCTAssertNil([request2 valueForHTTPHeaderField:@"X-Test"]);
+    XCTAssertEqualObjects([self bodyDictionaryForRequest:request2][@"client_id"], @"2");
+}
+
+- (void)testAuthorizationProviderURLWithPath
+{
+    CPARequestBuilder *requestBuilder = [[CPARequestBuilder alloc] initWithAuthorizationProviderURL:[NSURL URLWithString:@"https://cpa.rts.ch/ap/"]];
+    NSURLRequest *request = [requestBuilder clientTokenRequestWithClientIdentifier:@"407" clientSecret:@"secret" domain:@"cpa.rts.ch"];
+    XCTAssertEqualObjects(request.URL, [NSURL URLWithString:@"https://cpa.rts.ch/ap/token"]);
+}
+
+- (void)testEscapedValues
+{
+    NSArray<NSString *> *values = @[@"", @"a\"b\\c/d", @"line\nbreak\ttab\u0001", @"été €", @"\U0001F600 emoji"];
+    for (NSString *value in values) {
+        NSURLRequest *request = [self.requestBuilder userCodeRequestWithClientIdentifier:value clientSecret:@"secret" domain:value];
+        NSDictionary *bodyDictionary = [self bodyDictionaryForRequest:request];
+        XCTAssertEqualObjects(bodyDictionary[@"client_id"], value);
+        XCTAssertEqualObjects(bodyDictionary[@"domain"], value);
+    }
+    
+    // Lone surrogates are written as escapes, so that the body remains valid UTF-8
+    NSString *loneSurrogateString = [NSString stringWithFormat:@"a%Cb", (unichar)0xd83d];
+    NSURLRequest *request = [self.requestBuilder userCodeRequestWithClientIdentifier:loneSurrogateString clientSecret:@"secret" domain:@"cpa.rts.ch"];
+    NSString *body = [[NSString alloc] initWithData:request.HTTPBody encoding:NSUTF8StringEncoding];
+    XCTAssertTrue([body containsString:@"\"client_id\":\"a\\ud83db\""]);
+}
+
+@end
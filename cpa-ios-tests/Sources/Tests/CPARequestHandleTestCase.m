@@ -0,0 +1,122 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPARequestHandle+Private.h"
+
+#import <XCTest/XCTest.h>
+
+@interface CPARequestHandleTestCase : XCTestCase
+
+@end
+
+@implementation CPARequestHandleTestCase
+
+#pragma mark Tests
+
+- (void)testFinish
+{
+    __block BOOL called = NO;
+    CPARequestHandle *requestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:^{
+        called = YES;
+    }];
+    XCTAssertFalse(requestHandle.finished);
+    XCTAssertFalse(requestHandle.cancelled);
+    
+    dispatch_block_t completionBlock = [requestHandle finish];
+    XCTAssertNotNil(completionBlock);
+    completionBlock();
+    XCTAssertTrue(called);
+    
+    XCTAssertTrue(requestHandle.finished);
+    XCTAssertFalse(requestHandle.cancelled);
+    
+    // The completion block is only returned once
+    XCTAssertNil([requestHandle finish]);
+    
+    // Cancelling a finished request does nothing
+    [requestHandle cancel];
+    XCTAssertFalse(requestHandle.cancelled);
+}
+
+- (void)testCancel
+{
+    CPARequestHandle *requestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:^{}];
+    
+    __block NSUInteger cancellationCount = 0;
+    [requestHandle addCancellationBlock:^{
+        ++cancellationCount;
+    }];
+    
+    [requestHandle cancel];
+    XCTAssertTrue(requestHandle.cancelled);
+    XCTAssertTrue(requestHandle.finished);
+    XCTAssertEqual(cancellationCount, 1);
+    
+    // Cancellation blocks are only called once, and no completion block is returned anymore
+    [requestHandle cancel];
+    XCTAssertEqual(cancellationCount, 1);
+    XCTAssertNil([requestHandle finish]);
+    
+    // Cancellation blocks added after cancellation are called right away
+    [requestHandle addCancellationBlock:^{
+        ++cancellationCount;
+    }];
+    XCTAssertEqual(cancellationCount, 2);
+}
+
+- (void)testCancellationBlockAfterFinish
+{
+    CPARequestHandle *requestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:nil];
+    [requestHandle finish];
+    
+    [requestHandle addCancellationBlock:^{
+        XCTFail(@"Cancellation blocks of finished requests must not be called");
+    }];
+    [requestHandle cancel];
+}
+
+- (void)testChildRequestHandles
+{
+    CPARequestHandle *requestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:nil];
+    CPARequestHandle *childRequestHandle1 = [[CPARequestHandle alloc] initWithCompletionBlock:nil];
+    CPARequestHandle *childRequestHandle2 = [[CPARequestHandle alloc] initWithCompletionBlock:nil];
+    [requestHandle addChildRequestHandle:childRequestHandle1];
+    [requestHandle addChildRequestHandle:childRequestHandle2];
+    
+    // Cancelling a child does not cancel its parent
+    [childRequestHandle1 cancel];
+    XCTAssertFalse(requestHandle.cancelled);
+    
+    [requestHandle cancel];
+    XCTAssertTrue(childRequestHandle2.cancelled);
+}
+
+- (void)testBlocksReleased
+{
+    __weak id weakObject = nil;
+    CPARequestHandle *requestHandle = nil;
+    
+    @autoreleasepool {
+        NSObject *object = [[NSObject alloc] init];
+        weakObject = object;
+        
+        requestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:^{
+            [object description];
+        }];
+        [requestHandle addCancellationBlock:^{
+            [object description];
+        }];
+    }
+    XCTAssertNotNil(weakObject);
+    
+    // Objects captured by the completion and cancellation blocks are released on cancellation
+    @autoreleasepool {
+        [requestHandle cancel];
+    }
+    XCTAssertNil(weakObject);
+}
+
+@end
@@ -0,0 +1,163 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPAErrors.h"
+#import "CPAResponse.h"
+#import "HTTPStub.h"
+#import "HTTPStubFile.h"
+#import "NSBundle+Tests.h"
+#import "NSURLSession+CPAExtensions.h"
+
+#import <XCTest/XCTest.h>
+
+@interface CPAResponseTestCase : XCTestCase
+
+@end
+
+@implementation CPAResponseTestCase
+
+#pragma mark Helpers
+
+- (NSData *)responseBodyDataForStubWithName:(NSString *)name
+{
+    NSString *stubDirectory = [@"Stubs" stringByAppendingPathComponent:name];
+    NSString *responseFilePath = [[NSBundle testBundle] pathForResource:@"response" ofType:nil inDirectory:stubDirectory];
+    return [[HTTPStubFile alloc] initWithFilePath:responseFilePath].bodyData;
+}
+
+- (NSData *)dataWithString:(NSString *)string
+{
+    return [string dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+#pragma mark Tests
+
+- (void)testClientRegistrationResponse
+{
+    CPAClientRegistrationResponse *response = [CPAClientRegistrationResponse responseWithData:[self responseBodyDataForStubWithName:@"register_client_provider"]];
+    XCTAssertNotNil(response);
+    XCTAssertNil(response.errorIdentifier);
+    XCTAssertEqualObjects(response.clientIdentifier, @"407");
+    XCTAssertEqualObjects(response.clientSecret, @"f9f1c336a59219e05a59eecb40eb49eb");
+}
+
+- (void)testUserCodeResponse
+{
+    CPAUserCodeResponse *response = [CPAUserCodeResponse responseWithData:[self responseBodyDataForStubWithName:@"request_code"]];
+    XCTAssertNotNil(response);
+    XCTAssertEqualObjects(response.deviceCode, @"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1");
+    XCTAssertEqualObjects(response.userCode, @"KjaCtqSC");
+    XCTAssertEqualObjects(response.verificationURL, [NSURL URLWithString:@"https://cpa.rts.ch"]);
+    XCTAssertEqual(response.pollingIntervalInSeconds, 5);
+    XCTAssertEqual(response.expiresInSeconds, 3599);
+}
+
+- (void)testTokenResponse
+{
+    CPATokenResponse *response = [CPATokenResponse responseWithData:[self responseBodyDataForStubWithName:@"refresh_token_user"]];
+    XCTAssertNotNil(response);
+    XCTAssertEqualObjects(response.userName, @"james@nowhere.com");
+    XCTAssertEqualObjects(response.accessToken, @"238e39ed96eef7ec2e46f92ba4bcb1b0");
+    XCTAssertEqualObjects(response.tokenType, @"bearer");
+    XCTAssertEqualObjects(response.domainName, @"RTS - HbbTV demo");
+    XCTAssertEqual(response.expiresInSeconds, 2591999);
+}
+
+- (void)testNullValues
+{
+    CPATokenResponse *response = [CPATokenResponse responseWithData:[self responseBodyDataForStubWithName:@"refresh_token_json_with_null"]];
+    XCTAssertNotNil(response);
+    XCTAssertNil(response.userName);
+    XCTAssertNil(response.accessToken);
+    XCTAssertNil(response.tokenType);
+    XCTAssertNil(response.domainName);
+    XCTAssertEqual(response.expiresInSeconds, 0);
+}
+
+- (void)testErrorResponses
+{
+    CPATokenResponse *errorResponse = [CPATokenResponse responseWithData:[self responseBodyDataForStubWithName:@"refresh_token_invalid_client"]];
+    XCTAssertEqualObjects(errorResponse.errorIdentifier, @"invalid_client");
+    
+    CPATokenResponse *reasonResponse = [CPATokenResponse responseWithData:[self responseBodyDataForStubWithName:@"request_user_token_authorization_pending"]];
+    XCTAssertEqualObjects(reasonResponse.errorIdentifier, @"authorization_pending");
+    
+    // The error takes precedence over the reason
+    CPATokenResponse *response = [CPATokenResponse responseWithData:[self dataWithString:@"{\"reason\":\"authorization_pending\",\"error\":\"slow_down\"}"]];
+    XCTAssertEqualObjects(response.errorIdentifier, @"slow_down");
+}
+
+- (void)testEscapedStrings
+{
+    NSString *string = @"{\"access_token\":\"a\\\"b\\\\c\\/d\\n\\u00e9\\ud83d\\ude00\",\"token_type\":\"\\ud83d\"}";
+    CPATokenResponse *response = [CPATokenResponse responseWithData:[self dataWithString:string]];
+    XCTAssertEqualObjects(response.accessToken, @"a\"b\\c/d\n\u00e9\U0001F600");
+    
+    // Lone surrogates are replaced
+    XCTAssertEqualObjects(response.tokenType, @"\uFFFD");
+}
+
+- (void)testSkippedValues
+{
+    NSString *string = @" {\"domain\":{\"names\":[\"a\",\"}]\",{\"b\":null}]},\"access_token\":\"token\",\"valid\":true,"
+                        "\"ratio\":-1.5e3,\"expires_in\":\"60\"} ";
+    CPATokenResponse *response = [CPATokenResponse responseWithData:[self dataWithString:string]];
+    XCTAssertNotNil(response);
+    XCTAssertEqualObjects(response.accessToken, @"token");
+    XCTAssertEqual(response.expiresInSeconds, 60);
+    
+    // Values of unexpected types are treated as missing
+    CPATokenResponse *typeMismatchResponse = [CPATokenResponse responseWithData:[self dataWithString:@"{\"access_token\":42,\"expires_in\":[1]}"]];
+    XCTAssertNotNil(typeMismatchResponse);
+    XCTAssertNil(typeMismatchResponse.accessToken);
+    XCTAssertEqual(typeMismatchResponse.expiresInSeconds, 0);
+    
+    CPATokenResponse *decimalResponse = [CPATokenResponse responseWithData:[self dataWithString:@"{\"expires_in\":59.9}"]];
+    XCTAssertEqual(decimalResponse.expiresInSeconds, 59);
+}
+
+- (void)testInvalidResponses
+{
+    NSArray<NSString *> *invalidStrings = @[@"", @"[]", @"\"token\"", @"{", @"{\"access_token\":\"token\"", @"{\"access_token\":\"token\",}",
+                                            @"{\"access_token\" \"token\"}", @"{\"access_token\":\"token\"} {}", @"{\"valid\":tru}",
+                                            @"{\"access_token\":\"\\x\"}", @"{\"domain\":[1,2}"];
+    for (NSString *invalidString in invalidStrings) {
+        XCTAssertNil([CPATokenResponse responseWithData:[self dataWithString:invalidString]], @"%@ must not be decoded", invalidString);
+    }
+    
+    // A NUL byte is not part of a number
+    static const char kEmbeddedNullBytes[] = "{\"expires_in\":1\0}";
+    XCTAssertNil([CPATokenResponse responseWithData:[NSData dataWithBytes:kEmbeddedNullBytes length:sizeof(kEmbeddedNullBytes) - 1]]);
+    
+    XCTAssertNotNil([CPATokenResponse responseWithData:[self dataWithString:@"{}"]]);
+}
+
+- (void)testStubResponsesMatchDictionaryDecoding
+{
+    for (NSString *name in [HTTPStub availableStubNames]) {
+        NSData *data = [self responseBodyDataForStubWithName:name];
+        
+        NSError *error = nil;
+        NSDictionary *responseDictionary = CPAJSONDictionaryFromData(data, &error);
+        CPATokenResponse *response = [CPATokenResponse responseWithData:data];
+        XCTAssertNotNil(response, @"Stub %@", name);
+        
+        if (error) {
+            XCTAssertNotNil(response.errorIdentifier, @"Stub %@", name);
+            XCTAssertEqualObjects(error.domain, CPAErrorDomain);
+            continue;
+        }
+        
+        XCTAssertNil(response.errorIdentifier, @"Stub %@", name);
+        XCTAssertEqualObjects(response.accessToken, responseDictionary[@"access_token"], @"Stub %@", name);
+        XCTAssertEqualObjects(response.tokenType, responseDictionary[@"token_type"], @"Stub %@", name);
+        XCTAssertEqualObjects(response.domainName, responseDictionary[@"domain_display_name"], @"Stub %@", name);
+        XCTAssertEqualObjects(response.userName, responseDictionary[@"user_name"], @"Stub %@", name);
+        XCTAssertEqual(response.expiresInSeconds, [responseDictionary[@"expires_in"] integerValue], @"Stub %@", name);
+    }
+}
+
+@end
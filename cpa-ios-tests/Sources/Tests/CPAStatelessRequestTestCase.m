@@ -4,9 +4,14 @@
 //  License information is available from the LICENSE file.
 //
 
+#import "CPACircuitBreaker.h"
+#import "CPAEndpointSelector+Private.h"
 #import "CPAErrors.h"
+#import "CPAMetricsRecorder.h"
+#import "CPARetryPolicy.h"
 #import "CPAStatelessRequest.h"
 #import "HTTPStub.h"
+#import "OHHTTPStubs.h"
 
 #import <UIKit/UIKit.h>
 #import <XCTest/XCTest.h>
@@ -15,15 +20,64 @@ static NSTimeInterval kConnectionTimeOut = 60;
 
 @interface CPAStatelessRequestTestCase : XCTestCase
 
+@property (nonatomic, weak) id<OHHTTPStubsDescriptor> endpointStubDescriptor;
+
 @end
 
 @implementation CPAStatelessRequestTestCase
 
 #pragma mark Setup and teardown
 
+- (void)setUp
+{
+    // Retry quickly, with a fresh budget for each test
+    CPARetryPolicy *retryPolicy = [[CPARetryPolicy alloc] init];
+    retryPolicy.baseDelay = 0.01;
+    [CPAStatelessRequest setRetryPolicy:retryPolicy forAuthorizationProviderURL:[NSURL URLWithString:@"https://cpa.rts.ch"]];
+}
+
 - (void)tearDown
 {
     [HTTPStub removeAllStubs];
+    [CPAStatelessRequest setMetricsObserver:nil forAuthorizationProviderURL:[NSURL URLWithString:@"https://cpa.rts.ch"]];
+    [CPAStatelessRequest setCircuitBreaker:nil forAuthorizationProviderURL:[NSURL URLWithString:@"https://cpa.rts.ch"]];
+    [CPAStatelessRequest setCircuitBreaker:nil forAuthorizationProviderURL:[NSURL URLWithString:@"https://cpa-backup.rts.ch"]];
+    [CPAStatelessRequest setEndpointSelector:nil forAuthorizationProviderURL:[NSURL URLWithString:@"https://cpa.rts.ch"]];
+    
+    if (self.endpointStubDescriptor) {
+        [OHHTTPStubs removeStub:self.endpointStubDescriptor];
+    }
+}
+
+#pragma mark Helpers
+
+- (void)requestClientTokenWithExpectedErrorCode:(NSInteger)errorCode
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token (error)"];
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    
+    [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        XCTAssertEqual(error.code, errorCode);
+        XCTAssertNil(accessToken);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+}
+
+/**
+ * Install a stub answering all requests made to the specified host with a response. Must be installed after HTTPStub
+ * stubs so that it is checked first
+ */
+- (void)installEndpointStubForHost:(NSString *)host withResponse:(OHHTTPStubsResponse *)response
+{
+    self.endpointStubDescriptor = [OHHTTPStubs stubRequestsPassingTest:^BOOL(NSURLRequest *request) {
+        return [request.URL.host isEqualToString:host];
+    } withStubResponse:^OHHTTPStubsResponse *(NSURLRequest *request) {
+        return response;
+    }];
 }
 
 #pragma mark Tests
@@ -35,7 +89,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Register client"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest registerClientWithAuthorizationProviderURL:authorizationProviderURL clientName:@"iOS Test" softwareIdentifier:@"ch.ebu.ios_test" softwareVersion:@"0.1" completionBlock:^(NSString *clientIdentifier, NSString *clientSecret, NSError *error) {
+    [CPAStatelessRequest registerClientWithAuthorizationProviderURL:authorizationProviderURL clientName:@"iOS Test" softwareIdentifier:@"ch.ebu.ios_test" softwareVersion:@"0.1" completionQueue:nil completionBlock:^(NSString *clientIdentifier, NSString *clientSecret, NSError *error) {
         XCTAssertNil(error);
         
         XCTAssertEqualObjects(clientIdentifier, @"407");
@@ -49,6 +103,44 @@ static NSTimeInterval kConnectionTimeOut = 60;
     }];
 }
 
+- (void)testCompletionThread
+{
+    [HTTPStub installStubWithName:@"register_client"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Register client (completion thread)"];
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    
+    [CPAStatelessRequest registerClientWithAuthorizationProviderURL:authorizationProviderURL clientName:@"iOS Test" softwareIdentifier:@"ch.ebu.ios_test" softwareVersion:@"0.1" completionQueue:nil completionBlock:^(NSString *clientIdentifier, NSString *clientSecret, NSError *error) {
+        XCTAssertTrue([NSThread isMainThread]);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+}
+
+- (void)testCompletionQueue
+{
+    [HTTPStub installStubWithName:@"request_client_token"];
+    
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    
+    static void *s_queueKey = &s_queueKey;
+    dispatch_queue_t completionQueue = dispatch_queue_create("ch.ebu.cpa.tests.completion", DISPATCH_QUEUE_SERIAL);
+    dispatch_queue_set_specific(completionQueue, s_queueKey, s_queueKey, NULL);
+    
+    // The main thread is not involved, even when it is blocked
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionQueue:completionQueue completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        XCTAssertTrue(dispatch_get_specific(s_queueKey) == s_queueKey);
+        XCTAssertNotNil(accessToken);
+        dispatch_semaphore_signal(semaphore);
+    }];
+    
+    XCTAssertEqual(dispatch_semaphore_wait(semaphore, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kConnectionTimeOut * NSEC_PER_SEC))), 0);
+}
+
 - (void)testRegisterClientNetworkError
 {
     [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
@@ -56,7 +148,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Register client (network error)"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest registerClientWithAuthorizationProviderURL:authorizationProviderURL clientName:@"iOS Test" softwareIdentifier:@"ch.ebu.ios_test" softwareVersion:@"0.1" completionBlock:^(NSString *clientIdentifier, NSString *clientSecret, NSError *error) {
+    [CPAStatelessRequest registerClientWithAuthorizationProviderURL:authorizationProviderURL clientName:@"iOS Test" softwareIdentifier:@"ch.ebu.ios_test" softwareVersion:@"0.1" completionQueue:nil completionBlock:^(NSString *clientIdentifier, NSString *clientSecret, NSError *error) {
         XCTAssertEqualObjects(error.domain, NSURLErrorDomain);
         XCTAssertEqual(error.code, NSURLErrorNetworkConnectionLost);
         
@@ -69,6 +161,39 @@ static NSTimeInterval kConnectionTimeOut = 60;
     [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
         XCTAssertNil(error);
     }];
+    
+    // The AP might have registered the client before the connection was lost. Registration is not retried
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:HTTPStubNetworkConnectionLost], 1);
+}
+
+- (void)testRegisterClientRetryUnsentRequest
+{
+    __block NSUInteger requestCount = 0;
+    self.endpointStubDescriptor = [OHHTTPStubs stubRequestsPassingTest:^BOOL(NSURLRequest *request) {
+        return YES;
+    } withStubResponse:^OHHTTPStubsResponse *(NSURLRequest *request) {
+        @synchronized(self) {
+            ++requestCount;
+        }
+        return [OHHTTPStubsResponse responseWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCannotConnectToHost userInfo:nil]];
+    }];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Register client (unsent request)"];
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    
+    [CPAStatelessRequest registerClientWithAuthorizationProviderURL:authorizationProviderURL clientName:@"iOS Test" softwareIdentifier:@"ch.ebu.ios_test" softwareVersion:@"0.1" completionQueue:nil completionBlock:^(NSString *clientIdentifier, NSString *clientSecret, NSError *error) {
+        XCTAssertEqual(error.code, NSURLErrorCannotConnectToHost);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // The request could not reach the AP and can safely be retried
+    @synchronized(self) {
+        XCTAssertEqual(requestCount, 4);
+    }
 }
 
 - (void)testRequestCode
@@ -78,7 +203,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Request code"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest requestCodeWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionBlock:^(NSString *deviceCode, NSString *userCode, NSURL *verificationURL, NSInteger pollingIntervalInSeconds, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest requestCodeWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *deviceCode, NSString *userCode, NSURL *verificationURL, NSInteger pollingIntervalInSeconds, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertNil(error);
         
         XCTAssertEqualObjects(deviceCode, @"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1");
@@ -102,7 +227,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Request code (invalid client)"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest requestCodeWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"1NV4L1DCL13N7" clientSecret:@"1NV4L1D53CR37" domain:@"cpa.rts.ch" completionBlock:^(NSString *deviceCode, NSString *userCode, NSURL *verificationURL, NSInteger pollingIntervalInSeconds, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest requestCodeWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"1NV4L1DCL13N7" clientSecret:@"1NV4L1D53CR37" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *deviceCode, NSString *userCode, NSURL *verificationURL, NSInteger pollingIntervalInSeconds, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertEqualObjects(error.domain, CPAErrorDomain);
         XCTAssertEqual(error.code, CPAErrorInvalidClient);
         
@@ -127,7 +252,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Request code (network error)"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest requestCodeWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionBlock:^(NSString *deviceCode, NSString *userCode, NSURL *verificationURL, NSInteger pollingIntervalInSeconds, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest requestCodeWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *deviceCode, NSString *userCode, NSURL *verificationURL, NSInteger pollingIntervalInSeconds, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertEqualObjects(error.domain, NSURLErrorDomain);
         XCTAssertEqual(error.code, NSURLErrorNetworkConnectionLost);
         
@@ -152,7 +277,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertNil(error);
         
         XCTAssertNil(userName);
@@ -176,7 +301,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token (invalid client)"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"1NV4L1DCL13N7" clientSecret:@"1NV4L1D53CR37" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"1NV4L1DCL13N7" clientSecret:@"1NV4L1D53CR37" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertEqualObjects(error.domain, CPAErrorDomain);
         XCTAssertEqual(error.code, CPAErrorInvalidClient);
         
@@ -201,7 +326,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token (network error)"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertEqualObjects(error.domain, NSURLErrorDomain);
         XCTAssertEqual(error.code, NSURLErrorNetworkConnectionLost);
         
@@ -226,7 +351,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Request user token"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:authorizationProviderURL deviceCode:@"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1" clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:authorizationProviderURL deviceCode:@"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1" clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertNil(error);
         
         XCTAssertEqualObjects(userName, @"james@nowhere.com");
@@ -250,7 +375,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Request user token (pending authorization)"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:authorizationProviderURL deviceCode:@"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1" clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:authorizationProviderURL deviceCode:@"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1" clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertEqualObjects(error.domain, CPAErrorDomain);
         XCTAssertEqual(error.code, CPAErrorPendingAuthorization);
         
@@ -275,7 +400,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Request user token (denied)"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:authorizationProviderURL deviceCode:@"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1" clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:authorizationProviderURL deviceCode:@"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1" clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertEqualObjects(error.domain, CPAErrorDomain);
         XCTAssertEqual(error.code, CPAErrorAuthorizationDenied);
         
@@ -300,7 +425,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Request user token (expired)"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:authorizationProviderURL deviceCode:@"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1" clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:authorizationProviderURL deviceCode:@"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1" clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertEqualObjects(error.domain, CPAErrorDomain);
         XCTAssertEqual(error.code, CPAErrorAuthorizationRequestExpired);
         
@@ -325,7 +450,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Request user token (invalid client)"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:authorizationProviderURL deviceCode:@"1NV4L1DCOD3" clientIdentifier:@"1NV4L1DCL13N7" clientSecret:@"1NV4L1D53CR37" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:authorizationProviderURL deviceCode:@"1NV4L1DCOD3" clientIdentifier:@"1NV4L1DCL13N7" clientSecret:@"1NV4L1D53CR37" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertEqualObjects(error.domain, CPAErrorDomain);
         XCTAssertEqual(error.code, CPAErrorInvalidClient);
         
@@ -350,7 +475,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Request user token"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:authorizationProviderURL deviceCode:@"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1" clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:authorizationProviderURL deviceCode:@"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1" clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertEqualObjects(error.domain, NSURLErrorDomain);
         XCTAssertEqual(error.code, NSURLErrorNetworkConnectionLost);
         
@@ -375,7 +500,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Request user token"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:authorizationProviderURL deviceCode:@"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1" clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:authorizationProviderURL deviceCode:@"3ddd6b1e-d710-4eeb-ada8-a0d48f6cb0d1" clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertEqualObjects(error.domain, CPAErrorDomain);
         XCTAssertEqual(error.code, CPAErrorTooFast);
         
@@ -400,7 +525,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Refresh token (client)"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest refreshTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest refreshTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertNil(error);
         
         XCTAssertNil(userName);
@@ -424,7 +549,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Refresh client token (invalid client)"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest refreshTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"1NV4L1DCL13N7" clientSecret:@"1NV4L1D53CR37" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest refreshTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"1NV4L1DCL13N7" clientSecret:@"1NV4L1D53CR37" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertEqualObjects(error.domain, CPAErrorDomain);
         XCTAssertEqual(error.code, CPAErrorInvalidClient);
         
@@ -449,7 +574,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Refresh client token (network error)"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest refreshTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest refreshTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertEqualObjects(error.domain, NSURLErrorDomain);
         XCTAssertEqual(error.code, NSURLErrorNetworkConnectionLost);
         
@@ -474,7 +599,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Refresh token (user)"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest refreshTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest refreshTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertNil(error);
         
         XCTAssertEqualObjects(userName, @"james@nowhere.com");
@@ -498,7 +623,7 @@ static NSTimeInterval kConnectionTimeOut = 60;
     XCTestExpectation *expectation = [self expectationWithDescription:@"Refresh token (JSON With Null)"];
     NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
     
-    [CPAStatelessRequest refreshTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+    [CPAStatelessRequest refreshTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"f9f1c336a59219e05a59eecb40eb49eb" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
         XCTAssertNil(error);
         
         XCTAssertNil(userName);
@@ -515,4 +640,451 @@ static NSTimeInterval kConnectionTimeOut = 60;
     }];
 }
 
+- (void)testRetryNetworkError
+{
+    [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
+    
+    [self requestClientTokenWithExpectedErrorCode:NSURLErrorNetworkConnectionLost];
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:HTTPStubNetworkConnectionLost], 4);
+}
+
+- (void)testNoRetryPolicy
+{
+    [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
+    
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    [CPAStatelessRequest setRetryPolicy:[CPARetryPolicy noRetryPolicy] forAuthorizationProviderURL:authorizationProviderURL];
+    
+    [self requestClientTokenWithExpectedErrorCode:NSURLErrorNetworkConnectionLost];
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:HTTPStubNetworkConnectionLost], 1);
+}
+
+- (void)testRetryBudget
+{
+    [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
+    
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    CPARetryPolicy *retryPolicy = [[CPARetryPolicy alloc] init];
+    retryPolicy.baseDelay = 0.01;
+    retryPolicy.retryBudgetCapacity = 2;
+    retryPolicy.retryBudgetRatio = 0.;
+    [CPAStatelessRequest setRetryPolicy:retryPolicy forAuthorizationProviderURL:authorizationProviderURL];
+    
+    // The budget only allows for two retries
+    [self requestClientTokenWithExpectedErrorCode:NSURLErrorNetworkConnectionLost];
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:HTTPStubNetworkConnectionLost], 3);
+    
+    // The budget is exhausted and shared by all requests to the same AP
+    [self requestClientTokenWithExpectedErrorCode:NSURLErrorNetworkConnectionLost];
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:HTTPStubNetworkConnectionLost], 4);
+}
+
+- (void)testRetryAfter
+{
+    [HTTPStub installStubWithName:@"request_client_token_slow_down"];
+    
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    CPARetryPolicy *retryPolicy = [[CPARetryPolicy alloc] init];
+    retryPolicy.baseDelay = 0.01;
+    retryPolicy.maximumRetryCount = 1;
+    [CPAStatelessRequest setRetryPolicy:retryPolicy forAuthorizationProviderURL:authorizationProviderURL];
+    
+    // The AP asks to wait one second before retrying
+    NSDate *startDate = [NSDate date];
+    [self requestClientTokenWithExpectedErrorCode:CPAErrorTooFast];
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token_slow_down"], 2);
+    XCTAssertTrue([[NSDate date] timeIntervalSinceDate:startDate] >= 1.);
+}
+
+- (void)testRetryAfterTooLate
+{
+    [HTTPStub installStubWithName:@"request_client_token_slow_down"];
+    
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    CPARetryPolicy *retryPolicy = [[CPARetryPolicy alloc] init];
+    retryPolicy.baseDelay = 0.01;
+    retryPolicy.maximumDelay = 0.5;
+    [CPAStatelessRequest setRetryPolicy:retryPolicy forAuthorizationProviderURL:authorizationProviderURL];
+    
+    // The delay requested by the AP exceeds the maximum delay. No retry is made
+    [self requestClientTokenWithExpectedErrorCode:CPAErrorTooFast];
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token_slow_down"], 1);
+}
+
+- (void)testCircuitBreaker
+{
+    [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
+    
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    [CPAStatelessRequest setRetryPolicy:[CPARetryPolicy noRetryPolicy] forAuthorizationProviderURL:authorizationProviderURL];
+    
+    CPACircuitBreaker *circuitBreaker = [[CPACircuitBreaker alloc] init];
+    circuitBreaker.failureThreshold = 2;
+    circuitBreaker.openInterval = 60.;
+    [CPAStatelessRequest setCircuitBreaker:circuitBreaker forAuthorizationProviderURL:authorizationProviderURL];
+    
+    // The breaker is copied
+    circuitBreaker = [CPAStatelessRequest circuitBreakerForAuthorizationProviderURL:authorizationProviderURL];
+    XCTAssertEqual(circuitBreaker.failureThreshold, 2);
+    XCTAssertEqual(circuitBreaker.state, CPACircuitBreakerStateClosed);
+    
+    [self requestClientTokenWithExpectedErrorCode:NSURLErrorNetworkConnectionLost];
+    XCTAssertEqual(circuitBreaker.state, CPACircuitBreakerStateClosed);
+    XCTAssertEqual(circuitBreaker.consecutiveFailureCount, 1);
+    
+    [self requestClientTokenWithExpectedErrorCode:NSURLErrorNetworkConnectionLost];
+    XCTAssertEqual(circuitBreaker.state, CPACircuitBreakerStateOpen);
+    XCTAssertEqual(circuitBreaker.tripCount, 1);
+    
+    // Requests fail immediately while the breaker is open
+    [self requestClientTokenWithExpectedErrorCode:CPAErrorAuthorizationProviderUnavailable];
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:HTTPStubNetworkConnectionLost], 2);
+    XCTAssertEqual(circuitBreaker.rejectedRequestCount, 1);
+}
+
+- (void)testCircuitBreakerStopsRetries
+{
+    [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
+    
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    CPACircuitBreaker *circuitBreaker = [[CPACircuitBreaker alloc] init];
+    circuitBreaker.failureThreshold = 2;
+    [CPAStatelessRequest setCircuitBreaker:circuitBreaker forAuthorizationProviderURL:authorizationProviderURL];
+    
+    // The second attempt opens the breaker, the third one is not made
+    [self requestClientTokenWithExpectedErrorCode:CPAErrorAuthorizationProviderUnavailable];
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:HTTPStubNetworkConnectionLost], 2);
+}
+
+- (void)testCircuitBreakerRecovery
+{
+    [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
+    
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    [CPAStatelessRequest setRetryPolicy:[CPARetryPolicy noRetryPolicy] forAuthorizationProviderURL:authorizationProviderURL];
+    
+    CPACircuitBreaker *circuitBreaker = [[CPACircuitBreaker alloc] init];
+    circuitBreaker.failureThreshold = 1;
+    circuitBreaker.openInterval = 0.5;
+    [CPAStatelessRequest setCircuitBreaker:circuitBreaker forAuthorizationProviderURL:authorizationProviderURL];
+    circuitBreaker = [CPAStatelessRequest circuitBreakerForAuthorizationProviderURL:authorizationProviderURL];
+    
+    [self requestClientTokenWithExpectedErrorCode:NSURLErrorNetworkConnectionLost];
+    XCTAssertEqual(circuitBreaker.state, CPACircuitBreakerStateOpen);
+    
+    // Once the open interval has elapsed, a failed trial request opens the breaker again
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"state == %@", @(CPACircuitBreakerStateHalfOpen)] evaluatedWithObject:circuitBreaker handler:nil];
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    [self requestClientTokenWithExpectedErrorCode:NSURLErrorNetworkConnectionLost];
+    XCTAssertEqual(circuitBreaker.state, CPACircuitBreakerStateOpen);
+    XCTAssertEqual(circuitBreaker.tripCount, 2);
+    
+    // A successful trial request closes it
+    [HTTPStub removeStubWithName:HTTPStubNetworkConnectionLost];
+    [HTTPStub installStubWithName:@"request_client_token"];
+    
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"state == %@", @(CPACircuitBreakerStateHalfOpen)] evaluatedWithObject:circuitBreaker handler:nil];
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token"];
+    [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertNotNil(accessToken);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertEqual(circuitBreaker.state, CPACircuitBreakerStateClosed);
+    XCTAssertEqual(circuitBreaker.consecutiveFailureCount, 0);
+}
+
+- (void)testCircuitBreakerAuthorizationProviderErrors
+{
+    [HTTPStub installStubWithName:@"request_client_token_slow_down"];
+    
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    [CPAStatelessRequest setRetryPolicy:[CPARetryPolicy noRetryPolicy] forAuthorizationProviderURL:authorizationProviderURL];
+    
+    CPACircuitBreaker *circuitBreaker = [[CPACircuitBreaker alloc] init];
+    circuitBreaker.failureThreshold = 1;
+    [CPAStatelessRequest setCircuitBreaker:circuitBreaker forAuthorizationProviderURL:authorizationProviderURL];
+    
+    // Errors returned by an available AP do not open the breaker
+    [self requestClientTokenWithExpectedErrorCode:CPAErrorTooFast];
+    [self requestClientTokenWithExpectedErrorCode:CPAErrorTooFast];
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token_slow_down"], 2);
+    XCTAssertEqual([CPAStatelessRequest circuitBreakerForAuthorizationProviderURL:authorizationProviderURL].state, CPACircuitBreakerStateClosed);
+}
+
+- (void)testEndpointSelection
+{
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    NSURL *backupAuthorizationProviderURL = [NSURL URLWithString:@"https://cpa-backup.rts.ch"];
+    
+    CPAEndpointSelector *endpointSelector = [[CPAEndpointSelector alloc] initWithEndpointURLs:@[authorizationProviderURL, backupAuthorizationProviderURL] weights:@[@10, @1]];
+    endpointSelector.smoothingFactor = 0.5;
+    endpointSelector.explorationRatio = 0.;
+    [CPAStatelessRequest setEndpointSelector:endpointSelector forAuthorizationProviderURL:authorizationProviderURL];
+    
+    // The selector is copied
+    endpointSelector = [CPAStatelessRequest endpointSelectorForAuthorizationProviderURL:authorizationProviderURL];
+    XCTAssertEqual(endpointSelector.smoothingFactor, 0.5);
+    XCTAssertEqual(endpointSelector.explorationRatio, 0.);
+    
+    // Endpoints whose latency is unknown are tried first, in order
+    XCTAssertEqualObjects([endpointSelector rankedEndpointURLs], (@[authorizationProviderURL, backupAuthorizationProviderURL]));
+    [endpointSelector recordLatency:0.2 forEndpointURL:authorizationProviderURL];
+    XCTAssertEqualObjects([endpointSelector rankedEndpointURLs], (@[backupAuthorizationProviderURL, authorizationProviderURL]));
+    
+    // Latencies are weighted and averaged
+    [endpointSelector recordLatency:0.04 forEndpointURL:backupAuthorizationProviderURL];
+    XCTAssertEqualObjects([endpointSelector rankedEndpointURLs], (@[authorizationProviderURL, backupAuthorizationProviderURL]));
+    
+    [endpointSelector recordLatency:0.8 forEndpointURL:authorizationProviderURL];
+    XCTAssertEqualWithAccuracy([endpointSelector averageLatencyForEndpointURL:authorizationProviderURL], 0.5, 0.0001);
+    XCTAssertEqualObjects([endpointSelector rankedEndpointURLs], (@[backupAuthorizationProviderURL, authorizationProviderURL]));
+    
+    // Not enough latencies have been recorded to hedge requests
+    XCTAssertEqual(endpointSelector.hedgingDelay, 0.);
+}
+
+- (void)testEndpointFailover
+{
+    [HTTPStub installStubWithName:@"request_client_token"];
+    [self installEndpointStubForHost:@"cpa.rts.ch" withResponse:[OHHTTPStubsResponse responseWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil]]];
+    
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    NSURL *backupAuthorizationProviderURL = [NSURL URLWithString:@"https://cpa-backup.rts.ch"];
+    
+    CPAEndpointSelector *endpointSelector = [[CPAEndpointSelector alloc] initWithEndpointURLs:@[authorizationProviderURL, backupAuthorizationProviderURL]];
+    endpointSelector.explorationRatio = 0.;
+    [CPAStatelessRequest setEndpointSelector:endpointSelector forAuthorizationProviderURL:authorizationProviderURL];
+    endpointSelector = [CPAStatelessRequest endpointSelectorForAuthorizationProviderURL:authorizationProviderURL];
+    
+    // The first attempt fails, the request is retried with the backup endpoint
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token (failover)"];
+    [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqualObjects(accessToken, @"2232af6d5daa04f073561a859e95ba77");
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token"], 1);
+    XCTAssertEqual([endpointSelector averageLatencyForEndpointURL:authorizationProviderURL], 0.);
+    XCTAssertTrue([endpointSelector averageLatencyForEndpointURL:backupAuthorizationProviderURL] > 0.);
+    
+    // Each endpoint has its own circuit breaker
+    XCTAssertEqual([CPAStatelessRequest circuitBreakerForAuthorizationProviderURL:authorizationProviderURL].consecutiveFailureCount, 1);
+    XCTAssertEqual([CPAStatelessRequest circuitBreakerForAuthorizationProviderURL:backupAuthorizationProviderURL].consecutiveFailureCount, 0);
+}
+
+- (void)testHedgedRefresh
+{
+    [HTTPStub installStubWithName:@"refresh_token_client"];
+    [self installEndpointStubForHost:@"cpa.rts.ch" withResponse:[[OHHTTPStubsResponse responseWithData:[NSData data] statusCode:503 headers:nil] responseTime:5.]];
+    
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    NSURL *backupAuthorizationProviderURL = [NSURL URLWithString:@"https://cpa-backup.rts.ch"];
+    
+    CPAEndpointSelector *endpointSelector = [[CPAEndpointSelector alloc] initWithEndpointURLs:@[authorizationProviderURL, backupAuthorizationProviderURL]];
+    endpointSelector.explorationRatio = 0.;
+    endpointSelector.hedgingEnabled = YES;
+    [CPAStatelessRequest setEndpointSelector:endpointSelector forAuthorizationProviderURL:authorizationProviderURL];
+    endpointSelector = [CPAStatelessRequest endpointSelectorForAuthorizationProviderURL:authorizationProviderURL];
+    
+    // The main endpoint is usually the fastest one
+    for (NSUInteger i = 0; i < 10; ++i) {
+        [endpointSelector recordLatency:0.05 forEndpointURL:authorizationProviderURL];
+        [endpointSelector recordLatency:0.1 forEndpointURL:backupAuthorizationProviderURL];
+    }
+    XCTAssertTrue(endpointSelector.hedgingDelay > 0.);
+    
+    // The main endpoint is slow to answer this time. The request is hedged with the backup endpoint
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Refresh token (hedged)"];
+    NSDate *startDate = [NSDate date];
+    [CPAStatelessRequest refreshTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqualObjects(accessToken, @"2232af6d5daa04f073561a859e95ba77");
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertTrue([[NSDate date] timeIntervalSinceDate:startDate] < 2.);
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"refresh_token_client"], 1);
+}
+
+- (void)testCancelRequest
+{
+    [HTTPStub installStubWithName:@"request_client_token_slow_down"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token (cancelled)"];
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    
+    // The AP asks to wait one second before retrying. Cancel while waiting
+    CPARequestHandle *requestHandle = [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        XCTFail(@"The completion block of a cancelled request must not be called");
+    }];
+    XCTAssertFalse(requestHandle.finished);
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [requestHandle cancel];
+        XCTAssertTrue(requestHandle.cancelled);
+        XCTAssertTrue(requestHandle.finished);
+    });
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(2. * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [expectation fulfill];
+    });
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // No retry has been made
+    XCTAssertEqual([HTTPStub numberOfRequestsForStubWithName:@"request_client_token_slow_down"], 1);
+}
+
+- (void)testCancelFinishedRequest
+{
+    [HTTPStub installStubWithName:@"request_client_token"];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token"];
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    
+    __block CPARequestHandle *requestHandle = nil;
+    requestHandle = [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertTrue(requestHandle.finished);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // Cancelling a request which is already over does nothing
+    [requestHandle cancel];
+    XCTAssertFalse(requestHandle.cancelled);
+}
+
+- (void)testMetricsObserver
+{
+    [HTTPStub installStubWithName:@"request_client_token"];
+    
+    // No metrics are collected by default
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    XCTAssertNil([CPAStatelessRequest metricsObserverForAuthorizationProviderURL:authorizationProviderURL]);
+    XCTAssertNil([CPAStatelessRequest sessionForAuthorizationProviderURL:authorizationProviderURL].delegate);
+    
+    CPAMetricsRecorder *metricsRecorder = [[CPAMetricsRecorder alloc] init];
+    [CPAStatelessRequest setMetricsObserver:metricsRecorder forAuthorizationProviderURL:authorizationProviderURL];
+    XCTAssertEqual([CPAStatelessRequest metricsObserverForAuthorizationProviderURL:authorizationProviderURL], metricsRecorder);
+    XCTAssertNotNil([CPAStatelessRequest sessionForAuthorizationProviderURL:authorizationProviderURL].delegate);
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token (metrics)"];
+    
+    [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        XCTAssertNil(error);
+        [expectation fulfill];
+    }];
+    
+    // Metrics are reported asynchronously
+    [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(CPAMetricsRecorder *recorder, NSDictionary<NSString *, id> *bindings) {
+        return [recorder requestCountForEndpoint:@"token"] == 1;
+    }] evaluatedWithObject:metricsRecorder handler:nil];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertEqualObjects(metricsRecorder.endpoints, @[@"token"]);
+    XCTAssertEqual([metricsRecorder failedRequestCountForEndpoint:@"token"], 0);
+    XCTAssertEqual([metricsRecorder histogramForEndpoint:@"token" phase:CPARequestPhaseTotal].count, 1);
+    XCTAssertEqual([metricsRecorder histogramForEndpoint:@"token" phase:CPARequestPhaseParsing].count, 1);
+    XCTAssertTrue([metricsRecorder histogramForEndpoint:@"token" phase:CPARequestPhaseTotal].maximumDuration > 0.);
+    XCTAssertNil([metricsRecorder histogramForEndpoint:@"register" phase:CPARequestPhaseTotal]);
+    
+    NSDictionary *JSONDictionary = [NSJSONSerialization JSONObjectWithData:[metricsRecorder JSONData] options:0 error:NULL];
+    XCTAssertEqualObjects(JSONDictionary[@"token"][@"requests"], @1);
+    XCTAssertEqualObjects(JSONDictionary[@"token"][@"total"][@"count"], @1);
+    
+    // Each attempt is reported
+    [metricsRecorder reset];
+    [HTTPStub installStubWithName:HTTPStubNetworkConnectionLost];
+    
+    [self requestClientTokenWithExpectedErrorCode:NSURLErrorNetworkConnectionLost];
+    
+    [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(CPAMetricsRecorder *recorder, NSDictionary<NSString *, id> *bindings) {
+        return [recorder failedRequestCountForEndpoint:@"token"] == 4;
+    }] evaluatedWithObject:metricsRecorder handler:nil];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    XCTAssertNil([metricsRecorder histogramForEndpoint:@"token" phase:CPARequestPhaseParsing]);
+    
+    // Removing the observer restores a session without delegate
+    [CPAStatelessRequest setMetricsObserver:nil forAuthorizationProviderURL:authorizationProviderURL];
+    XCTAssertNil([CPAStatelessRequest sessionForAuthorizationProviderURL:authorizationProviderURL].delegate);
+}
+
+#pragma mark Performance tests
+
+- (void)testRequestLatencyPerformance
+{
+    [HTTPStub installStubWithName:@"request_client_token"];
+    
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 10; ++i) {
+            XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token"];
+            
+            [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:authorizationProviderURL clientIdentifier:@"407" clientSecret:@"0b596bf22cf992b8fd8202126ee5db40" domain:@"cpa.rts.ch" completionQueue:nil completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+                XCTAssertNil(error);
+                [expectation fulfill];
+            }];
+            
+            [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+                XCTAssertNil(error);
+            }];
+        }
+    }];
+}
+
+- (void)testSessionConfiguration
+{
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    NSURLSession *session = [CPAStatelessRequest sessionForAuthorizationProviderURL:authorizationProviderURL];
+    XCTAssertEqual(session, [CPAStatelessRequest sessionForAuthorizationProviderURL:authorizationProviderURL]);
+    XCTAssertEqual(session.configuration.timeoutIntervalForRequest, 30.);
+    
+    NSURLSessionConfiguration *sessionConfiguration = [NSURLSessionConfiguration defaultSessionConfiguration];
+    sessionConfiguration.timeoutIntervalForRequest = 10.;
+    [CPAStatelessRequest setSessionConfiguration:sessionConfiguration forAuthorizationProviderURL:authorizationProviderURL];
+    
+    NSURLSession *configuredSession = [CPAStatelessRequest sessionForAuthorizationProviderURL:authorizationProviderURL];
+    XCTAssertNotEqual(session, configuredSession);
+    XCTAssertEqual(configuredSession.configuration.timeoutIntervalForRequest, 10.);
+    
+    [CPAStatelessRequest setSessionConfiguration:nil forAuthorizationProviderURL:authorizationProviderURL];
+    XCTAssertEqual([CPAStatelessRequest sessionForAuthorizationProviderURL:authorizationProviderURL].configuration.timeoutIntervalForRequest, 30.);
+}
+
 @end
@@ -0,0 +1,221 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPAFileTokenStore.h"
+#import "CPAKeyChainTokenStore.h"
+#import "CPAMemoryTokenStore.h"
+#import "CPAProvider.h"
+#import "HTTPStub.h"
+
+#import <XCTest/XCTest.h>
+
+static NSTimeInterval kConnectionTimeOut = 60;
+
+@interface CPATokenStoreTestCase : XCTestCase
+
+@property (nonatomic) NSURL *fileURL;
+@property (nonatomic) NSData *encryptionKey;
+
+@end
+
+@implementation CPATokenStoreTestCase
+
+#pragma mark Setup and teardown
+
+- (void)setUp
+{
+    NSString *fileName = [NSString stringWithFormat:@"cpa-tests/%@.store", [NSUUID UUID].UUIDString];
+    self.fileURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:fileName]];
+    self.encryptionKey = [CPAFileTokenStore randomEncryptionKey];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtURL:[self.fileURL URLByDeletingLastPathComponent] error:NULL];
+    [HTTPStub removeAllStubs];
+}
+
+#pragma mark Helpers
+
+- (NSArray<id<CPATokenStore>> *)tokenStores
+{
+    return @[[[CPAKeyChainTokenStore alloc] initWithService:@"ch.ebu.cpa.tests" accessGroup:nil],
+             [[CPAMemoryTokenStore alloc] init],
+             [[CPAFileTokenStore alloc] initWithFileURL:self.fileURL encryptionKey:self.encryptionKey]];
+}
+
+- (void)waitForPendingWritesToTokenStore:(id<CPATokenStore>)tokenStore
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Pending writes"];
+    
+    // Completion blocks of mutations are called once pending writes are over
+    [tokenStore removeDataForKey:@"unknown" completionBlock:^{
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+}
+
+#pragma mark Tests
+
+- (void)testTokenStores
+{
+    NSData *data1 = [@"data1" dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *data2 = [@"data2" dataUsingEncoding:NSUTF8StringEncoding];
+    
+    for (id<CPATokenStore> tokenStore in [self tokenStores]) {
+        [tokenStore removeAllData];
+        XCTAssertEqual([tokenStore allKeys].count, 0);
+        XCTAssertNil([tokenStore dataForKey:@"key1"]);
+        
+        [tokenStore setData:data1 forKey:@"key1"];
+        [tokenStore setData:data1 forKey:@"key2"];
+        [tokenStore setData:data2 forKey:@"key2"];
+        XCTAssertEqualObjects([tokenStore dataForKey:@"key1"], data1);
+        XCTAssertEqualObjects([tokenStore dataForKey:@"key2"], data2);
+        XCTAssertEqualObjects([NSSet setWithArray:[tokenStore allKeys]], ([NSSet setWithObjects:@"key1", @"key2", nil]));
+        XCTAssertEqualObjects([tokenStore allData], (@{ @"key1" : data1, @"key2" : data2 }));
+        
+        [tokenStore removeDataForKey:@"key1"];
+        [tokenStore removeDataForKey:@"unknown"];
+        XCTAssertNil([tokenStore dataForKey:@"key1"]);
+        XCTAssertEqualObjects([tokenStore allKeys], @[@"key2"]);
+        
+        [tokenStore removeAllData];
+        XCTAssertEqual([tokenStore allKeys].count, 0);
+    }
+}
+
+- (void)testTokenStoresAsync
+{
+    NSData *data = [@"data" dataUsingEncoding:NSUTF8StringEncoding];
+    
+    for (id<CPATokenStore> tokenStore in [self tokenStores]) {
+        XCTestExpectation *expectation = [self expectationWithDescription:@"Asynchronous operations"];
+        
+        [tokenStore setData:data forKey:@"key" completionBlock:^{
+            XCTAssertTrue([NSThread isMainThread]);
+            
+            [tokenStore dataForKey:@"key" completionBlock:^(NSData *storedData) {
+                XCTAssertEqualObjects(storedData, data);
+                
+                [tokenStore removeAllDataWithCompletionBlock:^{
+                    [tokenStore allKeysWithCompletionBlock:^(NSArray<NSString *> *keys) {
+                        XCTAssertEqual(keys.count, 0);
+                        [expectation fulfill];
+                    }];
+                }];
+            }];
+        }];
+        
+        [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+            XCTAssertNil(error);
+        }];
+    }
+}
+
+- (void)testFileTokenStorePersistence
+{
+    NSData *data = [@"data" dataUsingEncoding:NSUTF8StringEncoding];
+    
+    CPAFileTokenStore *tokenStore = [[CPAFileTokenStore alloc] initWithFileURL:self.fileURL encryptionKey:self.encryptionKey];
+    [tokenStore setData:data forKey:@"key"];
+    [self waitForPendingWritesToTokenStore:tokenStore];
+    
+    // The contents are encrypted
+    NSData *fileData = [NSData dataWithContentsOfURL:self.fileURL];
+    XCTAssertNotNil(fileData);
+    XCTAssertEqual([fileData rangeOfData:[@"key" dataUsingEncoding:NSUTF8StringEncoding] options:0 range:NSMakeRange(0, fileData.length)].location, NSNotFound);
+    
+    CPAFileTokenStore *reopenedTokenStore = [[CPAFileTokenStore alloc] initWithFileURL:self.fileURL encryptionKey:self.encryptionKey];
+    XCTAssertEqualObjects([reopenedTokenStore dataForKey:@"key"], data);
+    
+    // Wrong key
+    CPAFileTokenStore *otherKeyTokenStore = [[CPAFileTokenStore alloc] initWithFileURL:self.fileURL encryptionKey:[CPAFileTokenStore randomEncryptionKey]];
+    XCTAssertNil([otherKeyTokenStore dataForKey:@"key"]);
+    
+    // Tampered file
+    NSMutableData *tamperedData = [fileData mutableCopy];
+    ((uint8_t *)tamperedData.mutableBytes)[tamperedData.length / 2] ^= 0x01;
+    [tamperedData writeToURL:self.fileURL atomically:YES];
+    
+    CPAFileTokenStore *tamperedTokenStore = [[CPAFileTokenStore alloc] initWithFileURL:self.fileURL encryptionKey:self.encryptionKey];
+    XCTAssertNil([tamperedTokenStore dataForKey:@"key"]);
+}
+
+- (void)testProviderWithMemoryTokenStore
+{
+    [HTTPStub installStubWithName:@"register_client_provider"];
+    [HTTPStub installStubWithName:@"request_client_token_provider"];
+    
+    CPAMemoryTokenStore *tokenStore = [[CPAMemoryTokenStore alloc] init];
+    NSURL *authorizationProviderURL = [NSURL URLWithString:@"https://cpa.rts.ch"];
+    CPAProvider *provider = [[CPAProvider alloc] initWithAuthorizationProviderURL:authorizationProviderURL
+                                                                       tokenStore:tokenStore
+                                                                 tokenStorageMode:CPATokenStorageModeItemPerDomain];
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Request client token"];
+    
+    [provider requestTokenForDomain:@"cpa.rts.ch" withType:CPATokenTypeClient completionBlock:^(CPAToken *token, NSError *error) {
+        XCTAssertNil(error);
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:kConnectionTimeOut handler:^(NSError *error) {
+        XCTAssertNil(error);
+    }];
+    
+    // Identity and token
+    XCTAssertEqual([tokenStore allKeys].count, 2);
+    
+    CPAProvider *otherProvider = [[CPAProvider alloc] initWithAuthorizationProviderURL:authorizationProviderURL
+                                                                            tokenStore:tokenStore
+                                                                      tokenStorageMode:CPATokenStorageModeItemPerDomain];
+    XCTAssertEqualObjects([otherProvider tokenForDomain:@"cpa.rts.ch"].value, @"5ba522aa04f23a9075da61f6d859e347");
+    
+    [otherProvider discardIdentity];
+    XCTAssertEqual([tokenStore allKeys].count, 0);
+}
+
+#pragma mark Performance tests
+
+- (void)testTokenStoresPerformance
+{
+    NSData *data = [NSKeyedArchiver archivedDataWithRootObject:@{ @"value" : [NSUUID UUID].UUIDString }];
+    NSUInteger keyCount = 100;
+    NSUInteger readCount = 1000;
+    
+    for (id<CPATokenStore> tokenStore in [self tokenStores]) {
+        [tokenStore removeAllData];
+        
+        CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+        for (NSUInteger i = 0; i < keyCount; ++i) {
+            [tokenStore setData:data forKey:@(i).stringValue];
+        }
+        [self waitForPendingWritesToTokenStore:tokenStore];
+        CFAbsoluteTime writeDuration = CFAbsoluteTimeGetCurrent() - startTime;
+        
+        startTime = CFAbsoluteTimeGetCurrent();
+        for (NSUInteger i = 0; i < readCount; ++i) {
+            XCTAssertNotNil([tokenStore dataForKey:@(i % keyCount).stringValue]);
+        }
+        CFAbsoluteTime readDuration = CFAbsoluteTimeGetCurrent() - startTime;
+        
+        startTime = CFAbsoluteTimeGetCurrent();
+        XCTAssertEqual([tokenStore allKeys].count, keyCount);
+        CFAbsoluteTime enumerationDuration = CFAbsoluteTimeGetCurrent() - startTime;
+        
+        NSLog(@"%@: %.3f ms per write, %.3f ms per read, %.3f ms per enumeration", [tokenStore class], writeDuration * 1000. / keyCount,
+              readDuration * 1000. / readCount, enumerationDuration * 1000.);
+        
+        [tokenStore removeAllData];
+        [self waitForPendingWritesToTokenStore:tokenStore];
+    }
+}
+
+@end
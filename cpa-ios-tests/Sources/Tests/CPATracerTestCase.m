@@ -0,0 +1,92 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPAErrors.h"
+#import "CPATracer.h"
+
+#import <XCTest/XCTest.h>
+
+@interface CPATracerTestCase : XCTestCase
+
+@end
+
+@implementation CPATracerTestCase
+
+#pragma mark Tests
+
+- (void)testSpans
+{
+    CPATracer *tracer = [[CPATracer alloc] init];
+    
+    CPATraceSpan *rootSpan = [tracer startSpanWithName:@"root" category:@"provider" parentSpan:nil];
+    CPATraceSpan *childSpan = [tracer startSpanWithName:@"child" category:@"request" parentSpan:rootSpan];
+    CPATraceSpan *grandChildSpan = [tracer startSpanWithName:@"grandChild" category:@"storage" parentSpan:childSpan];
+    
+    XCTAssertNotEqual(rootSpan.spanIdentifier, childSpan.spanIdentifier);
+    XCTAssertEqual(rootSpan.parentSpanIdentifier, 0);
+    XCTAssertEqual(childSpan.parentSpanIdentifier, rootSpan.spanIdentifier);
+    XCTAssertEqual(grandChildSpan.parentSpanIdentifier, childSpan.spanIdentifier);
+    XCTAssertEqual(grandChildSpan.traceIdentifier, rootSpan.spanIdentifier);
+    
+    // Spans are only recorded when finished
+    XCTAssertTrue(rootSpan.duration < 0.);
+    XCTAssertEqual(tracer.spans.count, 0);
+    
+    [grandChildSpan finish];
+    [childSpan finishWithError:[NSError errorWithDomain:CPAErrorDomain code:CPAErrorInvalidClient userInfo:nil]];
+    [rootSpan finish];
+    
+    // Only the first call has an effect
+    [rootSpan finishWithError:[NSError errorWithDomain:CPAErrorDomain code:CPAErrorInvalidClient userInfo:nil]];
+    
+    XCTAssertEqualObjects([tracer.spans valueForKey:@"name"], (@[@"grandChild", @"child", @"root"]));
+    XCTAssertEqual(childSpan.error.code, CPAErrorInvalidClient);
+    XCTAssertNil(rootSpan.error);
+    XCTAssertTrue(rootSpan.duration >= childSpan.duration);
+    
+    [tracer reset];
+    XCTAssertEqual(tracer.spans.count, 0);
+}
+
+- (void)testMaximumSpanCount
+{
+    CPATracer *tracer = [[CPATracer alloc] init];
+    tracer.maximumSpanCount = 2;
+    
+    for (NSUInteger i = 0; i < 5; ++i) {
+        [[tracer startSpanWithName:[NSString stringWithFormat:@"span%@", @(i)] category:@"provider" parentSpan:nil] finish];
+    }
+    XCTAssertEqualObjects([tracer.spans valueForKey:@"name"], (@[@"span3", @"span4"]));
+}
+
+- (void)testChromeTraceExport
+{
+    CPATracer *tracer = [[CPATracer alloc] init];
+    
+    CPATraceSpan *rootSpan = [tracer startSpanWithName:@"root" category:@"provider" parentSpan:nil];
+    [rootSpan setAttribute:@"cpa.rts.ch" forKey:@"domain"];
+    CPATraceSpan *childSpan = [tracer startSpanWithName:@"child" category:@"request" parentSpan:rootSpan];
+    [childSpan finishWithError:[NSError errorWithDomain:CPAErrorDomain code:CPAErrorInvalidClient userInfo:nil]];
+    [rootSpan finish];
+    
+    NSDictionary *trace = [NSJSONSerialization JSONObjectWithData:[tracer chromeTraceJSONData] options:0 error:NULL];
+    NSArray<NSDictionary *> *events = trace[@"traceEvents"];
+    XCTAssertEqual(events.count, 2);
+    
+    NSDictionary *childEvent = events.firstObject;
+    XCTAssertEqualObjects(childEvent[@"name"], @"child");
+    XCTAssertEqualObjects(childEvent[@"cat"], @"request");
+    XCTAssertEqualObjects(childEvent[@"ph"], @"X");
+    XCTAssertEqualObjects(childEvent[@"tid"], @(rootSpan.spanIdentifier));
+    XCTAssertEqualObjects(childEvent[@"args"][@"parent_id"], @(rootSpan.spanIdentifier));
+    XCTAssertNotNil(childEvent[@"args"][@"error"]);
+    
+    NSDictionary *rootEvent = events.lastObject;
+    XCTAssertEqualObjects(rootEvent[@"args"][@"domain"], @"cpa.rts.ch");
+    XCTAssertTrue([rootEvent[@"ts"] unsignedLongLongValue] <= [childEvent[@"ts"] unsignedLongLongValue]);
+}
+
+@end
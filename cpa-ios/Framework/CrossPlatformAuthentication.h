@@ -4,7 +4,20 @@
 //  License information is available from the LICENSE file.
 //
 
+#import <CrossPlatformAuthentication/CPACircuitBreaker.h>
+#import <CrossPlatformAuthentication/CPAEndpointSelector.h>
 #import <CrossPlatformAuthentication/CPAErrors.h>
+#import <CrossPlatformAuthentication/CPAFileTokenStore.h>
+#import <CrossPlatformAuthentication/CPAKeyChainTokenStore.h>
+#import <CrossPlatformAuthentication/CPALatencyHistogram.h>
+#import <CrossPlatformAuthentication/CPAMemoryTokenStore.h>
+#import <CrossPlatformAuthentication/CPAMetricsRecorder.h>
 #import <CrossPlatformAuthentication/CPANullability.h>
 #import <CrossPlatformAuthentication/CPAProvider.h>
+#import <CrossPlatformAuthentication/CPARequestAuthorizer.h>
+#import <CrossPlatformAuthentication/CPARequestHandle.h>
+#import <CrossPlatformAuthentication/CPARequestMetrics.h>
+#import <CrossPlatformAuthentication/CPARetryPolicy.h>
 #import <CrossPlatformAuthentication/CPAToken.h>
+#import <CrossPlatformAuthentication/CPATokenStore.h>
+#import <CrossPlatformAuthentication/CPATracer.h>
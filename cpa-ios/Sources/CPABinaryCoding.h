@@ -0,0 +1,101 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Compact binary encoding of objects saved to the keychain, for implementation purposes only
+ *
+ * A record starts with a 3-byte header (a marker byte, the format version and the record type), followed by its fields
+ * in a fixed order. Strings and data are stored as bytes (UTF-8 for strings) preceded by their length plus one (LEB128
+ * variable-length integer, 0 for nil), unsigned integers as LEB128 integers, and dates as a little-endian 64-bit floating
+ * point number of seconds since the reference date
+ */
+typedef NS_ENUM(uint8_t, CPABinaryRecordType) {
+    CPABinaryRecordTypeIdentity = 'I',
+    CPABinaryRecordTypeToken = 'T',
+    CPABinaryRecordTypeStore = 'S',
+    CPABinaryRecordTypeEntries = 'E'
+};
+
+/**
+ * The current format version
+ */
+OBJC_EXPORT const uint8_t CPABinaryCodingVersion;
+
+@interface CPABinaryWriter : NSObject
+
+/**
+ * Create a writer for a record of the specified type
+ */
+- (instancetype)initWithRecordType:(CPABinaryRecordType)recordType NS_DESIGNATED_INITIALIZER;
+
+/**
+ * Append a field to the record
+ */
+- (void)writeString:(nullable NSString *)string;
+- (void)writeData:(nullable NSData *)data;
+- (void)writeUnsignedInteger:(NSUInteger)unsignedInteger;
+- (void)writeDate:(nullable NSDate *)date;
+
+/**
+ * The record data
+ */
+@property (nonatomic, readonly, copy) NSData *data;
+
+@end
+
+@interface CPABinaryReader : NSObject
+
+/**
+ * Return YES iff the data starts with a binary record header (whatever its version or type). Used to tell binary records
+ * from keyed archives
+ */
++ (BOOL)isBinaryRecordData:(NSData *)data;
+
+/**
+ * Create a reader for a record of the specified type. Return nil if the data is not a record of this type, or if it
+ * has been written by a more recent format version
+ */
+- (nullable instancetype)initWithData:(NSData *)data recordType:(CPABinaryRecordType)recordType NS_DESIGNATED_INITIALIZER;
+
+/**
+ * The format version with which the record was written
+ */
+@property (nonatomic, readonly) uint8_t version;
+
+/**
+ * Read the next field of the record. Return nil (0 for integers) if the field is nil, or if the record is malformed
+ */
+- (nullable NSString *)readString;
+- (nullable NSData *)readData;
+- (NSUInteger)readUnsignedInteger;
+- (nullable NSDate *)readDate;
+
+/**
+ * NO as soon as a malformed or truncated field has been read
+ */
+@property (nonatomic, readonly, getter=isValid) BOOL valid;
+
+@end
+
+@interface CPABinaryWriter (UnavailableMethods)
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+@interface CPABinaryReader (UnavailableMethods)
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,274 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPABinaryCoding.h"
+
+// Constants
+const uint8_t CPABinaryCodingVersion = 1;
+
+static const uint8_t CPABinaryRecordMarker = 0xCA;
+static const NSUInteger CPABinaryRecordHeaderLength = 3;
+
+@interface CPABinaryWriter ()
+
+@property (nonatomic) NSMutableData *mutableData;
+
+@end
+
+@interface CPABinaryReader ()
+
+@property (nonatomic) NSData *data;
+@property (nonatomic) uint8_t version;
+@property (nonatomic) NSUInteger offset;
+@property (nonatomic, getter=isValid) BOOL valid;
+
+@end
+
+@implementation CPABinaryWriter
+
+#pragma mark Object lifecycle
+
+- (instancetype)initWithRecordType:(CPABinaryRecordType)recordType
+{
+    if (self = [super init]) {
+        // Most records fit in this capacity, avoiding reallocations
+        self.mutableData = [NSMutableData dataWithCapacity:128];
+        
+        uint8_t header[CPABinaryRecordHeaderLength] = { CPABinaryRecordMarker, CPABinaryCodingVersion, recordType };
+        [self.mutableData appendBytes:header length:sizeof(header)];
+    }
+    return self;
+}
+
+- (instancetype)init
+{
+    [self doesNotRecognizeSelector:_cmd];
+    return nil;
+}
+
+#pragma mark Accessors and mutators
+
+- (NSData *)data
+{
+    return [self.mutableData copy];
+}
+
+#pragma mark Writing
+
+- (void)writeLength:(uint64_t)length
+{
+    // LEB128 encoding
+    uint8_t bytes[10];
+    NSUInteger count = 0;
+    do {
+        uint8_t byte = length & 0x7f;
+        length >>= 7;
+        bytes[count++] = length ? (byte | 0x80) : byte;
+    } while (length);
+    [self.mutableData appendBytes:bytes length:count];
+}
+
+- (void)writeString:(NSString *)string
+{
+    if (! string) {
+        [self writeLength:0];
+        return;
+    }
+    
+    NSUInteger length = [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    [self writeLength:length + 1];
+    
+    NSUInteger offset = self.mutableData.length;
+    [self.mutableData increaseLengthBy:length];
+    [string getBytes:(uint8_t *)self.mutableData.mutableBytes + offset
+           maxLength:length
+          usedLength:NULL
+            encoding:NSUTF8StringEncoding
+             options:0
+               range:NSMakeRange(0, string.length)
+      remainingRange:NULL];
+}
+
+- (void)writeData:(NSData *)data
+{
+    if (! data) {
+        [self writeLength:0];
+        return;
+    }
+    
+    [self writeLength:data.length + 1];
+    [self.mutableData appendData:data];
+}
+
+- (void)writeUnsignedInteger:(NSUInteger)unsignedInteger
+{
+    [self writeLength:unsignedInteger];
+}
+
+- (void)writeDate:(NSDate *)date
+{
+    NSTimeInterval timeInterval = date ? date.timeIntervalSinceReferenceDate : NAN;
+    
+    uint64_t bits = 0;
+    memcpy(&bits, &timeInterval, sizeof(bits));
+    bits = CFSwapInt64HostToLittle(bits);
+    [self.mutableData appendBytes:&bits length:sizeof(bits)];
+}
+
+@end
+
+@implementation CPABinaryReader
+
+#pragma mark Class methods
+
++ (BOOL)isBinaryRecordData:(NSData *)data
+{
+    NSParameterAssert(data);
+    
+    return data.length >= CPABinaryRecordHeaderLength && ((const uint8_t *)data.bytes)[0] == CPABinaryRecordMarker;
+}
+
+#pragma mark Object lifecycle
+
+- (instancetype)initWithData:(NSData *)data recordType:(CPABinaryRecordType)recordType
+{
+    NSParameterAssert(data);
+    
+    if (! [CPABinaryReader isBinaryRecordData:data]) {
+        return nil;
+    }
+    
+    const uint8_t *bytes = data.bytes;
+    if (bytes[1] == 0 || bytes[1] > CPABinaryCodingVersion || bytes[2] != recordType) {
+        return nil;
+    }
+    
+    if (self = [super init]) {
+        self.data = data;
+        self.version = bytes[1];
+        self.offset = CPABinaryRecordHeaderLength;
+        self.valid = YES;
+    }
+    return self;
+}
+
+- (instancetype)init
+{
+    [self doesNotRecognizeSelector:_cmd];
+    return nil;
+}
+
+#pragma mark Reading
+
+- (BOOL)readLength:(uint64_t *)pLength
+{
+    NSParameterAssert(pLength);
+    
+    const uint8_t *bytes = self.data.bytes;
+    NSUInteger dataLength = self.data.length;
+    
+    uint64_t length = 0;
+    NSUInteger shift = 0;
+    while (self.offset < dataLength && shift < 64) {
+        uint8_t byte = bytes[self.offset++];
+        length |= (uint64_t)(byte & 0x7f) << shift;
+        if (! (byte & 0x80)) {
+            *pLength = length;
+            return YES;
+        }
+        shift += 7;
+    }
+    
+    self.valid = NO;
+    return NO;
+}
+
+- (NSString *)readString
+{
+    if (! self.valid) {
+        return nil;
+    }
+    
+    uint64_t length = 0;
+    if (! [self readLength:&length] || length == 0) {
+        return nil;
+    }
+    
+    length -= 1;
+    if (length > self.data.length - self.offset) {
+        self.valid = NO;
+        return nil;
+    }
+    
+    NSString *string = [[NSString alloc] initWithBytes:(const uint8_t *)self.data.bytes + self.offset length:(NSUInteger)length encoding:NSUTF8StringEncoding];
+    if (! string) {
+        self.valid = NO;
+        return nil;
+    }
+    
+    self.offset += (NSUInteger)length;
+    return string;
+}
+
+- (NSData *)readData
+{
+    if (! self.valid) {
+        return nil;
+    }
+    
+    uint64_t length = 0;
+    if (! [self readLength:&length] || length == 0) {
+        return nil;
+    }
+    
+    length -= 1;
+    if (length > self.data.length - self.offset) {
+        self.valid = NO;
+        return nil;
+    }
+    
+    NSData *data = [self.data subdataWithRange:NSMakeRange(self.offset, (NSUInteger)length)];
+    self.offset += (NSUInteger)length;
+    return data;
+}
+
+- (NSUInteger)readUnsignedInteger
+{
+    if (! self.valid) {
+        return 0;
+    }
+    
+    uint64_t unsignedInteger = 0;
+    if (! [self readLength:&unsignedInteger] || unsignedInteger > NSUIntegerMax) {
+        self.valid = NO;
+        return 0;
+    }
+    return (NSUInteger)unsignedInteger;
+}
+
+- (NSDate *)readDate
+{
+    if (! self.valid) {
+        return nil;
+    }
+    
+    uint64_t bits = 0;
+    if (sizeof(bits) > self.data.length - self.offset) {
+        self.valid = NO;
+        return nil;
+    }
+    
+    memcpy(&bits, (const uint8_t *)self.data.bytes + self.offset, sizeof(bits));
+    self.offset += sizeof(bits);
+    
+    bits = CFSwapInt64LittleToHost(bits);
+    
+    NSTimeInterval timeInterval = 0.;
+    memcpy(&timeInterval, &bits, sizeof(timeInterval));
+    return ! isnan(timeInterval) ? [NSDate dateWithTimeIntervalSinceReferenceDate:timeInterval] : nil;
+}
+
+@end
@@ -0,0 +1,30 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPACircuitBreaker.h"
+#import "CPANullability.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Private interface for implementation purposes
+ */
+@interface CPACircuitBreaker (Private)
+
+/**
+ * Return YES iff an attempt can be made. When the breaker is half-open, only the first caller is allowed to make an
+ * attempt, until its result is recorded. Each attempt allowed must be followed by a call to -recordResultWithError:response:
+ */
+- (BOOL)shouldAllowRequest;
+
+/**
+ * Record the result of an attempt. Cancelled attempts are neither counted as successes nor as failures
+ */
+- (void)recordResultWithError:(nullable NSError *)error response:(nullable NSURLResponse *)response;
+
+@end
+
+NS_ASSUME_NONNULL_END
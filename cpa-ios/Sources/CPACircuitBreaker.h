@@ -0,0 +1,65 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Circuit breaker states
+ */
+typedef NS_ENUM(NSInteger, CPACircuitBreakerState) {
+    CPACircuitBreakerStateClosed,                   // Requests are made normally
+    CPACircuitBreakerStateOpen,                     // Requests fail immediately
+    CPACircuitBreakerStateHalfOpen                  // A single trial request is made to check whether the authorization provider has recovered
+};
+
+/**
+ * Circuit breaker suspending requests to an authorization provider which keeps failing, so that clients do not wait
+ * for each request to time out, and do not load an authorization provider recovering from an outage
+ *
+ * Attempts failing because of a network error which might indicate an outage (time out, host unreachable, connection
+ * lost) or because of a server error (5xx status code) are counted. Other errors (e.g. invalid client) mean that the
+ * authorization provider is available and are counted as successes. Once failureThreshold attempts have failed in a
+ * row, the breaker opens and requests fail with CPAErrorAuthorizationProviderUnavailable without being made. After
+ * openInterval, the breaker is half-open and lets a single trial request through. If it succeeds the breaker closes,
+ * otherwise it opens again
+ *
+ * Since attempts are counted, retries are stopped as well when the breaker opens. Breakers are thread-safe
+ */
+@interface CPACircuitBreaker : NSObject <NSCopying>
+
+/**
+ * The number of attempts which must fail in a row for the breaker to open (default: 5). Set to 0 to disable the breaker
+ */
+@property (atomic) NSUInteger failureThreshold;
+
+/**
+ * The time during which the breaker stays open before a trial request is made (default: 30 seconds)
+ */
+@property (atomic) NSTimeInterval openInterval;
+
+/**
+ * The current state of the breaker
+ */
+@property (nonatomic, readonly) CPACircuitBreakerState state;
+
+/**
+ * The number of attempts which have failed in a row
+ */
+@property (nonatomic, readonly) NSUInteger consecutiveFailureCount;
+
+/**
+ * The number of times the breaker has opened, and the number of requests which failed immediately because it was open
+ */
+@property (nonatomic, readonly) NSUInteger tripCount;
+@property (nonatomic, readonly) NSUInteger rejectedRequestCount;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,200 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPACircuitBreaker.h"
+
+// Static functions
+static BOOL CPAIsFailure(NSError *error, NSURLResponse *response);
+
+@interface CPACircuitBreaker ()
+
+// Must be accessed within a @synchronized(self) block, as well as the state and counters
+@property (nonatomic) NSTimeInterval openingTime;
+@property (nonatomic, getter=isTrialRequestRunning) BOOL trialRequestRunning;
+
+@end
+
+@implementation CPACircuitBreaker
+
+@synthesize state = _state;
+@synthesize consecutiveFailureCount = _consecutiveFailureCount;
+@synthesize tripCount = _tripCount;
+@synthesize rejectedRequestCount = _rejectedRequestCount;
+
+#pragma mark Object lifecycle
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        self.failureThreshold = 5;
+        self.openInterval = 30.;
+    }
+    return self;
+}
+
+#pragma mark Accessors and mutators
+
+- (CPACircuitBreakerState)state
+{
+    @synchronized(self) {
+        [self updateState];
+        return _state;
+    }
+}
+
+- (NSUInteger)consecutiveFailureCount
+{
+    @synchronized(self) {
+        return _consecutiveFailureCount;
+    }
+}
+
+- (NSUInteger)tripCount
+{
+    @synchronized(self) {
+        return _tripCount;
+    }
+}
+
+- (NSUInteger)rejectedRequestCount
+{
+    @synchronized(self) {
+        return _rejectedRequestCount;
+    }
+}
+
+#pragma mark State transitions
+
+/**
+ * Switch an open breaker to the half-open state once the open interval has elapsed. Must be called within a
+ * @synchronized(self) block
+ */
+- (void)updateState
+{
+    if (_state == CPACircuitBreakerStateOpen && [NSProcessInfo processInfo].systemUptime - self.openingTime >= self.openInterval) {
+        _state = CPACircuitBreakerStateHalfOpen;
+        self.trialRequestRunning = NO;
+    }
+}
+
+- (BOOL)shouldAllowRequest
+{
+    if (self.failureThreshold == 0) {
+        return YES;
+    }
+    
+    @synchronized(self) {
+        [self updateState];
+        
+        if (_state == CPACircuitBreakerStateClosed) {
+            return YES;
+        }
+        else if (_state == CPACircuitBreakerStateHalfOpen && ! self.trialRequestRunning) {
+            self.trialRequestRunning = YES;
+            return YES;
+        }
+        else {
+            ++_rejectedRequestCount;
+            return NO;
+        }
+    }
+}
+
+- (void)recordResultWithError:(NSError *)error response:(NSURLResponse *)response
+{
+    if ([error.domain isEqualToString:NSURLErrorDomain] && error.code == NSURLErrorCancelled) {
+        @synchronized(self) {
+            self.trialRequestRunning = NO;
+        }
+        return;
+    }
+    
+    BOOL failed = CPAIsFailure(error, response);
+    NSUInteger failureThreshold = self.failureThreshold;
+    
+    @synchronized(self) {
+        self.trialRequestRunning = NO;
+        
+        if (! failed) {
+            _consecutiveFailureCount = 0;
+            _state = CPACircuitBreakerStateClosed;
+            return;
+        }
+        
+        ++_consecutiveFailureCount;
+        
+        // A failed trial request opens the breaker again. Attempts made before the breaker opened might still fail
+        // afterwards, and must not extend the open interval
+        if (_state == CPACircuitBreakerStateHalfOpen
+                || (_state == CPACircuitBreakerStateClosed && failureThreshold != 0 && _consecutiveFailureCount >= failureThreshold)) {
+            _state = CPACircuitBreakerStateOpen;
+            self.openingTime = [NSProcessInfo processInfo].systemUptime;
+            ++_tripCount;
+        }
+    }
+}
+
+#pragma mark NSCopying protocol
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    // The state is not copied, a copy starts closed
+    CPACircuitBreaker *circuitBreaker = [[[self class] allocWithZone:zone] init];
+    circuitBreaker.failureThreshold = self.failureThreshold;
+    circuitBreaker.openInterval = self.openInterval;
+    return circuitBreaker;
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    static NSArray<NSString *> *s_stateNames;
+    static dispatch_once_t s_onceToken;
+    dispatch_once(&s_onceToken, ^{
+        s_stateNames = @[@"closed", @"open", @"half-open"];
+    });
+    
+    return [NSString stringWithFormat:@"<%@: %p; state: %@; failureThreshold: %@; openInterval: %@; consecutiveFailureCount: %@; tripCount: %@>",
+            [self class],
+            self,
+            s_stateNames[self.state],
+            @(self.failureThreshold),
+            @(self.openInterval),
+            @(self.consecutiveFailureCount),
+            @(self.tripCount)];
+}
+
+@end
+
+#pragma mark Static functions
+
+/**
+ * Return YES iff an attempt failed in a way suggesting that the authorization provider is unavailable
+ */
+static BOOL CPAIsFailure(NSError *error, NSURLResponse *response)
+{
+    NSInteger statusCode = [response isKindOfClass:[NSHTTPURLResponse class]] ? ((NSHTTPURLResponse *)response).statusCode : 0;
+    if (statusCode >= 500) {
+        return YES;
+    }
+    
+    if (! [error.domain isEqualToString:NSURLErrorDomain]) {
+        return NO;
+    }
+    
+    // Being offline says nothing about the authorization provider
+    static NSSet<NSNumber *> *s_failureErrorCodes;
+    static dispatch_once_t s_onceToken;
+    dispatch_once(&s_onceToken, ^{
+        s_failureErrorCodes = [NSSet setWithObjects:@(NSURLErrorTimedOut),
+                               @(NSURLErrorCannotFindHost),
+                               @(NSURLErrorCannotConnectToHost),
+                               @(NSURLErrorNetworkConnectionLost),
+                               @(NSURLErrorDNSLookupFailed), nil];
+    });
+    return [s_failureErrorCodes containsObject:@(error.code)];
+}
@@ -0,0 +1,73 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+#import "CPAStatelessRequest.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Poll the authorization provider token endpoint until the user has authorized a device code, for implementation
+ * purposes only
+ *
+ * Polling is made at the interval returned by the authorization provider with the device code. This interval is
+ * increased by 5 seconds each time the authorization provider asks the client to slow down. Polling stops when a token
+ * has been obtained, when an error other than a pending authorization is received, when the device code expires or
+ * when the poller is cancelled
+ */
+@interface CPADeviceCodePoller : NSObject
+
+/**
+ * Create a poller for the specified device code and domain, on behalf of a given client. If no valid polling interval
+ * or expiration delay is provided, defaults of 5 seconds and 10 minutes are used
+ */
+- (instancetype)initWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                      deviceCode:(NSString *)deviceCode
+                                clientIdentifier:(NSString *)clientIdentifier
+                                    clientSecret:(NSString *)clientSecret
+                                          domain:(NSString *)domain
+                                 pollingInterval:(NSTimeInterval)pollingInterval
+                                expiresInSeconds:(NSInteger)expiresInSeconds NS_DESIGNATED_INITIALIZER;
+
+/**
+ * The current polling interval
+ */
+@property (atomic, readonly) NSTimeInterval pollingInterval;
+
+/**
+ * The date at which the device code expires
+ */
+@property (nonatomic, readonly) NSDate *expirationDate;
+
+/**
+ * The queue on which the completion block is called (default: main queue). Must be set before polling is started
+ */
+@property (atomic, null_resettable) dispatch_queue_t completionQueue;
+
+/**
+ * Start polling after the specified delay (use 0 to poll immediately). The completion block is called once on the
+ * completion queue, either with the token information or with an error. If the device code expires, a CPAErrorAuthorizationRequestExpired
+ * error is returned. A poller can only be started once
+ */
+- (void)startWithDelay:(NSTimeInterval)delay completionBlock:(CPATokenRequestCompletionBlock)completionBlock;
+
+/**
+ * Stop polling, cancelling the running poll request if any. The completion block is called with a CPAErrorAuthorizationCancelled
+ * error, unless polling was already over. Can be called from any thread
+ */
+- (void)cancel;
+
+@end
+
+@interface CPADeviceCodePoller (UnavailableMethods)
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,239 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPADeviceCodePoller.h"
+
+#import "CPAErrors+Private.h"
+
+// Constants
+static const NSTimeInterval CPADeviceCodeDefaultPollingInterval = 5.;
+static const NSTimeInterval CPADeviceCodeSlowDownPollingIntervalIncrement = 5.;
+static const NSTimeInterval CPADeviceCodeDefaultLifetime = 10. * 60.;
+
+@interface CPADeviceCodePoller ()
+
+@property (nonatomic) NSURL *authorizationProviderURL;
+@property (nonatomic, copy) NSString *deviceCode;
+@property (nonatomic, copy) NSString *clientIdentifier;
+@property (nonatomic, copy) NSString *clientSecret;
+@property (nonatomic, copy) NSString *domain;
+@property (atomic) NSTimeInterval pollingInterval;
+@property (nonatomic) NSDate *expirationDate;
+
+// Set while polling, nil when polling is over. Must be accessed within a @synchronized(self) block
+@property (nonatomic, copy) CPATokenRequestCompletionBlock completionBlock;
+@property (nonatomic) dispatch_source_t timerSource;
+@property (nonatomic) CPARequestHandle *pollRequestHandle;
+
+@end
+
+@implementation CPADeviceCodePoller
+
+@synthesize completionQueue = _completionQueue;
+
+#pragma mark Object lifecycle
+
+- (instancetype)initWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                      deviceCode:(NSString *)deviceCode
+                                clientIdentifier:(NSString *)clientIdentifier
+                                    clientSecret:(NSString *)clientSecret
+                                          domain:(NSString *)domain
+                                 pollingInterval:(NSTimeInterval)pollingInterval
+                                expiresInSeconds:(NSInteger)expiresInSeconds
+{
+    NSParameterAssert(authorizationProviderURL);
+    NSParameterAssert(deviceCode);
+    NSParameterAssert(clientIdentifier);
+    NSParameterAssert(clientSecret);
+    NSParameterAssert(domain);
+    
+    if (self = [super init]) {
+        self.authorizationProviderURL = authorizationProviderURL;
+        self.deviceCode = deviceCode;
+        self.clientIdentifier = clientIdentifier;
+        self.clientSecret = clientSecret;
+        self.domain = domain;
+        self.pollingInterval = (pollingInterval > 0.) ? pollingInterval : CPADeviceCodeDefaultPollingInterval;
+        
+        NSTimeInterval lifetime = (expiresInSeconds > 0) ? expiresInSeconds : CPADeviceCodeDefaultLifetime;
+        self.expirationDate = [NSDate dateWithTimeIntervalSinceNow:lifetime];
+        self.completionQueue = nil;
+    }
+    return self;
+}
+
+- (instancetype)init
+{
+    [self doesNotRecognizeSelector:_cmd];
+    return nil;
+}
+
+- (void)dealloc
+{
+    if (_timerSource) {
+        dispatch_source_cancel(_timerSource);
+    }
+}
+
+#pragma mark Accessors and mutators
+
+- (dispatch_queue_t)completionQueue
+{
+    @synchronized(self) {
+        return _completionQueue;
+    }
+}
+
+- (void)setCompletionQueue:(dispatch_queue_t)completionQueue
+{
+    @synchronized(self) {
+        _completionQueue = completionQueue ?: dispatch_get_main_queue();
+    }
+}
+
+#pragma mark Polling
+
+- (void)startWithDelay:(NSTimeInterval)delay completionBlock:(CPATokenRequestCompletionBlock)completionBlock
+{
+    NSParameterAssert(completionBlock);
+    
+    @synchronized(self) {
+        NSAssert(! self.completionBlock, @"A poller can only be started once");
+        self.completionBlock = completionBlock;
+        [self schedulePollWithDelay:delay];
+    }
+}
+
+- (void)cancel
+{
+    [self finishWithUserName:nil accessToken:nil tokenType:nil domainName:nil expiresInSeconds:0 error:CPAErrorFromCode(CPAErrorAuthorizationCancelled)];
+}
+
+/**
+ * Schedule the next poll. Must be called within a @synchronized(self) block
+ */
+- (void)schedulePollWithDelay:(NSTimeInterval)delay
+{
+    if (self.timerSource) {
+        dispatch_source_cancel(self.timerSource);
+    }
+    
+    // Never wait beyond expiration, so that expiration is reported in time
+    delay = fmax(fmin(delay, [self.expirationDate timeIntervalSinceNow]), 0.);
+    
+    // The timer retains the poller until polling is over. Polls are made in the background, the main thread is only
+    // involved if it is the completion queue
+    self.timerSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+    dispatch_source_set_timer(self.timerSource, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), DISPATCH_TIME_FOREVER, (uint64_t)(0.1 * NSEC_PER_SEC));
+    dispatch_source_set_event_handler(self.timerSource, ^{
+        [self poll];
+    });
+    dispatch_resume(self.timerSource);
+}
+
+- (void)poll
+{
+    @synchronized(self) {
+        if (! self.completionBlock) {
+            return;
+        }
+        
+        if (self.timerSource) {
+            dispatch_source_cancel(self.timerSource);
+            self.timerSource = nil;
+        }
+    }
+    
+    if ([self.expirationDate compare:[NSDate date]] != NSOrderedDescending) {
+        [self finishWithUserName:nil accessToken:nil tokenType:nil domainName:nil expiresInSeconds:0 error:CPAErrorFromCode(CPAErrorAuthorizationRequestExpired)];
+        return;
+    }
+    
+    CPARequestHandle *pollRequestHandle = [CPAStatelessRequest pollUserTokenWithAuthorizationProviderURL:self.authorizationProviderURL deviceCode:self.deviceCode clientIdentifier:self.clientIdentifier clientSecret:self.clientSecret domain:self.domain completionQueue:dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0) completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        if ([error.domain isEqualToString:CPAErrorDomain]) {
+            if (error.code == CPAErrorPendingAuthorization) {
+                @synchronized(self) {
+                    if (self.completionBlock) {
+                        [self schedulePollWithDelay:self.pollingInterval];
+                    }
+                }
+                return;
+            }
+            else if (error.code == CPAErrorTooFast) {
+                @synchronized(self) {
+                    if (self.completionBlock) {
+                        self.pollingInterval += CPADeviceCodeSlowDownPollingIntervalIncrement;
+                        [self schedulePollWithDelay:self.pollingInterval];
+                    }
+                }
+                return;
+            }
+        }
+        
+        [self finishWithUserName:userName accessToken:accessToken tokenType:tokenType domainName:domainName expiresInSeconds:expiresInSeconds error:error];
+    }];
+    
+    // Polling might have been cancelled in the meantime
+    @synchronized(self) {
+        if (self.completionBlock) {
+            self.pollRequestHandle = pollRequestHandle;
+        }
+        else {
+            [pollRequestHandle cancel];
+        }
+    }
+}
+
+/**
+ * Stop polling and call the completion block, if not already done
+ */
+- (void)finishWithUserName:(NSString *)userName
+               accessToken:(NSString *)accessToken
+                 tokenType:(NSString *)tokenType
+                domainName:(NSString *)domainName
+          expiresInSeconds:(NSInteger)expiresInSeconds
+                     error:(NSError *)error
+{
+    CPATokenRequestCompletionBlock completionBlock = nil;
+    CPARequestHandle *pollRequestHandle = nil;
+    @synchronized(self) {
+        completionBlock = self.completionBlock;
+        self.completionBlock = nil;
+        
+        if (self.timerSource) {
+            dispatch_source_cancel(self.timerSource);
+            self.timerSource = nil;
+        }
+        
+        pollRequestHandle = self.pollRequestHandle;
+        self.pollRequestHandle = nil;
+    }
+    
+    // Stop a running poll request, if any (does nothing if polling finished with its response)
+    [pollRequestHandle cancel];
+    
+    if (! completionBlock) {
+        return;
+    }
+    
+    dispatch_async(self.completionQueue, ^{
+        completionBlock(userName, accessToken, tokenType, domainName, expiresInSeconds, error);
+    });
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; domain: %@; pollingInterval: %@; expirationDate: %@>",
+            [self class],
+            self,
+            self.domain,
+            @(self.pollingInterval),
+            self.expirationDate];
+}
+
+@end
@@ -0,0 +1,29 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPAEndpointSelector.h"
+#import "CPANullability.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Private interface for implementation purposes
+ */
+@interface CPAEndpointSelector (Private)
+
+/**
+ * Return the endpoint URLs, from the one to which a request should be made to the one which should be used last
+ */
+- (NSArray<NSURL *> *)rankedEndpointURLs;
+
+/**
+ * Record the duration of a request answered by an endpoint
+ */
+- (void)recordLatency:(NSTimeInterval)latency forEndpointURL:(NSURL *)endpointURL;
+
+@end
+
+NS_ASSUME_NONNULL_END
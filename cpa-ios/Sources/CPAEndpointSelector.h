@@ -0,0 +1,89 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Selects the endpoint to which each request to an authorization provider available from several URLs (e.g. in several
+ * regions) is made. All endpoints must share the same clients and tokens, since the identity of an application is
+ * registered once for the authorization provider, whatever the endpoint
+ *
+ * The latency of each endpoint is tracked as an exponentially weighted moving average (EWMA) of the durations of the
+ * requests it answered. Requests are made to the endpoint with the lowest latency divided by its weight, endpoints
+ * whose latency is not known yet being tried first, in the order in which they were provided. Endpoints whose circuit
+ * breaker is open are skipped (see CPACircuitBreaker.h), and retries are made to another endpoint when possible
+ *
+ * Refresh requests can optionally be hedged: If no response has been received after a delay given by a percentile of
+ * the latencies recorded for all endpoints, the same request is made to another endpoint, and the first successful
+ * response is used
+ *
+ * Selectors are thread-safe
+ */
+@interface CPAEndpointSelector : NSObject <NSCopying>
+
+/**
+ * Create a selector for the specified endpoint URLs, by order of preference, with an optional weight for each one
+ * (1 by default). An endpoint with a higher weight is preferred to endpoints with lower weights, as long as its latency
+ * does not exceed theirs in a higher proportion
+ */
+- (instancetype)initWithEndpointURLs:(NSArray<NSURL *> *)endpointURLs weights:(nullable NSArray<NSNumber *> *)weights NS_DESIGNATED_INITIALIZER;
+
+/**
+ * Same as -initWithEndpointURLs:weights:, with the same weight for all endpoints
+ */
+- (instancetype)initWithEndpointURLs:(NSArray<NSURL *> *)endpointURLs;
+
+/**
+ * The endpoint URLs and their weights
+ */
+@property (nonatomic, readonly) NSArray<NSURL *> *endpointURLs;
+@property (nonatomic, readonly) NSArray<NSNumber *> *weights;
+
+/**
+ * The weight given to each new latency in the moving average of an endpoint, between 0 and 1 (default: 0.2)
+ */
+@property (atomic) double smoothingFactor;
+
+/**
+ * The fraction of requests made to an endpoint which is not the best one, so that the latency of all endpoints remains
+ * up to date (default: 0.05). Set to 0 to always make requests to the best endpoint
+ */
+@property (atomic) double explorationRatio;
+
+/**
+ * Set to YES to hedge refresh requests (default: NO)
+ */
+@property (atomic, getter=isHedgingEnabled) BOOL hedgingEnabled;
+
+/**
+ * The percentile (between 0 and 100) of recorded latencies after which a refresh request is hedged (default: 95)
+ */
+@property (atomic) double hedgingPercentile;
+
+/**
+ * The delay after which a refresh request is hedged, 0 if fewer than 20 latencies have been recorded, in which case no
+ * request is hedged
+ */
+@property (nonatomic, readonly) NSTimeInterval hedgingDelay;
+
+/**
+ * Return the average latency of an endpoint, 0 if unknown
+ */
+- (NSTimeInterval)averageLatencyForEndpointURL:(NSURL *)endpointURL;
+
+@end
+
+@interface CPAEndpointSelector (UnavailableMethods)
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,181 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPAEndpointSelector.h"
+
+#import "CPALatencyHistogram.h"
+
+// Constants
+static const NSUInteger CPAMinimumHedgingLatencyCount = 20;
+
+@interface CPAEndpointSelector ()
+
+@property (nonatomic) NSArray<NSURL *> *endpointURLs;
+@property (nonatomic) NSArray<NSNumber *> *weights;
+
+// Average latencies, keyed by endpoint absolute URL string. Must be accessed within a @synchronized(self) block
+@property (nonatomic) NSMutableDictionary<NSString *, NSNumber *> *averageLatencies;
+
+// Latencies recorded for all endpoints
+@property (nonatomic) CPALatencyHistogram *latencyHistogram;
+
+@end
+
+@implementation CPAEndpointSelector
+
+#pragma mark Object lifecycle
+
+- (instancetype)initWithEndpointURLs:(NSArray<NSURL *> *)endpointURLs weights:(NSArray<NSNumber *> *)weights
+{
+    NSParameterAssert(endpointURLs.count != 0);
+    NSParameterAssert(! weights || weights.count == endpointURLs.count);
+    
+    if (self = [super init]) {
+        self.endpointURLs = [endpointURLs copy];
+        
+        if (weights) {
+            self.weights = [weights copy];
+        }
+        else {
+            NSMutableArray<NSNumber *> *defaultWeights = [NSMutableArray arrayWithCapacity:endpointURLs.count];
+            for (NSUInteger i = 0; i < endpointURLs.count; ++i) {
+                [defaultWeights addObject:@1];
+            }
+            self.weights = [defaultWeights copy];
+        }
+        
+        self.smoothingFactor = 0.2;
+        self.explorationRatio = 0.05;
+        self.hedgingPercentile = 95.;
+        
+        self.averageLatencies = [NSMutableDictionary dictionary];
+        self.latencyHistogram = [[CPALatencyHistogram alloc] init];
+    }
+    return self;
+}
+
+- (instancetype)initWithEndpointURLs:(NSArray<NSURL *> *)endpointURLs
+{
+    return [self initWithEndpointURLs:endpointURLs weights:nil];
+}
+
+- (instancetype)init
+{
+    [self doesNotRecognizeSelector:_cmd];
+    return nil;
+}
+
+#pragma mark Latencies
+
+- (NSTimeInterval)averageLatencyForEndpointURL:(NSURL *)endpointURL
+{
+    NSParameterAssert(endpointURL);
+    
+    @synchronized(self) {
+        return self.averageLatencies[endpointURL.absoluteString].doubleValue;
+    }
+}
+
+- (void)recordLatency:(NSTimeInterval)latency forEndpointURL:(NSURL *)endpointURL
+{
+    NSParameterAssert(endpointURL);
+    
+    if (latency < 0.) {
+        return;
+    }
+    
+    double smoothingFactor = self.smoothingFactor;
+    @synchronized(self) {
+        NSString *key = endpointURL.absoluteString;
+        NSNumber *averageLatency = self.averageLatencies[key];
+        self.averageLatencies[key] = averageLatency ? @(smoothingFactor * latency + (1. - smoothingFactor) * averageLatency.doubleValue) : @(latency);
+    }
+    
+    [self.latencyHistogram recordDuration:latency];
+}
+
+- (NSTimeInterval)hedgingDelay
+{
+    CPALatencyHistogram *latencyHistogram = [self.latencyHistogram copy];
+    if (latencyHistogram.count < CPAMinimumHedgingLatencyCount) {
+        return 0.;
+    }
+    return [latencyHistogram durationAtPercentile:self.hedgingPercentile];
+}
+
+#pragma mark Selection
+
+- (NSArray<NSURL *> *)rankedEndpointURLs
+{
+    NSArray<NSURL *> *endpointURLs = self.endpointURLs;
+    NSUInteger count = endpointURLs.count;
+    
+    // Endpoints whose latency is unknown have a zero score and are tried first
+    NSMutableArray<NSNumber *> *scores = [NSMutableArray arrayWithCapacity:count];
+    @synchronized(self) {
+        for (NSUInteger i = 0; i < count; ++i) {
+            NSTimeInterval averageLatency = self.averageLatencies[endpointURLs[i].absoluteString].doubleValue;
+            [scores addObject:@(averageLatency / fmax(self.weights[i].doubleValue, DBL_MIN))];
+        }
+    }
+    
+    NSMutableArray<NSNumber *> *indexes = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; ++i) {
+        [indexes addObject:@(i)];
+    }
+    
+    // Stable sort, so that endpoints with the same score are kept in their original order
+    NSMutableArray<NSNumber *> *rankedIndexes = [[indexes sortedArrayWithOptions:NSSortStable usingComparator:^NSComparisonResult(NSNumber *index1, NSNumber *index2) {
+        return [scores[index1.unsignedIntegerValue] compare:scores[index2.unsignedIntegerValue]];
+    }] mutableCopy];
+    
+    double explorationRatio = self.explorationRatio;
+    if (count > 1 && explorationRatio > 0. && arc4random_uniform(10000) < explorationRatio * 10000.) {
+        NSUInteger exploredIndex = 1 + arc4random_uniform((uint32_t)count - 1);
+        NSNumber *index = rankedIndexes[exploredIndex];
+        [rankedIndexes removeObjectAtIndex:exploredIndex];
+        [rankedIndexes insertObject:index atIndex:0];
+    }
+    
+    NSMutableArray<NSURL *> *rankedEndpointURLs = [NSMutableArray arrayWithCapacity:count];
+    for (NSNumber *index in rankedIndexes) {
+        [rankedEndpointURLs addObject:endpointURLs[index.unsignedIntegerValue]];
+    }
+    return [rankedEndpointURLs copy];
+}
+
+#pragma mark NSCopying protocol
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    // Latencies are not copied, a copy starts without any
+    CPAEndpointSelector *endpointSelector = [[[self class] allocWithZone:zone] initWithEndpointURLs:self.endpointURLs weights:self.weights];
+    endpointSelector.smoothingFactor = self.smoothingFactor;
+    endpointSelector.explorationRatio = self.explorationRatio;
+    endpointSelector.hedgingEnabled = self.hedgingEnabled;
+    endpointSelector.hedgingPercentile = self.hedgingPercentile;
+    return endpointSelector;
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    NSDictionary<NSString *, NSNumber *> *averageLatencies = nil;
+    @synchronized(self) {
+        averageLatencies = [self.averageLatencies copy];
+    }
+    
+    return [NSString stringWithFormat:@"<%@: %p; endpointURLs: %@; weights: %@; averageLatencies: %@; hedgingEnabled: %@>",
+            [self class],
+            self,
+            self.endpointURLs,
+            self.weights,
+            averageLatencies,
+            self.hedgingEnabled ? @"YES" : @"NO"];
+}
+
+@end
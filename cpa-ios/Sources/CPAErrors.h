@@ -20,7 +20,8 @@ typedef NS_ENUM(NSInteger, CPAErrorCode) {
     CPAErrorPendingAuthorization,                   // Authorization has not yet been made
     CPAErrorAuthorizationCancelled,                 // The authorization request has been cancelled
     CPAErrorAuthorizationDenied,                    // The user denied access to the application
-    CPAErrorAuthorizationRequestExpired             // The authorization request expired
+    CPAErrorAuthorizationRequestExpired,            // The authorization request expired
+    CPAErrorAuthorizationProviderUnavailable        // Requests are suspended after repeated failures of the authorization provider
 };
 
 /**
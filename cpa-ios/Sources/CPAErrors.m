@@ -44,7 +44,8 @@ NSString *CPALocalizedErrorDescriptionForCode(CPAErrorCode errorCode)
                                           @(CPAErrorPendingAuthorization) : CPALocalizedString(@"Authorization is still pending", nil),
                                           @(CPAErrorAuthorizationCancelled) : CPALocalizedString(@"The authorization request has been cancelled", nil),
                                           @(CPAErrorAuthorizationDenied) : CPALocalizedString(@"Authorization was denied", nil),
-                                          @(CPAErrorAuthorizationRequestExpired) : CPALocalizedString(@"The authorization request has expired", nil) };
+                                          @(CPAErrorAuthorizationRequestExpired) : CPALocalizedString(@"The authorization request has expired", nil),
+                                          @(CPAErrorAuthorizationProviderUnavailable) : CPALocalizedString(@"The authorization provider is temporarily unavailable", nil) };
     });
     return s_localizedErrorDescriptions[@(errorCode)];
 }
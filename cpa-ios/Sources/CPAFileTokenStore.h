@@ -0,0 +1,52 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+#import "CPATokenStore.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Token store saving data to an encrypted file, e.g. for environments where the keychain is not available or too slow
+ *
+ * The file is memory-mapped and decrypted once, when the store is created. Its contents are then kept in memory, so
+ * that reads never block nor access the disk. Changes are immediately visible, and written back to the file on a
+ * background queue, several changes resulting in a single write. Use the asynchronous variants of the store methods
+ * to be notified when changes have been written
+ *
+ * The file is encrypted with AES-256 in CBC mode and authenticated with HMAC-SHA256, using keys derived from the
+ * encryption key supplied at creation. This key must be kept secret, e.g. in the keychain. A file which cannot be
+ * authenticated (wrong key, corrupted or tampered file) is ignored, the store starting empty
+ */
+@interface CPAFileTokenStore : NSObject <CPATokenStore>
+
+/**
+ * Return a new random key suitable for encrypting a store, nil if no secure random key could be generated
+ */
++ (nullable NSData *)randomEncryptionKey;
+
+/**
+ * Create a store saving data to the specified file URL, encrypted with the given 32-byte key. Intermediate directories
+ * are created if needed
+ */
+- (instancetype)initWithFileURL:(NSURL *)fileURL encryptionKey:(NSData *)encryptionKey NS_DESIGNATED_INITIALIZER;
+
+/**
+ * The URL of the file
+ */
+@property (nonatomic, readonly) NSURL *fileURL;
+
+@end
+
+@interface CPAFileTokenStore (UnavailableMethods)
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,366 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPAFileTokenStore.h"
+
+#import "CPABinaryCoding.h"
+
+#import <CommonCrypto/CommonCrypto.h>
+#import <Security/Security.h>
+
+// Constants
+static const NSUInteger CPAFileTokenStoreKeyLength = kCCKeySizeAES256;
+static const NSUInteger CPAFileTokenStoreIVLength = kCCBlockSizeAES128;
+static const NSUInteger CPAFileTokenStoreMACLength = CC_SHA256_DIGEST_LENGTH;
+
+// Static functions
+static NSData *CPADerivedKey(NSData *key, NSString *purpose);
+static NSData *CPAEncryptedData(NSData *data, NSData *encryptionKey, NSData *authenticationKey);
+static NSData *CPADecryptedData(NSData *data, NSData *encryptionKey, NSData *authenticationKey);
+
+@interface CPAFileTokenStore ()
+
+@property (nonatomic) NSURL *fileURL;
+@property (nonatomic) NSData *encryptionKey;
+@property (nonatomic) NSData *authenticationKey;
+
+// Immutable snapshot of the store contents. Must be replaced within a @synchronized(self) block
+@property (atomic, copy) NSDictionary<NSString *, NSData *> *entries;
+
+// Serial queue on which the file is written
+@property (nonatomic) dispatch_queue_t queue;
+
+// Must be accessed within a @synchronized(self) block
+@property (nonatomic, getter=isWriteScheduled) BOOL writeScheduled;
+
+@end
+
+@implementation CPAFileTokenStore
+
+#pragma mark Class methods
+
++ (NSData *)randomEncryptionKey
+{
+    NSMutableData *key = [NSMutableData dataWithLength:CPAFileTokenStoreKeyLength];
+    if (SecRandomCopyBytes(kSecRandomDefault, key.length, key.mutableBytes) != errSecSuccess) {
+        return nil;
+    }
+    return [key copy];
+}
+
+#pragma mark Object lifecycle
+
+- (instancetype)initWithFileURL:(NSURL *)fileURL encryptionKey:(NSData *)encryptionKey
+{
+    NSParameterAssert(fileURL.isFileURL);
+    NSParameterAssert(encryptionKey.length == CPAFileTokenStoreKeyLength);
+    
+    if (self = [super init]) {
+        self.fileURL = fileURL;
+        self.encryptionKey = CPADerivedKey(encryptionKey, @"encryption");
+        self.authenticationKey = CPADerivedKey(encryptionKey, @"authentication");
+        self.queue = dispatch_queue_create("ch.ebu.cpa.file-token-store", DISPATCH_QUEUE_SERIAL);
+        self.entries = [self readEntries] ?: @{};
+    }
+    return self;
+}
+
+- (instancetype)init
+{
+    [self doesNotRecognizeSelector:_cmd];
+    return nil;
+}
+
+#pragma mark File management
+
+- (NSDictionary<NSString *, NSData *> *)readEntries
+{
+    NSData *fileData = [NSData dataWithContentsOfURL:self.fileURL options:NSDataReadingMappedIfSafe error:NULL];
+    if (! fileData) {
+        return nil;
+    }
+    
+    NSData *data = CPADecryptedData(fileData, self.encryptionKey, self.authenticationKey);
+    if (! data) {
+        return nil;
+    }
+    
+    CPABinaryReader *reader = [[CPABinaryReader alloc] initWithData:data recordType:CPABinaryRecordTypeEntries];
+    NSUInteger count = [reader readUnsignedInteger];
+    
+    NSMutableDictionary<NSString *, NSData *> *entries = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < count && reader.valid; ++i) {
+        NSString *key = [reader readString];
+        NSData *entryData = [reader readData];
+        if (key && entryData) {
+            entries[key] = entryData;
+        }
+    }
+    return reader.valid ? [entries copy] : nil;
+}
+
+- (void)writeEntries:(NSDictionary<NSString *, NSData *> *)entries
+{
+    NSParameterAssert(entries);
+    
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    if (entries.count == 0) {
+        [fileManager removeItemAtURL:self.fileURL error:NULL];
+        return;
+    }
+    
+    CPABinaryWriter *writer = [[CPABinaryWriter alloc] initWithRecordType:CPABinaryRecordTypeEntries];
+    [writer writeUnsignedInteger:entries.count];
+    [entries enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSData *entryData, BOOL *stop) {
+        [writer writeString:key];
+        [writer writeData:entryData];
+    }];
+    
+    NSData *fileData = CPAEncryptedData(writer.data, self.encryptionKey, self.authenticationKey);
+    if (! fileData) {
+        return;
+    }
+    
+    [fileManager createDirectoryAtURL:[self.fileURL URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:NULL];
+    
+    NSError *error = nil;
+    if (! [fileData writeToURL:self.fileURL options:NSDataWritingAtomic | NSDataWritingFileProtectionCompleteUntilFirstUserAuthentication error:&error]) {
+        NSLog(@"Could not write the token store file. Reason: %@", error);
+    }
+}
+
+/**
+ * Write the latest contents to the file, coalescing with changes made until the write actually happens. Must be called
+ * within a @synchronized(self) block
+ */
+- (void)scheduleWrite
+{
+    if (self.writeScheduled) {
+        return;
+    }
+    
+    self.writeScheduled = YES;
+    dispatch_async(self.queue, ^{
+        NSDictionary<NSString *, NSData *> *entries = nil;
+        @synchronized(self) {
+            self.writeScheduled = NO;
+            entries = self.entries;
+        }
+        [self writeEntries:entries];
+    });
+}
+
+/**
+ * Call the completion block on the main thread once pending writes are over
+ */
+- (void)notifyAfterPendingWrites:(CPATokenStoreCompletionBlock)completionBlock
+{
+    if (! completionBlock) {
+        return;
+    }
+    
+    dispatch_async(self.queue, ^{
+        dispatch_async(dispatch_get_main_queue(), completionBlock);
+    });
+}
+
+#pragma mark CPATokenStore protocol
+
+- (NSData *)dataForKey:(NSString *)key
+{
+    NSParameterAssert(key);
+    
+    return self.entries[key];
+}
+
+- (void)setData:(NSData *)data forKey:(NSString *)key
+{
+    NSParameterAssert(data);
+    NSParameterAssert(key);
+    
+    data = [data copy];
+    @synchronized(self) {
+        NSMutableDictionary<NSString *, NSData *> *entries = [self.entries mutableCopy];
+        entries[key] = data;
+        self.entries = [entries copy];
+        [self scheduleWrite];
+    }
+}
+
+- (void)removeDataForKey:(NSString *)key
+{
+    NSParameterAssert(key);
+    
+    @synchronized(self) {
+        if (! self.entries[key]) {
+            return;
+        }
+        
+        NSMutableDictionary<NSString *, NSData *> *entries = [self.entries mutableCopy];
+        [entries removeObjectForKey:key];
+        self.entries = [entries copy];
+        [self scheduleWrite];
+    }
+}
+
+- (NSArray<NSString *> *)allKeys
+{
+    return self.entries.allKeys;
+}
+
+- (NSDictionary<NSString *, NSData *> *)allData
+{
+    return self.entries;
+}
+
+- (void)removeAllData
+{
+    @synchronized(self) {
+        self.entries = @{};
+        [self scheduleWrite];
+    }
+}
+
+- (void)dataForKey:(NSString *)key completionBlock:(CPATokenStoreDataCompletionBlock)completionBlock
+{
+    NSParameterAssert(completionBlock);
+    
+    NSData *data = [self dataForKey:key];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        completionBlock(data);
+    });
+}
+
+- (void)setData:(NSData *)data forKey:(NSString *)key completionBlock:(CPATokenStoreCompletionBlock)completionBlock
+{
+    [self setData:data forKey:key];
+    [self notifyAfterPendingWrites:completionBlock];
+}
+
+- (void)removeDataForKey:(NSString *)key completionBlock:(CPATokenStoreCompletionBlock)completionBlock
+{
+    [self removeDataForKey:key];
+    [self notifyAfterPendingWrites:completionBlock];
+}
+
+- (void)allKeysWithCompletionBlock:(CPATokenStoreKeysCompletionBlock)completionBlock
+{
+    NSParameterAssert(completionBlock);
+    
+    NSArray<NSString *> *keys = [self allKeys];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        completionBlock(keys);
+    });
+}
+
+- (void)allDataWithCompletionBlock:(CPATokenStoreAllDataCompletionBlock)completionBlock
+{
+    NSParameterAssert(completionBlock);
+    
+    NSDictionary<NSString *, NSData *> *allData = [self allData];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        completionBlock(allData);
+    });
+}
+
+- (void)removeAllDataWithCompletionBlock:(CPATokenStoreCompletionBlock)completionBlock
+{
+    [self removeAllData];
+    [self notifyAfterPendingWrites:completionBlock];
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; fileURL: %@; count: %@>",
+            [self class],
+            self,
+            self.fileURL,
+            @(self.entries.count)];
+}
+
+@end
+
+#pragma mark Static functions
+
+/**
+ * Derive a key for the specified purpose from a master key
+ */
+static NSData *CPADerivedKey(NSData *key, NSString *purpose)
+{
+    NSData *purposeData = [purpose dataUsingEncoding:NSUTF8StringEncoding];
+    
+    NSMutableData *derivedKey = [NSMutableData dataWithLength:CC_SHA256_DIGEST_LENGTH];
+    CCHmac(kCCHmacAlgSHA256, key.bytes, key.length, purposeData.bytes, purposeData.length, derivedKey.mutableBytes);
+    return [derivedKey copy];
+}
+
+/**
+ * Encrypt data, returning the random IV, the ciphertext and the MAC of both, in this order. Return nil on failure
+ */
+static NSData *CPAEncryptedData(NSData *data, NSData *encryptionKey, NSData *authenticationKey)
+{
+    NSMutableData *encryptedData = [NSMutableData dataWithLength:CPAFileTokenStoreIVLength + data.length + kCCBlockSizeAES128 + CPAFileTokenStoreMACLength];
+    uint8_t *bytes = encryptedData.mutableBytes;
+    
+    if (SecRandomCopyBytes(kSecRandomDefault, CPAFileTokenStoreIVLength, bytes) != errSecSuccess) {
+        return nil;
+    }
+    
+    size_t ciphertextLength = 0;
+    CCCryptorStatus status = CCCrypt(kCCEncrypt, kCCAlgorithmAES, kCCOptionPKCS7Padding,
+                                     encryptionKey.bytes, encryptionKey.length, bytes,
+                                     data.bytes, data.length,
+                                     bytes + CPAFileTokenStoreIVLength, data.length + kCCBlockSizeAES128, &ciphertextLength);
+    if (status != kCCSuccess) {
+        return nil;
+    }
+    
+    size_t authenticatedLength = CPAFileTokenStoreIVLength + ciphertextLength;
+    CCHmac(kCCHmacAlgSHA256, authenticationKey.bytes, authenticationKey.length, bytes, authenticatedLength, bytes + authenticatedLength);
+    encryptedData.length = authenticatedLength + CPAFileTokenStoreMACLength;
+    return [encryptedData copy];
+}
+
+/**
+ * Authenticate and decrypt data produced by CPAEncryptedData. Return nil on failure
+ */
+static NSData *CPADecryptedData(NSData *data, NSData *encryptionKey, NSData *authenticationKey)
+{
+    if (data.length < CPAFileTokenStoreIVLength + kCCBlockSizeAES128 + CPAFileTokenStoreMACLength) {
+        return nil;
+    }
+    
+    const uint8_t *bytes = data.bytes;
+    size_t authenticatedLength = data.length - CPAFileTokenStoreMACLength;
+    
+    uint8_t mac[CPAFileTokenStoreMACLength];
+    CCHmac(kCCHmacAlgSHA256, authenticationKey.bytes, authenticationKey.length, bytes, authenticatedLength, mac);
+    
+    // Constant-time comparison
+    uint8_t difference = 0;
+    for (NSUInteger i = 0; i < CPAFileTokenStoreMACLength; ++i) {
+        difference |= mac[i] ^ bytes[authenticatedLength + i];
+    }
+    if (difference != 0) {
+        return nil;
+    }
+    
+    size_t ciphertextLength = authenticatedLength - CPAFileTokenStoreIVLength;
+    NSMutableData *decryptedData = [NSMutableData dataWithLength:ciphertextLength];
+    size_t decryptedLength = 0;
+    CCCryptorStatus status = CCCrypt(kCCDecrypt, kCCAlgorithmAES, kCCOptionPKCS7Padding,
+                                     encryptionKey.bytes, encryptionKey.length, bytes,
+                                     bytes + CPAFileTokenStoreIVLength, ciphertextLength,
+                                     decryptedData.mutableBytes, ciphertextLength, &decryptedLength);
+    if (status != kCCSuccess) {
+        return nil;
+    }
+    
+    decryptedData.length = decryptedLength;
+    return [decryptedData copy];
+}
@@ -20,6 +20,17 @@ NS_ASSUME_NONNULL_BEGIN
 - (instancetype)initWithIdentifier:(NSString *)identifier
                             secret:(NSString *)secret;
 
+/**
+ * Create an identity from data saved to the keychain, either its binary representation or a keyed archive made by earlier
+ * versions of the library. Return nil if the data is invalid
+ */
++ (nullable CPAIdentity *)identityWithStoredData:(NSData *)data;
+
+/**
+ * Compact binary representation, used when saving the identity to the keychain
+ */
+- (NSData *)binaryRepresentation;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -6,6 +6,8 @@
 
 #import "CPAIdentity.h"
 
+#import "CPABinaryCoding.h"
+
 @interface CPAIdentity ()
 
 @property (nonatomic, copy) NSString *identifier;
@@ -30,6 +32,38 @@
     return self;
 }
 
+#pragma mark Binary representation
+
++ (CPAIdentity *)identityWithStoredData:(NSData *)data
+{
+    NSParameterAssert(data);
+    
+    if (! [CPABinaryReader isBinaryRecordData:data]) {
+        id object = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+        return [object isKindOfClass:[CPAIdentity class]] ? object : nil;
+    }
+    
+    CPABinaryReader *reader = [[CPABinaryReader alloc] initWithData:data recordType:CPABinaryRecordTypeIdentity];
+    if (! reader) {
+        return nil;
+    }
+    
+    NSString *identifier = [reader readString];
+    NSString *secret = [reader readString];
+    if (! reader.valid || ! identifier || ! secret) {
+        return nil;
+    }
+    return [[CPAIdentity alloc] initWithIdentifier:identifier secret:secret];
+}
+
+- (NSData *)binaryRepresentation
+{
+    CPABinaryWriter *writer = [[CPABinaryWriter alloc] initWithRecordType:CPABinaryRecordTypeIdentity];
+    [writer writeString:self.identifier];
+    [writer writeString:self.secret];
+    return writer.data;
+}
+
 #pragma NSCoding protocol
 
 - (instancetype)initWithCoder:(NSCoder *)aDecoder
@@ -0,0 +1,38 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+#import "CPATokenStore.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Token store saving data as generic password items in the keychain. This is the store used by default
+ */
+@interface CPAKeyChainTokenStore : NSObject <CPATokenStore>
+
+/**
+ * Create a store saving items for the specified service, and sharing them within a given key chain group (if set to
+ * nil, no group sharing is made)
+ */
+- (instancetype)initWithService:(NSString *)service accessGroup:(nullable NSString *)accessGroup NS_DESIGNATED_INITIALIZER;
+
+/**
+ * Create a store saving items for the main bundle identifier, without keychain group sharing
+ */
+- (instancetype)init;
+
+/**
+ * The service and access group of the items
+ */
+@property (nonatomic, readonly, copy) NSString *service;
+@property (nonatomic, readonly, copy, nullable) NSString *accessGroup;
+
+@end
+
+NS_ASSUME_NONNULL_END
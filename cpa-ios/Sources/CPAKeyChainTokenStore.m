@@ -0,0 +1,171 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPAKeyChainTokenStore.h"
+
+#import "CPAUICKeyChainStore.h"
+
+@interface CPAKeyChainTokenStore ()
+
+@property (nonatomic, copy) NSString *service;
+@property (nonatomic, copy) NSString *accessGroup;
+@property (nonatomic) CPAUICKeyChainStore *keyChainStore;
+
+// Queue on which asynchronous operations are performed, in order
+@property (nonatomic) dispatch_queue_t queue;
+
+@end
+
+@implementation CPAKeyChainTokenStore
+
+#pragma mark Object lifecycle
+
+- (instancetype)initWithService:(NSString *)service accessGroup:(NSString *)accessGroup
+{
+    NSParameterAssert(service);
+    
+    if (self = [super init]) {
+        self.service = service;
+        self.accessGroup = accessGroup;
+        self.keyChainStore = [CPAUICKeyChainStore keyChainStoreWithService:service accessGroup:accessGroup];
+        self.queue = dispatch_queue_create("ch.ebu.cpa.keychain-token-store", DISPATCH_QUEUE_SERIAL);
+    }
+    return self;
+}
+
+- (instancetype)init
+{
+    return [self initWithService:[NSBundle mainBundle].bundleIdentifier accessGroup:nil];
+}
+
+#pragma mark CPATokenStore protocol
+
+- (NSData *)dataForKey:(NSString *)key
+{
+    NSParameterAssert(key);
+    
+    return [self.keyChainStore dataForKey:key];
+}
+
+- (void)setData:(NSData *)data forKey:(NSString *)key
+{
+    NSParameterAssert(data);
+    NSParameterAssert(key);
+    
+    [self.keyChainStore setData:data forKey:key];
+}
+
+- (void)removeDataForKey:(NSString *)key
+{
+    NSParameterAssert(key);
+    
+    [self.keyChainStore removeItemForKey:key];
+}
+
+- (NSArray<NSString *> *)allKeys
+{
+    return [self.keyChainStore allKeys];
+}
+
+- (NSDictionary<NSString *, NSData *> *)allData
+{
+    // A single keychain query returns all items with their data. Values which are valid UTF-8 strings are returned as
+    // strings, and must be converted back
+    NSMutableDictionary<NSString *, NSData *> *allData = [NSMutableDictionary dictionary];
+    for (NSDictionary *item in [self.keyChainStore allItems]) {
+        NSString *key = item[@"key"];
+        id value = item[@"value"];
+        NSData *data = [value isKindOfClass:[NSString class]] ? [value dataUsingEncoding:NSUTF8StringEncoding] : value;
+        if (key && [data isKindOfClass:[NSData class]]) {
+            allData[key] = data;
+        }
+    }
+    return [allData copy];
+}
+
+- (void)removeAllData
+{
+    [self.keyChainStore removeAllItems];
+}
+
+- (void)dataForKey:(NSString *)key completionBlock:(CPATokenStoreDataCompletionBlock)completionBlock
+{
+    NSParameterAssert(completionBlock);
+    
+    dispatch_async(self.queue, ^{
+        NSData *data = [self dataForKey:key];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            completionBlock(data);
+        });
+    });
+}
+
+- (void)setData:(NSData *)data forKey:(NSString *)key completionBlock:(CPATokenStoreCompletionBlock)completionBlock
+{
+    dispatch_async(self.queue, ^{
+        [self setData:data forKey:key];
+        if (completionBlock) {
+            dispatch_async(dispatch_get_main_queue(), completionBlock);
+        }
+    });
+}
+
+- (void)removeDataForKey:(NSString *)key completionBlock:(CPATokenStoreCompletionBlock)completionBlock
+{
+    dispatch_async(self.queue, ^{
+        [self removeDataForKey:key];
+        if (completionBlock) {
+            dispatch_async(dispatch_get_main_queue(), completionBlock);
+        }
+    });
+}
+
+- (void)allKeysWithCompletionBlock:(CPATokenStoreKeysCompletionBlock)completionBlock
+{
+    NSParameterAssert(completionBlock);
+    
+    dispatch_async(self.queue, ^{
+        NSArray<NSString *> *keys = [self allKeys];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            completionBlock(keys);
+        });
+    });
+}
+
+- (void)allDataWithCompletionBlock:(CPATokenStoreAllDataCompletionBlock)completionBlock
+{
+    NSParameterAssert(completionBlock);
+    
+    dispatch_async(self.queue, ^{
+        NSDictionary<NSString *, NSData *> *allData = [self allData];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            completionBlock(allData);
+        });
+    });
+}
+
+- (void)removeAllDataWithCompletionBlock:(CPATokenStoreCompletionBlock)completionBlock
+{
+    dispatch_async(self.queue, ^{
+        [self removeAllData];
+        if (completionBlock) {
+            dispatch_async(dispatch_get_main_queue(), completionBlock);
+        }
+    });
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; service: %@; accessGroup: %@>",
+            [self class],
+            self,
+            self.service,
+            self.accessGroup];
+}
+
+@end
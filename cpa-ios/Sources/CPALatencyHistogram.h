@@ -0,0 +1,64 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Histogram of durations, with log-linear buckets in the spirit of HdrHistogram. Durations between 1 microsecond and
+ * 1 hour are recorded with a relative precision better than 1/64 (longer durations are recorded as 1 hour), in constant
+ * time and without any allocation
+ *
+ * Histograms are thread-safe. Use -copy to take a consistent snapshot of a histogram being recorded to
+ */
+@interface CPALatencyHistogram : NSObject <NSCopying>
+
+/**
+ * Record a duration, in seconds. Negative durations are ignored
+ */
+- (void)recordDuration:(NSTimeInterval)duration;
+
+/**
+ * Add all durations recorded by another histogram
+ */
+- (void)addDurationsFromHistogram:(CPALatencyHistogram *)histogram;
+
+/**
+ * Discard all recorded durations
+ */
+- (void)reset;
+
+/**
+ * The number of recorded durations
+ */
+@property (nonatomic, readonly) NSUInteger count;
+
+/**
+ * The minimum, maximum and mean recorded durations, 0 if no duration has been recorded
+ */
+@property (nonatomic, readonly) NSTimeInterval minimumDuration;
+@property (nonatomic, readonly) NSTimeInterval maximumDuration;
+@property (nonatomic, readonly) NSTimeInterval meanDuration;
+
+/**
+ * Return the duration below which the specified percentage (between 0 and 100) of recorded durations lie, 0 if no
+ * duration has been recorded
+ */
+- (NSTimeInterval)durationAtPercentile:(double)percentile;
+
+/**
+ * Return a representation of the histogram which can be serialized with NSJSONSerialization. It contains the count,
+ * the minimum, maximum and mean durations, usual percentiles (50, 90, 99 and 99.9) and non-empty buckets, each one
+ * given by its upper bound and its count. Durations are given in seconds
+ */
+- (NSDictionary<NSString *, id> *)dictionaryRepresentation;
+
+@end
+
+NS_ASSUME_NONNULL_END
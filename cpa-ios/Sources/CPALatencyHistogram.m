@@ -0,0 +1,238 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPALatencyHistogram.h"
+
+// Constants
+static const uint64_t CPALatencyHistogramSubBucketCount = 128;
+static const uint64_t CPALatencyHistogramSubBucketHalfCount = 64;
+static const uint64_t CPALatencyHistogramSubBucketHalfCountMagnitude = 6;
+static const uint64_t CPALatencyHistogramHighestTrackableValue = 3600ull * 1000000ull;         // 1 hour, in microseconds
+
+// Static functions
+static NSUInteger CPALatencyHistogramIndexForValue(uint64_t value);
+static uint64_t CPALatencyHistogramHighestEquivalentValueForIndex(NSUInteger index);
+
+@interface CPALatencyHistogram () {
+@private
+    // Values are recorded in microseconds. Must be accessed within a @synchronized(self) block
+    uint32_t *_counts;
+    NSUInteger _bucketCount;
+    NSUInteger _count;
+    uint64_t _minimumValue;
+    uint64_t _maximumValue;
+    double _totalValue;
+}
+
+@end
+
+@implementation CPALatencyHistogram
+
+#pragma mark Object lifecycle
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        _bucketCount = CPALatencyHistogramIndexForValue(CPALatencyHistogramHighestTrackableValue) + 1;
+        _counts = calloc(_bucketCount, sizeof(uint32_t));
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(_counts);
+}
+
+#pragma mark Recording
+
+- (void)recordDuration:(NSTimeInterval)duration
+{
+    if (duration < 0.) {
+        return;
+    }
+    
+    uint64_t value = (uint64_t)fmin(round(duration * 1000000.), CPALatencyHistogramHighestTrackableValue);
+    NSUInteger index = CPALatencyHistogramIndexForValue(value);
+    
+    @synchronized(self) {
+        _counts[index] += 1;
+        _minimumValue = (_count == 0) ? value : MIN(_minimumValue, value);
+        _maximumValue = MAX(_maximumValue, value);
+        _totalValue += value;
+        _count += 1;
+    }
+}
+
+- (void)addDurationsFromHistogram:(CPALatencyHistogram *)histogram
+{
+    NSParameterAssert(histogram);
+    
+    // Work on a snapshot, so that two histograms are never locked at the same time
+    CPALatencyHistogram *snapshot = [histogram copy];
+    if (snapshot->_count == 0) {
+        return;
+    }
+    
+    @synchronized(self) {
+        for (NSUInteger i = 0; i < _bucketCount; ++i) {
+            _counts[i] += snapshot->_counts[i];
+        }
+        _minimumValue = (_count == 0) ? snapshot->_minimumValue : MIN(_minimumValue, snapshot->_minimumValue);
+        _maximumValue = MAX(_maximumValue, snapshot->_maximumValue);
+        _totalValue += snapshot->_totalValue;
+        _count += snapshot->_count;
+    }
+}
+
+- (void)reset
+{
+    @synchronized(self) {
+        memset(_counts, 0, _bucketCount * sizeof(uint32_t));
+        _count = 0;
+        _minimumValue = 0;
+        _maximumValue = 0;
+        _totalValue = 0.;
+    }
+}
+
+#pragma mark Statistics
+
+- (NSUInteger)count
+{
+    @synchronized(self) {
+        return _count;
+    }
+}
+
+- (NSTimeInterval)minimumDuration
+{
+    @synchronized(self) {
+        return _minimumValue / 1000000.;
+    }
+}
+
+- (NSTimeInterval)maximumDuration
+{
+    @synchronized(self) {
+        return _maximumValue / 1000000.;
+    }
+}
+
+- (NSTimeInterval)meanDuration
+{
+    @synchronized(self) {
+        return (_count != 0) ? _totalValue / _count / 1000000. : 0.;
+    }
+}
+
+- (NSTimeInterval)durationAtPercentile:(double)percentile
+{
+    @synchronized(self) {
+        if (_count == 0) {
+            return 0.;
+        }
+        
+        // Same convention as HdrHistogram: Return the highest value equivalent to the one found, but never more than the maximum
+        double clampedPercentile = fmin(fmax(percentile, 0.), 100.);
+        NSUInteger targetCount = MAX((NSUInteger)ceil(clampedPercentile / 100. * _count), 1);
+        
+        NSUInteger cumulatedCount = 0;
+        for (NSUInteger i = 0; i < _bucketCount; ++i) {
+            cumulatedCount += _counts[i];
+            if (cumulatedCount >= targetCount) {
+                return MIN(CPALatencyHistogramHighestEquivalentValueForIndex(i), _maximumValue) / 1000000.;
+            }
+        }
+        return _maximumValue / 1000000.;
+    }
+}
+
+#pragma mark Export
+
+- (NSDictionary<NSString *, id> *)dictionaryRepresentation
+{
+    CPALatencyHistogram *snapshot = [self copy];
+    
+    NSMutableArray<NSDictionary<NSString *, NSNumber *> *> *buckets = [NSMutableArray array];
+    for (NSUInteger i = 0; i < snapshot->_bucketCount; ++i) {
+        if (snapshot->_counts[i] == 0) {
+            continue;
+        }
+        
+        [buckets addObject:@{ @"value" : @(CPALatencyHistogramHighestEquivalentValueForIndex(i) / 1000000.),
+                              @"count" : @(snapshot->_counts[i]) }];
+    }
+    
+    return @{ @"count" : @(snapshot.count),
+              @"minimum" : @(snapshot.minimumDuration),
+              @"maximum" : @(snapshot.maximumDuration),
+              @"mean" : @(snapshot.meanDuration),
+              @"percentiles" : @{ @"50" : @([snapshot durationAtPercentile:50.]),
+                                  @"90" : @([snapshot durationAtPercentile:90.]),
+                                  @"99" : @([snapshot durationAtPercentile:99.]),
+                                  @"99.9" : @([snapshot durationAtPercentile:99.9]) },
+              @"buckets" : [buckets copy] };
+}
+
+#pragma mark NSCopying protocol
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    CPALatencyHistogram *histogram = [[[self class] allocWithZone:zone] init];
+    @synchronized(self) {
+        memcpy(histogram->_counts, _counts, _bucketCount * sizeof(uint32_t));
+        histogram->_count = _count;
+        histogram->_minimumValue = _minimumValue;
+        histogram->_maximumValue = _maximumValue;
+        histogram->_totalValue = _totalValue;
+    }
+    return histogram;
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; count: %@; minimum: %@; p50: %@; p99: %@; maximum: %@>",
+            [self class],
+            self,
+            @(self.count),
+            @(self.minimumDuration),
+            @([self durationAtPercentile:50.]),
+            @([self durationAtPercentile:99.]),
+            @(self.maximumDuration)];
+}
+
+@end
+
+#pragma mark Static functions
+
+/**
+ * Values below the sub-bucket count are recorded exactly. Above, each power of two range is split into half as many
+ * sub-buckets, whose width doubles from one range to the next
+ */
+static NSUInteger CPALatencyHistogramIndexForValue(uint64_t value)
+{
+    if (value < CPALatencyHistogramSubBucketCount) {
+        return (NSUInteger)value;
+    }
+    
+    uint64_t shift = (63 - __builtin_clzll(value)) - CPALatencyHistogramSubBucketHalfCountMagnitude;
+    return (NSUInteger)(CPALatencyHistogramSubBucketCount + (shift - 1) * CPALatencyHistogramSubBucketHalfCount + ((value >> shift) - CPALatencyHistogramSubBucketHalfCount));
+}
+
+static uint64_t CPALatencyHistogramHighestEquivalentValueForIndex(NSUInteger index)
+{
+    if (index < CPALatencyHistogramSubBucketCount) {
+        return index;
+    }
+    
+    uint64_t offset = index - CPALatencyHistogramSubBucketCount;
+    uint64_t shift = offset / CPALatencyHistogramSubBucketHalfCount + 1;
+    uint64_t subBucketIndex = offset % CPALatencyHistogramSubBucketHalfCount + CPALatencyHistogramSubBucketHalfCount;
+    return (subBucketIndex << shift) + (1ull << shift) - 1;
+}
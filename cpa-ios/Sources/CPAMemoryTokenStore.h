@@ -0,0 +1,25 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+#import "CPATokenStore.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Token store keeping data in memory only, e.g. for tests or for applications which must not persist tokens. Data is
+ * lost when the store is deallocated
+ *
+ * Reads never wait for writes: They are made on an immutable snapshot of the store contents, replaced as a whole when
+ * data is written
+ */
+@interface CPAMemoryTokenStore : NSObject <CPATokenStore>
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,147 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPAMemoryTokenStore.h"
+
+@interface CPAMemoryTokenStore ()
+
+// Immutable snapshot of the store contents. Must be replaced within a @synchronized(self) block. Reading it only
+// briefly takes the runtime property lock
+@property (atomic, copy) NSDictionary<NSString *, NSData *> *entries;
+
+@end
+
+@implementation CPAMemoryTokenStore
+
+#pragma mark Object lifecycle
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        self.entries = @{};
+    }
+    return self;
+}
+
+#pragma mark CPATokenStore protocol
+
+- (NSData *)dataForKey:(NSString *)key
+{
+    NSParameterAssert(key);
+    
+    return self.entries[key];
+}
+
+- (void)setData:(NSData *)data forKey:(NSString *)key
+{
+    NSParameterAssert(data);
+    NSParameterAssert(key);
+    
+    data = [data copy];
+    @synchronized(self) {
+        NSMutableDictionary<NSString *, NSData *> *entries = [self.entries mutableCopy];
+        entries[key] = data;
+        self.entries = [entries copy];
+    }
+}
+
+- (void)removeDataForKey:(NSString *)key
+{
+    NSParameterAssert(key);
+    
+    @synchronized(self) {
+        if (! self.entries[key]) {
+            return;
+        }
+        
+        NSMutableDictionary<NSString *, NSData *> *entries = [self.entries mutableCopy];
+        [entries removeObjectForKey:key];
+        self.entries = [entries copy];
+    }
+}
+
+- (NSArray<NSString *> *)allKeys
+{
+    return self.entries.allKeys;
+}
+
+- (NSDictionary<NSString *, NSData *> *)allData
+{
+    return self.entries;
+}
+
+- (void)removeAllData
+{
+    @synchronized(self) {
+        self.entries = @{};
+    }
+}
+
+- (void)dataForKey:(NSString *)key completionBlock:(CPATokenStoreDataCompletionBlock)completionBlock
+{
+    NSParameterAssert(completionBlock);
+    
+    NSData *data = [self dataForKey:key];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        completionBlock(data);
+    });
+}
+
+- (void)setData:(NSData *)data forKey:(NSString *)key completionBlock:(CPATokenStoreCompletionBlock)completionBlock
+{
+    [self setData:data forKey:key];
+    if (completionBlock) {
+        dispatch_async(dispatch_get_main_queue(), completionBlock);
+    }
+}
+
+- (void)removeDataForKey:(NSString *)key completionBlock:(CPATokenStoreCompletionBlock)completionBlock
+{
+    [self removeDataForKey:key];
+    if (completionBlock) {
+        dispatch_async(dispatch_get_main_queue(), completionBlock);
+    }
+}
+
+- (void)allKeysWithCompletionBlock:(CPATokenStoreKeysCompletionBlock)completionBlock
+{
+    NSParameterAssert(completionBlock);
+    
+    NSArray<NSString *> *keys = [self allKeys];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        completionBlock(keys);
+    });
+}
+
+- (void)allDataWithCompletionBlock:(CPATokenStoreAllDataCompletionBlock)completionBlock
+{
+    NSParameterAssert(completionBlock);
+    
+    NSDictionary<NSString *, NSData *> *allData = [self allData];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        completionBlock(allData);
+    });
+}
+
+- (void)removeAllDataWithCompletionBlock:(CPATokenStoreCompletionBlock)completionBlock
+{
+    [self removeAllData];
+    if (completionBlock) {
+        dispatch_async(dispatch_get_main_queue(), completionBlock);
+    }
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; count: %@>",
+            [self class],
+            self,
+            @(self.entries.count)];
+}
+
+@end
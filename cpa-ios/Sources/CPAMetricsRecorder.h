@@ -0,0 +1,56 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPALatencyHistogram.h"
+#import "CPANullability.h"
+#import "CPARequestMetrics.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Metrics observer recording the duration of each request phase in one histogram per endpoint and phase, so that
+ * latencies to an authorization provider can be monitored in the field. Recorders are thread-safe
+ */
+@interface CPAMetricsRecorder : NSObject <CPAMetricsObserver>
+
+/**
+ * The endpoints for which metrics have been recorded, sorted alphabetically
+ */
+@property (nonatomic, readonly) NSArray<NSString *> *endpoints;
+
+/**
+ * Return the number of attempts recorded for an endpoint, and how many of them failed
+ */
+- (NSUInteger)requestCountForEndpoint:(NSString *)endpoint;
+- (NSUInteger)failedRequestCountForEndpoint:(NSString *)endpoint;
+
+/**
+ * Return a snapshot of the histogram for the specified endpoint and phase, nil if no duration has been recorded
+ */
+- (nullable CPALatencyHistogram *)histogramForEndpoint:(NSString *)endpoint phase:(CPARequestPhase)phase;
+
+/**
+ * Discard all recorded metrics
+ */
+- (void)reset;
+
+/**
+ * Return a snapshot of all recorded metrics, which can be serialized with NSJSONSerialization. Metrics are grouped by
+ * endpoint, each endpoint having request counts and one histogram representation per phase (see -[CPALatencyHistogram
+ * dictionaryRepresentation])
+ */
+- (NSDictionary<NSString *, id> *)dictionaryRepresentation;
+
+/**
+ * Return the same snapshot as JSON data, e.g. to be sent to an analytics service
+ */
+- (nullable NSData *)JSONData;
+
+@end
+
+NS_ASSUME_NONNULL_END
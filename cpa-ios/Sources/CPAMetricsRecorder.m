@@ -0,0 +1,181 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPAMetricsRecorder.h"
+
+// Static functions
+static NSArray<NSNumber *> *CPARequestPhases(void);
+static NSString *CPANameForRequestPhase(CPARequestPhase phase);
+
+@interface CPAMetricsRecorder ()
+
+// Must be accessed within a @synchronized(self) block
+@property (nonatomic) NSMutableDictionary<NSString *, NSMutableDictionary<NSNumber *, CPALatencyHistogram *> *> *histograms;
+@property (nonatomic) NSCountedSet<NSString *> *requestCounts;
+@property (nonatomic) NSCountedSet<NSString *> *failedRequestCounts;
+
+@end
+
+@implementation CPAMetricsRecorder
+
+#pragma mark Object lifecycle
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        self.histograms = [NSMutableDictionary dictionary];
+        self.requestCounts = [NSCountedSet set];
+        self.failedRequestCounts = [NSCountedSet set];
+    }
+    return self;
+}
+
+#pragma mark Accessors and mutators
+
+- (NSArray<NSString *> *)endpoints
+{
+    @synchronized(self) {
+        return [self.requestCounts.allObjects sortedArrayUsingSelector:@selector(compare:)];
+    }
+}
+
+- (NSUInteger)requestCountForEndpoint:(NSString *)endpoint
+{
+    NSParameterAssert(endpoint);
+    
+    @synchronized(self) {
+        return [self.requestCounts countForObject:endpoint];
+    }
+}
+
+- (NSUInteger)failedRequestCountForEndpoint:(NSString *)endpoint
+{
+    NSParameterAssert(endpoint);
+    
+    @synchronized(self) {
+        return [self.failedRequestCounts countForObject:endpoint];
+    }
+}
+
+- (CPALatencyHistogram *)histogramForEndpoint:(NSString *)endpoint phase:(CPARequestPhase)phase
+{
+    NSParameterAssert(endpoint);
+    
+    CPALatencyHistogram *histogram = nil;
+    @synchronized(self) {
+        histogram = self.histograms[endpoint][@(phase)];
+    }
+    return [histogram copy];
+}
+
+- (void)reset
+{
+    @synchronized(self) {
+        [self.histograms removeAllObjects];
+        [self.requestCounts removeAllObjects];
+        [self.failedRequestCounts removeAllObjects];
+    }
+}
+
+#pragma mark Export
+
+- (NSDictionary<NSString *, id> *)dictionaryRepresentation
+{
+    NSMutableDictionary<NSString *, id> *dictionary = [NSMutableDictionary dictionary];
+    for (NSString *endpoint in self.endpoints) {
+        NSMutableDictionary<NSString *, id> *endpointDictionary = [NSMutableDictionary dictionary];
+        endpointDictionary[@"requests"] = @([self requestCountForEndpoint:endpoint]);
+        endpointDictionary[@"failed_requests"] = @([self failedRequestCountForEndpoint:endpoint]);
+        
+        for (NSNumber *phase in CPARequestPhases()) {
+            CPALatencyHistogram *histogram = [self histogramForEndpoint:endpoint phase:phase.integerValue];
+            endpointDictionary[CPANameForRequestPhase(phase.integerValue)] = [histogram dictionaryRepresentation];
+        }
+        
+        dictionary[endpoint] = [endpointDictionary copy];
+    }
+    return [dictionary copy];
+}
+
+- (NSData *)JSONData
+{
+    return [NSJSONSerialization dataWithJSONObject:[self dictionaryRepresentation] options:0 error:NULL];
+}
+
+#pragma mark CPAMetricsObserver protocol
+
+- (void)didCollectRequestMetrics:(CPARequestMetrics *)requestMetrics
+{
+    NSString *endpoint = requestMetrics.endpoint;
+    
+    NSMutableDictionary<NSNumber *, CPALatencyHistogram *> *histograms = nil;
+    @synchronized(self) {
+        [self.requestCounts addObject:endpoint];
+        if (requestMetrics.error) {
+            [self.failedRequestCounts addObject:endpoint];
+        }
+        
+        histograms = self.histograms[endpoint];
+        if (! histograms) {
+            histograms = [NSMutableDictionary dictionary];
+            self.histograms[endpoint] = histograms;
+        }
+        
+        // Only create histograms for phases which took place, so that e.g. reused connections do not count as connections
+        for (NSNumber *phase in CPARequestPhases()) {
+            NSTimeInterval duration = [requestMetrics durationForPhase:phase.integerValue];
+            if (duration < 0.) {
+                continue;
+            }
+            
+            CPALatencyHistogram *histogram = histograms[phase];
+            if (! histogram) {
+                histogram = [[CPALatencyHistogram alloc] init];
+                histograms[phase] = histogram;
+            }
+            [histogram recordDuration:duration];
+        }
+    }
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; endpoints: %@>",
+            [self class],
+            self,
+            self.endpoints];
+}
+
+@end
+
+#pragma mark Static functions
+
+static NSArray<NSNumber *> *CPARequestPhases(void)
+{
+    return @[ @(CPARequestPhaseDomainLookup),
+              @(CPARequestPhaseConnect),
+              @(CPARequestPhaseSecureConnection),
+              @(CPARequestPhaseTimeToFirstByte),
+              @(CPARequestPhaseParsing),
+              @(CPARequestPhaseTotal) ];
+}
+
+static NSString *CPANameForRequestPhase(CPARequestPhase phase)
+{
+    static NSDictionary<NSNumber *, NSString *> *s_names;
+    static dispatch_once_t s_onceToken;
+    dispatch_once(&s_onceToken, ^{
+        s_names = @{ @(CPARequestPhaseDomainLookup) : @"domain_lookup",
+                     @(CPARequestPhaseConnect) : @"connect",
+                     @(CPARequestPhaseSecureConnection) : @"secure_connection",
+                     @(CPARequestPhaseTimeToFirstByte) : @"time_to_first_byte",
+                     @(CPARequestPhaseParsing) : @"parsing",
+                     @(CPARequestPhaseTotal) : @"total" };
+    });
+    return s_names[@(phase)];
+}
@@ -0,0 +1,24 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+#import "CPAProvider.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Private interface for implementation purposes
+ */
+@interface CPAProvider (Private)
+
+/**
+ * Return the token locally available for a given domain, whether it has expired or not. Can be called from any thread
+ */
+- (nullable CPAToken *)localTokenForDomain:(NSString *)domain;
+
+@end
+
+NS_ASSUME_NONNULL_END
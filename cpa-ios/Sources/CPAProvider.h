@@ -4,8 +4,15 @@
 //  License information is available from the LICENSE file.
 //
 
+#import "CPACircuitBreaker.h"
+#import "CPAEndpointSelector.h"
 #import "CPANullability.h"
+#import "CPARequestHandle.h"
+#import "CPARequestMetrics.h"
+#import "CPARetryPolicy.h"
 #import "CPAToken.h"
+#import "CPATokenStore.h"
+#import "CPATracer.h"
 
 #import <Foundation/Foundation.h>
 #import <UIKit/UIKit.h>
@@ -20,9 +27,19 @@ typedef NS_ENUM(NSInteger, CPAPresentationAction) {
     CPAPresentationActionDismiss,            // The view controller must be dismissed
 };
 
+/**
+ * How the identity and tokens are saved to the token store
+ */
+typedef NS_ENUM(NSInteger, CPATokenStorageMode) {
+    CPATokenStorageModeItemPerDomain,        // One item for the identity, and one for each domain token
+    CPATokenStorageModeSingleItem,           // A single item for the identity and all tokens
+};
+
 // Types
 typedef void (^CPACredentialsPresentationBlock)(UIViewController *viewController, CPAPresentationAction action);
 typedef void (^CPATokenCompletionBlock)(CPAToken * __nullable token, NSError * __nullable error);
+typedef void (^CPAUserCodeBlock)(NSString *userCode, NSURL *verificationURL);
+typedef void (^CPATokensCompletionBlock)(NSDictionary<NSString *, CPAToken *> *tokens, NSDictionary<NSString *, NSError *> *errors);
 
 /**
  * Authentication provider managing cross-platform authentication (CPA) with an authorization provider.
@@ -41,8 +58,10 @@ typedef void (^CPATokenCompletionBlock)(CPAToken * __nullable token, NSError * _
  * You can instantiate as many providers as required. In most cases a single provider should suffice, which you can 
  * instantiate and conveniently install as default provider by calling +setDefaultProvider:
  *
- * The authentication provider is intended to be used from the main application thread. Using it from any other thread
- * results in undefined behavior.
+ * The authentication provider can be used from any thread. Locally available tokens are returned without blocking on
+ * the internal queue on which token requests and keychain mutations are serialized. Completion blocks are called on the
+ * main thread, unless another completion queue has been set. Credentials presentation blocks are always called on the
+ * main thread.
  */
 @interface CPAProvider : NSObject
 
@@ -56,12 +75,25 @@ typedef void (^CPATokenCompletionBlock)(CPAToken * __nullable token, NSError * _
  */
 + (nullable CPAProvider *)defaultProvider;
 
+/**
+ * Create an authentication provider connecting to the specified authorization provider URL (mandatory), saving its
+ * identity and tokens to a given store (mandatory) with the specified mode
+ *
+ * With CPATokenStorageModeSingleItem, the store item is read once, when first needed, and changes are written back
+ * shortly after they have been made, several changes resulting in a single write. Items previously saved with one item 
+ * per domain are imported and removed when the item is first read. All applications sharing tokens through a keychain
+ * access group must therefore use the same storage mode
+ */
+- (instancetype)initWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                      tokenStore:(id<CPATokenStore>)tokenStore
+                                tokenStorageMode:(CPATokenStorageMode)tokenStorageMode NS_DESIGNATED_INITIALIZER;
+
 /**
  * Create an authentication provider connecting to the specified authorization provider URL (mandatory), and sharing tokens
- * within a given key chain group (if set to nil, no group sharing is made)
+ * within a given key chain group (if set to nil, no group sharing is made). One keychain item is used per domain
  */
 - (instancetype)initWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
-                             keyChainAccessGroup:(nullable NSString *)keyChainAccessGroup NS_DESIGNATED_INITIALIZER;
+                             keyChainAccessGroup:(nullable NSString *)keyChainAccessGroup;
 
 /**
  * Create an authentication provider connecting to the specified authorization provider URL (mandatory) without
@@ -75,10 +107,151 @@ typedef void (^CPATokenCompletionBlock)(CPAToken * __nullable token, NSError * _
 @property (nonatomic, readonly) NSURL *authorizationProviderURL;
 
 /**
- * Return the token locally available for a given domain, nil if none
+ * The store to which the identity and tokens are saved, and how they are saved
+ */
+@property (nonatomic, readonly) id<CPATokenStore> tokenStore;
+@property (nonatomic, readonly) CPATokenStorageMode tokenStorageMode;
+
+/**
+ * The configuration of the session used to communicate with the authorization provider. All requests made to the
+ * authorization provider share this session and its connection pool. Set to nil to restore the default configuration
+ *
+ * The configuration is shared by all providers with the same authorization provider URL
+ */
+@property (nonatomic, copy, null_resettable) NSURLSessionConfiguration *sessionConfiguration;
+
+/**
+ * The policy applied to retry requests to the authorization provider failing because of transient errors. Set to nil
+ * to restore the default policy. Use +[CPARetryPolicy noRetryPolicy] to disable retries
+ *
+ * As for the session configuration, the policy and its retry budget are shared by all providers with the same
+ * authorization provider URL
+ */
+@property (nonatomic, copy, null_resettable) CPARetryPolicy *retryPolicy;
+
+/**
+ * The circuit breaker suspending requests to the authorization provider after repeated failures, so that token requests
+ * fail immediately with CPAErrorAuthorizationProviderUnavailable during outages. The breaker is copied when set, and
+ * the returned breaker is the one in use, whose state can be read for telemetry purposes. Set to nil to restore the
+ * default breaker
+ *
+ * As for the session configuration, the breaker and its state are shared by all providers with the same authorization
+ * provider URL
+ */
+@property (nonatomic, copy, null_resettable) CPACircuitBreaker *circuitBreaker;
+
+/**
+ * The selector of the endpoints to which requests are sent when the authorization provider is available from several
+ * URLs, e.g. in several regions. Each request is made to the fastest endpoint available, retries are made to another
+ * endpoint, and refresh requests can be hedged. The selector is copied when set, and the returned selector is the one
+ * in use. Set to nil to send all requests to the authorization provider URL (default)
+ *
+ * The identity and tokens remain stored for the authorization provider URL, and are used with all endpoints. Each
+ * endpoint has its own circuit breaker, configured as the circuit breaker of the provider when first used
+ *
+ * As for the session configuration, the selector and the latencies it records are shared by all providers with the
+ * same authorization provider URL
+ */
+@property (nonatomic, copy, nullable) CPAEndpointSelector *endpointSelector;
+
+/**
+ * The observer notified of the timings of each request made to the authorization provider, e.g. a CPAMetricsRecorder.
+ * Metrics are only collected while an observer is set
+ *
+ * As for the session configuration, the observer is shared by all providers with the same authorization provider URL
+ */
+@property (nonatomic, nullable) id<CPAMetricsObserver> metricsObserver;
+
+/**
+ * The queue on which token request completion blocks are called. Set to nil to restore the default main queue
+ */
+@property (atomic, null_resettable) dispatch_queue_t completionQueue;
+
+/**
+ * The tracer to which token requests are recorded, nil if none (default). Each token request is traced with child spans
+ * for requests made to the authorization provider, token store accesses and credentials presentation
+ */
+@property (atomic, nullable) CPATracer *tracer;
+
+/**
+ * Read the identity and all tokens from the token store on a background queue, keeping them in memory so that the first
+ * -tokenForDomain: calls and token requests do not have to access the store. Call right after creating the provider,
+ * e.g. when the application starts, so that reads happen while the application is launching instead of on the main
+ * thread when tokens are first needed
+ *
+ * Warm-up is optional. Lookups made while it is running wait for it to finish instead of reading the store again. Only
+ * domains with a stored token are kept in memory: The first lookup for any other domain still reads the store. Warm-up
+ * can be performed again after the token cache has been purged or the identity discarded
+ */
+- (void)warmUp;
+
+/**
+ * Return YES once warm-up has been performed, until the token cache is purged or the identity discarded
+ */
+@property (atomic, readonly, getter=isWarmedUp) BOOL warmedUp;
+
+/**
+ * Return the token locally available for a given domain, nil if none or if it has expired. Same as calling 
+ * -tokenForDomain:validForTimeInterval: with a time interval of 0
+ *
+ * Tokens are kept in memory once read from the keychain, so that subsequent calls for the same domain are cheap. This
+ * in-memory cache is kept up to date by the provider itself
  */
 - (nullable CPAToken *)tokenForDomain:(NSString *)domain;
 
+/**
+ * Return the token locally available for a given domain, provided it remains valid for at least the specified time 
+ * interval, nil otherwise. Use a leeway covering the time needed to use the token, so that a service provider does not
+ * receive a token expiring in the meantime
+ *
+ * Expired tokens are kept until purged, and are still used when requesting a token of the same type again, so that it 
+ * can be refreshed
+ */
+- (nullable CPAToken *)tokenForDomain:(NSString *)domain validForTimeInterval:(NSTimeInterval)timeInterval;
+
+/**
+ * Return all tokens locally available, sorted by domain, including expired ones. The token store is read at once, and
+ * tokens already kept in memory are not decoded again. Tokens read are kept in memory as well, so that subsequent
+ * -tokenForDomain: calls are cheap
+ */
+- (NSArray<CPAToken *> *)allTokens;
+
+/**
+ * Return the tokens locally available which match the specified predicate (evaluated against CPAToken objects), sorted 
+ * by domain. Same as -allTokens otherwise
+ */
+- (NSArray<CPAToken *> *)tokensMatchingPredicate:(NSPredicate *)predicate;
+
+/**
+ * Number of -tokenForDomain: calls served from memory, respectively requiring a token store access
+ */
+@property (nonatomic, readonly) NSUInteger tokenCacheHitCount;
+@property (nonatomic, readonly) NSUInteger tokenCacheMissCount;
+
+/**
+ * Number of -tokenForDomain: calls for which a token was found but has expired, or was expiring too soon
+ */
+@property (nonatomic, readonly) NSUInteger expiredTokenCount;
+
+/**
+ * Number of expired tokens purged from the token store
+ */
+@property (nonatomic, readonly) NSUInteger purgedTokenCount;
+
+/**
+ * Number of token store operations (reads, writes, removals and enumerations) performed by the provider
+ */
+@property (nonatomic, readonly) NSUInteger tokenStoreOperationCount;
+
+/**
+ * Forget about the identity and tokens kept in memory, so that they are read again from the keychain when next needed.
+ * Only useful if tokens are shared with other applications through a keychain access group, since those might have
+ * updated them
+ *
+ * With CPATokenStorageModeSingleItem, pending changes are written to the token store first
+ */
+- (void)purgeTokenCache;
+
 /**
  * Retrieve a token for the specified domain with a given type. Before calling this method, you should check whether
  * a token is already available locally by calling the -tokenForDomain: method first, and checking its type property
@@ -88,9 +261,15 @@ typedef void (^CPATokenCompletionBlock)(CPAToken * __nullable token, NSError * _
  * Note that if a token request is performed while a token is already available locally, and if the request is successful, 
  * the previous local token will be replaced.
  *
+ * If a request for a token of the same type and domain is already running, no new request is made to the authorization
+ * provider. The completion block is simply called with the result of the running request
+ *
+ * The request can be cancelled with the returned handle, in which case the completion block is not called. The credentials
+ * view controller is dismissed if displayed
+ *
  * For possible errors, check CPAErrors.h
  */
-- (void)requestTokenForDomain:(NSString *)domain withType:(CPATokenType)type completionBlock:(nullable CPATokenCompletionBlock)completionBlock;
+- (CPARequestHandle *)requestTokenForDomain:(NSString *)domain withType:(CPATokenType)type completionBlock:(nullable CPATokenCompletionBlock)completionBlock;
 
 /**
  * Same as -requestTokenForDomain:withType:completionBlock:, but providing a way to customise how the credentials view
@@ -99,11 +278,73 @@ typedef void (^CPATokenCompletionBlock)(CPAToken * __nullable token, NSError * _
  *
  * If credentialsPresentationBlock is set to nil, the view controller is displayed modally within a navigation controller
  * (as a modal sheet on iPad)
+ *
+ * If the request is coalesced with a running one, the credentials presentation block of the running request is used
+ */
+- (CPARequestHandle *)requestTokenForDomain:(NSString *)domain
+                                   withType:(CPATokenType)type
+               credentialsPresentationBlock:(nullable CPACredentialsPresentationBlock)credentialsPresentationBlock
+                            completionBlock:(nullable CPATokenCompletionBlock)completionBlock;
+
+/**
+ * Retrieve a user token for the specified domain, letting the user authorize the application on another device (e.g. 
+ * for second-screen or TV applications, where no credentials view controller is presented). If the application needs
+ * to be authorized, the user code block is called on the main thread with a user code and a verification URL, which 
+ * must be displayed to the user. The authorization provider is then polled until the user has entered the code at 
+ * the verification URL, or until the code expires (CPAErrorAuthorizationRequestExpired)
+ *
+ * If a user token request for the same domain is already running, the user code block is not called and the completion
+ * block is called with the result of the running request
+ *
+ * The request can be cancelled with the returned handle, in which case polling stops and the completion block is not
+ * called
+ *
+ * For possible errors, check CPAErrors.h
+ */
+- (CPARequestHandle *)requestUserTokenForDomain:(NSString *)domain
+                                  userCodeBlock:(CPAUserCodeBlock)userCodeBlock
+                                completionBlock:(nullable CPATokenCompletionBlock)completionBlock;
+
+/**
+ * Stop waiting for the user to authorize the application for a running token request. The request completion blocks are
+ * called with a CPAErrorAuthorizationCancelled error. Does nothing if no request is waiting for user authorization
+ *
+ * To cancel a single request without calling its completion block, use the handle returned when the request was made
  */
-- (void)requestTokenForDomain:(NSString *)domain
-                     withType:(CPATokenType)type
- credentialsPresentationBlock:(nullable CPACredentialsPresentationBlock)credentialsPresentationBlock
-              completionBlock:(nullable CPATokenCompletionBlock)completionBlock;
+- (void)cancelTokenRequestForDomain:(NSString *)domain withType:(CPATokenType)type;
+
+/**
+ * Retrieve tokens for several domains at once, with a given type. The identity is registered or read once, after which
+ * tokens are requested from the authorization provider in parallel, with at most maximumConcurrentTokenRequestCount
+ * requests running at the same time. User tokens require credentials to be entered and are therefore requested one
+ * domain after the other, using the default credentials presentation
+ *
+ * The completion block is called once all requests are over, with the tokens successfully retrieved and the errors
+ * encountered, per domain. Each domain appears in exactly one of these dictionaries
+ *
+ * Cancelling the returned handle cancels all running requests, starts no new ones, and the completion block is not called
+ *
+ * For possible errors, check CPAErrors.h
+ */
+- (CPARequestHandle *)requestTokensForDomains:(NSArray<NSString *> *)domains withType:(CPATokenType)type completionBlock:(nullable CPATokensCompletionBlock)completionBlock;
+
+/**
+ * Maximum number of token requests run in parallel by -requestTokensForDomains:withType:completionBlock: (default: 4, 
+ * the default maximum number of simultaneous connections to a single host)
+ */
+@property (atomic) NSUInteger maximumConcurrentTokenRequestCount;
+
+/**
+ * If greater than 0, token requests are answered right away with the locally available token of the requested type
+ * if it expired less than this time interval ago. The token is then refreshed in the background, and replaced once the
+ * refreshed token has been received (stale-while-revalidate). Use if service providers accept recently expired tokens,
+ * so that an authorization provider which is slow or unreachable does not delay token requests (default: 0, i.e. token
+ * requests always wait for the authorization provider)
+ *
+ * If the refresh fails, it is attempted again with the next token request made after a retry interval of one minute.
+ * Tokens cannot be served stale before an identity has been registered
+ */
+@property (atomic) NSTimeInterval staleTokenGraceInterval;
 
 /**
  * Discard a locally available token for the given domain, if any. The identity itself does not get discarded, a new
@@ -116,6 +357,53 @@ typedef void (^CPATokenCompletionBlock)(CPAToken * __nullable token, NSError * _
  */
 - (void)discardIdentity;
 
+/**
+ * Remove all expired tokens from the token store, in the background and as a single batch. Tokens which can still be
+ * served stale (see staleTokenGraceInterval) are only removed once the grace interval has elapsed
+ */
+- (void)purgeExpiredTokens;
+
+/**
+ * If greater than 0, expired tokens are automatically purged in the background at this time interval (default: 0, 
+ * i.e. no automatic purge). Purges keep tokens which can still be served stale
+ */
+@property (atomic) NSTimeInterval expiredTokenPurgeInterval;
+
+/**
+ * Start refreshing the tokens known to the provider automatically, in the background, before they expire. This avoids
+ * having to perform a token request at the time a token is actually needed
+ *
+ * Only tokens which can be refreshed without user interaction are renewed. If a refresh fails, it is attempted again 
+ * later until the token has expired
+ */
+- (void)startTokenRefreshScheduling;
+
+/**
+ * Stop refreshing tokens automatically. Refreshes already running are not cancelled
+ */
+- (void)stopTokenRefreshScheduling;
+
+/**
+ * Return YES iff tokens are automatically refreshed
+ */
+@property (nonatomic, readonly, getter=isSchedulingTokenRefresh) BOOL schedulingTokenRefresh;
+
+/**
+ * Time interval before expiration at which tokens are automatically refreshed (default: 5 minutes)
+ */
+@property (atomic) NSTimeInterval tokenRefreshMargin;
+
+/**
+ * Maximum random amount of time by which an automatic refresh is performed earlier, so that clients do not all contact
+ * the authorization provider at the same time (default: 30 seconds)
+ */
+@property (atomic) NSTimeInterval tokenRefreshJitter;
+
+/**
+ * Tokens whose refresh is due within this time interval are refreshed together, in a single batch (default: 1 minute)
+ */
+@property (atomic) NSTimeInterval tokenRefreshBatchInterval;
+
 @end
 
 @interface CPAProvider (UnavailableMethods)
@@ -6,63 +6,172 @@
 
 #import "CPAProvider.h"
 
+#import "CPABinaryCoding.h"
 #import "CPAIdentity+Private.h"
 #import "CPAErrors+Private.h"
+#import "CPAProvider+Private.h"
 #import "CPAStatelessRequest.h"
-#import "CPAUICKeyChainStore.h"
 #import "CPAToken+Private.h"
 #import "CPAAuthorizationViewController.h"
+#import "CPADeviceCodePoller.h"
+#import "CPAKeyChainTokenStore.h"
+#import "CPARequestHandle+Private.h"
 #import "NSBundle+CPAExtensions.h"
 
+#import <stdatomic.h>
 #import <UIKit/UIKit.h>
 
 // Typedefs
 typedef void (^CPAVoidCompletionBlock)(NSError *error);
 
+// Present a user code and its verification URL, calling the completion block when the user has authorized the application
+// (isAuthorized = YES), as soon as the code has been presented if authorization happens elsewhere (isAuthorized = NO), or
+// with an error. The presentation block returns a block dismissing the presentation if the request is cancelled, if any
+typedef void (^CPAUserCodePresentationCompletionBlock)(BOOL isAuthorized, NSError *error);
+typedef dispatch_block_t (^CPAUserCodePresentationBlock)(NSString *userCode, NSURL *verificationURL, CPAUserCodePresentationCompletionBlock completionBlock);
+
+// Constants
+static const NSTimeInterval CPATokenRefreshRetryInterval = 60.;
+static const NSTimeInterval CPATokenStoreWriteCoalescingDelay = 0.1;
+
 // Globals
 static CPAProvider *s_defaultProvider = nil;
 
-@interface CPAProvider ()
+static void *s_stateQueueKey = &s_stateQueueKey;
+
+@interface CPAProvider () {
+@private
+    _Atomic(NSUInteger) _tokenCacheHitCount;
+    _Atomic(NSUInteger) _tokenCacheMissCount;
+    _Atomic(NSUInteger) _tokenStoreOperationCount;
+    _Atomic(NSUInteger) _expiredTokenCount;
+    _Atomic(NSUInteger) _purgedTokenCount;
+    
+    // Must be accessed on the state queue
+    NSTimeInterval _expiredTokenPurgeInterval;
+}
 
 @property (nonatomic) NSURL *authorizationProviderURL;
-@property (nonatomic) CPAUICKeyChainStore *keyChainStore;
+@property (nonatomic) id<CPATokenStore> tokenStore;
+@property (nonatomic) CPATokenStorageMode tokenStorageMode;
+
+// Serial queue on which token requests and token store mutations are performed. Unless stated otherwise, private methods
+// must be called on this queue
+@property (nonatomic) dispatch_queue_t stateQueue;
+
+// Tokens read from or written to the token store, per domain. NSNull is used for domains known not to have a token. The
+// dictionary is immutable and replaced as a whole on the state queue, so that it can be read from any thread without
+// blocking on the state queue (the atomic accessor only briefly takes the runtime property lock)
+@property (atomic, copy) NSDictionary<NSString *, id> *tokenCache;
+
+// Handles of running token requests, per domain and token type. Requests for the same domain and token type share a
+// single request to the AP, whose handle is cancelled when all of them have been
+@property (nonatomic) NSMutableDictionary<NSString *, NSMutableArray<CPARequestHandle *> *> *pendingRequestHandles;
+@property (nonatomic) NSMutableDictionary<NSString *, CPARequestHandle *> *sharedRequestHandles;
 
-@property (nonatomic, readonly, copy) NSString *keyChainIdentifier;
+// Device code pollers waiting for user authorization, per domain and token type
+@property (nonatomic) NSMutableDictionary<NSString *, CPADeviceCodePoller *> *deviceCodePollers;
+
+// Automatic token refresh. For each domain, the date before which no new automatic refresh attempt must be made is
+// recorded, preventing refresh storms when a refresh fails or when the margin exceeds the token lifetime
+@property (nonatomic, getter=isSchedulingTokenRefresh) BOOL schedulingTokenRefresh;
+@property (nonatomic) dispatch_source_t tokenRefreshTimerSource;
+@property (nonatomic) NSMutableSet<NSString *> *refreshingDomains;
+@property (nonatomic) NSMutableDictionary<NSString *, NSDate *> *tokenRefreshNotBeforeDates;
+
+// Automatic purge of expired tokens
+@property (nonatomic) dispatch_source_t expiredTokenPurgeTimerSource;
+
+// Single item storage mode: Identity and tokens saved in the store item, loaded once when first needed. Changes are
+// written back after a short delay, so that successive changes result in a single store write
+@property (nonatomic, getter=isStoreLoaded) BOOL storeLoaded;
+@property (nonatomic) CPAIdentity *storedIdentity;
+@property (nonatomic) NSMutableDictionary<NSString *, CPAToken *> *storedTokens;
+@property (nonatomic, getter=isStoreWriteScheduled) BOOL storeWriteScheduled;
+
+// One item per domain storage mode: The identity item is read once when first needed, and kept as stored identity until
+// the token cache is purged
+@property (nonatomic, getter=isIdentityLoaded) BOOL identityLoaded;
+
+@property (atomic, getter=isWarmedUp) BOOL warmedUp;
+
+@property (nonatomic, readonly, copy) NSString *storeIdentifier;
+@property (nonatomic, readonly, copy) NSString *singleItemKey;
 
 @end
 
+
 @implementation CPAProvider
 
 #pragma mark Class methods
 
 + (CPAProvider *)setDefaultProvider:(CPAProvider *)provider
 {
-    CPAProvider *previousProvider = s_defaultProvider;
-    s_defaultProvider = provider;
-    return previousProvider;
+    @synchronized(self) {
+        CPAProvider *previousProvider = s_defaultProvider;
+        s_defaultProvider = provider;
+        return previousProvider;
+    }
 }
 
 + (CPAProvider *)defaultProvider
 {
-    return s_defaultProvider;
+    @synchronized(self) {
+        return s_defaultProvider;
+    }
 }
 
 #pragma mark Object lifecycle
 
 - (instancetype)initWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
-                             keyChainAccessGroup:(NSString *)keyChainAccessGroup
+                                      tokenStore:(id<CPATokenStore>)tokenStore
+                                tokenStorageMode:(CPATokenStorageMode)tokenStorageMode
 {
     NSParameterAssert(authorizationProviderURL);
+    NSParameterAssert(tokenStore);
     
     if (self = [super init]) {
         self.authorizationProviderURL = authorizationProviderURL;
+        self.tokenStore = tokenStore;
+        self.tokenStorageMode = tokenStorageMode;
+        self.storedTokens = [NSMutableDictionary dictionary];
+        
+        self.stateQueue = dispatch_queue_create("ch.ebu.cpa.provider", DISPATCH_QUEUE_SERIAL);
+        dispatch_queue_set_specific(self.stateQueue, s_stateQueueKey, (__bridge void *)self, NULL);
+        
+        self.tokenCache = @{};
+        self.pendingRequestHandles = [NSMutableDictionary dictionary];
+        self.sharedRequestHandles = [NSMutableDictionary dictionary];
+        self.deviceCodePollers = [NSMutableDictionary dictionary];
+        self.completionQueue = nil;
+        self.maximumConcurrentTokenRequestCount = 4;
         
-        NSString *serviceIdentifier = [NSBundle mainBundle].bundleIdentifier;
-        self.keyChainStore = [CPAUICKeyChainStore keyChainStoreWithService:serviceIdentifier accessGroup:keyChainAccessGroup];
+        self.tokenRefreshMargin = 5. * 60.;
+        self.tokenRefreshJitter = 30.;
+        self.tokenRefreshBatchInterval = 60.;
+        self.refreshingDomains = [NSMutableSet set];
+        self.tokenRefreshNotBeforeDates = [NSMutableDictionary dictionary];
+        
+        if (tokenStorageMode == CPATokenStorageModeSingleItem) {
+            [[NSNotificationCenter defaultCenter] addObserver:self
+                                                     selector:@selector(applicationDidEnterBackground:)
+                                                         name:UIApplicationDidEnterBackgroundNotification
+                                                       object:nil];
+        }
     }
     return self;
 }
 
+- (instancetype)initWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                             keyChainAccessGroup:(NSString *)keyChainAccessGroup
+{
+    NSString *serviceIdentifier = [NSBundle mainBundle].bundleIdentifier;
+    CPAKeyChainTokenStore *tokenStore = [[CPAKeyChainTokenStore alloc] initWithService:serviceIdentifier accessGroup:keyChainAccessGroup];
+    return [self initWithAuthorizationProviderURL:authorizationProviderURL
+                                       tokenStore:tokenStore
+                                 tokenStorageMode:CPATokenStorageModeItemPerDomain];
+}
+
 - (instancetype)initWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
 {
     return [self initWithAuthorizationProviderURL:authorizationProviderURL keyChainAccessGroup:nil];
@@ -74,256 +183,1580 @@ static CPAProvider *s_defaultProvider = nil;
     return nil;
 }
 
-#pragma mark Token retrieval
-
-- (CPAToken *)tokenForDomain:(NSString *)domain
+- (void)dealloc
 {
-    NSParameterAssert(domain);
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    
+    if (_tokenRefreshTimerSource) {
+        dispatch_source_cancel(_tokenRefreshTimerSource);
+    }
     
-    NSString *key = [self keyChainKeyForDomain:domain];
-    NSData *tokenData = [self.keyChainStore dataForKey:key];
-    return tokenData ? [NSKeyedUnarchiver unarchiveObjectWithData:tokenData] : nil;
+    if (_expiredTokenPurgeTimerSource) {
+        dispatch_source_cancel(_expiredTokenPurgeTimerSource);
+    }
 }
 
-- (void)requestTokenForDomain:(NSString *)domain withType:(CPATokenType)type completionBlock:(CPATokenCompletionBlock)completionBlock
+#pragma mark Accessors and mutators
+
+- (NSURLSessionConfiguration *)sessionConfiguration
 {
-    [self requestTokenForDomain:domain withType:type credentialsPresentationBlock:nil completionBlock:completionBlock];
+    return [CPAStatelessRequest sessionConfigurationForAuthorizationProviderURL:self.authorizationProviderURL];
 }
 
-- (void)requestTokenForDomain:(NSString *)domain
-                     withType:(CPATokenType)type
- credentialsPresentationBlock:(CPACredentialsPresentationBlock)credentialsPresentationBlock
-              completionBlock:(CPATokenCompletionBlock)completionBlock
+- (void)setSessionConfiguration:(NSURLSessionConfiguration *)sessionConfiguration
 {
-    NSParameterAssert(domain);
-    
-    // Default: Modal presentation, wrapped in a navigation controller, with a cancel button at the top left
-    if (! credentialsPresentationBlock) {
-        credentialsPresentationBlock = ^(UIViewController *viewController, CPAPresentationAction action) {
-            viewController.navigationItem.leftBarButtonItem = [[UIBarButtonItem alloc] initWithTitle:CPALocalizedString(@"Cancel", nil)
-                                                                                               style:UIBarButtonItemStylePlain
-                                                                                              target:self
-                                                                                              action:@selector(closeCredentials:)];
-            
-            UIViewController *rootViewController = [UIApplication sharedApplication].keyWindow.rootViewController;
-            if (action == CPAPresentationActionShow) {
-                UINavigationController *navigationController = [[UINavigationController alloc] initWithRootViewController:viewController];
-                navigationController.modalPresentationStyle = UIModalPresentationFormSheet;
-                [rootViewController presentViewController:navigationController animated:YES completion:nil];
-            }
-            else {
-                [rootViewController dismissViewControllerAnimated:YES completion:nil];
-            }
-        };
+    [CPAStatelessRequest setSessionConfiguration:sessionConfiguration forAuthorizationProviderURL:self.authorizationProviderURL];
+}
+
+- (CPARetryPolicy *)retryPolicy
+{
+    return [[CPAStatelessRequest retryPolicyForAuthorizationProviderURL:self.authorizationProviderURL] copy];
+}
+
+- (void)setRetryPolicy:(CPARetryPolicy *)retryPolicy
+{
+    [CPAStatelessRequest setRetryPolicy:retryPolicy forAuthorizationProviderURL:self.authorizationProviderURL];
+}
+
+- (CPACircuitBreaker *)circuitBreaker
+{
+    return [CPAStatelessRequest circuitBreakerForAuthorizationProviderURL:self.authorizationProviderURL];
+}
+
+- (void)setCircuitBreaker:(CPACircuitBreaker *)circuitBreaker
+{
+    [CPAStatelessRequest setCircuitBreaker:circuitBreaker forAuthorizationProviderURL:self.authorizationProviderURL];
+}
+
+- (CPAEndpointSelector *)endpointSelector
+{
+    return [CPAStatelessRequest endpointSelectorForAuthorizationProviderURL:self.authorizationProviderURL];
+}
+
+- (void)setEndpointSelector:(CPAEndpointSelector *)endpointSelector
+{
+    [CPAStatelessRequest setEndpointSelector:endpointSelector forAuthorizationProviderURL:self.authorizationProviderURL];
+}
+
+- (id<CPAMetricsObserver>)metricsObserver
+{
+    return [CPAStatelessRequest metricsObserverForAuthorizationProviderURL:self.authorizationProviderURL];
+}
+
+- (void)setMetricsObserver:(id<CPAMetricsObserver>)metricsObserver
+{
+    [CPAStatelessRequest setMetricsObserver:metricsObserver forAuthorizationProviderURL:self.authorizationProviderURL];
+}
+
+- (dispatch_queue_t)completionQueue
+{
+    @synchronized(self) {
+        return _completionQueue;
     }
-    
-    [self registerAndRequestTokenForDomain:domain withType:type credentialsPresentationBlock:credentialsPresentationBlock completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
-        if (error) {
-            completionBlock ? completionBlock(nil, error) : nil;
-            return;
-        }
-        
-        NSDate *expirationDate = [[NSDate date] dateByAddingTimeInterval:expiresInSeconds];
-        CPAToken *token = [[CPAToken alloc] initWithValue:accessToken
-                                                   domain:domain
-                                               domainName:domainName
-                                                 userName:userName
-                                           expirationDate:expirationDate];
-        [self setToken:token forDomain:domain];
-        
-        completionBlock ? completionBlock(token, nil) : nil;
+}
+
+- (void)setCompletionQueue:(dispatch_queue_t)completionQueue
+{
+    @synchronized(self) {
+        _completionQueue = completionQueue ?: dispatch_get_main_queue();
+    }
+}
+
+- (NSUInteger)tokenCacheHitCount
+{
+    return atomic_load(&_tokenCacheHitCount);
+}
+
+- (NSUInteger)tokenCacheMissCount
+{
+    return atomic_load(&_tokenCacheMissCount);
+}
+
+- (NSUInteger)tokenStoreOperationCount
+{
+    return atomic_load(&_tokenStoreOperationCount);
+}
+
+- (NSUInteger)expiredTokenCount
+{
+    return atomic_load(&_expiredTokenCount);
+}
+
+- (NSUInteger)purgedTokenCount
+{
+    return atomic_load(&_purgedTokenCount);
+}
+
+- (NSTimeInterval)expiredTokenPurgeInterval
+{
+    __block NSTimeInterval expiredTokenPurgeInterval = 0.;
+    [self performSyncOnStateQueue:^{
+        expiredTokenPurgeInterval = _expiredTokenPurgeInterval;
+    }];
+    return expiredTokenPurgeInterval;
+}
+
+- (void)setExpiredTokenPurgeInterval:(NSTimeInterval)expiredTokenPurgeInterval
+{
+    [self performSyncOnStateQueue:^{
+        _expiredTokenPurgeInterval = fmax(expiredTokenPurgeInterval, 0.);
+        [self scheduleExpiredTokenPurge];
     }];
 }
 
+#pragma mark State queue
+
 /**
- * Create a new identity if needed and obtain a client / user token for the specified domain on its behalf
+ * Synchronously execute a block on the state queue. Can be safely called from any thread, including the state queue
  */
-- (void)registerAndRequestTokenForDomain:(NSString *)domain
-                                withType:(CPATokenType)type
-            credentialsPresentationBlock:(CPACredentialsPresentationBlock)credentialsPresentationBlock
-                         completionBlock:(CPATokenRequestCompletionBlock)completionBlock
+- (void)performSyncOnStateQueue:(void (^)(void))block
 {
-    // If an identity has already been retrieved for this provider, reuse it. This makes single sign-on possible (the AP
-    // might automatically grant a token for a domain if a token for an affiliated domain has already been granted)
-    CPAIdentity *identity = [self identity];
-    if (identity) {
-        [self requestTokenForDomain:domain withType:type identity:identity credentialsPresentationBlock:credentialsPresentationBlock completionBlock:completionBlock];
+    NSParameterAssert(block);
+    
+    if (dispatch_get_specific(s_stateQueueKey) == (__bridge void *)self) {
+        block();
     }
     else {
-        NSString *clientName = [NSBundle mainBundle].infoDictionary[@"CFBundleName"];
-        NSAssert(clientName, @"A client name is required");
-        
-        NSString *softwareIdentifier = [NSBundle mainBundle].bundleIdentifier;
-        NSAssert(softwareIdentifier, @"A software identifier is required");
-        
-        NSString *softwareVersion = [NSBundle mainBundle].infoDictionary[@"CFBundleShortVersionString"];
-        NSAssert(softwareVersion, @"A software version is required");
-        
-        [CPAStatelessRequest registerClientWithAuthorizationProviderURL:self.authorizationProviderURL clientName:clientName softwareIdentifier:softwareIdentifier softwareVersion:softwareVersion completionBlock:^(NSString *clientIdentifier, NSString *clientSecret, NSError *error) {
-            if (error) {
-                completionBlock ? completionBlock(nil, nil, nil, nil, 0, error) : nil;
-                return;
-            }
-            
-            CPAIdentity *identity = [[CPAIdentity alloc] initWithIdentifier:clientIdentifier secret:clientSecret];
-            [self setIdentity:identity];
-            
-            [self requestTokenForDomain:domain withType:type identity:identity credentialsPresentationBlock:credentialsPresentationBlock completionBlock:completionBlock];
-        }];
+        dispatch_sync(self.stateQueue, block);
     }
 }
 
 /**
- * Request a client / user token for the specified domain on behalf of the provided identity
+ * Asynchronously execute a block on the state queue. Can be called from any thread
  */
-- (void)requestTokenForDomain:(NSString *)domain
-                     withType:(CPATokenType)type
-                     identity:(CPAIdentity *)identity
- credentialsPresentationBlock:(CPACredentialsPresentationBlock)credentialsPresentationBlock
-              completionBlock:(CPATokenRequestCompletionBlock)completionBlock
+- (void)performAsyncOnStateQueue:(void (^)(void))block
 {
-    // Token of the same type already available from the keychain. Attempt a refresh
-    CPAToken *token = [self tokenForDomain:domain];
-    if (token && token.type == type) {
-        [CPAStatelessRequest refreshTokenWithAuthorizationProviderURL:self.authorizationProviderURL clientIdentifier:identity.identifier clientSecret:identity.secret domain:domain completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
-            if (error) {
-                // The client has been revoked and the token cannot thus be refreshed. Start again from scratch, registering a new client
-                if ([error.domain isEqualToString:CPAErrorDomain] && error.code == CPAErrorInvalidClient) {
-                    [self discardIdentity];
-                    [self registerAndRequestTokenForDomain:domain withType:type
-                              credentialsPresentationBlock:credentialsPresentationBlock
-                                           completionBlock:completionBlock];
-                    return;
-                }
-                
-                completionBlock ? completionBlock(nil, nil, nil, nil, 0, error) : nil;
-            }
-            
-            completionBlock ? completionBlock(userName, accessToken, tokenType, domainName, expiresInSeconds, error) : nil;
-        }];
-    }
-    else {
-        // Requesting a client token when a user token is already available. We must discard the identity first, otherwise refreshing the token
-        // (which is the same for client and user tokens) at a later time would return a user token. The identity remain valid on the AP, though,
-        // and can manually be discarded by logging into the AP user account
-        if (token && token.type == CPATokenTypeUser && type != token.type) {
-            [self discardIdentity];
-        }
+    NSParameterAssert(block);
+    
+    dispatch_async(self.stateQueue, block);
+}
+
+#pragma mark Warm-up
+
+- (void)warmUp
+{
+    // Run below the priority of the caller (usually the main thread during launch). Lookups waiting on the state queue
+    // in the meantime raise its priority until warm-up is over
+    dispatch_block_t warmUpBlock = dispatch_block_create_with_qos_class(DISPATCH_BLOCK_ENFORCE_QOS_CLASS, QOS_CLASS_UTILITY, 0, ^{
+        CPATraceSpan *span = [self.tracer startSpanWithName:@"warmUp" category:@"storage" parentSpan:nil];
+        NSArray<CPAToken *> *tokens = [self loadAllTokens];
+        CPAIdentity *identity = [self identity];
+        [span setAttribute:@(tokens.count) forKey:@"token_count"];
+        [span setAttribute:@(identity != nil) forKey:@"identity_found"];
+        [span finish];
         
-        if (type == CPATokenTypeUser) {
-            [self requestCodeAndUserTokenForDomain:domain withIdentity:identity credentialsPresentationBlock:credentialsPresentationBlock completionBlock:completionBlock];
-        }
-        else {
-            [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:self.authorizationProviderURL clientIdentifier:identity.identifier clientSecret:identity.secret domain:domain completionBlock:completionBlock];
-        }
+        self.warmedUp = YES;
+    });
+    [self performAsyncOnStateQueue:warmUpBlock];
+}
+
+#pragma mark Token retrieval
+
+- (CPAToken *)tokenForDomain:(NSString *)domain
+{
+    return [self tokenForDomain:domain validForTimeInterval:0.];
+}
+
+- (CPAToken *)tokenForDomain:(NSString *)domain validForTimeInterval:(NSTimeInterval)timeInterval
+{
+    CPAToken *token = [self localTokenForDomain:domain];
+    if (token && [token isExpiredAtDate:[NSDate dateWithTimeIntervalSinceNow:timeInterval]]) {
+        atomic_fetch_add(&_expiredTokenCount, 1);
+        return nil;
     }
+    return token;
 }
 
-- (void)requestCodeAndUserTokenForDomain:(NSString *)domain
-                            withIdentity:(CPAIdentity *)identity
-            credentialsPresentationBlock:(CPACredentialsPresentationBlock)credentialsPresentationBlock
-                         completionBlock:(CPATokenRequestCompletionBlock)completionBlock
+/**
+ * Return the token locally available for a given domain, whether it has expired or not. Can be called from any thread
+ */
+- (CPAToken *)localTokenForDomain:(NSString *)domain
 {
-    [CPAStatelessRequest requestCodeWithAuthorizationProviderURL:self.authorizationProviderURL clientIdentifier:identity.identifier clientSecret:identity.secret domain:domain completionBlock:^(NSString *deviceCode, NSString *userCode, NSURL *verificationURL, NSInteger pollingInterval, NSInteger expiresInSeconds, NSError *error) {
-        if (error) {
-            // The client has been revoked and no user code can be retrieved for it anymore. Start again from scratch, registering a new client
-            if ([error.domain isEqualToString:CPAErrorDomain] && error.code == CPAErrorInvalidClient) {
-                [self discardIdentity];
-                [self registerAndRequestTokenForDomain:domain withType:CPATokenTypeUser
-                          credentialsPresentationBlock:credentialsPresentationBlock
-                                       completionBlock:completionBlock];
-                return;
-            }
-            
-            completionBlock ? completionBlock(nil, nil, nil, nil, 0, error) : nil;
+    NSParameterAssert(domain);
+    
+    // Fast path, without blocking on the state queue
+    id cachedToken = self.tokenCache[domain];
+    if (cachedToken) {
+        atomic_fetch_add(&_tokenCacheHitCount, 1);
+        return (cachedToken != [NSNull null]) ? cachedToken : nil;
+    }
+    
+    // Read from the keychain on the state queue, so that the result cannot overwrite a concurrent mutation
+    __block CPAToken *token = nil;
+    [self performSyncOnStateQueue:^{
+        id cachedToken = self.tokenCache[domain];
+        if (cachedToken) {
+            atomic_fetch_add(&_tokenCacheHitCount, 1);
+            token = (cachedToken != [NSNull null]) ? cachedToken : nil;
             return;
         }
         
-        // Open verification URL built-in browser
-        if (verificationURL) {
-            __block CPAAuthorizationViewController *authorizationViewController = [[CPAAuthorizationViewController alloc] initWithVerificationURL:verificationURL userCode:userCode completionBlock:^(BOOL isFinished, NSError *error) {
-                // The view controller was not dismissed early and must now be dismissed
-                if (isFinished) {
-                    credentialsPresentationBlock ? credentialsPresentationBlock(authorizationViewController, CPAPresentationActionDismiss) : nil;
-                }
-                authorizationViewController = nil;
-                
-                if (error) {
-                    completionBlock ? completionBlock(nil, nil, nil, nil, 0, error) : nil;
-                    return;
-                }
-                
-                [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:self.authorizationProviderURL
-                                                                       deviceCode:deviceCode
-                                                                 clientIdentifier:identity.identifier
-                                                                     clientSecret:identity.secret
-                                                                           domain:domain
-                                                                  completionBlock:completionBlock];
-            }];
-            credentialsPresentationBlock ? credentialsPresentationBlock(authorizationViewController, CPAPresentationActionShow) : nil;
-        }
-        // If no verification URL is received, this means that a refresh can be made without having to enter credentials
-        // and validate the application again. Proceed with token retrieval
-        else {
-            [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:self.authorizationProviderURL
-                                                                   deviceCode:deviceCode
-                                                             clientIdentifier:identity.identifier
-                                                                 clientSecret:identity.secret
-                                                                       domain:domain
-                                                              completionBlock:completionBlock];
-        }
+        atomic_fetch_add(&_tokenCacheMissCount, 1);
+        
+        token = [self storedTokenForDomain:domain];
+        [self setCachedToken:token forDomain:domain];
     }];
+    return token;
 }
 
-- (void)discardTokenForDomain:(NSString *)domain
+- (NSArray<CPAToken *> *)allTokens
 {
-    NSParameterAssert(domain);
-    
-    NSString *key = [self keyChainKeyForDomain:domain];
-    [self.keyChainStore removeItemForKey:key];
+    __block NSArray<CPAToken *> *tokens = nil;
+    [self performSyncOnStateQueue:^{
+        tokens = [self loadAllTokens];
+    }];
+    return tokens;
 }
 
-#pragma mark Keychain storage management
+- (NSArray<CPAToken *> *)tokensMatchingPredicate:(NSPredicate *)predicate
+{
+    NSParameterAssert(predicate);
+    
+    return [[self allTokens] filteredArrayUsingPredicate:predicate];
+}
 
-- (NSString *)keyChainIdentifier
+- (void)purgeTokenCache
 {
-    return self.authorizationProviderURL.absoluteString;
+    [self performSyncOnStateQueue:^{
+        self.tokenCache = @{};
+        self.identityLoaded = NO;
+        self.warmedUp = NO;
+        
+        if (self.tokenStorageMode == CPATokenStorageModeSingleItem) {
+            if (self.storeWriteScheduled) {
+                [self writeStore];
+            }
+            self.storeLoaded = NO;
+        }
+    }];
 }
 
-- (CPAIdentity *)identity
+/**
+ * Update the token cache for a given domain. Use nil to record that no token is available
+ */
+- (void)setCachedToken:(CPAToken *)token forDomain:(NSString *)domain
 {
-    NSData *identityData = [self.keyChainStore dataForKey:self.keyChainIdentifier];
-    return identityData ? [NSKeyedUnarchiver unarchiveObjectWithData:identityData] : nil;
+    NSParameterAssert(domain);
+    
+    NSMutableDictionary<NSString *, id> *tokenCache = [self.tokenCache mutableCopy];
+    tokenCache[domain] = token ?: [NSNull null];
+    self.tokenCache = [tokenCache copy];
 }
 
-- (void)setIdentity:(CPAIdentity *)identity
+- (CPARequestHandle *)requestTokenForDomain:(NSString *)domain withType:(CPATokenType)type completionBlock:(CPATokenCompletionBlock)completionBlock
 {
-    NSData *identityData = [NSKeyedArchiver archivedDataWithRootObject:identity];
-    [self.keyChainStore setData:identityData forKey:self.keyChainIdentifier];
+    return [self requestTokenForDomain:domain withType:type credentialsPresentationBlock:nil completionBlock:completionBlock];
 }
 
-- (void)discardIdentity
+- (CPARequestHandle *)requestTokenForDomain:(NSString *)domain
+                                   withType:(CPATokenType)type
+               credentialsPresentationBlock:(CPACredentialsPresentationBlock)credentialsPresentationBlock
+                            completionBlock:(CPATokenCompletionBlock)completionBlock
 {
-    [self.keyChainStore removeAllItems];
+    NSParameterAssert(domain);
+    
+    if (! credentialsPresentationBlock) {
+        credentialsPresentationBlock = [self defaultCredentialsPresentationBlock];
+    }
+    
+    CPAUserCodePresentationBlock userCodePresentationBlock = [self userCodePresentationBlockWithCredentialsPresentationBlock:credentialsPresentationBlock];
+    CPARequestHandle *requestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:completionBlock];
+    
+    [self performAsyncOnStateQueue:^{
+        [self performTokenRequestForDomain:domain withType:type identity:nil parentSpan:nil userCodePresentationBlock:userCodePresentationBlock requestHandle:requestHandle];
+    }];
+    return requestHandle;
 }
 
-- (NSString *)keyChainKeyForDomain:(NSString *)domain
+- (CPARequestHandle *)requestUserTokenForDomain:(NSString *)domain userCodeBlock:(CPAUserCodeBlock)userCodeBlock completionBlock:(CPATokenCompletionBlock)completionBlock
 {
     NSParameterAssert(domain);
+    NSParameterAssert(userCodeBlock);
     
-    // FIXME: If we want to support multiple users per application, the key should also contain a reference
-    //        to a reliable user identifier. Currently only the user display name can be retrieved (user_name),
-    //        which is sadly not reliable enough since it might change
-    return [NSString stringWithFormat:@"%@_%@", self.keyChainIdentifier, domain];
+    // Authorization is made on another device. Display the code and wait for authorization. Nothing needs to be dismissed
+    // if the request is cancelled
+    CPAUserCodePresentationBlock userCodePresentationBlock = ^dispatch_block_t (NSString *userCode, NSURL *verificationURL, CPAUserCodePresentationCompletionBlock completionBlock) {
+        userCodeBlock(userCode, verificationURL);
+        completionBlock(NO, nil);
+        return nil;
+    };
+    CPARequestHandle *requestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:completionBlock];
+    
+    [self performAsyncOnStateQueue:^{
+        [self performTokenRequestForDomain:domain withType:CPATokenTypeUser identity:nil parentSpan:nil userCodePresentationBlock:userCodePresentationBlock requestHandle:requestHandle];
+    }];
+    return requestHandle;
 }
 
-- (void)setToken:(CPAToken *)token forDomain:(NSString *)domain
+- (void)cancelTokenRequestForDomain:(NSString *)domain withType:(CPATokenType)type
 {
     NSParameterAssert(domain);
     
-    NSData *tokenData = [NSKeyedArchiver archivedDataWithRootObject:token];
-    NSString *key = [self keyChainKeyForDomain:domain];
-    [self.keyChainStore setData:tokenData forKey:key];
+    [self performSyncOnStateQueue:^{
+        NSString *requestKey = [self requestKeyForDomain:domain withType:type];
+        [self.deviceCodePollers[requestKey] cancel];
+    }];
+}
+
+- (CPARequestHandle *)requestTokensForDomains:(NSArray<NSString *> *)domains withType:(CPATokenType)type completionBlock:(CPATokensCompletionBlock)completionBlock
+{
+    NSParameterAssert(domains);
+    
+    NSArray<NSString *> *uniqueDomains = [NSOrderedSet orderedSetWithArray:domains].array;
+    CPARequestHandle *requestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:completionBlock];
+    
+    [self performAsyncOnStateQueue:^{
+        if (requestHandle.cancelled) {
+            return;
+        }
+        
+        if (uniqueDomains.count == 0) {
+            dispatch_async(self.completionQueue, ^{
+                CPATokensCompletionBlock pendingCompletionBlock = [requestHandle finish];
+                pendingCompletionBlock ? pendingCompletionBlock(@{}, @{}) : nil;
+            });
+            return;
+        }
+        
+        CPATraceSpan *span = [self.tracer startSpanWithName:@"requestTokens" category:@"provider" parentSpan:nil];
+        [span setAttribute:@(uniqueDomains.count) forKey:@"domain_count"];
+        
+        [requestHandle addCancellationBlock:^{
+            [span setAttribute:@YES forKey:@"cancelled"];
+            [span finish];
+        }];
+        
+        CPATokensCompletionBlock tracedCompletionBlock = ^(NSDictionary<NSString *, CPAToken *> *tokens, NSDictionary<NSString *, NSError *> *errors) {
+            CPATokensCompletionBlock pendingCompletionBlock = [requestHandle finish];
+            [span finishWithError:errors.allValues.firstObject];
+            pendingCompletionBlock ? pendingCompletionBlock(tokens, errors) : nil;
+        };
+        
+        // Register or read the identity once for all domains
+        CPAIdentity *identity = [self identityWithParentSpan:span];
+        if (identity) {
+            [self requestTokensForDomains:uniqueDomains withType:type identity:identity parentSpan:span requestHandle:requestHandle completionBlock:tracedCompletionBlock];
+        }
+        else {
+            CPARequestHandle *registrationRequestHandle = [self registerClientWithParentSpan:span completionBlock:^(CPAIdentity *identity, NSError *error) {
+                if (error) {
+                    NSMutableDictionary<NSString *, NSError *> *errors = [NSMutableDictionary dictionary];
+                    for (NSString *domain in uniqueDomains) {
+                        errors[domain] = error;
+                    }
+                    
+                    dispatch_async(self.completionQueue, ^{
+                        tracedCompletionBlock(@{}, [errors copy]);
+                    });
+                    return;
+                }
+                
+                [self requestTokensForDomains:uniqueDomains withType:type identity:identity parentSpan:span requestHandle:requestHandle completionBlock:tracedCompletionBlock];
+            }];
+            [requestHandle addChildRequestHandle:registrationRequestHandle];
+        }
+    }];
+    return requestHandle;
+}
+
+/**
+ * Request tokens for several domains on behalf of the provided identity, running at most maximumConcurrentTokenRequestCount
+ * requests at the same time. Running requests are cancelled and no new requests are started if the specified request
+ * handle is cancelled, in which case the completion block is not called
+ */
+- (void)requestTokensForDomains:(NSArray<NSString *> *)domains
+                       withType:(CPATokenType)type
+                       identity:(CPAIdentity *)identity
+                     parentSpan:(CPATraceSpan *)parentSpan
+                  requestHandle:(CPARequestHandle *)requestHandle
+                completionBlock:(CPATokensCompletionBlock)completionBlock
+{
+    NSParameterAssert(domains);
+    NSParameterAssert(identity);
+    NSParameterAssert(requestHandle);
+    
+    NSMutableArray<NSString *> *remainingDomains = [domains mutableCopy];
+    NSMutableDictionary<NSString *, CPAToken *> *tokens = [NSMutableDictionary dictionary];
+    NSMutableDictionary<NSString *, NSError *> *errors = [NSMutableDictionary dictionary];
+    
+    // User token requests might present the credentials UI, and are therefore performed one after the other
+    NSUInteger maximumConcurrentTokenRequestCount = (type == CPATokenTypeUser) ? 1 : MAX(self.maximumConcurrentTokenRequestCount, 1);
+    __block NSUInteger runningTokenRequestCount = 0;
+    
+    CPAUserCodePresentationBlock userCodePresentationBlock = [self userCodePresentationBlockWithCredentialsPresentationBlock:[self defaultCredentialsPresentationBlock]];
+    
+    // Start the next request when a slot is available. The block references itself and is released when all requests
+    // are over, or when the requests are cancelled
+    __block void (^requestNextToken)(void) = ^{
+        NSString *domain = remainingDomains.firstObject;
+        if (! domain) {
+            if (runningTokenRequestCount == 0) {
+                NSDictionary<NSString *, CPAToken *> *receivedTokens = [tokens copy];
+                NSDictionary<NSString *, NSError *> *receivedErrors = [errors copy];
+                dispatch_async(self.completionQueue, ^{
+                    completionBlock ? completionBlock(receivedTokens, receivedErrors) : nil;
+                });
+                requestNextToken = nil;
+            }
+            return;
+        }
+        
+        [remainingDomains removeObjectAtIndex:0];
+        ++runningTokenRequestCount;
+        
+        CPARequestHandle *tokenRequestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:^(CPAToken *token, NSError *error) {
+            [self performAsyncOnStateQueue:^{
+                if (error) {
+                    errors[domain] = error;
+                }
+                else {
+                    tokens[domain] = token;
+                }
+                
+                --runningTokenRequestCount;
+                requestNextToken ? requestNextToken() : nil;
+            }];
+        }];
+        [requestHandle addChildRequestHandle:tokenRequestHandle];
+        
+        [self performTokenRequestForDomain:domain withType:type identity:identity parentSpan:parentSpan userCodePresentationBlock:userCodePresentationBlock requestHandle:tokenRequestHandle];
+    };
+    
+    [requestHandle addCancellationBlock:^{
+        [self performAsyncOnStateQueue:^{
+            requestNextToken = nil;
+        }];
+    }];
+    
+    for (NSUInteger i = 0; i < MIN(maximumConcurrentTokenRequestCount, domains.count); ++i) {
+        requestNextToken ? requestNextToken() : nil;
+    }
+}
+
+/**
+ * Request a token, sharing the result with a running request for the same domain and type, if any. If no identity is
+ * provided, it is read or registered first. The completion block of the request handle is called on the completion
+ * queue. The request is traced as a child of the parent span, if any
+ *
+ * The token is requested on behalf of all request handles waiting for it. It is only cancelled once all of them have
+ * been cancelled
+ */
+- (void)performTokenRequestForDomain:(NSString *)domain
+                            withType:(CPATokenType)type
+                            identity:(CPAIdentity *)identity
+                          parentSpan:(CPATraceSpan *)parentSpan
+           userCodePresentationBlock:(CPAUserCodePresentationBlock)userCodePresentationBlock
+                       requestHandle:(CPARequestHandle *)requestHandle
+{
+    NSParameterAssert(domain);
+    NSParameterAssert(requestHandle);
+    
+    if (requestHandle.cancelled) {
+        return;
+    }
+    
+    // Serve a recently expired token right away, and refresh it in the background
+    CPAToken *staleToken = [self staleTokenForDomain:domain withType:type];
+    CPAIdentity *staleTokenIdentity = staleToken ? (identity ?: [self identityWithParentSpan:parentSpan]) : nil;
+    if (staleTokenIdentity) {
+        CPATraceSpan *span = [self.tracer startSpanWithName:@"requestToken" category:@"provider" parentSpan:parentSpan];
+        [span setAttribute:domain forKey:@"domain"];
+        [span setAttribute:@YES forKey:@"stale"];
+        
+        // Failed refreshes are not attempted again before the retry interval has elapsed
+        NSDate *notBeforeDate = self.tokenRefreshNotBeforeDates[domain];
+        if (! [self.refreshingDomains containsObject:domain] && (! notBeforeDate || [notBeforeDate timeIntervalSinceNow] <= 0.)) {
+            [self refreshToken:staleToken withIdentity:staleTokenIdentity parentSpan:span];
+        }
+        [span finish];
+        
+        dispatch_async(self.completionQueue, ^{
+            CPATokenCompletionBlock completionBlock = [requestHandle finish];
+            completionBlock ? completionBlock(staleToken, nil) : nil;
+        });
+        return;
+    }
+    
+    // Stop waiting for the token if the request is cancelled
+    NSString *requestKey = [self requestKeyForDomain:domain withType:type];
+    __weak CPARequestHandle *weakRequestHandle = requestHandle;
+    [requestHandle addCancellationBlock:^{
+        [self performAsyncOnStateQueue:^{
+            [self removePendingRequestHandle:weakRequestHandle forRequestKey:requestKey];
+        }];
+    }];
+    
+    // A request for the same token is already running. Wait for its result instead of contacting the AP again
+    NSMutableArray<CPARequestHandle *> *requestHandles = self.pendingRequestHandles[requestKey];
+    if (requestHandles) {
+        [requestHandles addObject:requestHandle];
+        return;
+    }
+    
+    requestHandles = [NSMutableArray arrayWithObject:requestHandle];
+    self.pendingRequestHandles[requestKey] = requestHandles;
+    
+    // Handle of the request made to the AP on behalf of all pending request handles
+    CPARequestHandle *sharedRequestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:nil];
+    self.sharedRequestHandles[requestKey] = sharedRequestHandle;
+    
+    CPATraceSpan *span = [self.tracer startSpanWithName:@"requestToken" category:@"provider" parentSpan:parentSpan];
+    [span setAttribute:domain forKey:@"domain"];
+    [span setAttribute:(type == CPATokenTypeUser) ? @"user" : @"client" forKey:@"type"];
+    
+    [sharedRequestHandle addCancellationBlock:^{
+        [span setAttribute:@YES forKey:@"cancelled"];
+        [span finish];
+    }];
+    
+    CPATokenRequestCompletionBlock tokenRequestCompletionBlock = ^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        [self performAsyncOnStateQueue:^{
+            // Cancelled in the meantime, all pending request handles having been cancelled. Do not store anything
+            if (sharedRequestHandle.cancelled) {
+                return;
+            }
+            
+            [sharedRequestHandle finish];
+            
+            NSArray<CPARequestHandle *> *completedRequestHandles = [requestHandles copy];
+            [self.pendingRequestHandles removeObjectForKey:requestKey];
+            [self.sharedRequestHandles removeObjectForKey:requestKey];
+            
+            CPAToken *token = nil;
+            if (! error) {
+                CPATraceSpan *storageSpan = [self.tracer startSpanWithName:@"storeToken" category:@"storage" parentSpan:span];
+                token = [self storeTokenForDomain:domain withAccessToken:accessToken domainName:domainName userName:userName expiresInSeconds:expiresInSeconds];
+                [storageSpan finish];
+            }
+            [span finishWithError:error];
+            
+            dispatch_async(self.completionQueue, ^{
+                for (CPARequestHandle *pendingRequestHandle in completedRequestHandles) {
+                    CPATokenCompletionBlock pendingCompletionBlock = [pendingRequestHandle finish];
+                    pendingCompletionBlock ? pendingCompletionBlock(token, error) : nil;
+                }
+            });
+        }];
+    };
+    
+    if (identity) {
+        [self requestTokenForDomain:domain withType:type identity:identity span:span requestHandle:sharedRequestHandle userCodePresentationBlock:userCodePresentationBlock completionBlock:tokenRequestCompletionBlock];
+    }
+    else {
+        [self registerAndRequestTokenForDomain:domain withType:type span:span requestHandle:sharedRequestHandle userCodePresentationBlock:userCodePresentationBlock completionBlock:tokenRequestCompletionBlock];
+    }
+}
+
+/**
+ * Return the token locally available for the specified domain if it has the specified type and expired within the stale
+ * token grace interval, nil otherwise
+ */
+- (CPAToken *)staleTokenForDomain:(NSString *)domain withType:(CPATokenType)type
+{
+    NSParameterAssert(domain);
+    
+    NSTimeInterval staleTokenGraceInterval = self.staleTokenGraceInterval;
+    if (staleTokenGraceInterval <= 0.) {
+        return nil;
+    }
+    
+    CPAToken *token = [self localTokenForDomain:domain];
+    if (! token || token.type != type) {
+        return nil;
+    }
+    
+    NSDate *date = [NSDate date];
+    if (! [token isExpiredAtDate:date] || [token isExpiredAtDate:[date dateByAddingTimeInterval:-staleTokenGraceInterval]]) {
+        return nil;
+    }
+    
+    return token;
+}
+
+/**
+ * Stop waiting for a token on behalf of a cancelled request handle. If no other request handle is waiting for the same
+ * token, the request made to the AP is cancelled as well
+ */
+- (void)removePendingRequestHandle:(CPARequestHandle *)requestHandle forRequestKey:(NSString *)requestKey
+{
+    NSParameterAssert(requestKey);
+    
+    NSMutableArray<CPARequestHandle *> *requestHandles = self.pendingRequestHandles[requestKey];
+    if (! requestHandle || [requestHandles indexOfObjectIdenticalTo:requestHandle] == NSNotFound) {
+        return;
+    }
+    
+    [requestHandles removeObjectIdenticalTo:requestHandle];
+    if (requestHandles.count != 0) {
+        return;
+    }
+    
+    CPARequestHandle *sharedRequestHandle = self.sharedRequestHandles[requestKey];
+    [self.pendingRequestHandles removeObjectForKey:requestKey];
+    [self.sharedRequestHandles removeObjectForKey:requestKey];
+    [sharedRequestHandle cancel];
+    
+    // The domain might now be eligible for automatic refresh again
+    [self scheduleTokenRefresh];
+}
+
+/**
+ * Default presentation: Modal, wrapped in a navigation controller, with a cancel button at the top left
+ */
+- (CPACredentialsPresentationBlock)defaultCredentialsPresentationBlock
+{
+    return ^(UIViewController *viewController, CPAPresentationAction action) {
+        viewController.navigationItem.leftBarButtonItem = [[UIBarButtonItem alloc] initWithTitle:CPALocalizedString(@"Cancel", nil)
+                                                                                           style:UIBarButtonItemStylePlain
+                                                                                          target:self
+                                                                                          action:@selector(closeCredentials:)];
+        
+        UIViewController *rootViewController = [UIApplication sharedApplication].keyWindow.rootViewController;
+        if (action == CPAPresentationActionShow) {
+            UINavigationController *navigationController = [[UINavigationController alloc] initWithRootViewController:viewController];
+            navigationController.modalPresentationStyle = UIModalPresentationFormSheet;
+            [rootViewController presentViewController:navigationController animated:YES completion:nil];
+        }
+        else {
+            [rootViewController dismissViewControllerAnimated:YES completion:nil];
+        }
+    };
+}
+
+/**
+ * Present the user code in the built-in browser, using the specified credentials presentation block
+ */
+- (CPAUserCodePresentationBlock)userCodePresentationBlockWithCredentialsPresentationBlock:(CPACredentialsPresentationBlock)credentialsPresentationBlock
+{
+    NSParameterAssert(credentialsPresentationBlock);
+    
+    // Request completion blocks are called on the main thread, the UI can therefore be safely presented
+    return ^dispatch_block_t (NSString *userCode, NSURL *verificationURL, CPAUserCodePresentationCompletionBlock completionBlock) {
+        __block CPAAuthorizationViewController *authorizationViewController = [[CPAAuthorizationViewController alloc] initWithVerificationURL:verificationURL userCode:userCode completionBlock:^(BOOL isFinished, NSError *error) {
+            // The view controller was not dismissed early and must now be dismissed
+            if (isFinished) {
+                credentialsPresentationBlock(authorizationViewController, CPAPresentationActionDismiss);
+            }
+            authorizationViewController = nil;
+            
+            completionBlock(YES, error);
+        }];
+        credentialsPresentationBlock(authorizationViewController, CPAPresentationActionShow);
+        
+        // Dismiss the view controller if the request is cancelled while it is displayed, without reporting anything
+        return ^{
+            dispatch_async(dispatch_get_main_queue(), ^{
+                if (! authorizationViewController) {
+                    return;
+                }
+                
+                authorizationViewController.completionBlock = nil;
+                credentialsPresentationBlock(authorizationViewController, CPAPresentationActionDismiss);
+                authorizationViewController = nil;
+            });
+        };
+    };
+}
+
+- (NSString *)requestKeyForDomain:(NSString *)domain withType:(CPATokenType)type
+{
+    NSParameterAssert(domain);
+    
+    return [NSString stringWithFormat:@"%@_%@", domain, @(type)];
+}
+
+/**
+ * Create a token from the information received from the AP, and save it for the specified domain
+ */
+- (CPAToken *)storeTokenForDomain:(NSString *)domain
+                  withAccessToken:(NSString *)accessToken
+                       domainName:(NSString *)domainName
+                         userName:(NSString *)userName
+                 expiresInSeconds:(NSInteger)expiresInSeconds
+{
+    NSDate *expirationDate = [[NSDate date] dateByAddingTimeInterval:expiresInSeconds];
+    CPAToken *token = [[CPAToken alloc] initWithValue:accessToken
+                                               domain:domain
+                                           domainName:domainName
+                                             userName:userName
+                                       expirationDate:expirationDate];
+    [self setToken:token forDomain:domain];
+    return token;
+}
+
+/**
+ * Create a new identity if needed and obtain a client / user token for the specified domain on its behalf. Steps are
+ * traced as children of the specified token request span, if any, and cancelled with the specified request handle
+ */
+- (void)registerAndRequestTokenForDomain:(NSString *)domain
+                                withType:(CPATokenType)type
+                                    span:(CPATraceSpan *)span
+                           requestHandle:(CPARequestHandle *)requestHandle
+               userCodePresentationBlock:(CPAUserCodePresentationBlock)userCodePresentationBlock
+                         completionBlock:(CPATokenRequestCompletionBlock)completionBlock
+{
+    if (requestHandle.cancelled) {
+        return;
+    }
+    
+    // If an identity has already been retrieved for this provider, reuse it. This makes single sign-on possible (the AP
+    // might automatically grant a token for a domain if a token for an affiliated domain has already been granted)
+    CPAIdentity *identity = [self identityWithParentSpan:span];
+    if (identity) {
+        [self requestTokenForDomain:domain withType:type identity:identity span:span requestHandle:requestHandle userCodePresentationBlock:userCodePresentationBlock completionBlock:completionBlock];
+    }
+    else {
+        CPARequestHandle *registrationRequestHandle = [self registerClientWithParentSpan:span completionBlock:^(CPAIdentity *identity, NSError *error) {
+            if (error) {
+                completionBlock ? completionBlock(nil, nil, nil, nil, 0, error) : nil;
+                return;
+            }
+            
+            [self requestTokenForDomain:domain withType:type identity:identity span:span requestHandle:requestHandle userCodePresentationBlock:userCodePresentationBlock completionBlock:completionBlock];
+        }];
+        [requestHandle addChildRequestHandle:registrationRequestHandle];
+    }
+}
+
+/**
+ * Read the identity, tracing the token store access as a child of the specified span, if any
+ */
+- (CPAIdentity *)identityWithParentSpan:(CPATraceSpan *)parentSpan
+{
+    CPATraceSpan *span = [self.tracer startSpanWithName:@"readIdentity" category:@"storage" parentSpan:parentSpan];
+    CPAIdentity *identity = [self identity];
+    [span setAttribute:@(identity != nil) forKey:@"found"];
+    [span finish];
+    return identity;
+}
+
+/**
+ * Discard the identity, tracing the token store access as a child of the specified span, if any
+ */
+- (void)discardIdentityWithParentSpan:(CPATraceSpan *)parentSpan
+{
+    CPATraceSpan *span = [self.tracer startSpanWithName:@"discardIdentity" category:@"storage" parentSpan:parentSpan];
+    [self discardIdentity];
+    [span finish];
+}
+
+/**
+ * Register a new client with the AP and save the associated identity. The completion block is called on the state queue,
+ * except if the returned request is cancelled, in which case no identity is saved. Registration is traced as a child of
+ * the parent span, if any
+ */
+- (CPARequestHandle *)registerClientWithParentSpan:(CPATraceSpan *)parentSpan completionBlock:(void (^)(CPAIdentity *identity, NSError *error))completionBlock
+{
+    NSParameterAssert(completionBlock);
+    
+    NSString *clientName = [NSBundle mainBundle].infoDictionary[@"CFBundleName"];
+    NSAssert(clientName, @"A client name is required");
+    
+    NSString *softwareIdentifier = [NSBundle mainBundle].bundleIdentifier;
+    NSAssert(softwareIdentifier, @"A software identifier is required");
+    
+    NSString *softwareVersion = [NSBundle mainBundle].infoDictionary[@"CFBundleShortVersionString"];
+    NSAssert(softwareVersion, @"A software version is required");
+    
+    CPATraceSpan *span = [self.tracer startSpanWithName:@"register" category:@"request" parentSpan:parentSpan];
+    CPARequestHandle *requestHandle = [CPAStatelessRequest registerClientWithAuthorizationProviderURL:self.authorizationProviderURL clientName:clientName softwareIdentifier:softwareIdentifier softwareVersion:softwareVersion completionQueue:self.stateQueue completionBlock:^(NSString *clientIdentifier, NSString *clientSecret, NSError *error) {
+        [span finishWithError:error];
+        
+        [self performAsyncOnStateQueue:^{
+            if (error) {
+                completionBlock(nil, error);
+                return;
+            }
+            
+            CPAIdentity *identity = [[CPAIdentity alloc] initWithIdentifier:clientIdentifier secret:clientSecret];
+            CPATraceSpan *storageSpan = [self.tracer startSpanWithName:@"storeIdentity" category:@"storage" parentSpan:parentSpan];
+            [self setIdentity:identity];
+            [storageSpan finish];
+            completionBlock(identity, nil);
+        }];
+    }];
+    [requestHandle addCancellationBlock:^{
+        [span setAttribute:@YES forKey:@"cancelled"];
+        [span finish];
+    }];
+    return requestHandle;
+}
+
+/**
+ * Request a client / user token for the specified domain on behalf of the provided identity. Steps are traced as children
+ * of the specified token request span, if any, and cancelled with the specified request handle
+ */
+- (void)requestTokenForDomain:(NSString *)domain
+                     withType:(CPATokenType)type
+                     identity:(CPAIdentity *)identity
+                         span:(CPATraceSpan *)span
+                requestHandle:(CPARequestHandle *)requestHandle
+    userCodePresentationBlock:(CPAUserCodePresentationBlock)userCodePresentationBlock
+              completionBlock:(CPATokenRequestCompletionBlock)completionBlock
+{
+    if (requestHandle.cancelled) {
+        return;
+    }
+    
+    // Token of the same type already available from the keychain, even expired. Attempt a refresh
+    CPATraceSpan *storageSpan = [self.tracer startSpanWithName:@"readToken" category:@"storage" parentSpan:span];
+    CPAToken *token = [self localTokenForDomain:domain];
+    [storageSpan setAttribute:@(token != nil) forKey:@"found"];
+    [storageSpan finish];
+    
+    if (token && token.type == type) {
+        CPATraceSpan *refreshSpan = [self.tracer startSpanWithName:@"refresh" category:@"request" parentSpan:span];
+        CPARequestHandle *refreshRequestHandle = [CPAStatelessRequest refreshTokenWithAuthorizationProviderURL:self.authorizationProviderURL clientIdentifier:identity.identifier clientSecret:identity.secret domain:domain completionQueue:self.stateQueue completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+            [refreshSpan finishWithError:error];
+            
+            if (error) {
+                // The client has been revoked and the token cannot thus be refreshed. Start again from scratch, registering a new client
+                if ([error.domain isEqualToString:CPAErrorDomain] && error.code == CPAErrorInvalidClient) {
+                    [self performAsyncOnStateQueue:^{
+                        if (requestHandle.cancelled) {
+                            return;
+                        }
+                        
+                        [self discardIdentityWithParentSpan:span];
+                        [self registerAndRequestTokenForDomain:domain withType:type
+                                                          span:span
+                                                 requestHandle:requestHandle
+                                     userCodePresentationBlock:userCodePresentationBlock
+                                               completionBlock:completionBlock];
+                    }];
+                    return;
+                }
+                
+                completionBlock ? completionBlock(nil, nil, nil, nil, 0, error) : nil;
+                return;
+            }
+            
+            completionBlock ? completionBlock(userName, accessToken, tokenType, domainName, expiresInSeconds, error) : nil;
+        }];
+        [requestHandle addChildRequestHandle:refreshRequestHandle];
+    }
+    else {
+        // Requesting a client token when a user token is already available. We must discard the identity first, otherwise refreshing the token
+        // (which is the same for client and user tokens) at a later time would return a user token. The identity remain valid on the AP, though,
+        // and can manually be discarded by logging into the AP user account
+        if (token && token.type == CPATokenTypeUser && type != token.type) {
+            [self discardIdentityWithParentSpan:span];
+        }
+        
+        if (type == CPATokenTypeUser) {
+            [self requestCodeAndUserTokenForDomain:domain withIdentity:identity span:span requestHandle:requestHandle userCodePresentationBlock:userCodePresentationBlock completionBlock:completionBlock];
+        }
+        else {
+            CPATraceSpan *tokenSpan = [self.tracer startSpanWithName:@"requestClientToken" category:@"request" parentSpan:span];
+            CPARequestHandle *tokenRequestHandle = [CPAStatelessRequest requestClientTokenWithAuthorizationProviderURL:self.authorizationProviderURL clientIdentifier:identity.identifier clientSecret:identity.secret domain:domain completionQueue:self.stateQueue completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+                [tokenSpan finishWithError:error];
+                completionBlock ? completionBlock(userName, accessToken, tokenType, domainName, expiresInSeconds, error) : nil;
+            }];
+            [requestHandle addChildRequestHandle:tokenRequestHandle];
+        }
+    }
+}
+
+- (void)requestCodeAndUserTokenForDomain:(NSString *)domain
+                            withIdentity:(CPAIdentity *)identity
+                                    span:(CPATraceSpan *)span
+                           requestHandle:(CPARequestHandle *)requestHandle
+               userCodePresentationBlock:(CPAUserCodePresentationBlock)userCodePresentationBlock
+                         completionBlock:(CPATokenRequestCompletionBlock)completionBlock
+{
+    CPATraceSpan *codeSpan = [self.tracer startSpanWithName:@"requestCode" category:@"request" parentSpan:span];
+    // The user code is presented right away, on the main thread
+    CPARequestHandle *codeRequestHandle = [CPAStatelessRequest requestCodeWithAuthorizationProviderURL:self.authorizationProviderURL clientIdentifier:identity.identifier clientSecret:identity.secret domain:domain completionQueue:dispatch_get_main_queue() completionBlock:^(NSString *deviceCode, NSString *userCode, NSURL *verificationURL, NSInteger pollingInterval, NSInteger expiresInSeconds, NSError *error) {
+        [codeSpan finishWithError:error];
+        
+        if (error) {
+            // The client has been revoked and no user code can be retrieved for it anymore. Start again from scratch, registering a new client
+            if ([error.domain isEqualToString:CPAErrorDomain] && error.code == CPAErrorInvalidClient) {
+                [self performAsyncOnStateQueue:^{
+                    if (requestHandle.cancelled) {
+                        return;
+                    }
+                    
+                    [self discardIdentityWithParentSpan:span];
+                    [self registerAndRequestTokenForDomain:domain withType:CPATokenTypeUser
+                                                      span:span
+                                             requestHandle:requestHandle
+                                 userCodePresentationBlock:userCodePresentationBlock
+                                           completionBlock:completionBlock];
+                }];
+                return;
+            }
+            
+            completionBlock ? completionBlock(nil, nil, nil, nil, 0, error) : nil;
+            return;
+        }
+        
+        // Let the user authorize the application, and poll the AP until this has been done
+        if (verificationURL) {
+            CPATraceSpan *presentationSpan = [self.tracer startSpanWithName:@"presentCredentials" category:@"ui" parentSpan:span];
+            dispatch_block_t presentationCancellationBlock = userCodePresentationBlock(userCode, verificationURL, ^(BOOL isAuthorized, NSError *error) {
+                [presentationSpan setAttribute:@(isAuthorized) forKey:@"authorized"];
+                [presentationSpan finishWithError:error];
+                
+                if (error) {
+                    completionBlock ? completionBlock(nil, nil, nil, nil, 0, error) : nil;
+                    return;
+                }
+                
+                [self performAsyncOnStateQueue:^{
+                    if (requestHandle.cancelled) {
+                        return;
+                    }
+                    
+                    NSString *requestKey = [self requestKeyForDomain:domain withType:CPATokenTypeUser];
+                    CPADeviceCodePoller *deviceCodePoller = [[CPADeviceCodePoller alloc] initWithAuthorizationProviderURL:self.authorizationProviderURL
+                                                                                                               deviceCode:deviceCode
+                                                                                                         clientIdentifier:identity.identifier
+                                                                                                             clientSecret:identity.secret
+                                                                                                                   domain:domain
+                                                                                                          pollingInterval:pollingInterval
+                                                                                                         expiresInSeconds:expiresInSeconds];
+                    deviceCodePoller.completionQueue = self.stateQueue;
+                    self.deviceCodePollers[requestKey] = deviceCodePoller;
+                    
+                    // If the user authorized the application on this device, the token should be available right away
+                    NSTimeInterval delay = isAuthorized ? 0. : deviceCodePoller.pollingInterval;
+                    CPATraceSpan *pollingSpan = [self.tracer startSpanWithName:@"pollUserToken" category:@"request" parentSpan:span];
+                    [deviceCodePoller startWithDelay:delay completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+                        [pollingSpan finishWithError:error];
+                        
+                        [self performAsyncOnStateQueue:^{
+                            if (self.deviceCodePollers[requestKey] == deviceCodePoller) {
+                                [self.deviceCodePollers removeObjectForKey:requestKey];
+                            }
+                        }];
+                        
+                        completionBlock ? completionBlock(userName, accessToken, tokenType, domainName, expiresInSeconds, error) : nil;
+                    }];
+                    
+                    __weak CPADeviceCodePoller *weakDeviceCodePoller = deviceCodePoller;
+                    [requestHandle addCancellationBlock:^{
+                        [weakDeviceCodePoller cancel];
+                    }];
+                }];
+            });
+            
+            if (presentationCancellationBlock) {
+                [requestHandle addCancellationBlock:presentationCancellationBlock];
+            }
+        }
+        // If no verification URL is received, this means that a refresh can be made without having to enter credentials
+        // and validate the application again. Proceed with token retrieval
+        else {
+            CPATraceSpan *tokenSpan = [self.tracer startSpanWithName:@"requestUserToken" category:@"request" parentSpan:span];
+            CPARequestHandle *tokenRequestHandle = [CPAStatelessRequest requestUserTokenWithAuthorizationProviderURL:self.authorizationProviderURL
+                                                                                                          deviceCode:deviceCode
+                                                                                                    clientIdentifier:identity.identifier
+                                                                                                        clientSecret:identity.secret
+                                                                                                              domain:domain
+                                                                                                     completionQueue:self.stateQueue
+                                                                                                     completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+                [tokenSpan finishWithError:error];
+                completionBlock ? completionBlock(userName, accessToken, tokenType, domainName, expiresInSeconds, error) : nil;
+            }];
+            [requestHandle addChildRequestHandle:tokenRequestHandle];
+        }
+    }];
+    [requestHandle addChildRequestHandle:codeRequestHandle];
+}
+
+- (void)discardTokenForDomain:(NSString *)domain
+{
+    NSParameterAssert(domain);
+    
+    [self performSyncOnStateQueue:^{
+        [self removeStoredTokenForDomain:domain];
+        [self setCachedToken:nil forDomain:domain];
+        
+        [self scheduleTokenRefresh];
+    }];
+}
+
+#pragma mark Expired token purge
+
+- (void)purgeExpiredTokens
+{
+    [self performAsyncOnStateQueue:^{
+        [self removeExpiredTokens];
+    }];
+}
+
+/**
+ * Remove all expired tokens from the token store and from the token cache. Tokens which can still be served stale are
+ * kept until the grace interval has elapsed
+ */
+- (void)removeExpiredTokens
+{
+    NSDate *date = [NSDate dateWithTimeIntervalSinceNow:-fmax(self.staleTokenGraceInterval, 0.)];
+    NSMutableArray<NSString *> *domains = [NSMutableArray array];
+    for (CPAToken *token in [self loadAllTokens]) {
+        if ([token isExpiredAtDate:date]) {
+            [domains addObject:token.domain];
+        }
+    }
+    
+    if (domains.count == 0) {
+        return;
+    }
+    
+    [self removeStoredTokensForDomains:domains];
+    
+    NSMutableDictionary<NSString *, id> *tokenCache = [self.tokenCache mutableCopy];
+    for (NSString *domain in domains) {
+        tokenCache[domain] = [NSNull null];
+    }
+    self.tokenCache = [tokenCache copy];
+    
+    atomic_fetch_add(&_purgedTokenCount, domains.count);
+    
+    [self scheduleTokenRefresh];
+}
+
+/**
+ * Schedule periodic purges of expired tokens, if enabled
+ */
+- (void)scheduleExpiredTokenPurge
+{
+    if (self.expiredTokenPurgeTimerSource) {
+        dispatch_source_cancel(self.expiredTokenPurgeTimerSource);
+        self.expiredTokenPurgeTimerSource = nil;
+    }
+    
+    NSTimeInterval interval = _expiredTokenPurgeInterval;
+    if (interval == 0.) {
+        return;
+    }
+    
+    __weak __typeof(self) weakSelf = self;
+    self.expiredTokenPurgeTimerSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.stateQueue);
+    dispatch_source_set_timer(self.expiredTokenPurgeTimerSource,
+                              dispatch_time(DISPATCH_TIME_NOW, (int64_t)(interval * NSEC_PER_SEC)),
+                              (uint64_t)(interval * NSEC_PER_SEC),
+                              (uint64_t)(interval * 0.1 * NSEC_PER_SEC));
+    dispatch_source_set_event_handler(self.expiredTokenPurgeTimerSource, ^{
+        [weakSelf removeExpiredTokens];
+    });
+    dispatch_resume(self.expiredTokenPurgeTimerSource);
+}
+
+#pragma mark Automatic token refresh
+
+- (void)startTokenRefreshScheduling
+{
+    [self performSyncOnStateQueue:^{
+        if (self.schedulingTokenRefresh) {
+            return;
+        }
+        
+        // Load all tokens saved for this provider so that they can be scheduled as well
+        [self loadAllTokens];
+        
+        self.schedulingTokenRefresh = YES;
+        [self scheduleTokenRefresh];
+    }];
+}
+
+- (void)stopTokenRefreshScheduling
+{
+    [self performSyncOnStateQueue:^{
+        if (! self.schedulingTokenRefresh) {
+            return;
+        }
+        
+        self.schedulingTokenRefresh = NO;
+        [self scheduleTokenRefresh];
+    }];
+}
+
+/**
+ * Return the date at which a token should be automatically refreshed, nil if it must not
+ */
+- (NSDate *)refreshDateForToken:(CPAToken *)token
+{
+    NSParameterAssert(token);
+    
+    // Expired tokens are not refreshed automatically anymore. Running requests already take care of the domain
+    NSDate *expirationDate = token.expirationDate;
+    if ([expirationDate compare:[NSDate date]] != NSOrderedDescending
+            || [self.refreshingDomains containsObject:token.domain]
+            || self.pendingRequestHandles[[self requestKeyForDomain:token.domain withType:CPATokenTypeClient]]
+            || self.pendingRequestHandles[[self requestKeyForDomain:token.domain withType:CPATokenTypeUser]]) {
+        return nil;
+    }
+    
+    NSDate *refreshDate = [expirationDate dateByAddingTimeInterval:-self.tokenRefreshMargin];
+    NSDate *notBeforeDate = self.tokenRefreshNotBeforeDates[token.domain];
+    return notBeforeDate ? [refreshDate laterDate:notBeforeDate] : refreshDate;
+}
+
+/**
+ * Schedule the next automatic refresh batch, if any
+ */
+- (void)scheduleTokenRefresh
+{
+    if (self.tokenRefreshTimerSource) {
+        dispatch_source_cancel(self.tokenRefreshTimerSource);
+        self.tokenRefreshTimerSource = nil;
+    }
+    
+    if (! self.schedulingTokenRefresh) {
+        return;
+    }
+    
+    NSDate *nextRefreshDate = nil;
+    for (id cachedToken in [self.tokenCache allValues]) {
+        if (cachedToken == [NSNull null]) {
+            continue;
+        }
+        
+        NSDate *refreshDate = [self refreshDateForToken:cachedToken];
+        if (refreshDate) {
+            nextRefreshDate = nextRefreshDate ? [nextRefreshDate earlierDate:refreshDate] : refreshDate;
+        }
+    }
+    
+    if (! nextRefreshDate) {
+        return;
+    }
+    
+    // Only refresh earlier, never later, so that the margin is guaranteed
+    NSTimeInterval jitter = self.tokenRefreshJitter * arc4random_uniform(1001) / 1000.;
+    NSTimeInterval delay = fmax([nextRefreshDate timeIntervalSinceNow] - jitter, 0.);
+    
+    __weak __typeof(self) weakSelf = self;
+    self.tokenRefreshTimerSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.stateQueue);
+    dispatch_source_set_timer(self.tokenRefreshTimerSource,
+                              dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)),
+                              DISPATCH_TIME_FOREVER,
+                              (uint64_t)(fmax(jitter, 1.) * NSEC_PER_SEC));
+    dispatch_source_set_event_handler(self.tokenRefreshTimerSource, ^{
+        [weakSelf refreshDueTokens];
+    });
+    dispatch_resume(self.tokenRefreshTimerSource);
+}
+
+/**
+ * Refresh all tokens whose refresh is due within the batch interval
+ */
+- (void)refreshDueTokens
+{
+    CPAIdentity *identity = [self identity];
+    if (! identity) {
+        return;
+    }
+    
+    NSDate *batchDate = [NSDate dateWithTimeIntervalSinceNow:self.tokenRefreshBatchInterval + self.tokenRefreshJitter];
+    for (id cachedToken in [self.tokenCache allValues]) {
+        if (cachedToken == [NSNull null]) {
+            continue;
+        }
+        
+        NSDate *refreshDate = [self refreshDateForToken:cachedToken];
+        if (refreshDate && [refreshDate compare:batchDate] != NSOrderedDescending) {
+            [self refreshToken:cachedToken withIdentity:identity parentSpan:nil];
+        }
+    }
+    
+    [self scheduleTokenRefresh];
+}
+
+/**
+ * Refresh a token in the background. The refresh is traced as a child of the parent span, if any
+ */
+- (void)refreshToken:(CPAToken *)token withIdentity:(CPAIdentity *)identity parentSpan:(CPATraceSpan *)parentSpan
+{
+    NSParameterAssert(token);
+    NSParameterAssert(identity);
+    
+    NSString *domain = token.domain;
+    [self.refreshingDomains addObject:domain];
+    self.tokenRefreshNotBeforeDates[domain] = [NSDate dateWithTimeIntervalSinceNow:CPATokenRefreshRetryInterval];
+    
+    CPATraceSpan *span = [self.tracer startSpanWithName:@"automaticRefresh" category:@"provider" parentSpan:parentSpan];
+    [span setAttribute:domain forKey:@"domain"];
+    
+    CPATraceSpan *refreshSpan = [self.tracer startSpanWithName:@"refresh" category:@"request" parentSpan:span];
+    [CPAStatelessRequest refreshTokenWithAuthorizationProviderURL:self.authorizationProviderURL clientIdentifier:identity.identifier clientSecret:identity.secret domain:domain completionQueue:self.stateQueue completionBlock:^(NSString *userName, NSString *accessToken, NSString *tokenType, NSString *domainName, NSInteger expiresInSeconds, NSError *error) {
+        [refreshSpan finishWithError:error];
+        
+        [self performAsyncOnStateQueue:^{
+            [self.refreshingDomains removeObject:domain];
+            
+            // Only failed refreshes must wait before being attempted again, whichever token ends up stored
+            if (! error) {
+                [self.tokenRefreshNotBeforeDates removeObjectForKey:domain];
+            }
+            
+            // The token might have been discarded or replaced in the meantime. Errors are silently ignored, the refresh
+            // will be attempted again later
+            if (! error && self.tokenCache[domain] == token) {
+                CPATraceSpan *storageSpan = [self.tracer startSpanWithName:@"storeToken" category:@"storage" parentSpan:span];
+                [self storeTokenForDomain:domain withAccessToken:accessToken domainName:domainName userName:userName expiresInSeconds:expiresInSeconds];
+                [storageSpan finish];
+            }
+            else {
+                [self scheduleTokenRefresh];
+            }
+            [span finishWithError:error];
+        }];
+    }];
+}
+
+#pragma mark Token storage management
+
+- (NSString *)storeIdentifier
+{
+    return self.authorizationProviderURL.absoluteString;
+}
+
+- (NSString *)singleItemKey
+{
+    return [NSString stringWithFormat:@"%@#store", self.storeIdentifier];
+}
+
+- (NSString *)storeKeyForDomain:(NSString *)domain
+{
+    NSParameterAssert(domain);
+    
+    // FIXME: If we want to support multiple users per application, the key should also contain a reference
+    //        to a reliable user identifier. Currently only the user display name can be retrieved (user_name),
+    //        which is sadly not reliable enough since it might change
+    return [NSString stringWithFormat:@"%@_%@", self.storeIdentifier, domain];
+}
+
+- (CPAIdentity *)identity
+{
+    if (self.tokenStorageMode == CPATokenStorageModeSingleItem) {
+        [self loadStore];
+        return self.storedIdentity;
+    }
+    
+    if (self.identityLoaded) {
+        return self.storedIdentity;
+    }
+    
+    NSData *identityData = [self tokenStoreDataForKey:self.storeIdentifier];
+    CPAIdentity *identity = identityData ? [CPAIdentity identityWithStoredData:identityData] : nil;
+    
+    // Migrate keyed archives saved by earlier versions
+    if (identity && ! [CPABinaryReader isBinaryRecordData:identityData]) {
+        [self setIdentity:identity];
+    }
+    
+    self.storedIdentity = identity;
+    self.identityLoaded = YES;
+    return identity;
+}
+
+- (void)setIdentity:(CPAIdentity *)identity
+{
+    if (self.tokenStorageMode == CPATokenStorageModeSingleItem) {
+        [self loadStore];
+        self.storedIdentity = identity;
+        [self scheduleStoreWrite];
+        return;
+    }
+    
+    NSData *identityData = [identity binaryRepresentation];
+    [self setTokenStoreData:identityData forKey:self.storeIdentifier];
+    
+    self.storedIdentity = identity;
+    self.identityLoaded = YES;
+}
+
+- (void)discardIdentity
+{
+    [self performSyncOnStateQueue:^{
+        [self removeAllTokenStoreData];
+        self.tokenCache = @{};
+        self.warmedUp = NO;
+        [self.tokenRefreshNotBeforeDates removeAllObjects];
+        
+        // Nothing is left in the store
+        self.storedIdentity = nil;
+        [self.storedTokens removeAllObjects];
+        self.storeLoaded = YES;
+        self.identityLoaded = YES;
+        self.storeWriteScheduled = NO;
+        
+        [self scheduleTokenRefresh];
+    }];
+}
+
+/**
+ * Return the token saved for the specified domain, nil if none
+ */
+- (CPAToken *)storedTokenForDomain:(NSString *)domain
+{
+    NSParameterAssert(domain);
+    
+    if (self.tokenStorageMode == CPATokenStorageModeSingleItem) {
+        [self loadStore];
+        return self.storedTokens[domain];
+    }
+    
+    NSString *key = [self storeKeyForDomain:domain];
+    NSData *tokenData = [self tokenStoreDataForKey:key];
+    return tokenData ? [self tokenWithStoredData:tokenData forKey:key] : nil;
+}
+
+/**
+ * Decode a token saved with the specified key
+ */
+- (CPAToken *)tokenWithStoredData:(NSData *)tokenData forKey:(NSString *)key
+{
+    NSParameterAssert(tokenData);
+    NSParameterAssert(key);
+    
+    CPAToken *token = [CPAToken tokenWithStoredData:tokenData];
+    
+    // Migrate keyed archives saved by earlier versions
+    if (token && ! [CPABinaryReader isBinaryRecordData:tokenData]) {
+        [self setTokenStoreData:[token binaryRepresentation] forKey:key];
+    }
+    
+    return token;
+}
+
+/**
+ * Return the tokens saved for all domains, reading the token store at once, and update the token cache accordingly.
+ * Tokens already in the token cache are not decoded again
+ */
+- (NSArray<CPAToken *> *)loadAllTokens
+{
+    NSDictionary<NSString *, id> *tokenCache = self.tokenCache;
+    NSMutableDictionary<NSString *, CPAToken *> *tokens = [NSMutableDictionary dictionary];
+    
+    if (self.tokenStorageMode == CPATokenStorageModeSingleItem) {
+        [self loadStore];
+        [tokens addEntriesFromDictionary:self.storedTokens];
+    }
+    else {
+        NSString *keyPrefix = [self storeKeyForDomain:@""];
+        [[self tokenStoreAllData] enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSData *tokenData, BOOL *stop) {
+            if (! [key hasPrefix:keyPrefix] || key.length == keyPrefix.length) {
+                return;
+            }
+            
+            NSString *domain = [key substringFromIndex:keyPrefix.length];
+            id cachedToken = tokenCache[domain];
+            CPAToken *token = [cachedToken isKindOfClass:[CPAToken class]] ? cachedToken : [self tokenWithStoredData:tokenData forKey:key];
+            if (token) {
+                tokens[domain] = token;
+            }
+        }];
+    }
+    
+    NSMutableDictionary<NSString *, id> *updatedTokenCache = [tokenCache mutableCopy];
+    [updatedTokenCache addEntriesFromDictionary:tokens];
+    self.tokenCache = [updatedTokenCache copy];
+    
+    return [tokens.allValues sortedArrayUsingComparator:^NSComparisonResult(CPAToken *token1, CPAToken *token2) {
+        return [token1.domain compare:token2.domain];
+    }];
+}
+
+- (void)setToken:(CPAToken *)token forDomain:(NSString *)domain
+{
+    NSParameterAssert(domain);
+    
+    if (self.tokenStorageMode == CPATokenStorageModeSingleItem) {
+        [self loadStore];
+        self.storedTokens[domain] = token;
+        [self scheduleStoreWrite];
+    }
+    else {
+        NSData *tokenData = [token binaryRepresentation];
+        NSString *key = [self storeKeyForDomain:domain];
+        [self setTokenStoreData:tokenData forKey:key];
+    }
+    [self setCachedToken:token forDomain:domain];
+    
+    [self scheduleTokenRefresh];
+}
+
+- (void)removeStoredTokenForDomain:(NSString *)domain
+{
+    NSParameterAssert(domain);
+    
+    [self removeStoredTokensForDomains:@[domain]];
+}
+
+- (void)removeStoredTokensForDomains:(NSArray<NSString *> *)domains
+{
+    NSParameterAssert(domains);
+    
+    if (self.tokenStorageMode == CPATokenStorageModeSingleItem) {
+        [self loadStore];
+        
+        NSUInteger count = self.storedTokens.count;
+        [self.storedTokens removeObjectsForKeys:domains];
+        if (self.storedTokens.count != count) {
+            [self scheduleStoreWrite];
+        }
+    }
+    else {
+        for (NSString *domain in domains) {
+            NSString *key = [self storeKeyForDomain:domain];
+            [self removeTokenStoreDataForKey:key];
+        }
+    }
+}
+
+#pragma mark Single item storage
+
+/**
+ * Read the store item, if not already done. Items saved with one item per domain are imported
+ */
+- (void)loadStore
+{
+    if (self.storeLoaded) {
+        return;
+    }
+    
+    self.storeLoaded = YES;
+    self.storedIdentity = nil;
+    [self.storedTokens removeAllObjects];
+    
+    NSData *storeData = [self tokenStoreDataForKey:self.singleItemKey];
+    if (storeData) {
+        CPABinaryReader *reader = [[CPABinaryReader alloc] initWithData:storeData recordType:CPABinaryRecordTypeStore];
+        NSData *identityData = [reader readData];
+        CPAIdentity *identity = identityData ? [CPAIdentity identityWithStoredData:identityData] : nil;
+        
+        NSMutableDictionary<NSString *, CPAToken *> *tokens = [NSMutableDictionary dictionary];
+        NSUInteger tokenCount = [reader readUnsignedInteger];
+        for (NSUInteger i = 0; i < tokenCount && reader.valid; ++i) {
+            NSString *domain = [reader readString];
+            NSData *tokenData = [reader readData];
+            CPAToken *token = tokenData ? [CPAToken tokenWithStoredData:tokenData] : nil;
+            if (domain && token) {
+                tokens[domain] = token;
+            }
+        }
+        
+        // Unreadable items (malformed or written by a more recent version) are considered empty
+        if (reader.valid) {
+            self.storedIdentity = identity;
+            [self.storedTokens addEntriesFromDictionary:tokens];
+        }
+        return;
+    }
+    
+    // Import items saved with one item per domain
+    NSDictionary<NSString *, NSData *> *allData = [self tokenStoreAllData];
+    NSData *identityData = allData[self.storeIdentifier];
+    self.storedIdentity = identityData ? [CPAIdentity identityWithStoredData:identityData] : nil;
+    
+    NSMutableArray<NSString *> *importedKeys = [NSMutableArray array];
+    NSString *keyPrefix = [self storeKeyForDomain:@""];
+    [allData enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSData *tokenData, BOOL *stop) {
+        if (! [key hasPrefix:keyPrefix] || key.length == keyPrefix.length) {
+            return;
+        }
+        
+        CPAToken *token = [CPAToken tokenWithStoredData:tokenData];
+        if (token) {
+            self.storedTokens[[key substringFromIndex:keyPrefix.length]] = token;
+        }
+        [importedKeys addObject:key];
+    }];
+    
+    if (! identityData && importedKeys.count == 0) {
+        return;
+    }
+    
+    [self writeStore];
+    
+    [self removeTokenStoreDataForKey:self.storeIdentifier];
+    for (NSString *key in importedKeys) {
+        [self removeTokenStoreDataForKey:key];
+    }
+}
+
+/**
+ * Write changes to the store item after a short delay, coalescing them with subsequent changes
+ */
+- (void)scheduleStoreWrite
+{
+    if (self.storeWriteScheduled) {
+        return;
+    }
+    
+    self.storeWriteScheduled = YES;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(CPATokenStoreWriteCoalescingDelay * NSEC_PER_SEC)), self.stateQueue, ^{
+        if (self.storeWriteScheduled) {
+            [self writeStore];
+        }
+    });
+}
+
+- (void)writeStore
+{
+    self.storeWriteScheduled = NO;
+    
+    if (! self.storedIdentity && self.storedTokens.count == 0) {
+        [self removeTokenStoreDataForKey:self.singleItemKey];
+        return;
+    }
+    
+    CPABinaryWriter *writer = [[CPABinaryWriter alloc] initWithRecordType:CPABinaryRecordTypeStore];
+    [writer writeData:[self.storedIdentity binaryRepresentation]];
+    [writer writeUnsignedInteger:self.storedTokens.count];
+    [self.storedTokens enumerateKeysAndObjectsUsingBlock:^(NSString *domain, CPAToken *token, BOOL *stop) {
+        [writer writeString:domain];
+        [writer writeData:[token binaryRepresentation]];
+    }];
+    [self setTokenStoreData:writer.data forKey:self.singleItemKey];
+}
+
+#pragma mark Token store operations
+
+- (NSData *)tokenStoreDataForKey:(NSString *)key
+{
+    atomic_fetch_add(&_tokenStoreOperationCount, 1);
+    return [self.tokenStore dataForKey:key];
+}
+
+- (void)setTokenStoreData:(NSData *)data forKey:(NSString *)key
+{
+    atomic_fetch_add(&_tokenStoreOperationCount, 1);
+    [self.tokenStore setData:data forKey:key];
+}
+
+- (void)removeTokenStoreDataForKey:(NSString *)key
+{
+    atomic_fetch_add(&_tokenStoreOperationCount, 1);
+    [self.tokenStore removeDataForKey:key];
+}
+
+- (NSDictionary<NSString *, NSData *> *)tokenStoreAllData
+{
+    atomic_fetch_add(&_tokenStoreOperationCount, 1);
+    return [self.tokenStore allData];
+}
+
+- (void)removeAllTokenStoreData
+{
+    atomic_fetch_add(&_tokenStoreOperationCount, 1);
+    [self.tokenStore removeAllData];
+}
+
+#pragma mark Notifications
+
+- (void)applicationDidEnterBackground:(NSNotification *)notification
+{
+    // Do not lose pending changes if the application is terminated while in the background
+    [self performSyncOnStateQueue:^{
+        if (self.storeWriteScheduled) {
+            [self writeStore];
+        }
+    }];
 }
 
 #pragma mark Actions
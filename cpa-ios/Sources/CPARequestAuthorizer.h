@@ -0,0 +1,87 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+#import "CPAProvider.h"
+#import "CPARequestHandle.h"
+#import "CPAToken.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Types
+typedef void (^CPADataCompletionBlock)(NSData * __nullable data, NSURLResponse * __nullable response, NSError * __nullable error);
+
+/**
+ * Performs requests to services protected by CPA, adding the token of the domain associated with the request host as
+ * bearer authorization header. Authorizers are thread-safe
+ *
+ * Tokens are read from the in-memory state of the provider. If no token is available for the domain, a token is
+ * requested before the request is sent. If a service rejects a token (HTTP 401 status code), a new token is requested
+ * and the request replayed once. Token requests for the same domain are coalesced by the provider, so that requests
+ * rejected at the same time wait for a single refresh and are then replayed together
+ */
+@interface CPARequestAuthorizer : NSObject
+
+/**
+ * Create an authorizer retrieving tokens from the specified provider, and performing requests with the specified
+ * session
+ */
+- (instancetype)initWithProvider:(CPAProvider *)provider session:(NSURLSession *)session NS_DESIGNATED_INITIALIZER;
+
+/**
+ * Same as -initWithProvider:session:, performing requests with the shared session
+ */
+- (instancetype)initWithProvider:(CPAProvider *)provider;
+
+/**
+ * The provider from which tokens are retrieved
+ */
+@property (nonatomic, readonly) CPAProvider *provider;
+
+/**
+ * The session with which requests are performed
+ */
+@property (nonatomic, readonly) NSURLSession *session;
+
+/**
+ * Associate a domain with a host (case-insensitive), specifying the type of the token to request if none is available
+ * or if a token is rejected. Setting the domain to nil removes the association. Requests to hosts without associated
+ * domain are performed as is
+ */
+- (void)setDomain:(nullable NSString *)domain withType:(CPATokenType)type forHost:(NSString *)host;
+
+/**
+ * Return the domain associated with a host, nil if none
+ */
+- (nullable NSString *)domainForHost:(NSString *)host;
+
+/**
+ * Return a copy of a request with the authorization header set to the token currently available for its host, or the
+ * request itself if its host has no associated domain or if no token is available
+ */
+- (NSURLRequest *)authorizedRequestWithRequest:(NSURLRequest *)request;
+
+/**
+ * Perform a request with authorization. The completion block is called on the provider completion queue, with the
+ * response of the replayed request if the token was rejected. Requests with a body stream cannot be replayed and must
+ * therefore be avoided
+ *
+ * The request can be cancelled with the returned handle, in which case the completion block is not called. A token
+ * request made on its behalf is only cancelled if no other request waits for it
+ */
+- (CPARequestHandle *)dataTaskWithRequest:(NSURLRequest *)request completionBlock:(CPADataCompletionBlock)completionBlock;
+
+@end
+
+@interface CPARequestAuthorizer (UnavailableMethods)
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,229 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPARequestAuthorizer.h"
+
+#import "CPAProvider+Private.h"
+#import "CPARequestHandle+Private.h"
+
+@interface CPARequestAuthorizer ()
+
+@property (nonatomic) CPAProvider *provider;
+@property (nonatomic) NSURLSession *session;
+
+// Must be accessed within a @synchronized(self) block. Keys are lowercase hosts
+@property (nonatomic) NSMutableDictionary<NSString *, NSString *> *domains;
+@property (nonatomic) NSMutableDictionary<NSString *, NSNumber *> *tokenTypes;
+
+@end
+
+@implementation CPARequestAuthorizer
+
+#pragma mark Object lifecycle
+
+- (instancetype)initWithProvider:(CPAProvider *)provider session:(NSURLSession *)session
+{
+    NSParameterAssert(provider);
+    NSParameterAssert(session);
+    
+    if (self = [super init]) {
+        self.provider = provider;
+        self.session = session;
+        self.domains = [NSMutableDictionary dictionary];
+        self.tokenTypes = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (instancetype)initWithProvider:(CPAProvider *)provider
+{
+    return [self initWithProvider:provider session:[NSURLSession sharedSession]];
+}
+
+- (instancetype)init
+{
+    [self doesNotRecognizeSelector:_cmd];
+    return nil;
+}
+
+#pragma mark Domains
+
+- (void)setDomain:(NSString *)domain withType:(CPATokenType)type forHost:(NSString *)host
+{
+    NSParameterAssert(host);
+    
+    NSString *key = host.lowercaseString;
+    @synchronized(self) {
+        self.domains[key] = domain;
+        self.tokenTypes[key] = domain ? @(type) : nil;
+    }
+}
+
+- (NSString *)domainForHost:(NSString *)host
+{
+    NSParameterAssert(host);
+    
+    return [self domainForHost:host type:NULL];
+}
+
+/**
+ * Return the domain associated with a host, nil if none (or if the host is nil), and the type of the tokens to request
+ * for it
+ */
+- (NSString *)domainForHost:(NSString *)host type:(CPATokenType *)pType
+{
+    if (! host) {
+        return nil;
+    }
+    
+    NSString *key = host.lowercaseString;
+    @synchronized(self) {
+        if (pType) {
+            *pType = self.tokenTypes[key].integerValue;
+        }
+        return self.domains[key];
+    }
+}
+
+#pragma mark Requests
+
+- (NSURLRequest *)requestWithRequest:(NSURLRequest *)request token:(CPAToken *)token
+{
+    NSMutableURLRequest *authorizedRequest = [request mutableCopy];
+    [authorizedRequest setValue:[@"Bearer " stringByAppendingString:token.value] forHTTPHeaderField:@"Authorization"];
+    return [authorizedRequest copy];
+}
+
+- (NSURLRequest *)authorizedRequestWithRequest:(NSURLRequest *)request
+{
+    NSParameterAssert(request);
+    
+    NSString *domain = [self domainForHost:request.URL.host type:NULL];
+    CPAToken *token = domain ? [self.provider tokenForDomain:domain] : nil;
+    return token ? [self requestWithRequest:request token:token] : request;
+}
+
+- (CPARequestHandle *)dataTaskWithRequest:(NSURLRequest *)request completionBlock:(CPADataCompletionBlock)completionBlock
+{
+    NSParameterAssert(request);
+    NSParameterAssert(completionBlock);
+    
+    CPARequestHandle *requestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:completionBlock];
+    
+    CPATokenType type = CPATokenTypeClient;
+    NSString *domain = [self domainForHost:request.URL.host type:&type];
+    if (! domain) {
+        [self performRequest:request withToken:nil domain:nil type:type replayable:NO requestHandle:requestHandle];
+        return requestHandle;
+    }
+    
+    CPAToken *token = [self.provider tokenForDomain:domain];
+    if (token) {
+        [self performRequest:request withToken:token domain:domain type:type replayable:YES requestHandle:requestHandle];
+    }
+    else {
+        [self requestTokenForRequest:request domain:domain type:type requestHandle:requestHandle];
+    }
+    return requestHandle;
+}
+
+/**
+ * Request a token for the domain, and perform the request with it. Token requests are coalesced by the provider, so
+ * that all requests waiting for a token of the same domain are performed once the same token has been retrieved
+ */
+- (void)requestTokenForRequest:(NSURLRequest *)request
+                        domain:(NSString *)domain
+                          type:(CPATokenType)type
+                 requestHandle:(CPARequestHandle *)requestHandle
+{
+    if (requestHandle.cancelled) {
+        return;
+    }
+    
+    CPARequestHandle *tokenRequestHandle = [self.provider requestTokenForDomain:domain withType:type completionBlock:^(CPAToken *token, NSError *error) {
+        if (error) {
+            [self finishRequestHandle:requestHandle withData:nil response:nil error:error];
+            return;
+        }
+        
+        // A freshly retrieved token is not replaced if rejected. An expired token served while being refreshed might
+        // be, though
+        [self performRequest:request withToken:token domain:domain type:type replayable:token.expired requestHandle:requestHandle];
+    }];
+    [requestHandle addChildRequestHandle:tokenRequestHandle];
+}
+
+/**
+ * Perform a request, authorized with the specified token if any. If the token is rejected and the request replayable,
+ * the request is replayed once with a new token
+ */
+- (void)performRequest:(NSURLRequest *)request
+             withToken:(CPAToken *)token
+                domain:(NSString *)domain
+                  type:(CPATokenType)type
+            replayable:(BOOL)replayable
+         requestHandle:(CPARequestHandle *)requestHandle
+{
+    if (requestHandle.cancelled) {
+        return;
+    }
+    
+    NSURLRequest *authorizedRequest = token ? [self requestWithRequest:request token:token] : request;
+    NSURLSessionDataTask *dataTask = [self.session dataTaskWithRequest:authorizedRequest completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+        NSInteger statusCode = [response isKindOfClass:[NSHTTPURLResponse class]] ? ((NSHTTPURLResponse *)response).statusCode : 0;
+        if (! replayable || statusCode != 401) {
+            [self finishRequestHandle:requestHandle withData:data response:response error:error];
+            return;
+        }
+        
+        // If the token has been replaced in the meantime (e.g. by the refresh made for another rejected request), replay
+        // the request with the new token right away. Otherwise discard the local token, even if expired, so that it
+        // cannot be served again while stale, and request a new one
+        CPAToken *currentToken = [self.provider localTokenForDomain:domain];
+        if (currentToken && ! currentToken.expired && ! [currentToken.value isEqualToString:token.value]) {
+            [self performRequest:request withToken:currentToken domain:domain type:type replayable:NO requestHandle:requestHandle];
+            return;
+        }
+        
+        if (currentToken) {
+            [self.provider discardTokenForDomain:domain];
+        }
+        [self requestTokenForRequest:request domain:domain type:type requestHandle:requestHandle];
+    }];
+    
+    __weak NSURLSessionDataTask *weakDataTask = dataTask;
+    [requestHandle addCancellationBlock:^{
+        [weakDataTask cancel];
+    }];
+    
+    [dataTask resume];
+}
+
+- (void)finishRequestHandle:(CPARequestHandle *)requestHandle withData:(NSData *)data response:(NSURLResponse *)response error:(NSError *)error
+{
+    dispatch_async(self.provider.completionQueue, ^{
+        CPADataCompletionBlock completionBlock = [requestHandle finish];
+        completionBlock ? completionBlock(data, response, error) : nil;
+    });
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    NSDictionary<NSString *, NSString *> *domains = nil;
+    @synchronized(self) {
+        domains = [self.domains copy];
+    }
+    
+    return [NSString stringWithFormat:@"<%@: %p; provider: %@; domains: %@>",
+            [self class],
+            self,
+            self.provider,
+            domains];
+}
+
+@end
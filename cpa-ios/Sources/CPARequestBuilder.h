@@ -0,0 +1,65 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Builds requests to the endpoints of an authorization provider, for implementation purposes only
+ *
+ * Endpoint URLs and headers are set up once per builder, requests being obtained by copying prepared prototypes. JSON
+ * bodies are written in a single buffer from constant templates whose slots are filled with escaped values, without
+ * any intermediate dictionary or serialization
+ */
+@interface CPARequestBuilder : NSObject
+
+/**
+ * Create a builder for requests made to the specified authorization provider
+ */
+- (instancetype)initWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL NS_DESIGNATED_INITIALIZER;
+
+/**
+ * The authorization provider URL
+ */
+@property (nonatomic, readonly) NSURL *authorizationProviderURL;
+
+/**
+ * Request to the /register endpoint
+ */
+- (NSURLRequest *)registrationRequestWithClientName:(NSString *)clientName
+                                 softwareIdentifier:(NSString *)softwareIdentifier
+                                    softwareVersion:(NSString *)softwareVersion;
+
+/**
+ * Request to the /associate endpoint
+ */
+- (NSURLRequest *)userCodeRequestWithClientIdentifier:(NSString *)clientIdentifier
+                                         clientSecret:(NSString *)clientSecret
+                                               domain:(NSString *)domain;
+
+/**
+ * Requests to the /token endpoint, for the device code and client credentials grant types respectively
+ */
+- (NSURLRequest *)userTokenRequestWithDeviceCode:(NSString *)deviceCode
+                                clientIdentifier:(NSString *)clientIdentifier
+                                    clientSecret:(NSString *)clientSecret
+                                          domain:(NSString *)domain;
+- (NSURLRequest *)clientTokenRequestWithClientIdentifier:(NSString *)clientIdentifier
+                                            clientSecret:(NSString *)clientSecret
+                                                  domain:(NSString *)domain;
+
+@end
+
+@interface CPARequestBuilder (UnavailableMethods)
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,268 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPARequestBuilder.h"
+
+// Constants
+
+// Body templates, as literal segments surrounding the slots filled with escaped string values (one slot less than
+// segments). Templates are terminated by NULL
+static const char * const CPARegistrationBodyTemplate[] = {
+    "{\"client_name\":\"",
+    "\",\"software_id\":\"",
+    "\",\"software_version\":\"",
+    "\"}",
+    NULL
+};
+
+static const char * const CPAUserCodeBodyTemplate[] = {
+    "{\"client_id\":\"",
+    "\",\"client_secret\":\"",
+    "\",\"domain\":\"",
+    "\"}",
+    NULL
+};
+
+static const char * const CPAUserTokenBodyTemplate[] = {
+    "{\"grant_type\":\"http://tech.ebu.ch/cpa/1.0/device_code\",\"device_code\":\"",
+    "\",\"client_id\":\"",
+    "\",\"client_secret\":\"",
+    "\",\"domain\":\"",
+    "\"}",
+    NULL
+};
+
+static const char * const CPAClientTokenBodyTemplate[] = {
+    "{\"grant_type\":\"http://tech.ebu.ch/cpa/1.0/client_credentials\",\"client_id\":\"",
+    "\",\"client_secret\":\"",
+    "\",\"domain\":\"",
+    "\"}",
+    NULL
+};
+
+// Static functions
+static NSData *CPAJSONBodyFromTemplate(const char * const *segments, NSString * const *values);
+static size_t CPAJSONWriteEscapedString(CFStringRef string, uint8_t *buffer);
+
+@interface CPARequestBuilder ()
+
+@property (nonatomic) NSURL *authorizationProviderURL;
+
+// Requests with URL, method and headers already set, copied to build new requests
+@property (nonatomic) NSURLRequest *registrationRequestPrototype;
+@property (nonatomic) NSURLRequest *userCodeRequestPrototype;
+@property (nonatomic) NSURLRequest *tokenRequestPrototype;
+
+@end
+
+@implementation CPARequestBuilder
+
+#pragma mark Object lifecycle
+
+- (instancetype)initWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(authorizationProviderURL);
+    
+    if (self = [super init]) {
+        self.authorizationProviderURL = authorizationProviderURL;
+        self.registrationRequestPrototype = [self requestPrototypeForEndpoint:@"register"];
+        self.userCodeRequestPrototype = [self requestPrototypeForEndpoint:@"associate"];
+        self.tokenRequestPrototype = [self requestPrototypeForEndpoint:@"token"];
+    }
+    return self;
+}
+
+- (instancetype)init
+{
+    [self doesNotRecognizeSelector:_cmd];
+    return nil;
+}
+
+#pragma mark Requests
+
+- (NSURLRequest *)requestPrototypeForEndpoint:(NSString *)endpoint
+{
+    NSURL *URL = [self.authorizationProviderURL URLByAppendingPathComponent:endpoint];
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:URL];
+    [request setHTTPMethod:@"POST"];
+    [request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+    return [request copy];
+}
+
+- (NSURLRequest *)requestWithPrototype:(NSURLRequest *)prototype body:(NSData *)body
+{
+    NSMutableURLRequest *request = [prototype mutableCopy];
+    [request setHTTPBody:body];
+    return request;
+}
+
+- (NSURLRequest *)registrationRequestWithClientName:(NSString *)clientName
+                                 softwareIdentifier:(NSString *)softwareIdentifier
+                                    softwareVersion:(NSString *)softwareVersion
+{
+    NSParameterAssert(clientName);
+    NSParameterAssert(softwareIdentifier);
+    NSParameterAssert(softwareVersion);
+    
+    NSString * const values[] = { clientName, softwareIdentifier, softwareVersion };
+    return [self requestWithPrototype:self.registrationRequestPrototype body:CPAJSONBodyFromTemplate(CPARegistrationBodyTemplate, values)];
+}
+
+- (NSURLRequest *)userCodeRequestWithClientIdentifier:(NSString *)clientIdentifier
+                                         clientSecret:(NSString *)clientSecret
+                                               domain:(NSString *)domain
+{
+    NSParameterAssert(clientIdentifier);
+    NSParameterAssert(clientSecret);
+    NSParameterAssert(domain);
+    
+    NSString * const values[] = { clientIdentifier, clientSecret, domain };
+    return [self requestWithPrototype:self.userCodeRequestPrototype body:CPAJSONBodyFromTemplate(CPAUserCodeBodyTemplate, values)];
+}
+
+- (NSURLRequest *)userTokenRequestWithDeviceCode:(NSString *)deviceCode
+                                clientIdentifier:(NSString *)clientIdentifier
+                                    clientSecret:(NSString *)clientSecret
+                                          domain:(NSString *)domain
+{
+    NSParameterAssert(deviceCode);
+    NSParameterAssert(clientIdentifier);
+    NSParameterAssert(clientSecret);
+    NSParameterAssert(domain);
+    
+    NSString * const values[] = { deviceCode, clientIdentifier, clientSecret, domain };
+    return [self requestWithPrototype:self.tokenRequestPrototype body:CPAJSONBodyFromTemplate(CPAUserTokenBodyTemplate, values)];
+}
+
+- (NSURLRequest *)clientTokenRequestWithClientIdentifier:(NSString *)clientIdentifier
+                                            clientSecret:(NSString *)clientSecret
+                                                  domain:(NSString *)domain
+{
+    NSParameterAssert(clientIdentifier);
+    NSParameterAssert(clientSecret);
+    NSParameterAssert(domain);
+    
+    NSString * const values[] = { clientIdentifier, clientSecret, domain };
+    return [self requestWithPrototype:self.tokenRequestPrototype body:CPAJSONBodyFromTemplate(CPAClientTokenBodyTemplate, values)];
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; authorizationProviderURL: %@>",
+            [self class],
+            self,
+            self.authorizationProviderURL];
+}
+
+@end
+
+#pragma mark Static functions
+
+/**
+ * Fill a body template with the specified values (one less than template segments). The exact body length is computed
+ * first, so that the body is written in a single allocated buffer, owned by the returned data
+ */
+static NSData *CPAJSONBodyFromTemplate(const char * const *segments, NSString * const *values)
+{
+    size_t length = strlen(segments[0]);
+    for (NSUInteger i = 1; segments[i]; ++i) {
+        length += CPAJSONWriteEscapedString((__bridge CFStringRef)values[i - 1], NULL) + strlen(segments[i]);
+    }
+    
+    uint8_t *bytes = malloc(length);
+    if (! bytes) {
+        return [NSData data];
+    }
+    
+    size_t segmentLength = strlen(segments[0]);
+    memcpy(bytes, segments[0], segmentLength);
+    size_t position = segmentLength;
+    for (NSUInteger i = 1; segments[i]; ++i) {
+        position += CPAJSONWriteEscapedString((__bridge CFStringRef)values[i - 1], bytes + position);
+        
+        segmentLength = strlen(segments[i]);
+        memcpy(bytes + position, segments[i], segmentLength);
+        position += segmentLength;
+    }
+    
+    return [NSData dataWithBytesNoCopy:bytes length:length freeWhenDone:YES];
+}
+
+/**
+ * Write the UTF-8 bytes of a string, escaped for use within a JSON string, to the specified buffer, and return the
+ * number of bytes written. If the buffer is NULL, only return the number of bytes which would be written. Characters
+ * are read through an inline buffer, without any allocation. Lone surrogates, which cannot be encoded in UTF-8, are
+ * written as escapes
+ */
+static size_t CPAJSONWriteEscapedString(CFStringRef string, uint8_t *buffer)
+{
+    static const char *s_hexDigits = "0123456789abcdef";
+    
+    CFIndex stringLength = CFStringGetLength(string);
+    CFStringInlineBuffer inlineBuffer;
+    CFStringInitInlineBuffer(string, &inlineBuffer, CFRangeMake(0, stringLength));
+    
+    size_t length = 0;
+    for (CFIndex i = 0; i < stringLength; ++i) {
+        UniChar character = CFStringGetCharacterFromInlineBuffer(&inlineBuffer, i);
+        
+        uint8_t bytes[6];
+        size_t count = 0;
+        if (character == '"' || character == '\\') {
+            bytes[0] = '\\';
+            bytes[1] = (uint8_t)character;
+            count = 2;
+        }
+        else if (character < 0x20) {
+            memcpy(bytes, "\\u00", 4);
+            bytes[4] = (uint8_t)s_hexDigits[character >> 4];
+            bytes[5] = (uint8_t)s_hexDigits[character & 0xf];
+            count = 6;
+        }
+        else if (character < 0x80) {
+            bytes[0] = (uint8_t)character;
+            count = 1;
+        }
+        else if (character < 0x800) {
+            bytes[0] = (uint8_t)(0xc0 | (character >> 6));
+            bytes[1] = (uint8_t)(0x80 | (character & 0x3f));
+            count = 2;
+        }
+        else if (CFStringIsSurrogateHighCharacter(character) && i + 1 < stringLength
+                    && CFStringIsSurrogateLowCharacter(CFStringGetCharacterFromInlineBuffer(&inlineBuffer, i + 1))) {
+            UTF32Char codePoint = CFStringGetLongCharacterForSurrogatePair(character, CFStringGetCharacterFromInlineBuffer(&inlineBuffer, i + 1));
+            bytes[0] = (uint8_t)(0xf0 | (codePoint >> 18));
+            bytes[1] = (uint8_t)(0x80 | ((codePoint >> 12) & 0x3f));
+            bytes[2] = (uint8_t)(0x80 | ((codePoint >> 6) & 0x3f));
+            bytes[3] = (uint8_t)(0x80 | (codePoint & 0x3f));
+            count = 4;
+            ++i;
+        }
+        else if (CFStringIsSurrogateHighCharacter(character) || CFStringIsSurrogateLowCharacter(character)) {
+            bytes[0] = '\\';
+            bytes[1] = 'u';
+            bytes[2] = (uint8_t)s_hexDigits[character >> 12];
+            bytes[3] = (uint8_t)s_hexDigits[(character >> 8) & 0xf];
+            bytes[4] = (uint8_t)s_hexDigits[(character >> 4) & 0xf];
+            bytes[5] = (uint8_t)s_hexDigits[character & 0xf];
+            count = 6;
+        }
+        else {
+            bytes[0] = (uint8_t)(0xe0 | (character >> 12));
+            bytes[1] = (uint8_t)(0x80 | ((character >> 6) & 0x3f));
+            bytes[2] = (uint8_t)(0x80 | (character & 0x3f));
+            count = 3;
+        }
+        
+        if (buffer) {
+            memcpy(buffer + length, bytes, count);
+        }
+        length += count;
+    }
+    return length;
+}
@@ -0,0 +1,44 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+#import "CPARequestHandle.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Private interface for implementation purposes
+ */
+@interface CPARequestHandle (Private)
+
+/**
+ * Create a handle for a request with the specified completion block (of any block type), which the handle keeps until
+ * the request is over
+ */
+- (instancetype)initWithCompletionBlock:(nullable id)completionBlock;
+
+/**
+ * Add a block to be called when the request is cancelled, on the thread calling -cancel. The block is called right away
+ * if the request has already been cancelled, and discarded if the request is already over. All blocks are released
+ * when the request is over
+ */
+- (void)addCancellationBlock:(dispatch_block_t)cancellationBlock;
+
+/**
+ * Cancel the request of another handle (e.g. a step of the request) when the request is cancelled. The other handle
+ * is not retained
+ */
+- (void)addChildRequestHandle:(CPARequestHandle *)childRequestHandle;
+
+/**
+ * Mark the request as over, and return its completion block so that it can be called, nil if the request has been
+ * cancelled or is already over
+ */
+- (nullable id)finish;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,49 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Handle returned by token requests, through which they can be cancelled. Handles are thread-safe
+ */
+@interface CPARequestHandle : NSObject
+
+/**
+ * Cancel the request. Network tasks, polling and credentials presentation made on its behalf are stopped right away,
+ * and nothing gets written to the token store anymore. The completion block is not called and is released, as are all
+ * blocks captured by the request
+ *
+ * If the request shares its result with other requests for the same token, the token is still retrieved on their
+ * behalf, and is only cancelled once all of them have been cancelled
+ *
+ * Does nothing if the request is already over or has already been cancelled
+ */
+- (void)cancel;
+
+/**
+ * Return YES iff the request has been cancelled
+ */
+@property (nonatomic, readonly, getter=isCancelled) BOOL cancelled;
+
+/**
+ * Return YES iff the request is over, either because its completion block has been called or because it has been
+ * cancelled
+ */
+@property (nonatomic, readonly, getter=isFinished) BOOL finished;
+
+@end
+
+@interface CPARequestHandle (UnavailableMethods)
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,137 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPARequestHandle.h"
+
+@interface CPARequestHandle ()
+
+// Must be accessed within a @synchronized(self) block, as well as the cancelled and finished flags. Blocks are released
+// when the request is over
+@property (nonatomic, copy) id completionBlock;
+@property (nonatomic) NSMutableArray<dispatch_block_t> *cancellationBlocks;
+
+@end
+
+@implementation CPARequestHandle
+
+@synthesize cancelled = _cancelled;
+@synthesize finished = _finished;
+
+#pragma mark Object lifecycle
+
+- (instancetype)initWithCompletionBlock:(id)completionBlock
+{
+    if (self = [super init]) {
+        self.completionBlock = completionBlock;
+    }
+    return self;
+}
+
+- (instancetype)init
+{
+    [self doesNotRecognizeSelector:_cmd];
+    return nil;
+}
+
+#pragma mark Accessors and mutators
+
+- (BOOL)isCancelled
+{
+    @synchronized(self) {
+        return _cancelled;
+    }
+}
+
+- (BOOL)isFinished
+{
+    @synchronized(self) {
+        return _finished;
+    }
+}
+
+#pragma mark Cancellation
+
+- (void)cancel
+{
+    NSArray<dispatch_block_t> *cancellationBlocks = nil;
+    @synchronized(self) {
+        if (_finished) {
+            return;
+        }
+        
+        _cancelled = YES;
+        _finished = YES;
+        
+        cancellationBlocks = self.cancellationBlocks;
+        self.cancellationBlocks = nil;
+        self.completionBlock = nil;
+    }
+    
+    // Outside the lock, since blocks might cancel other requests
+    for (dispatch_block_t cancellationBlock in cancellationBlocks) {
+        cancellationBlock();
+    }
+}
+
+- (void)addCancellationBlock:(dispatch_block_t)cancellationBlock
+{
+    NSParameterAssert(cancellationBlock);
+    
+    @synchronized(self) {
+        if (! _finished) {
+            if (! self.cancellationBlocks) {
+                self.cancellationBlocks = [NSMutableArray array];
+            }
+            [self.cancellationBlocks addObject:[cancellationBlock copy]];
+            return;
+        }
+        
+        if (! _cancelled) {
+            return;
+        }
+    }
+    
+    cancellationBlock();
+}
+
+- (void)addChildRequestHandle:(CPARequestHandle *)childRequestHandle
+{
+    NSParameterAssert(childRequestHandle);
+    
+    __weak CPARequestHandle *weakChildRequestHandle = childRequestHandle;
+    [self addCancellationBlock:^{
+        [weakChildRequestHandle cancel];
+    }];
+}
+
+- (id)finish
+{
+    @synchronized(self) {
+        if (_finished) {
+            return nil;
+        }
+        
+        _finished = YES;
+        
+        id completionBlock = self.completionBlock;
+        self.completionBlock = nil;
+        self.cancellationBlocks = nil;
+        return completionBlock;
+    }
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; cancelled: %@; finished: %@>",
+            [self class],
+            self,
+            self.cancelled ? @"YES" : @"NO",
+            self.finished ? @"YES" : @"NO"];
+}
+
+@end
@@ -0,0 +1,32 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+#import "CPARequestMetrics.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Private interface for implementation purposes
+ */
+@interface CPARequestMetrics (Private)
+
+/**
+ * Create metrics for an attempt. Network timings are extracted from the task metrics, if available (iOS 10 and above)
+ */
+- (instancetype)initWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                        endpoint:(NSString *)endpoint
+                                      retryCount:(NSUInteger)retryCount
+                                        response:(nullable NSURLResponse *)response
+                                           error:(nullable NSError *)error
+                                       startDate:(NSDate *)startDate
+                                   totalDuration:(NSTimeInterval)totalDuration
+                                 parsingDuration:(NSTimeInterval)parsingDuration
+                                     taskMetrics:(nullable NSURLSessionTaskMetrics *)taskMetrics;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,101 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Phases of a request made to an authorization provider
+ */
+typedef NS_ENUM(NSInteger, CPARequestPhase) {
+    CPARequestPhaseDomainLookup,        // DNS lookup
+    CPARequestPhaseConnect,             // Connection establishment, including the TLS handshake
+    CPARequestPhaseSecureConnection,    // TLS handshake
+    CPARequestPhaseTimeToFirstByte,     // From the start of the request to the first response byte
+    CPARequestPhaseParsing,             // Response JSON parsing
+    CPARequestPhaseTotal                // From the start of the request to the parsed response
+};
+
+/**
+ * Timings of a single attempt made to perform a request to an authorization provider. Retries of a failed request are
+ * reported as separate attempts
+ *
+ * Network timings are extracted from NSURLSessionTaskMetrics, and are therefore only available on iOS 10 and above.
+ * Phases which did not take place (e.g. DNS lookup and connection establishment when a connection is reused) or which
+ * could not be measured have a negative duration
+ */
+@interface CPARequestMetrics : NSObject
+
+/**
+ * The authorization provider URL
+ */
+@property (nonatomic, readonly) NSURL *authorizationProviderURL;
+
+/**
+ * The endpoint to which the request was made (register, associate or token)
+ */
+@property (nonatomic, readonly, copy) NSString *endpoint;
+
+/**
+ * The number of retries made before this attempt (0 for the first attempt)
+ */
+@property (nonatomic, readonly) NSUInteger retryCount;
+
+/**
+ * The HTTP status code, 0 if no response was received
+ */
+@property (nonatomic, readonly) NSInteger statusCode;
+
+/**
+ * The error with which the attempt failed, nil on success
+ */
+@property (nonatomic, readonly, nullable) NSError *error;
+
+/**
+ * The date at which the attempt started
+ */
+@property (nonatomic, readonly) NSDate *startDate;
+
+/**
+ * Phase durations, in seconds
+ */
+@property (nonatomic, readonly) NSTimeInterval domainLookupDuration;
+@property (nonatomic, readonly) NSTimeInterval connectDuration;
+@property (nonatomic, readonly) NSTimeInterval secureConnectionDuration;
+@property (nonatomic, readonly) NSTimeInterval timeToFirstByte;
+@property (nonatomic, readonly) NSTimeInterval parsingDuration;
+@property (nonatomic, readonly) NSTimeInterval totalDuration;
+
+/**
+ * Return the duration of the specified phase, negative if unavailable
+ */
+- (NSTimeInterval)durationForPhase:(CPARequestPhase)phase;
+
+@end
+
+@interface CPARequestMetrics (UnavailableMethods)
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+/**
+ * Protocol for objects notified of requests made to an authorization provider
+ */
+@protocol CPAMetricsObserver <NSObject>
+
+/**
+ * Called on a background queue each time an attempt to perform a request is over, successfully or not. Implementations
+ * must be thread-safe and return quickly
+ */
+- (void)didCollectRequestMetrics:(CPARequestMetrics *)requestMetrics;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,123 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPARequestMetrics.h"
+
+// Static functions
+static NSTimeInterval CPADurationBetweenDates(NSDate *startDate, NSDate *endDate);
+
+@interface CPARequestMetrics ()
+
+@property (nonatomic) NSURL *authorizationProviderURL;
+@property (nonatomic, copy) NSString *endpoint;
+@property (nonatomic) NSUInteger retryCount;
+@property (nonatomic) NSInteger statusCode;
+@property (nonatomic) NSError *error;
+@property (nonatomic) NSDate *startDate;
+@property (nonatomic) NSTimeInterval domainLookupDuration;
+@property (nonatomic) NSTimeInterval connectDuration;
+@property (nonatomic) NSTimeInterval secureConnectionDuration;
+@property (nonatomic) NSTimeInterval timeToFirstByte;
+@property (nonatomic) NSTimeInterval parsingDuration;
+@property (nonatomic) NSTimeInterval totalDuration;
+
+@end
+
+@implementation CPARequestMetrics
+
+#pragma mark Object lifecycle
+
+- (instancetype)initWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                        endpoint:(NSString *)endpoint
+                                      retryCount:(NSUInteger)retryCount
+                                        response:(NSURLResponse *)response
+                                           error:(NSError *)error
+                                       startDate:(NSDate *)startDate
+                                   totalDuration:(NSTimeInterval)totalDuration
+                                 parsingDuration:(NSTimeInterval)parsingDuration
+                                     taskMetrics:(NSURLSessionTaskMetrics *)taskMetrics
+{
+    NSParameterAssert(authorizationProviderURL);
+    NSParameterAssert(endpoint);
+    NSParameterAssert(startDate);
+    
+    if (self = [super init]) {
+        self.authorizationProviderURL = authorizationProviderURL;
+        self.endpoint = endpoint;
+        self.retryCount = retryCount;
+        self.statusCode = [response isKindOfClass:[NSHTTPURLResponse class]] ? ((NSHTTPURLResponse *)response).statusCode : 0;
+        self.error = error;
+        self.startDate = startDate;
+        self.totalDuration = totalDuration;
+        self.parsingDuration = parsingDuration;
+        
+        // The last transaction is the one which delivered the response, earlier ones being redirects
+        NSURLSessionTaskTransactionMetrics *transactionMetrics = taskMetrics.transactionMetrics.lastObject;
+        self.domainLookupDuration = CPADurationBetweenDates(transactionMetrics.domainLookupStartDate, transactionMetrics.domainLookupEndDate);
+        self.connectDuration = CPADurationBetweenDates(transactionMetrics.connectStartDate, transactionMetrics.connectEndDate);
+        self.secureConnectionDuration = CPADurationBetweenDates(transactionMetrics.secureConnectionStartDate, transactionMetrics.secureConnectionEndDate);
+        self.timeToFirstByte = CPADurationBetweenDates(transactionMetrics.fetchStartDate, transactionMetrics.responseStartDate);
+    }
+    return self;
+}
+
+- (instancetype)init
+{
+    [self doesNotRecognizeSelector:_cmd];
+    return nil;
+}
+
+#pragma mark Phases
+
+- (NSTimeInterval)durationForPhase:(CPARequestPhase)phase
+{
+    switch (phase) {
+        case CPARequestPhaseDomainLookup:
+            return self.domainLookupDuration;
+        case CPARequestPhaseConnect:
+            return self.connectDuration;
+        case CPARequestPhaseSecureConnection:
+            return self.secureConnectionDuration;
+        case CPARequestPhaseTimeToFirstByte:
+            return self.timeToFirstByte;
+        case CPARequestPhaseParsing:
+            return self.parsingDuration;
+        case CPARequestPhaseTotal:
+            return self.totalDuration;
+        default:
+            return -1.;
+    }
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; endpoint: %@; retryCount: %@; statusCode: %@; error: %@; totalDuration: %@>",
+            [self class],
+            self,
+            self.endpoint,
+            @(self.retryCount),
+            @(self.statusCode),
+            self.error,
+            @(self.totalDuration)];
+}
+
+@end
+
+#pragma mark Static functions
+
+/**
+ * Return the duration between two dates, -1 if one of them is missing
+ */
+static NSTimeInterval CPADurationBetweenDates(NSDate *startDate, NSDate *endDate)
+{
+    if (! startDate || ! endDate) {
+        return -1.;
+    }
+    
+    return fmax([endDate timeIntervalSinceDate:startDate], 0.);
+}
@@ -0,0 +1,76 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Authorization provider responses, decoded straight from UTF-8 response bytes, for implementation purposes only
+ *
+ * No intermediate JSON object is built: The top-level object is scanned once, values of unknown keys are skipped (their
+ * syntax is only checked loosely), and strings are only created for known fields. Fields whose value is null or of an
+ * unexpected type are treated as missing. Integer fields also accept strings containing integers
+ */
+@interface CPAResponse : NSObject
+
+/**
+ * Decode a response. Return nil if the data is not a JSON object
+ */
++ (nullable instancetype)responseWithData:(NSData *)data;
+
+/**
+ * The error identifier returned by the authorization provider, if any
+ */
+@property (nonatomic, readonly, copy, nullable) NSString *errorIdentifier;
+
+@end
+
+/**
+ * Response to a client registration request
+ */
+@interface CPAClientRegistrationResponse : CPAResponse
+
+@property (nonatomic, readonly, copy, nullable) NSString *clientIdentifier;
+@property (nonatomic, readonly, copy, nullable) NSString *clientSecret;
+
+@end
+
+/**
+ * Response to a user code request
+ */
+@interface CPAUserCodeResponse : CPAResponse
+
+@property (nonatomic, readonly, copy, nullable) NSString *deviceCode;
+@property (nonatomic, readonly, copy, nullable) NSString *userCode;
+@property (nonatomic, readonly, nullable) NSURL *verificationURL;
+@property (nonatomic, readonly) NSInteger pollingIntervalInSeconds;
+@property (nonatomic, readonly) NSInteger expiresInSeconds;
+
+@end
+
+/**
+ * Response to a client or user token request
+ */
+@interface CPATokenResponse : CPAResponse
+
+@property (nonatomic, readonly, copy, nullable) NSString *userName;
+@property (nonatomic, readonly, copy, nullable) NSString *accessToken;
+@property (nonatomic, readonly, copy, nullable) NSString *tokenType;
+@property (nonatomic, readonly, copy, nullable) NSString *domainName;
+@property (nonatomic, readonly) NSInteger expiresInSeconds;
+
+@end
+
+@interface CPAResponse (UnavailableMethods)
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,634 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPAResponse.h"
+
+// Types
+typedef struct {
+    const uint8_t *bytes;
+    size_t length;
+    size_t position;
+    BOOL failed;
+} CPAJSONScanner;
+
+// Static functions
+static void CPAJSONScannerSkipWhitespace(CPAJSONScanner *scanner);
+static BOOL CPAJSONScannerScanCharacter(CPAJSONScanner *scanner, uint8_t character);
+static BOOL CPAJSONScannerScanLiteral(CPAJSONScanner *scanner, const char *literal);
+static BOOL CPAJSONScannerScanString(CPAJSONScanner *scanner, const uint8_t **pBytes, size_t *pLength, BOOL *pEscaped);
+static BOOL CPAJSONScannerSkipValue(CPAJSONScanner *scanner);
+static NSString *CPAJSONScannerReadString(CPAJSONScanner *scanner);
+static NSInteger CPAJSONScannerReadInteger(CPAJSONScanner *scanner);
+static NSString *CPAStringFromJSONStringBytes(const uint8_t *bytes, size_t length, BOOL escaped);
+static BOOL CPAJSONHexQuadValue(const uint8_t *bytes, size_t length, uint32_t *pValue);
+static size_t CPAUTF8EncodeCodePoint(uint32_t codePoint, uint8_t *buffer);
+static BOOL CPAJSONKeyEqualsString(const uint8_t *key, size_t length, const char *string);
+
+@interface CPAResponse ()
+
+@property (nonatomic, copy) NSString *errorValue;
+@property (nonatomic, copy) NSString *reasonValue;
+
+- (instancetype)initForDecoding;
+
+/**
+ * Decode the value of the field with the specified key, returning NO if the key is unknown. Subclasses must call the
+ * parent implementation for keys they do not know
+ */
+- (BOOL)decodeValueForKey:(const uint8_t *)key length:(size_t)length scanner:(CPAJSONScanner *)scanner;
+
+@end
+
+@interface CPAClientRegistrationResponse ()
+
+@property (nonatomic, copy) NSString *clientIdentifier;
+@property (nonatomic, copy) NSString *clientSecret;
+
+@end
+
+@interface CPAUserCodeResponse ()
+
+@property (nonatomic, copy) NSString *deviceCode;
+@property (nonatomic, copy) NSString *userCode;
+@property (nonatomic) NSURL *verificationURL;
+@property (nonatomic) NSInteger pollingIntervalInSeconds;
+@property (nonatomic) NSInteger expiresInSeconds;
+
+@end
+
+@interface CPATokenResponse ()
+
+@property (nonatomic, copy) NSString *userName;
+@property (nonatomic, copy) NSString *accessToken;
+@property (nonatomic, copy) NSString *tokenType;
+@property (nonatomic, copy) NSString *domainName;
+@property (nonatomic) NSInteger expiresInSeconds;
+
+@end
+
+@implementation CPAResponse
+
+#pragma mark Class methods
+
++ (instancetype)responseWithData:(NSData *)data
+{
+    NSParameterAssert(data);
+    
+    CPAJSONScanner scanner = { data.bytes, data.length, 0, NO };
+    
+    // Skip the byte order mark, if any
+    if (scanner.length >= 3 && memcmp(scanner.bytes, "\xEF\xBB\xBF", 3) == 0) {
+        scanner.position = 3;
+    }
+    
+    CPAJSONScannerSkipWhitespace(&scanner);
+    if (! CPAJSONScannerScanCharacter(&scanner, '{')) {
+        return nil;
+    }
+    
+    CPAResponse *response = [[self alloc] initForDecoding];
+    
+    CPAJSONScannerSkipWhitespace(&scanner);
+    if (! CPAJSONScannerScanCharacter(&scanner, '}')) {
+        do {
+            CPAJSONScannerSkipWhitespace(&scanner);
+            
+            const uint8_t *key = NULL;
+            size_t keyLength = 0;
+            BOOL keyEscaped = NO;
+            if (! CPAJSONScannerScanString(&scanner, &key, &keyLength, &keyEscaped)) {
+                return nil;
+            }
+            
+            CPAJSONScannerSkipWhitespace(&scanner);
+            if (! CPAJSONScannerScanCharacter(&scanner, ':')) {
+                return nil;
+            }
+            CPAJSONScannerSkipWhitespace(&scanner);
+            
+            // Known keys never contain escape sequences
+            if (keyEscaped || ! [response decodeValueForKey:key length:keyLength scanner:&scanner]) {
+                CPAJSONScannerSkipValue(&scanner);
+            }
+            if (scanner.failed) {
+                return nil;
+            }
+            
+            CPAJSONScannerSkipWhitespace(&scanner);
+        } while (CPAJSONScannerScanCharacter(&scanner, ','));
+        
+        if (! CPAJSONScannerScanCharacter(&scanner, '}')) {
+            return nil;
+        }
+    }
+    
+    // Nothing but whitespace may follow the object
+    CPAJSONScannerSkipWhitespace(&scanner);
+    if (scanner.position != scanner.length) {
+        return nil;
+    }
+    
+    return response;
+}
+
+#pragma mark Object lifecycle
+
+- (instancetype)initForDecoding
+{
+    return [super init];
+}
+
+- (instancetype)init
+{
+    [self doesNotRecognizeSelector:_cmd];
+    return nil;
+}
+
+#pragma mark Accessors and mutators
+
+- (NSString *)errorIdentifier
+{
+    return self.errorValue ?: self.reasonValue;
+}
+
+#pragma mark Decoding
+
+- (BOOL)decodeValueForKey:(const uint8_t *)key length:(size_t)length scanner:(CPAJSONScanner *)scanner
+{
+    if (CPAJSONKeyEqualsString(key, length, "error")) {
+        self.errorValue = CPAJSONScannerReadString(scanner);
+        return YES;
+    }
+    else if (CPAJSONKeyEqualsString(key, length, "reason")) {
+        self.reasonValue = CPAJSONScannerReadString(scanner);
+        return YES;
+    }
+    else {
+        return NO;
+    }
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; errorIdentifier: %@>",
+            [self class],
+            self,
+            self.errorIdentifier];
+}
+
+@end
+
+@implementation CPAClientRegistrationResponse
+
+#pragma mark Decoding
+
+- (BOOL)decodeValueForKey:(const uint8_t *)key length:(size_t)length scanner:(CPAJSONScanner *)scanner
+{
+    if (CPAJSONKeyEqualsString(key, length, "client_id")) {
+        self.clientIdentifier = CPAJSONScannerReadString(scanner);
+        return YES;
+    }
+    else if (CPAJSONKeyEqualsString(key, length, "client_secret")) {
+        self.clientSecret = CPAJSONScannerReadString(scanner);
+        return YES;
+    }
+    else {
+        return [super decodeValueForKey:key length:length scanner:scanner];
+    }
+}
+
+@end
+
+@implementation CPAUserCodeResponse
+
+#pragma mark Decoding
+
+- (BOOL)decodeValueForKey:(const uint8_t *)key length:(size_t)length scanner:(CPAJSONScanner *)scanner
+{
+    if (CPAJSONKeyEqualsString(key, length, "device_code")) {
+        self.deviceCode = CPAJSONScannerReadString(scanner);
+        return YES;
+    }
+    else if (CPAJSONKeyEqualsString(key, length, "user_code")) {
+        self.userCode = CPAJSONScannerReadString(scanner);
+        return YES;
+    }
+    else if (CPAJSONKeyEqualsString(key, length, "verification_uri")) {
+        NSString *verificationURLString = CPAJSONScannerReadString(scanner);
+        self.verificationURL = verificationURLString ? [NSURL URLWithString:verificationURLString] : nil;
+        return YES;
+    }
+    else if (CPAJSONKeyEqualsString(key, length, "interval")) {
+        self.pollingIntervalInSeconds = CPAJSONScannerReadInteger(scanner);
+        return YES;
+    }
+    else if (CPAJSONKeyEqualsString(key, length, "expires_in")) {
+        self.expiresInSeconds = CPAJSONScannerReadInteger(scanner);
+        return YES;
+    }
+    else {
+        return [super decodeValueForKey:key length:length scanner:scanner];
+    }
+}
+
+@end
+
+@implementation CPATokenResponse
+
+#pragma mark Decoding
+
+- (BOOL)decodeValueForKey:(const uint8_t *)key length:(size_t)length scanner:(CPAJSONScanner *)scanner
+{
+    if (CPAJSONKeyEqualsString(key, length, "user_name")) {
+        self.userName = CPAJSONScannerReadString(scanner);
+        return YES;
+    }
+    else if (CPAJSONKeyEqualsString(key, length, "access_token")) {
+        self.accessToken = CPAJSONScannerReadString(scanner);
+        return YES;
+    }
+    else if (CPAJSONKeyEqualsString(key, length, "token_type")) {
+        self.tokenType = CPAJSONScannerReadString(scanner);
+        return YES;
+    }
+    else if (CPAJSONKeyEqualsString(key, length, "domain_display_name")) {
+        self.domainName = CPAJSONScannerReadString(scanner);
+        return YES;
+    }
+    else if (CPAJSONKeyEqualsString(key, length, "expires_in")) {
+        self.expiresInSeconds = CPAJSONScannerReadInteger(scanner);
+        return YES;
+    }
+    else {
+        return [super decodeValueForKey:key length:length scanner:scanner];
+    }
+}
+
+@end
+
+#pragma mark Static functions
+
+static void CPAJSONScannerSkipWhitespace(CPAJSONScanner *scanner)
+{
+    while (scanner->position < scanner->length) {
+        uint8_t byte = scanner->bytes[scanner->position];
+        if (byte != ' ' && byte != '\t' && byte != '\n' && byte != '\r') {
+            break;
+        }
+        ++scanner->position;
+    }
+}
+
+/**
+ * Scan the specified character if found at the current position. Does not fail otherwise
+ */
+static BOOL CPAJSONScannerScanCharacter(CPAJSONScanner *scanner, uint8_t character)
+{
+    if (scanner->position >= scanner->length || scanner->bytes[scanner->position] != character) {
+        return NO;
+    }
+    
+    ++scanner->position;
+    return YES;
+}
+
+static BOOL CPAJSONScannerScanLiteral(CPAJSONScanner *scanner, const char *literal)
+{
+    size_t length = strlen(literal);
+    if (scanner->length - scanner->position < length || memcmp(scanner->bytes + scanner->position, literal, length) != 0) {
+        scanner->failed = YES;
+        return NO;
+    }
+    
+    scanner->position += length;
+    return YES;
+}
+
+/**
+ * Scan a string, returning its raw bytes (between quotes) and whether it contains escape sequences. No copy is made
+ */
+static BOOL CPAJSONScannerScanString(CPAJSONScanner *scanner, const uint8_t **pBytes, size_t *pLength, BOOL *pEscaped)
+{
+    if (! CPAJSONScannerScanCharacter(scanner, '"')) {
+        scanner->failed = YES;
+        return NO;
+    }
+    
+    size_t start = scanner->position;
+    BOOL escaped = NO;
+    while (scanner->position < scanner->length) {
+        uint8_t byte = scanner->bytes[scanner->position];
+        if (byte == '"') {
+            if (pBytes) {
+                *pBytes = scanner->bytes + start;
+            }
+            if (pLength) {
+                *pLength = scanner->position - start;
+            }
+            if (pEscaped) {
+                *pEscaped = escaped;
+            }
+            
+            ++scanner->position;
+            return YES;
+        }
+        else if (byte == '\\') {
+            escaped = YES;
+            scanner->position += 2;
+        }
+        else if (byte < 0x20) {
+            // Control characters must be escaped
+            break;
+        }
+        else {
+            ++scanner->position;
+        }
+    }
+    
+    scanner->failed = YES;
+    return NO;
+}
+
+/**
+ * Skip a value without decoding it. Objects and arrays are skipped by balancing brackets
+ */
+static BOOL CPAJSONScannerSkipValue(CPAJSONScanner *scanner)
+{
+    if (scanner->position >= scanner->length) {
+        scanner->failed = YES;
+        return NO;
+    }
+    
+    uint8_t byte = scanner->bytes[scanner->position];
+    if (byte == '"') {
+        return CPAJSONScannerScanString(scanner, NULL, NULL, NULL);
+    }
+    else if (byte == '{' || byte == '[') {
+        NSUInteger depth = 0;
+        while (scanner->position < scanner->length) {
+            byte = scanner->bytes[scanner->position];
+            if (byte == '"') {
+                if (! CPAJSONScannerScanString(scanner, NULL, NULL, NULL)) {
+                    return NO;
+                }
+                continue;
+            }
+            
+            if (byte == '{' || byte == '[') {
+                ++depth;
+            }
+            else if (byte == '}' || byte == ']') {
+                --depth;
+                if (depth == 0) {
+                    ++scanner->position;
+                    return YES;
+                }
+            }
+            ++scanner->position;
+        }
+        
+        scanner->failed = YES;
+        return NO;
+    }
+    else if (byte == 't') {
+        return CPAJSONScannerScanLiteral(scanner, "true");
+    }
+    else if (byte == 'f') {
+        return CPAJSONScannerScanLiteral(scanner, "false");
+    }
+    else if (byte == 'n') {
+        return CPAJSONScannerScanLiteral(scanner, "null");
+    }
+    else if (byte == '-' || (byte >= '0' && byte <= '9')) {
+        while (scanner->position < scanner->length) {
+            // strchr also matches the terminating NUL, which must therefore be excluded
+            uint8_t numberByte = scanner->bytes[scanner->position];
+            if (numberByte == '\0' || ! strchr("+-.0123456789eE", numberByte)) {
+                break;
+            }
+            ++scanner->position;
+        }
+        return YES;
+    }
+    else {
+        scanner->failed = YES;
+        return NO;
+    }
+}
+
+/**
+ * Read a string value. Return nil for any other kind of value
+ */
+static NSString *CPAJSONScannerReadString(CPAJSONScanner *scanner)
+{
+    if (scanner->position >= scanner->length || scanner->bytes[scanner->position] != '"') {
+        CPAJSONScannerSkipValue(scanner);
+        return nil;
+    }
+    
+    const uint8_t *bytes = NULL;
+    size_t length = 0;
+    BOOL escaped = NO;
+    if (! CPAJSONScannerScanString(scanner, &bytes, &length, &escaped)) {
+        return nil;
+    }
+    
+    NSString *string = CPAStringFromJSONStringBytes(bytes, length, escaped);
+    if (! string) {
+        scanner->failed = YES;
+    }
+    return string;
+}
+
+/**
+ * Read an integer value, truncating decimal numbers. Strings are converted like -[NSString integerValue] does. Return 0
+ * for any other kind of value
+ */
+static NSInteger CPAJSONScannerReadInteger(CPAJSONScanner *scanner)
+{
+    if (scanner->position >= scanner->length) {
+        scanner->failed = YES;
+        return 0;
+    }
+    
+    uint8_t byte = scanner->bytes[scanner->position];
+    if (byte == '"') {
+        return [CPAJSONScannerReadString(scanner) integerValue];
+    }
+    else if (byte != '-' && (byte < '0' || byte > '9')) {
+        CPAJSONScannerSkipValue(scanner);
+        return 0;
+    }
+    
+    size_t start = scanner->position;
+    CPAJSONScannerSkipValue(scanner);
+    
+    // Copy the number so that it can be parsed by C functions, which expect NUL-terminated strings
+    char buffer[64];
+    size_t length = scanner->position - start;
+    if (length >= sizeof(buffer)) {
+        return 0;
+    }
+    memcpy(buffer, scanner->bytes + start, length);
+    buffer[length] = '\0';
+    
+    if (strpbrk(buffer, ".eE")) {
+        double value = strtod(buffer, NULL);
+        return (NSInteger)fmax(fmin(value, (double)NSIntegerMax), (double)NSIntegerMin);
+    }
+    else {
+        return (NSInteger)strtol(buffer, NULL, 10);
+    }
+}
+
+/**
+ * Create a string from the raw bytes of a JSON string, decoding escape sequences if any. Return nil if the bytes are
+ * not valid
+ */
+static NSString *CPAStringFromJSONStringBytes(const uint8_t *bytes, size_t length, BOOL escaped)
+{
+    if (! escaped) {
+        return [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
+    }
+    
+    // Escape sequences are never shorter than the UTF-8 characters they represent
+    uint8_t stackBuffer[256];
+    uint8_t *buffer = (length <= sizeof(stackBuffer)) ? stackBuffer : malloc(length);
+    size_t bufferLength = 0;
+    
+    BOOL valid = YES;
+    for (size_t i = 0; i < length && valid; ++i) {
+        uint8_t byte = bytes[i];
+        if (byte != '\\') {
+            buffer[bufferLength++] = byte;
+            continue;
+        }
+        
+        // Strings are scanned so that a backslash is always followed by a character
+        byte = bytes[++i];
+        if (byte == '"' || byte == '\\' || byte == '/') {
+            buffer[bufferLength++] = byte;
+        }
+        else if (byte == 'b') {
+            buffer[bufferLength++] = '\b';
+        }
+        else if (byte == 'f') {
+            buffer[bufferLength++] = '\f';
+        }
+        else if (byte == 'n') {
+            buffer[bufferLength++] = '\n';
+        }
+        else if (byte == 'r') {
+            buffer[bufferLength++] = '\r';
+        }
+        else if (byte == 't') {
+            buffer[bufferLength++] = '\t';
+        }
+        else if (byte == 'u') {
+            uint32_t codePoint = 0;
+            if (! CPAJSONHexQuadValue(bytes + i + 1, length - i - 1, &codePoint)) {
+                valid = NO;
+                break;
+            }
+            i += 4;
+            
+            // Combine surrogate pairs. Lone surrogates are replaced
+            if (codePoint >= 0xD800 && codePoint <= 0xDBFF) {
+                uint32_t lowSurrogate = 0;
+                if (length - i - 1 >= 6 && bytes[i + 1] == '\\' && bytes[i + 2] == 'u'
+                        && CPAJSONHexQuadValue(bytes + i + 3, length - i - 3, &lowSurrogate)
+                        && lowSurrogate >= 0xDC00 && lowSurrogate <= 0xDFFF) {
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (lowSurrogate - 0xDC00);
+                    i += 6;
+                }
+                else {
+                    codePoint = 0xFFFD;
+                }
+            }
+            else if (codePoint >= 0xDC00 && codePoint <= 0xDFFF) {
+                codePoint = 0xFFFD;
+            }
+            
+            bufferLength += CPAUTF8EncodeCodePoint(codePoint, buffer + bufferLength);
+        }
+        else {
+            valid = NO;
+        }
+    }
+    
+    NSString *string = valid ? [[NSString alloc] initWithBytes:buffer length:bufferLength encoding:NSUTF8StringEncoding] : nil;
+    if (buffer != stackBuffer) {
+        free(buffer);
+    }
+    return string;
+}
+
+static BOOL CPAJSONHexQuadValue(const uint8_t *bytes, size_t length, uint32_t *pValue)
+{
+    NSCParameterAssert(pValue);
+    
+    if (length < 4) {
+        return NO;
+    }
+    
+    uint32_t value = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        uint8_t byte = bytes[i];
+        uint32_t digit = 0;
+        if (byte >= '0' && byte <= '9') {
+            digit = byte - '0';
+        }
+        else if (byte >= 'a' && byte <= 'f') {
+            digit = byte - 'a' + 10;
+        }
+        else if (byte >= 'A' && byte <= 'F') {
+            digit = byte - 'A' + 10;
+        }
+        else {
+            return NO;
+        }
+        value = (value << 4) | digit;
+    }
+    
+    *pValue = value;
+    return YES;
+}
+
+/**
+ * Write the UTF-8 encoding of a code point to a buffer (with room for at least 4 bytes), returning its length
+ */
+static size_t CPAUTF8EncodeCodePoint(uint32_t codePoint, uint8_t *buffer)
+{
+    if (codePoint < 0x80) {
+        buffer[0] = (uint8_t)codePoint;
+        return 1;
+    }
+    else if (codePoint < 0x800) {
+        buffer[0] = (uint8_t)(0xC0 | (codePoint >> 6));
+        buffer[1] = (uint8_t)(0x80 | (codePoint & 0x3F));
+        return 2;
+    }
+    else if (codePoint < 0x10000) {
+        buffer[0] = (uint8_t)(0xE0 | (codePoint >> 12));
+        buffer[1] = (uint8_t)(0x80 | ((codePoint >> 6) & 0x3F));
+        buffer[2] = (uint8_t)(0x80 | (codePoint & 0x3F));
+        return 3;
+    }
+    else {
+        buffer[0] = (uint8_t)(0xF0 | (codePoint >> 18));
+        buffer[1] = (uint8_t)(0x80 | ((codePoint >> 12) & 0x3F));
+        buffer[2] = (uint8_t)(0x80 | ((codePoint >> 6) & 0x3F));
+        buffer[3] = (uint8_t)(0x80 | (codePoint & 0x3F));
+        return 4;
+    }
+}
+
+static BOOL CPAJSONKeyEqualsString(const uint8_t *key, size_t length, const char *string)
+{
+    return strlen(string) == length && memcmp(key, string, length) == 0;
+}
@@ -0,0 +1,44 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+#import "CPARetryPolicy.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Options describing how a request can be retried
+ */
+typedef NS_OPTIONS(NSInteger, CPARetryOptions) {
+    CPARetryOptionsNone = 0,
+    CPARetryOptionNonIdempotent = 1 << 0,           // The request must not be processed twice. Only retried after failures which occurred before it was sent
+    CPARetryOptionNoSlowDownRetry = 1 << 1          // Slow down answers (CPAErrorTooFast) are handled by the caller and never retried
+};
+
+/**
+ * Private interface for implementation purposes
+ */
+@interface CPARetryPolicy (Private)
+
+/**
+ * Record that a new request is made, adding to the retry budget
+ */
+- (void)recordRequest;
+
+/**
+ * Return YES iff a request which failed with the specified error and response can be retried, consuming one unit from the
+ * retry budget. The number of retries already made and the retry options of the request must be provided. On success,
+ * the delay to wait before retrying is returned in pDelay
+ */
+- (BOOL)shouldRetryAfterError:(NSError *)error
+                     response:(nullable NSURLResponse *)response
+                   retryCount:(NSUInteger)retryCount
+                      options:(CPARetryOptions)options
+                        delay:(NSTimeInterval *)pDelay;
+
+@end
+
+NS_ASSUME_NONNULL_END
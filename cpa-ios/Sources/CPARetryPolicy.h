@@ -0,0 +1,70 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Policy describing how requests to an authorization provider are retried when they fail because of a transient
+ * network error or because the authorization provider asked clients to slow down (CPAErrorTooFast)
+ *
+ * Retries are made with capped exponential backoff and full jitter: The delay before the n-th retry is a random value
+ * between 0 and min(maximumDelay, baseDelay * 2^(n-1)). If the authorization provider sends a Retry-After header, the
+ * delay is at least the one it specifies. If this delay exceeds maximumDelay, the request is not retried
+ *
+ * To avoid overloading an authorization provider recovering from an outage, retries are limited by a retry budget,
+ * shared by all requests made to the same authorization provider. Each retry consumes one unit from the budget, and
+ * each request adds retryBudgetRatio units to it, up to retryBudgetCapacity. When the budget is exhausted, failed
+ * requests are not retried anymore
+ *
+ * Client registration is not idempotent, and is only retried when it could not be sent at all (host not found,
+ * connection refused, no network). Otherwise the authorization provider might have registered a client already. Device
+ * code polls are never retried after a slow down answer, since the poller increases its polling interval instead
+ */
+@interface CPARetryPolicy : NSObject <NSCopying>
+
+/**
+ * Return a policy which never retries requests
+ */
++ (CPARetryPolicy *)noRetryPolicy;
+
+/**
+ * Maximum number of times a request is retried (default: 3). Set to 0 to disable retries
+ */
+@property (atomic) NSUInteger maximumRetryCount;
+
+/**
+ * The maximum delay before the first retry, doubled for each subsequent retry (default: 0.5 seconds)
+ */
+@property (atomic) NSTimeInterval baseDelay;
+
+/**
+ * The maximum delay before a retry (default: 30 seconds)
+ */
+@property (atomic) NSTimeInterval maximumDelay;
+
+/**
+ * The maximum number of retries which can be made in a row, and the initial budget (default: 10)
+ */
+@property (atomic) NSUInteger retryBudgetCapacity;
+
+/**
+ * The fraction of a retry added to the budget for each request (default: 0.2, i.e. at most one request in five can be
+ * retried once the initial budget has been used)
+ */
+@property (atomic) double retryBudgetRatio;
+
+/**
+ * Return YES iff the specified error is transient and a request failing with it might therefore be retried
+ */
+- (BOOL)isRetryableError:(NSError *)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,220 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPARetryPolicy.h"
+
+#import "CPAErrors.h"
+#import "CPARetryPolicy+Private.h"
+
+// Static functions
+static BOOL CPAIsUnsentRequestError(NSError *error);
+static NSTimeInterval CPARetryAfterDelayFromResponse(NSURLResponse *response);
+
+@interface CPARetryPolicy ()
+
+@property (nonatomic) double retryBudget;
+
+@end
+
+@implementation CPARetryPolicy
+
+#pragma mark Class methods
+
++ (CPARetryPolicy *)noRetryPolicy
+{
+    CPARetryPolicy *retryPolicy = [[CPARetryPolicy alloc] init];
+    retryPolicy.maximumRetryCount = 0;
+    return retryPolicy;
+}
+
+#pragma mark Object lifecycle
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        self.maximumRetryCount = 3;
+        self.baseDelay = 0.5;
+        self.maximumDelay = 30.;
+        self.retryBudgetCapacity = 10;
+        self.retryBudgetRatio = 0.2;
+        self.retryBudget = self.retryBudgetCapacity;
+    }
+    return self;
+}
+
+#pragma mark Retry decisions
+
+- (BOOL)isRetryableError:(NSError *)error
+{
+    NSParameterAssert(error);
+    
+    if ([error.domain isEqualToString:CPAErrorDomain]) {
+        return error.code == CPAErrorTooFast;
+    }
+    else if ([error.domain isEqualToString:NSURLErrorDomain]) {
+        static NSSet<NSNumber *> *s_retryableErrorCodes;
+        static dispatch_once_t s_onceToken;
+        dispatch_once(&s_onceToken, ^{
+            s_retryableErrorCodes = [NSSet setWithObjects:@(NSURLErrorTimedOut),
+                                     @(NSURLErrorCannotFindHost),
+                                     @(NSURLErrorCannotConnectToHost),
+                                     @(NSURLErrorNetworkConnectionLost),
+                                     @(NSURLErrorDNSLookupFailed),
+                                     @(NSURLErrorNotConnectedToInternet), nil];
+        });
+        return [s_retryableErrorCodes containsObject:@(error.code)];
+    }
+    else {
+        return NO;
+    }
+}
+
+- (void)recordRequest
+{
+    @synchronized(self) {
+        self.retryBudget = fmin(self.retryBudget + self.retryBudgetRatio, self.retryBudgetCapacity);
+    }
+}
+
+- (BOOL)shouldRetryAfterError:(NSError *)error response:(NSURLResponse *)response retryCount:(NSUInteger)retryCount options:(CPARetryOptions)options delay:(NSTimeInterval *)pDelay
+{
+    NSParameterAssert(error);
+    NSParameterAssert(pDelay);
+    
+    if (retryCount >= self.maximumRetryCount) {
+        return NO;
+    }
+    
+    if ((options & CPARetryOptionNoSlowDownRetry) && [error.domain isEqualToString:CPAErrorDomain] && error.code == CPAErrorTooFast) {
+        return NO;
+    }
+    
+    // A time out, a lost connection or a server error does not tell whether the request was processed or not
+    if ((options & CPARetryOptionNonIdempotent) && ! CPAIsUnsentRequestError(error)) {
+        return NO;
+    }
+    
+    // Service unavailable or rate-limited responses might not contain any usable JSON error
+    NSInteger statusCode = [response isKindOfClass:[NSHTTPURLResponse class]] ? ((NSHTTPURLResponse *)response).statusCode : 0;
+    if (! [self isRetryableError:error] && statusCode != 429 && statusCode != 503) {
+        return NO;
+    }
+    
+    // Full jitter
+    NSTimeInterval maximumDelay = self.maximumDelay;
+    NSTimeInterval backoffDelay = fmin(self.baseDelay * pow(2., retryCount), maximumDelay);
+    NSTimeInterval delay = backoffDelay * arc4random_uniform(1001) / 1000.;
+    
+    // Never retry earlier than requested by the AP. Give up if this is too late
+    NSTimeInterval retryAfterDelay = CPARetryAfterDelayFromResponse(response);
+    if (retryAfterDelay > maximumDelay) {
+        return NO;
+    }
+    delay = fmax(delay, retryAfterDelay);
+    
+    @synchronized(self) {
+        if (self.retryBudget < 1.) {
+            return NO;
+        }
+        self.retryBudget -= 1.;
+    }
+    
+    *pDelay = delay;
+    return YES;
+}
+
+#pragma mark NSCopying protocol
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    // The budget is not copied, a copy starts with a full budget
+    CPARetryPolicy *retryPolicy = [[[self class] allocWithZone:zone] init];
+    retryPolicy.maximumRetryCount = self.maximumRetryCount;
+    retryPolicy.baseDelay = self.baseDelay;
+    retryPolicy.maximumDelay = self.maximumDelay;
+    retryPolicy.retryBudgetCapacity = self.retryBudgetCapacity;
+    retryPolicy.retryBudgetRatio = self.retryBudgetRatio;
+    retryPolicy.retryBudget = retryPolicy.retryBudgetCapacity;
+    return retryPolicy;
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; maximumRetryCount: %@; baseDelay: %@; maximumDelay: %@; retryBudget: %@/%@>",
+            [self class],
+            self,
+            @(self.maximumRetryCount),
+            @(self.baseDelay),
+            @(self.maximumDelay),
+            @(self.retryBudget),
+            @(self.retryBudgetCapacity)];
+}
+
+@end
+
+#pragma mark Static functions
+
+/**
+ * Return YES iff the specified error means that a request could not be sent at all
+ */
+static BOOL CPAIsUnsentRequestError(NSError *error)
+{
+    if (! [error.domain isEqualToString:NSURLErrorDomain]) {
+        return NO;
+    }
+    
+    static NSSet<NSNumber *> *s_unsentRequestErrorCodes;
+    static dispatch_once_t s_onceToken;
+    dispatch_once(&s_onceToken, ^{
+        s_unsentRequestErrorCodes = [NSSet setWithObjects:@(NSURLErrorCannotFindHost),
+                                     @(NSURLErrorCannotConnectToHost),
+                                     @(NSURLErrorDNSLookupFailed),
+                                     @(NSURLErrorNotConnectedToInternet), nil];
+    });
+    return [s_unsentRequestErrorCodes containsObject:@(error.code)];
+}
+
+/**
+ * Return the delay specified by the Retry-After header of a response (in seconds or as an HTTP date), 0 if none
+ */
+static NSTimeInterval CPARetryAfterDelayFromResponse(NSURLResponse *response)
+{
+    if (! [response isKindOfClass:[NSHTTPURLResponse class]]) {
+        return 0.;
+    }
+    
+    __block NSString *retryAfter = nil;
+    [((NSHTTPURLResponse *)response).allHeaderFields enumerateKeysAndObjectsUsingBlock:^(NSString *name, NSString *value, BOOL *stop) {
+        if ([name caseInsensitiveCompare:@"Retry-After"] == NSOrderedSame) {
+            retryAfter = value;
+            *stop = YES;
+        }
+    }];
+    
+    if (! retryAfter) {
+        return 0.;
+    }
+    
+    NSScanner *scanner = [NSScanner scannerWithString:retryAfter];
+    NSInteger seconds = 0;
+    if ([scanner scanInteger:&seconds] && scanner.isAtEnd) {
+        return fmax(seconds, 0.);
+    }
+    
+    static NSDateFormatter *s_dateFormatter;
+    static dispatch_once_t s_onceToken;
+    dispatch_once(&s_onceToken, ^{
+        s_dateFormatter = [[NSDateFormatter alloc] init];
+        s_dateFormatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+        s_dateFormatter.timeZone = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+        s_dateFormatter.dateFormat = @"EEE, dd MMM yyyy HH:mm:ss zzz";
+    });
+    
+    NSDate *date = [s_dateFormatter dateFromString:retryAfter];
+    return date ? fmax([date timeIntervalSinceNow], 0.) : 0.;
+}
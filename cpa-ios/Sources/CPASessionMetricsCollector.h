@@ -0,0 +1,32 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Types
+typedef void (^CPATaskMetricsBlock)(NSURLSessionTaskMetrics * __nullable taskMetrics);
+
+/**
+ * Session delegate collecting task metrics, for implementation purposes only
+ *
+ * Task metrics and task completion are delivered separately by NSURLSession, in no guaranteed order. The collector
+ * matches them so that both can be reported together
+ */
+@interface CPASessionMetricsCollector : NSObject <NSURLSessionTaskDelegate>
+
+/**
+ * Call the block on a background queue with the metrics collected for a task. The block is called with nil if metrics
+ * are not available (before iOS 10) or have not been delivered shortly after the task completed
+ */
+- (void)collectMetricsForTask:(NSURLSessionTask *)task withBlock:(CPATaskMetricsBlock)block;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,102 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPASessionMetricsCollector.h"
+
+// Constants
+static const NSTimeInterval CPASessionMetricsCollectionTimeout = 1.;
+
+@interface CPASessionMetricsCollector ()
+
+// Metrics received before the corresponding block, and blocks waiting for metrics, by task identifier. Must be accessed
+// within a @synchronized(self) block
+@property (nonatomic) NSMutableDictionary<NSNumber *, NSURLSessionTaskMetrics *> *taskMetrics;
+@property (nonatomic) NSMutableDictionary<NSNumber *, CPATaskMetricsBlock> *blocks;
+
+@end
+
+@implementation CPASessionMetricsCollector
+
+#pragma mark Object lifecycle
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        self.taskMetrics = [NSMutableDictionary dictionary];
+        self.blocks = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+#pragma mark Collection
+
+- (void)collectMetricsForTask:(NSURLSessionTask *)task withBlock:(CPATaskMetricsBlock)block
+{
+    NSParameterAssert(task);
+    NSParameterAssert(block);
+    
+    if (! NSClassFromString(@"NSURLSessionTaskMetrics")) {
+        block(nil);
+        return;
+    }
+    
+    NSNumber *taskIdentifier = @(task.taskIdentifier);
+    NSURLSessionTaskMetrics *taskMetrics = nil;
+    @synchronized(self) {
+        taskMetrics = self.taskMetrics[taskIdentifier];
+        if (taskMetrics) {
+            [self.taskMetrics removeObjectForKey:taskIdentifier];
+        }
+        else {
+            self.blocks[taskIdentifier] = block;
+        }
+    }
+    
+    if (taskMetrics) {
+        block(taskMetrics);
+        return;
+    }
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(CPASessionMetricsCollectionTimeout * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        CPATaskMetricsBlock pendingBlock = nil;
+        @synchronized(self) {
+            pendingBlock = self.blocks[taskIdentifier];
+            [self.blocks removeObjectForKey:taskIdentifier];
+        }
+        pendingBlock ? pendingBlock(nil) : nil;
+    });
+}
+
+#pragma mark NSURLSessionTaskDelegate protocol
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didFinishCollectingMetrics:(NSURLSessionTaskMetrics *)metrics
+{
+    NSNumber *taskIdentifier = @(task.taskIdentifier);
+    CPATaskMetricsBlock block = nil;
+    @synchronized(self) {
+        block = self.blocks[taskIdentifier];
+        if (block) {
+            [self.blocks removeObjectForKey:taskIdentifier];
+        }
+        else {
+            self.taskMetrics[taskIdentifier] = metrics;
+        }
+    }
+    
+    if (block) {
+        block(metrics);
+        return;
+    }
+    
+    // Discard metrics of tasks which are not collected
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(CPASessionMetricsCollectionTimeout * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        @synchronized(self) {
+            [self.taskMetrics removeObjectForKey:taskIdentifier];
+        }
+    });
+}
+
+@end
@@ -4,7 +4,12 @@
 //  License information is available from the LICENSE file.
 //
 
+#import "CPACircuitBreaker.h"
+#import "CPAEndpointSelector.h"
 #import "CPANullability.h"
+#import "CPARequestHandle.h"
+#import "CPARequestMetrics.h"
+#import "CPARetryPolicy.h"
 
 #import <Foundation/Foundation.h>
 
@@ -17,61 +22,162 @@ typedef void (^CPATokenRequestCompletionBlock)(NSString * __nullable userName, N
 
 /**
  * Stateless requests, for implementation purposes only
+ *
+ * Responses are received and parsed on background queues. Completion blocks are called on the specified completion
+ * queue, or on the main thread if none is provided
+ *
+ * Requests failing because of transient errors are retried according to the retry policy of the authorization provider
+ *
+ * Requests fail immediately with CPAErrorAuthorizationProviderUnavailable while the circuit breaker of the authorization
+ * provider is open
+ *
+ * If an endpoint selector has been set for the authorization provider, each attempt is made to one of its endpoints,
+ * with a circuit breaker for each endpoint, configured as the one of the authorization provider. Refresh requests are
+ * hedged if enabled by the selector
+ *
+ * If a metrics observer has been set for the authorization provider, it is notified of the timings of each attempt
+ *
+ * Requests return a handle through which they can be cancelled, including while waiting for a retry. The completion
+ * block of a cancelled request is never called
  */
 @interface CPAStatelessRequest : NSObject
 
+/**
+ * Set the configuration of the session used to perform requests to an authorization provider. Requests made to the same 
+ * authorization provider share a single session, and therefore a single connection pool. If set to nil, a default 
+ * configuration is used, with a 30 second request timeout and no response caching
+ *
+ * Requests already running are not affected by a configuration change
+ */
++ (void)setSessionConfiguration:(nullable NSURLSessionConfiguration *)sessionConfiguration forAuthorizationProviderURL:(NSURL *)authorizationProviderURL;
+
+/**
+ * Return the configuration of the session used to perform requests to an authorization provider
+ */
++ (NSURLSessionConfiguration *)sessionConfigurationForAuthorizationProviderURL:(NSURL *)authorizationProviderURL;
+
+/**
+ * Return the session used to perform requests to an authorization provider
+ */
++ (NSURLSession *)sessionForAuthorizationProviderURL:(NSURL *)authorizationProviderURL;
+
+/**
+ * Set the policy applied to retry failed requests made to an authorization provider. The policy is copied, its retry
+ * budget being shared by all requests made to the authorization provider. If set to nil, a default policy is used
+ */
++ (void)setRetryPolicy:(nullable CPARetryPolicy *)retryPolicy forAuthorizationProviderURL:(NSURL *)authorizationProviderURL;
+
+/**
+ * Return the policy applied to retry failed requests made to an authorization provider
+ */
++ (CPARetryPolicy *)retryPolicyForAuthorizationProviderURL:(NSURL *)authorizationProviderURL;
+
+/**
+ * Set the circuit breaker suspending requests to an authorization provider which keeps failing. The breaker is copied
+ * and starts closed, its state being shared by all requests made to the authorization provider. If set to nil, a
+ * default breaker is used
+ */
++ (void)setCircuitBreaker:(nullable CPACircuitBreaker *)circuitBreaker forAuthorizationProviderURL:(NSURL *)authorizationProviderURL;
+
+/**
+ * Return the circuit breaker in use for an authorization provider, whose state can be read for telemetry purposes
+ */
++ (CPACircuitBreaker *)circuitBreakerForAuthorizationProviderURL:(NSURL *)authorizationProviderURL;
+
+/**
+ * Set the selector of the endpoints to which requests made to an authorization provider are sent, nil to send them to
+ * the authorization provider URL. The selector is copied, the latencies it records being shared by all requests made to
+ * the authorization provider
+ */
++ (void)setEndpointSelector:(nullable CPAEndpointSelector *)endpointSelector forAuthorizationProviderURL:(NSURL *)authorizationProviderURL;
+
+/**
+ * Return the endpoint selector in use for an authorization provider, if any
+ */
++ (nullable CPAEndpointSelector *)endpointSelectorForAuthorizationProviderURL:(NSURL *)authorizationProviderURL;
+
+/**
+ * Set the observer notified of the metrics of requests made to an authorization provider, nil to remove it. Metrics are
+ * only collected while an observer is set, requests being otherwise performed without any additional overhead. Since
+ * collecting network timings requires a session delegate, the session is replaced when an observer is set or removed
+ */
++ (void)setMetricsObserver:(nullable id<CPAMetricsObserver>)metricsObserver forAuthorizationProviderURL:(NSURL *)authorizationProviderURL;
+
+/**
+ * Return the observer notified of the metrics of requests made to an authorization provider, if any
+ */
++ (nullable id<CPAMetricsObserver>)metricsObserverForAuthorizationProviderURL:(NSURL *)authorizationProviderURL;
+
 /**
  * To register with the authorization provider, the client makes a request to the authorization provider's registration endpoint, 
  * /register. In response, the authorization provider assigns a unique client identifier and an associated client secret
  */
-+ (void)registerClientWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
-                                        clientName:(NSString *)clientName
-                                softwareIdentifier:(NSString *)softwareIdentifier
-                                   softwareVersion:(NSString *)softwareVersion
-                                   completionBlock:(CPAClientRegistrationCompletionBlock)completionBlock;
++ (CPARequestHandle *)registerClientWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                                      clientName:(NSString *)clientName
+                                              softwareIdentifier:(NSString *)softwareIdentifier
+                                                 softwareVersion:(NSString *)softwareVersion
+                                                 completionQueue:(nullable dispatch_queue_t)completionQueue
+                                                 completionBlock:(CPAClientRegistrationCompletionBlock)completionBlock;
 
 /**
  * To associate a client with a user account, the client first makes a request to the authorization provider's association endpoint,
  * /associate. In response, the authorization provider assigns a user verification code and returns this to the client together with 
  * a URI that the user should visit in order to authenticate himself and input the user code to pair their client with their account
  */
-+ (void)requestCodeWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
-                               clientIdentifier:(NSString *)clientIdentifier
-                                   clientSecret:(NSString *)clientSecret
-                                         domain:(NSString *)domain
-                                completionBlock:(CPAUserCodeRequestCompletionBlock)completionBlock;
++ (CPARequestHandle *)requestCodeWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                             clientIdentifier:(NSString *)clientIdentifier
+                                                 clientSecret:(NSString *)clientSecret
+                                                       domain:(NSString *)domain
+                                              completionQueue:(nullable dispatch_queue_t)completionQueue
+                                              completionBlock:(CPAUserCodeRequestCompletionBlock)completionBlock;
 
 /**
  * To obtain an access token, the client makes a request to the authorization provider's token endpoint, /token. In user mode, a token
  * will be obtained after the user has visited the verification URL, entered her credentials and authorized the device
  */
-+ (void)requestUserTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
-                                          deviceCode:(NSString *)deviceCode
-                                    clientIdentifier:(NSString *)clientIdentifier
-                                        clientSecret:(NSString *)clientSecret
-                                              domain:(NSString *)domain
-                                     completionBlock:(CPATokenRequestCompletionBlock)completionBlock;
++ (CPARequestHandle *)requestUserTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                                        deviceCode:(NSString *)deviceCode
+                                                  clientIdentifier:(NSString *)clientIdentifier
+                                                      clientSecret:(NSString *)clientSecret
+                                                            domain:(NSString *)domain
+                                                   completionQueue:(nullable dispatch_queue_t)completionQueue
+                                                   completionBlock:(CPATokenRequestCompletionBlock)completionBlock;
+
+/**
+ * Same as +requestUserTokenWithAuthorizationProviderURL:deviceCode:clientIdentifier:clientSecret:domain:completionQueue:completionBlock:,
+ * for polling. Slow down answers (CPAErrorTooFast) are never retried, the caller being responsible for increasing its
+ * polling interval
+ */
++ (CPARequestHandle *)pollUserTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                                     deviceCode:(NSString *)deviceCode
+                                               clientIdentifier:(NSString *)clientIdentifier
+                                                   clientSecret:(NSString *)clientSecret
+                                                         domain:(NSString *)domain
+                                                completionQueue:(nullable dispatch_queue_t)completionQueue
+                                                completionBlock:(CPATokenRequestCompletionBlock)completionBlock;
 
 /**
  * To obtain an access token, the client makes a request to the authorization provider's token endpoint, /token. In client mode, since
  * the authorization provider doesn't require any further action on the part of the user, the authorization provider can automatically
  * issue a token
  */
-+ (void)requestClientTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
-                                      clientIdentifier:(NSString *)clientIdentifier
-                                          clientSecret:(NSString *)clientSecret
-                                                domain:(NSString *)domain
-                                       completionBlock:(CPATokenRequestCompletionBlock)completionBlock;
++ (CPARequestHandle *)requestClientTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                                    clientIdentifier:(NSString *)clientIdentifier
+                                                        clientSecret:(NSString *)clientSecret
+                                                              domain:(NSString *)domain
+                                                     completionQueue:(nullable dispatch_queue_t)completionQueue
+                                                     completionBlock:(CPATokenRequestCompletionBlock)completionBlock;
 
 /**
  * To replace an expired client or user token with a new access token, the client makes a HTTP POST request to the authorization 
  * provider's /token endpoint
  */
-+ (void)refreshTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
-                                clientIdentifier:(NSString *)clientIdentifier
-                                    clientSecret:(NSString *)clientSecret
-                                          domain:(NSString *)domain
-                                 completionBlock:(CPATokenRequestCompletionBlock)completionBlock;
++ (CPARequestHandle *)refreshTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                              clientIdentifier:(NSString *)clientIdentifier
+                                                  clientSecret:(NSString *)clientSecret
+                                                        domain:(NSString *)domain
+                                               completionQueue:(nullable dispatch_queue_t)completionQueue
+                                               completionBlock:(CPATokenRequestCompletionBlock)completionBlock;
 
 @end
 
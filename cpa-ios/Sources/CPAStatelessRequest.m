@@ -6,90 +6,575 @@
 
 #import "CPAStatelessRequest.h"
 
-#import "NSURLConnection+CPAExtensions.h"
+#import "CPACircuitBreaker+Private.h"
+#import "CPAEndpointSelector+Private.h"
+#import "CPAErrors+Private.h"
+#import "CPARequestBuilder.h"
+#import "CPARequestHandle+Private.h"
+#import "CPARequestMetrics+Private.h"
+#import "CPARetryPolicy+Private.h"
+#import "CPASessionMetricsCollector.h"
+#import "NSURLSession+CPAExtensions.h"
+
+// Types
+typedef void (^CPADecodedResponseCompletionHandler)(__kindof CPAResponse *decodedResponse, NSURLResponse *response, NSError *error);
+
+// Globals
+static NSMutableDictionary<NSString *, NSURLSessionConfiguration *> *s_sessionConfigurations = nil;
+static NSMutableDictionary<NSString *, NSURLSession *> *s_sessions = nil;
+static NSMutableDictionary<NSString *, CPARetryPolicy *> *s_retryPolicies = nil;
+static NSMutableDictionary<NSString *, CPACircuitBreaker *> *s_circuitBreakers = nil;
+static NSMutableDictionary<NSString *, CPAEndpointSelector *> *s_endpointSelectors = nil;
+static NSMutableDictionary<NSString *, id<CPAMetricsObserver>> *s_metricsObservers = nil;
+static NSMutableDictionary<NSString *, CPARequestBuilder *> *s_requestBuilders = nil;
 
 @implementation CPAStatelessRequest
 
-+ (void)registerClientWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
-                                        clientName:(NSString *)clientName
-                                softwareIdentifier:(NSString *)softwareIdentifier
-                                   softwareVersion:(NSString *)softwareVersion
-                                   completionBlock:(CPAClientRegistrationCompletionBlock)completionBlock
+#pragma mark Class methods
+
++ (void)initialize
+{
+    if (self != [CPAStatelessRequest class]) {
+        return;
+    }
+    
+    s_sessionConfigurations = [NSMutableDictionary dictionary];
+    s_sessions = [NSMutableDictionary dictionary];
+    s_retryPolicies = [NSMutableDictionary dictionary];
+    s_circuitBreakers = [NSMutableDictionary dictionary];
+    s_endpointSelectors = [NSMutableDictionary dictionary];
+    s_metricsObservers = [NSMutableDictionary dictionary];
+    s_requestBuilders = [NSMutableDictionary dictionary];
+}
+
+#pragma mark Sessions
+
++ (void)setSessionConfiguration:(NSURLSessionConfiguration *)sessionConfiguration forAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(authorizationProviderURL);
+    
+    @synchronized(self) {
+        NSString *key = authorizationProviderURL.absoluteString;
+        s_sessionConfigurations[key] = [sessionConfiguration copy];
+        
+        // Let running tasks complete. A new session will be created when needed
+        [s_sessions[key] finishTasksAndInvalidate];
+        [s_sessions removeObjectForKey:key];
+    }
+}
+
++ (NSURLSessionConfiguration *)sessionConfigurationForAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(authorizationProviderURL);
+    
+    @synchronized(self) {
+        NSURLSessionConfiguration *sessionConfiguration = s_sessionConfigurations[authorizationProviderURL.absoluteString];
+        if (sessionConfiguration) {
+            return [sessionConfiguration copy];
+        }
+    }
+    
+    NSURLSessionConfiguration *sessionConfiguration = [NSURLSessionConfiguration defaultSessionConfiguration];
+    sessionConfiguration.timeoutIntervalForRequest = 30.;
+    sessionConfiguration.URLCache = nil;
+    sessionConfiguration.requestCachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+    return sessionConfiguration;
+}
+
++ (NSURLSession *)sessionForAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(authorizationProviderURL);
+    
+    @synchronized(self) {
+        NSString *key = authorizationProviderURL.absoluteString;
+        NSURLSession *session = s_sessions[key];
+        if (! session) {
+            NSURLSessionConfiguration *sessionConfiguration = [self sessionConfigurationForAuthorizationProviderURL:authorizationProviderURL];
+            
+            // Parse responses in the background, results are delivered to the completion queue afterwards
+            NSOperationQueue *delegateQueue = [[NSOperationQueue alloc] init];
+            delegateQueue.name = [NSString stringWithFormat:@"ch.ebu.cpa.session (%@)", key];
+            
+            // Only collect metrics when they are observed
+            CPASessionMetricsCollector *metricsCollector = s_metricsObservers[key] ? [[CPASessionMetricsCollector alloc] init] : nil;
+            session = [NSURLSession sessionWithConfiguration:sessionConfiguration delegate:metricsCollector delegateQueue:delegateQueue];
+            s_sessions[key] = session;
+        }
+        return session;
+    }
+}
+
+#pragma mark Retries
+
++ (void)setRetryPolicy:(CPARetryPolicy *)retryPolicy forAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(authorizationProviderURL);
+    
+    @synchronized(self) {
+        s_retryPolicies[authorizationProviderURL.absoluteString] = [retryPolicy copy];
+    }
+}
+
++ (CPARetryPolicy *)retryPolicyForAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(authorizationProviderURL);
+    
+    @synchronized(self) {
+        NSString *key = authorizationProviderURL.absoluteString;
+        CPARetryPolicy *retryPolicy = s_retryPolicies[key];
+        if (! retryPolicy) {
+            retryPolicy = [[CPARetryPolicy alloc] init];
+            s_retryPolicies[key] = retryPolicy;
+        }
+        return retryPolicy;
+    }
+}
+
+#pragma mark Circuit breakers
+
++ (void)setCircuitBreaker:(CPACircuitBreaker *)circuitBreaker forAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(authorizationProviderURL);
+    
+    @synchronized(self) {
+        s_circuitBreakers[authorizationProviderURL.absoluteString] = [circuitBreaker copy];
+    }
+}
+
++ (CPACircuitBreaker *)circuitBreakerForAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(authorizationProviderURL);
+    
+    @synchronized(self) {
+        NSString *key = authorizationProviderURL.absoluteString;
+        CPACircuitBreaker *circuitBreaker = s_circuitBreakers[key];
+        if (! circuitBreaker) {
+            circuitBreaker = [[CPACircuitBreaker alloc] init];
+            s_circuitBreakers[key] = circuitBreaker;
+        }
+        return circuitBreaker;
+    }
+}
+
+/**
+ * Return the circuit breaker of an endpoint of an authorization provider. When first needed, the breaker of an endpoint
+ * is configured as the one of the authorization provider
+ */
++ (CPACircuitBreaker *)circuitBreakerForEndpointURL:(NSURL *)endpointURL authorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(endpointURL);
+    NSParameterAssert(authorizationProviderURL);
+    
+    if ([endpointURL isEqual:authorizationProviderURL]) {
+        return [self circuitBreakerForAuthorizationProviderURL:authorizationProviderURL];
+    }
+    
+    @synchronized(self) {
+        NSString *key = endpointURL.absoluteString;
+        CPACircuitBreaker *circuitBreaker = s_circuitBreakers[key];
+        if (! circuitBreaker) {
+            circuitBreaker = [[self circuitBreakerForAuthorizationProviderURL:authorizationProviderURL] copy];
+            s_circuitBreakers[key] = circuitBreaker;
+        }
+        return circuitBreaker;
+    }
+}
+
+#pragma mark Endpoints
+
++ (void)setEndpointSelector:(CPAEndpointSelector *)endpointSelector forAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(authorizationProviderURL);
+    
+    @synchronized(self) {
+        s_endpointSelectors[authorizationProviderURL.absoluteString] = [endpointSelector copy];
+    }
+}
+
++ (CPAEndpointSelector *)endpointSelectorForAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(authorizationProviderURL);
+    
+    @synchronized(self) {
+        return s_endpointSelectors[authorizationProviderURL.absoluteString];
+    }
+}
+
+/**
+ * Return the endpoint to which the next attempt of a request is made, preferring endpoints which have not been attempted
+ * yet for the request. Endpoints whose circuit breaker does not allow the attempt are skipped, nil is returned if no
+ * endpoint is available
+ */
++ (NSURL *)endpointURLForAuthorizationProviderURL:(NSURL *)authorizationProviderURL attemptedEndpointURLs:(NSArray<NSURL *> *)attemptedEndpointURLs
+{
+    NSParameterAssert(authorizationProviderURL);
+    NSParameterAssert(attemptedEndpointURLs);
+    
+    CPAEndpointSelector *endpointSelector = [self endpointSelectorForAuthorizationProviderURL:authorizationProviderURL];
+    NSArray<NSURL *> *rankedEndpointURLs = endpointSelector ? [endpointSelector rankedEndpointURLs] : @[authorizationProviderURL];
+    
+    NSMutableArray<NSURL *> *candidateEndpointURLs = [NSMutableArray arrayWithCapacity:rankedEndpointURLs.count];
+    NSMutableArray<NSURL *> *attemptedCandidateEndpointURLs = [NSMutableArray array];
+    for (NSURL *endpointURL in rankedEndpointURLs) {
+        [attemptedEndpointURLs containsObject:endpointURL] ? [attemptedCandidateEndpointURLs addObject:endpointURL] : [candidateEndpointURLs addObject:endpointURL];
+    }
+    [candidateEndpointURLs addObjectsFromArray:attemptedCandidateEndpointURLs];
+    
+    for (NSURL *endpointURL in candidateEndpointURLs) {
+        if ([[self circuitBreakerForEndpointURL:endpointURL authorizationProviderURL:authorizationProviderURL] shouldAllowRequest]) {
+            return endpointURL;
+        }
+    }
+    return nil;
+}
+
+#pragma mark Metrics
+
++ (void)setMetricsObserver:(id<CPAMetricsObserver>)metricsObserver forAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(authorizationProviderURL);
+    
+    @synchronized(self) {
+        NSString *key = authorizationProviderURL.absoluteString;
+        BOOL wasObserved = (s_metricsObservers[key] != nil);
+        s_metricsObservers[key] = metricsObserver;
+        
+        // The session delegate collecting metrics is only installed when needed. As for configuration changes, let
+        // running tasks complete
+        if (wasObserved != (metricsObserver != nil)) {
+            [s_sessions[key] finishTasksAndInvalidate];
+            [s_sessions removeObjectForKey:key];
+        }
+    }
+}
+
++ (id<CPAMetricsObserver>)metricsObserverForAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(authorizationProviderURL);
+    
+    @synchronized(self) {
+        return s_metricsObservers[authorizationProviderURL.absoluteString];
+    }
+}
+
+#pragma mark Request builders
+
+/**
+ * Return the builder of requests made to an authorization provider. Builders are created once and kept for the
+ * lifetime of the application, so that endpoint URLs and headers are not computed again for each request
+ */
++ (CPARequestBuilder *)requestBuilderForAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+{
+    NSParameterAssert(authorizationProviderURL);
+    
+    @synchronized(self) {
+        NSString *key = authorizationProviderURL.absoluteString;
+        CPARequestBuilder *requestBuilder = s_requestBuilders[key];
+        if (! requestBuilder) {
+            requestBuilder = [[CPARequestBuilder alloc] initWithAuthorizationProviderURL:authorizationProviderURL];
+            s_requestBuilders[key] = requestBuilder;
+        }
+        return requestBuilder;
+    }
+}
+
+#pragma mark Requests with retries
+
+/**
+ * Perform a request to an authorization provider, retrying it according to the associated retry policy and to the
+ * specified options. The response is decoded as an instance of the specified CPAResponse subclass. The completion
+ * handler is called on a background queue (or right away if the circuit breakers of all endpoints of the authorization
+ * provider are open), unless the request is cancelled through the provided handle
+ */
++ (void)responseWithRequest:(NSURLRequest *)request
+              responseClass:(Class)responseClass
+   authorizationProviderURL:(NSURL *)authorizationProviderURL
+              requestHandle:(CPARequestHandle *)requestHandle
+               retryOptions:(CPARetryOptions)retryOptions
+          completionHandler:(CPADecodedResponseCompletionHandler)completionHandler
+{
+    NSParameterAssert(request);
+    NSParameterAssert(authorizationProviderURL);
+    NSParameterAssert(requestHandle);
+    NSParameterAssert(completionHandler);
+    
+    CPARetryPolicy *retryPolicy = [self retryPolicyForAuthorizationProviderURL:authorizationProviderURL];
+    [retryPolicy recordRequest];
+    [self responseWithRequest:request responseClass:responseClass authorizationProviderURL:authorizationProviderURL requestHandle:requestHandle retryOptions:retryOptions attemptedEndpointURLs:[NSMutableArray array] retryPolicy:retryPolicy retryCount:0 completionHandler:completionHandler];
+}
+
++ (void)responseWithRequest:(NSURLRequest *)request
+              responseClass:(Class)responseClass
+   authorizationProviderURL:(NSURL *)authorizationProviderURL
+              requestHandle:(CPARequestHandle *)requestHandle
+               retryOptions:(CPARetryOptions)retryOptions
+      attemptedEndpointURLs:(NSMutableArray<NSURL *> *)attemptedEndpointURLs
+                retryPolicy:(CPARetryPolicy *)retryPolicy
+                 retryCount:(NSUInteger)retryCount
+          completionHandler:(CPADecodedResponseCompletionHandler)completionHandler
+{
+    // Cancelled, possibly while waiting for a retry
+    if (requestHandle.cancelled) {
+        return;
+    }
+    
+    // Fail fast while all endpoints of the authorization provider are unavailable. This also stops retries
+    NSArray<NSURL *> *previousEndpointURLs = nil;
+    @synchronized(attemptedEndpointURLs) {
+        previousEndpointURLs = [attemptedEndpointURLs copy];
+    }
+    
+    NSURL *endpointURL = [self endpointURLForAuthorizationProviderURL:authorizationProviderURL attemptedEndpointURLs:previousEndpointURLs];
+    if (! endpointURL) {
+        completionHandler(nil, nil, CPAErrorFromCode(CPAErrorAuthorizationProviderUnavailable));
+        return;
+    }
+    
+    @synchronized(attemptedEndpointURLs) {
+        [attemptedEndpointURLs addObject:endpointURL];
+    }
+    
+    CPACircuitBreaker *circuitBreaker = [self circuitBreakerForEndpointURL:endpointURL authorizationProviderURL:authorizationProviderURL];
+    CPAEndpointSelector *endpointSelector = [self endpointSelectorForAuthorizationProviderURL:authorizationProviderURL];
+    
+    // Requests are built for the authorization provider URL, and sent to the same path of the selected endpoint
+    NSURLRequest *endpointRequest = request;
+    if (! [endpointURL isEqual:authorizationProviderURL]) {
+        NSMutableURLRequest *mutableRequest = [request mutableCopy];
+        mutableRequest.URL = [endpointURL URLByAppendingPathComponent:request.URL.lastPathComponent];
+        endpointRequest = [mutableRequest copy];
+    }
+    
+    // Always use the current session, which might have changed between attempts. All endpoints share the session of
+    // the authorization provider
+    NSURLSession *session = [self sessionForAuthorizationProviderURL:authorizationProviderURL];
+    
+    id<CPAMetricsObserver> metricsObserver = [self metricsObserverForAuthorizationProviderURL:authorizationProviderURL];
+    CPASessionMetricsCollector *metricsCollector = [session.delegate isKindOfClass:[CPASessionMetricsCollector class]] ? (CPASessionMetricsCollector *)session.delegate : nil;
+    NSDate *startDate = metricsObserver ? [NSDate date] : nil;
+    NSTimeInterval startTime = [NSProcessInfo processInfo].systemUptime;
+    
+    __block NSURLSessionDataTask *dataTask = [session cpa_responseTaskWithRequest:endpointRequest responseClass:responseClass completionHandler:^(CPAResponse *decodedResponse, NSURLResponse *response, NSError *error, NSTimeInterval decodingDuration) {
+        NSTimeInterval totalDuration = [NSProcessInfo processInfo].systemUptime - startTime;
+        
+        if (metricsObserver) {
+            CPATaskMetricsBlock reportBlock = ^(NSURLSessionTaskMetrics *taskMetrics) {
+                CPARequestMetrics *requestMetrics = [[CPARequestMetrics alloc] initWithAuthorizationProviderURL:authorizationProviderURL
+                                                                                                        endpoint:request.URL.lastPathComponent
+                                                                                                      retryCount:retryCount
+                                                                                                        response:response
+                                                                                                           error:error
+                                                                                                       startDate:startDate
+                                                                                                   totalDuration:totalDuration
+                                                                                                 parsingDuration:decodingDuration
+                                                                                                     taskMetrics:taskMetrics];
+                [metricsObserver didCollectRequestMetrics:requestMetrics];
+            };
+            metricsCollector ? [metricsCollector collectMetricsForTask:dataTask withBlock:reportBlock] : reportBlock(nil);
+        }
+        
+        // Break the cycle between the task and its completion handler
+        dataTask = nil;
+        
+        [circuitBreaker recordResultWithError:error response:response];
+        
+        // Only responses actually served by the endpoint tell how fast it is
+        NSInteger statusCode = [response isKindOfClass:[NSHTTPURLResponse class]] ? ((NSHTTPURLResponse *)response).statusCode : 0;
+        if (statusCode != 0 && statusCode < 500) {
+            [endpointSelector recordLatency:totalDuration forEndpointURL:endpointURL];
+        }
+        
+        if (requestHandle.cancelled) {
+            return;
+        }
+        
+        NSTimeInterval delay = 0.;
+        if (error && [retryPolicy shouldRetryAfterError:error response:response retryCount:retryCount options:retryOptions delay:&delay]) {
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                [self responseWithRequest:request responseClass:responseClass authorizationProviderURL:authorizationProviderURL requestHandle:requestHandle retryOptions:retryOptions attemptedEndpointURLs:attemptedEndpointURLs retryPolicy:retryPolicy retryCount:retryCount + 1 completionHandler:completionHandler];
+            });
+            return;
+        }
+        
+        completionHandler(decodedResponse, response, error);
+    }];
+    
+    // The session retains the task while it runs
+    __weak NSURLSessionDataTask *weakDataTask = dataTask;
+    [requestHandle addCancellationBlock:^{
+        [weakDataTask cancel];
+    }];
+    [dataTask resume];
+}
+
+/**
+ * Same as +responseWithRequest:responseClass:authorizationProviderURL:requestHandle:retryOptions:completionHandler:
+ * for idempotent requests, hedging the request if enabled by the endpoint selector of the authorization provider: If no
+ * response has been received after the hedging delay, the same request is made to another endpoint. The first
+ * successful response is used and the other request is cancelled. An error is only reported once both requests have
+ * failed
+ */
++ (void)hedgedResponseWithRequest:(NSURLRequest *)request
+                    responseClass:(Class)responseClass
+         authorizationProviderURL:(NSURL *)authorizationProviderURL
+                    requestHandle:(CPARequestHandle *)requestHandle
+                completionHandler:(CPADecodedResponseCompletionHandler)completionHandler
+{
+    NSParameterAssert(request);
+    NSParameterAssert(authorizationProviderURL);
+    NSParameterAssert(requestHandle);
+    NSParameterAssert(completionHandler);
+    
+    CPAEndpointSelector *endpointSelector = [self endpointSelectorForAuthorizationProviderURL:authorizationProviderURL];
+    NSTimeInterval hedgingDelay = endpointSelector.hedgingDelay;
+    if (! endpointSelector.hedgingEnabled || hedgingDelay == 0. || endpointSelector.endpointURLs.count < 2) {
+        [self responseWithRequest:request responseClass:responseClass authorizationProviderURL:authorizationProviderURL requestHandle:requestHandle retryOptions:CPARetryOptionsNone completionHandler:completionHandler];
+        return;
+    }
+    
+    // Both requests report to a serial queue, which therefore protects the hedging state
+    static dispatch_queue_t s_hedgingQueue;
+    static dispatch_once_t s_onceToken;
+    dispatch_once(&s_onceToken, ^{
+        s_hedgingQueue = dispatch_queue_create("ch.ebu.cpa.hedging", DISPATCH_QUEUE_SERIAL);
+    });
+    
+    __block BOOL completed = NO;
+    __block NSUInteger runningRequestCount = 1;
+    
+    CPARequestHandle *primaryRequestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:nil];
+    CPARequestHandle *hedgedRequestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:nil];
+    [requestHandle addChildRequestHandle:primaryRequestHandle];
+    [requestHandle addChildRequestHandle:hedgedRequestHandle];
+    
+    CPADecodedResponseCompletionHandler (^hedgingCompletionHandler)(CPARequestHandle *, CPARequestHandle *) = ^CPADecodedResponseCompletionHandler(CPARequestHandle *ownRequestHandle, CPARequestHandle *otherRequestHandle) {
+        return ^(CPAResponse *decodedResponse, NSURLResponse *response, NSError *error) {
+            dispatch_async(s_hedgingQueue, ^{
+                --runningRequestCount;
+                
+                // Wait for the other request if it is still running
+                if (completed || (error && runningRequestCount != 0)) {
+                    return;
+                }
+                
+                completed = YES;
+                [ownRequestHandle finish];
+                [otherRequestHandle cancel];
+                completionHandler(decodedResponse, response, error);
+            });
+        };
+    };
+    
+    CPARetryPolicy *retryPolicy = [self retryPolicyForAuthorizationProviderURL:authorizationProviderURL];
+    [retryPolicy recordRequest];
+    
+    NSMutableArray<NSURL *> *attemptedEndpointURLs = [NSMutableArray array];
+    [self responseWithRequest:request responseClass:responseClass authorizationProviderURL:authorizationProviderURL requestHandle:primaryRequestHandle retryOptions:CPARetryOptionsNone attemptedEndpointURLs:attemptedEndpointURLs retryPolicy:retryPolicy retryCount:0 completionHandler:hedgingCompletionHandler(primaryRequestHandle, hedgedRequestHandle)];
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(hedgingDelay * NSEC_PER_SEC)), s_hedgingQueue, ^{
+        if (completed || requestHandle.cancelled) {
+            return;
+        }
+        
+        // Prefer endpoints which the primary request has not attempted yet
+        NSMutableArray<NSURL *> *hedgedAttemptedEndpointURLs = nil;
+        @synchronized(attemptedEndpointURLs) {
+            hedgedAttemptedEndpointURLs = [attemptedEndpointURLs mutableCopy];
+        }
+        
+        ++runningRequestCount;
+        [self responseWithRequest:request responseClass:responseClass authorizationProviderURL:authorizationProviderURL requestHandle:hedgedRequestHandle retryOptions:CPARetryOptionsNone attemptedEndpointURLs:hedgedAttemptedEndpointURLs retryPolicy:retryPolicy retryCount:0 completionHandler:hedgingCompletionHandler(hedgedRequestHandle, primaryRequestHandle)];
+    });
+}
+
+#pragma mark Requests
+
++ (CPARequestHandle *)registerClientWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                                      clientName:(NSString *)clientName
+                                              softwareIdentifier:(NSString *)softwareIdentifier
+                                                 softwareVersion:(NSString *)softwareVersion
+                                                 completionQueue:(dispatch_queue_t)completionQueue
+                                                 completionBlock:(CPAClientRegistrationCompletionBlock)completionBlock
 {
     NSParameterAssert(authorizationProviderURL);
     NSParameterAssert(clientName);
     NSParameterAssert(softwareIdentifier);
     NSParameterAssert(softwareVersion);
     
-    NSURL *URL = [authorizationProviderURL URLByAppendingPathComponent:@"register"];
-    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:URL];
-    [request setHTTPMethod:@"POST"];
-    [request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+    CPARequestBuilder *requestBuilder = [self requestBuilderForAuthorizationProviderURL:authorizationProviderURL];
+    NSURLRequest *request = [requestBuilder registrationRequestWithClientName:clientName softwareIdentifier:softwareIdentifier softwareVersion:softwareVersion];
+    CPARequestHandle *requestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:completionBlock];
     
-    NSDictionary<NSString *, NSString *> *requestDictionary = @{ @"client_name" : clientName,
-                                                                 @"software_id" : softwareIdentifier,
-                                                                 @"software_version" : softwareVersion };
-    NSData *body = [NSJSONSerialization dataWithJSONObject:requestDictionary options:0 error:NULL];
-    [request setHTTPBody:body];
-    
-    [NSURLConnection cpa_JSONDictionaryWithRequest:request completionHandler:^(NSDictionary *responseDictionary, NSURLResponse *response, NSError *error) {
+    [self responseWithRequest:request responseClass:[CPAClientRegistrationResponse class] authorizationProviderURL:authorizationProviderURL requestHandle:requestHandle retryOptions:CPARetryOptionNonIdempotent completionHandler:^(CPAClientRegistrationResponse *registrationResponse, NSURLResponse *response, NSError *error) {
         if (error) {
-            completionBlock ? completionBlock(nil, nil, error) : nil;
+            dispatch_async(completionQueue ?: dispatch_get_main_queue(), ^{
+                CPAClientRegistrationCompletionBlock pendingCompletionBlock = [requestHandle finish];
+                pendingCompletionBlock ? pendingCompletionBlock(nil, nil, error) : nil;
+            });
             return;
         }
         
-        NSString *clientIdentifier = responseDictionary[@"client_id"];
-        NSString *clientSecret = responseDictionary[@"client_secret"];
+        NSString *clientIdentifier = registrationResponse.clientIdentifier;
+        NSString *clientSecret = registrationResponse.clientSecret;
         
-        completionBlock ? completionBlock(clientIdentifier, clientSecret, nil) : nil;
+        dispatch_async(completionQueue ?: dispatch_get_main_queue(), ^{
+            CPAClientRegistrationCompletionBlock pendingCompletionBlock = [requestHandle finish];
+            pendingCompletionBlock ? pendingCompletionBlock(clientIdentifier, clientSecret, nil) : nil;
+        });
     }];
+    return requestHandle;
 }
 
-+ (void)requestCodeWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
-                               clientIdentifier:(NSString *)clientIdentifier
-                                   clientSecret:(NSString *)clientSecret
-                                         domain:(NSString *)domain
-                                completionBlock:(CPAUserCodeRequestCompletionBlock)completionBlock
++ (CPARequestHandle *)requestCodeWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                             clientIdentifier:(NSString *)clientIdentifier
+                                                 clientSecret:(NSString *)clientSecret
+                                                       domain:(NSString *)domain
+                                              completionQueue:(dispatch_queue_t)completionQueue
+                                              completionBlock:(CPAUserCodeRequestCompletionBlock)completionBlock
 {
     NSParameterAssert(authorizationProviderURL);
     NSParameterAssert(clientIdentifier);
     NSParameterAssert(clientSecret);
     NSParameterAssert(domain);
     
-    NSURL *URL = [authorizationProviderURL URLByAppendingPathComponent:@"associate"];
-    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:URL];
-    [request setHTTPMethod:@"POST"];
-    [request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
-    
-    NSDictionary<NSString *, NSString *> *requestDictionary = @{ @"client_id" : clientIdentifier,
-                                                                 @"client_secret" : clientSecret,
-                                                                 @"domain" : domain };
-    NSData *body = [NSJSONSerialization dataWithJSONObject:requestDictionary options:0 error:NULL];
-    [request setHTTPBody:body];
+    CPARequestBuilder *requestBuilder = [self requestBuilderForAuthorizationProviderURL:authorizationProviderURL];
+    NSURLRequest *request = [requestBuilder userCodeRequestWithClientIdentifier:clientIdentifier clientSecret:clientSecret domain:domain];
+    CPARequestHandle *requestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:completionBlock];
     
-    [NSURLConnection cpa_JSONDictionaryWithRequest:request completionHandler:^(NSDictionary *responseDictionary, NSURLResponse *response, NSError *error) {
+    [self responseWithRequest:request responseClass:[CPAUserCodeResponse class] authorizationProviderURL:authorizationProviderURL requestHandle:requestHandle retryOptions:CPARetryOptionsNone completionHandler:^(CPAUserCodeResponse *userCodeResponse, NSURLResponse *response, NSError *error) {
         if (error) {
-            completionBlock ? completionBlock(nil, nil, nil, 0, 0, error) : nil;
+            dispatch_async(completionQueue ?: dispatch_get_main_queue(), ^{
+                CPAUserCodeRequestCompletionBlock pendingCompletionBlock = [requestHandle finish];
+                pendingCompletionBlock ? pendingCompletionBlock(nil, nil, nil, 0, 0, error) : nil;
+            });
             return;
         }
         
-        NSString *deviceCode = responseDictionary[@"device_code"];
-        NSString *userCode = responseDictionary[@"user_code"];
-        NSString *verificationURLString = responseDictionary[@"verification_uri"];
-        NSURL *verificationURL = verificationURLString ? [NSURL URLWithString:verificationURLString] : nil;
-        NSInteger pollingIntervalInSeconds = [responseDictionary[@"interval"] integerValue];
-        NSInteger expiresInSeconds = [responseDictionary[@"expires_in"] integerValue];
+        NSString *deviceCode = userCodeResponse.deviceCode;
+        NSString *userCode = userCodeResponse.userCode;
+        NSURL *verificationURL = userCodeResponse.verificationURL;
+        NSInteger pollingIntervalInSeconds = userCodeResponse.pollingIntervalInSeconds;
+        NSInteger expiresInSeconds = userCodeResponse.expiresInSeconds;
         
-        completionBlock ? completionBlock(deviceCode, userCode, verificationURL, pollingIntervalInSeconds, expiresInSeconds, nil) : nil;
+        dispatch_async(completionQueue ?: dispatch_get_main_queue(), ^{
+            CPAUserCodeRequestCompletionBlock pendingCompletionBlock = [requestHandle finish];
+            pendingCompletionBlock ? pendingCompletionBlock(deviceCode, userCode, verificationURL, pollingIntervalInSeconds, expiresInSeconds, nil) : nil;
+        });
     }];
+    return requestHandle;
 }
 
-+ (void)requestUserTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
-                                          deviceCode:(NSString *)deviceCode
-                                    clientIdentifier:(NSString *)clientIdentifier
-                                        clientSecret:(NSString *)clientSecret
-                                              domain:(NSString *)domain
-                                     completionBlock:(CPATokenRequestCompletionBlock)completionBlock
+/**
+ * Request a user token, retrying the request with the specified options
+ */
++ (CPARequestHandle *)userTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                                 deviceCode:(NSString *)deviceCode
+                                           clientIdentifier:(NSString *)clientIdentifier
+                                               clientSecret:(NSString *)clientSecret
+                                                     domain:(NSString *)domain
+                                               retryOptions:(CPARetryOptions)retryOptions
+                                            completionQueue:(dispatch_queue_t)completionQueue
+                                            completionBlock:(CPATokenRequestCompletionBlock)completionBlock
 {
     NSParameterAssert(authorizationProviderURL);
     NSParameterAssert(deviceCode);
@@ -97,110 +582,144 @@
     NSParameterAssert(clientSecret);
     NSParameterAssert(domain);
     
-    NSURL *URL = [authorizationProviderURL URLByAppendingPathComponent:@"token"];
-    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:URL];
-    [request setHTTPMethod:@"POST"];
-    [request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+    CPARequestBuilder *requestBuilder = [self requestBuilderForAuthorizationProviderURL:authorizationProviderURL];
+    NSURLRequest *request = [requestBuilder userTokenRequestWithDeviceCode:deviceCode clientIdentifier:clientIdentifier clientSecret:clientSecret domain:domain];
+    CPARequestHandle *requestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:completionBlock];
     
-    NSDictionary<NSString *, NSString *> *requestDictionary = @{ @"grant_type" : @"http://tech.ebu.ch/cpa/1.0/device_code",
-                                                                 @"device_code" : deviceCode,
-                                                                 @"client_id" : clientIdentifier,
-                                                                 @"client_secret" : clientSecret,
-                                                                 @"domain" : domain };
-    NSData *body = [NSJSONSerialization dataWithJSONObject:requestDictionary options:0 error:NULL];
-    [request setHTTPBody:body];
-    
-    [NSURLConnection cpa_JSONDictionaryWithRequest:request completionHandler:^(NSDictionary *responseDictionary, NSURLResponse *response, NSError *error) {
+    [self responseWithRequest:request responseClass:[CPATokenResponse class] authorizationProviderURL:authorizationProviderURL requestHandle:requestHandle retryOptions:retryOptions completionHandler:^(CPATokenResponse *tokenResponse, NSURLResponse *response, NSError *error) {
         if (error) {
-            completionBlock ? completionBlock(nil, nil, nil, nil, 0, error) : nil;
+            dispatch_async(completionQueue ?: dispatch_get_main_queue(), ^{
+                CPATokenRequestCompletionBlock pendingCompletionBlock = [requestHandle finish];
+                pendingCompletionBlock ? pendingCompletionBlock(nil, nil, nil, nil, 0, error) : nil;
+            });
             return;
         }
         
-        NSString *userName = responseDictionary[@"user_name"];
-        NSString *accessToken = responseDictionary[@"access_token"];
-        NSString *tokenType = responseDictionary[@"token_type"];
-        NSString *domainName = responseDictionary[@"domain_display_name"];
-        NSInteger expiresInSeconds = [responseDictionary[@"expires_in"] integerValue];
+        NSString *userName = tokenResponse.userName;
+        NSString *accessToken = tokenResponse.accessToken;
+        NSString *tokenType = tokenResponse.tokenType;
+        NSString *domainName = tokenResponse.domainName;
+        NSInteger expiresInSeconds = tokenResponse.expiresInSeconds;
         
-        completionBlock ? completionBlock(userName, accessToken, tokenType, domainName, expiresInSeconds, nil) : nil;
+        dispatch_async(completionQueue ?: dispatch_get_main_queue(), ^{
+            CPATokenRequestCompletionBlock pendingCompletionBlock = [requestHandle finish];
+            pendingCompletionBlock ? pendingCompletionBlock(userName, accessToken, tokenType, domainName, expiresInSeconds, nil) : nil;
+        });
     }];
+    return requestHandle;
 }
 
-+ (void)requestClientTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
-                                      clientIdentifier:(NSString *)clientIdentifier
-                                          clientSecret:(NSString *)clientSecret
-                                                domain:(NSString *)domain
-                                       completionBlock:(CPATokenRequestCompletionBlock)completionBlock
++ (CPARequestHandle *)requestUserTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                                        deviceCode:(NSString *)deviceCode
+                                                  clientIdentifier:(NSString *)clientIdentifier
+                                                      clientSecret:(NSString *)clientSecret
+                                                            domain:(NSString *)domain
+                                                   completionQueue:(dispatch_queue_t)completionQueue
+                                                   completionBlock:(CPATokenRequestCompletionBlock)completionBlock
+{
+    return [self userTokenWithAuthorizationProviderURL:authorizationProviderURL
+                                            deviceCode:deviceCode
+                                      clientIdentifier:clientIdentifier
+                                          clientSecret:clientSecret
+                                                domain:domain
+                                          retryOptions:CPARetryOptionsNone
+                                       completionQueue:completionQueue
+                                       completionBlock:completionBlock];
+}
+
++ (CPARequestHandle *)pollUserTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                                     deviceCode:(NSString *)deviceCode
+                                               clientIdentifier:(NSString *)clientIdentifier
+                                                   clientSecret:(NSString *)clientSecret
+                                                         domain:(NSString *)domain
+                                                completionQueue:(dispatch_queue_t)completionQueue
+                                                completionBlock:(CPATokenRequestCompletionBlock)completionBlock
+{
+    return [self userTokenWithAuthorizationProviderURL:authorizationProviderURL
+                                            deviceCode:deviceCode
+                                      clientIdentifier:clientIdentifier
+                                          clientSecret:clientSecret
+                                                domain:domain
+                                          retryOptions:CPARetryOptionNoSlowDownRetry
+                                       completionQueue:completionQueue
+                                       completionBlock:completionBlock];
+}
+
++ (CPARequestHandle *)requestClientTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                                    clientIdentifier:(NSString *)clientIdentifier
+                                                        clientSecret:(NSString *)clientSecret
+                                                              domain:(NSString *)domain
+                                                     completionQueue:(dispatch_queue_t)completionQueue
+                                                     completionBlock:(CPATokenRequestCompletionBlock)completionBlock
 {
     NSParameterAssert(authorizationProviderURL);
     NSParameterAssert(clientIdentifier);
     NSParameterAssert(clientSecret);
     NSParameterAssert(domain);
     
-    NSURL *URL = [authorizationProviderURL URLByAppendingPathComponent:@"token"];
-    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:URL];
-    [request setHTTPMethod:@"POST"];
-    [request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+    CPARequestBuilder *requestBuilder = [self requestBuilderForAuthorizationProviderURL:authorizationProviderURL];
+    NSURLRequest *request = [requestBuilder clientTokenRequestWithClientIdentifier:clientIdentifier clientSecret:clientSecret domain:domain];
+    CPARequestHandle *requestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:completionBlock];
     
-    NSDictionary<NSString *, NSString *> *requestDictionary = @{ @"grant_type" : @"http://tech.ebu.ch/cpa/1.0/client_credentials",
-                                                                 @"client_id" : clientIdentifier,
-                                                                 @"client_secret" : clientSecret,
-                                                                 @"domain" : domain };
-    NSData *body = [NSJSONSerialization dataWithJSONObject:requestDictionary options:0 error:NULL];
-    [request setHTTPBody:body];
-    
-    [NSURLConnection cpa_JSONDictionaryWithRequest:request completionHandler:^(NSDictionary *responseDictionary, NSURLResponse *response, NSError *error) {
+    [self responseWithRequest:request responseClass:[CPATokenResponse class] authorizationProviderURL:authorizationProviderURL requestHandle:requestHandle retryOptions:CPARetryOptionsNone completionHandler:^(CPATokenResponse *tokenResponse, NSURLResponse *response, NSError *error) {
         if (error) {
-            completionBlock ? completionBlock(nil, nil, nil, nil, 0, error) : nil;
+            dispatch_async(completionQueue ?: dispatch_get_main_queue(), ^{
+                CPATokenRequestCompletionBlock pendingCompletionBlock = [requestHandle finish];
+                pendingCompletionBlock ? pendingCompletionBlock(nil, nil, nil, nil, 0, error) : nil;
+            });
             return;
         }
         
-        NSString *accessToken = responseDictionary[@"access_token"];
-        NSString *tokenType = responseDictionary[@"token_type"];
-        NSString *domainName = responseDictionary[@"domain_display_name"];
-        NSInteger expiresInSeconds = [responseDictionary[@"expires_in"] integerValue];
+        NSString *accessToken = tokenResponse.accessToken;
+        NSString *tokenType = tokenResponse.tokenType;
+        NSString *domainName = tokenResponse.domainName;
+        NSInteger expiresInSeconds = tokenResponse.expiresInSeconds;
         
-        completionBlock ? completionBlock(nil, accessToken, tokenType, domainName, expiresInSeconds, nil) : nil;
+        dispatch_async(completionQueue ?: dispatch_get_main_queue(), ^{
+            CPATokenRequestCompletionBlock pendingCompletionBlock = [requestHandle finish];
+            pendingCompletionBlock ? pendingCompletionBlock(nil, accessToken, tokenType, domainName, expiresInSeconds, nil) : nil;
+        });
     }];
+    return requestHandle;
 }
 
-+ (void)refreshTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
-                                clientIdentifier:(NSString *)clientIdentifier
-                                    clientSecret:(NSString *)clientSecret
-                                          domain:(NSString *)domain
-                                 completionBlock:(CPATokenRequestCompletionBlock)completionBlock
++ (CPARequestHandle *)refreshTokenWithAuthorizationProviderURL:(NSURL *)authorizationProviderURL
+                                              clientIdentifier:(NSString *)clientIdentifier
+                                                  clientSecret:(NSString *)clientSecret
+                                                        domain:(NSString *)domain
+                                               completionQueue:(dispatch_queue_t)completionQueue
+                                               completionBlock:(CPATokenRequestCompletionBlock)completionBlock
 {
     NSParameterAssert(authorizationProviderURL);
     NSParameterAssert(clientIdentifier);
     NSParameterAssert(clientSecret);
     NSParameterAssert(domain);
     
-    NSURL *URL = [authorizationProviderURL URLByAppendingPathComponent:@"token"];
-    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:URL];
-    [request setHTTPMethod:@"POST"];
-    [request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
-    
-    NSDictionary<NSString *, NSString *> *requestDictionary = @{ @"grant_type" : @"http://tech.ebu.ch/cpa/1.0/client_credentials",
-                                                                 @"client_id" : clientIdentifier,
-                                                                 @"client_secret" : clientSecret,
-                                                                 @"domain" : domain };
-    NSData *body = [NSJSONSerialization dataWithJSONObject:requestDictionary options:0 error:NULL];
-    [request setHTTPBody:body];
+    CPARequestBuilder *requestBuilder = [self requestBuilderForAuthorizationProviderURL:authorizationProviderURL];
+    NSURLRequest *request = [requestBuilder clientTokenRequestWithClientIdentifier:clientIdentifier clientSecret:clientSecret domain:domain];
+    CPARequestHandle *requestHandle = [[CPARequestHandle alloc] initWithCompletionBlock:completionBlock];
     
-    [NSURLConnection cpa_JSONDictionaryWithRequest:request completionHandler:^(NSDictionary *responseDictionary, NSURLResponse *response, NSError *error) {
+    [self hedgedResponseWithRequest:request responseClass:[CPATokenResponse class] authorizationProviderURL:authorizationProviderURL requestHandle:requestHandle completionHandler:^(CPATokenResponse *tokenResponse, NSURLResponse *response, NSError *error) {
         if (error) {
-            completionBlock ? completionBlock(nil, nil, nil, nil, 0, error) : nil;
+            dispatch_async(completionQueue ?: dispatch_get_main_queue(), ^{
+                CPATokenRequestCompletionBlock pendingCompletionBlock = [requestHandle finish];
+                pendingCompletionBlock ? pendingCompletionBlock(nil, nil, nil, nil, 0, error) : nil;
+            });
             return;
         }
         
-        NSString *userName = responseDictionary[@"user_name"];
-        NSString *accessToken = responseDictionary[@"access_token"];
-        NSString *tokenType = responseDictionary[@"token_type"];
-        NSString *domainName = responseDictionary[@"domain_display_name"];
-        NSInteger expiresInSeconds = [responseDictionary[@"expires_in"] integerValue];
+        NSString *userName = tokenResponse.userName;
+        NSString *accessToken = tokenResponse.accessToken;
+        NSString *tokenType = tokenResponse.tokenType;
+        NSString *domainName = tokenResponse.domainName;
+        NSInteger expiresInSeconds = tokenResponse.expiresInSeconds;
         
-        completionBlock ? completionBlock(userName, accessToken, tokenType, domainName, expiresInSeconds, nil) : nil;
+        dispatch_async(completionQueue ?: dispatch_get_main_queue(), ^{
+            CPATokenRequestCompletionBlock pendingCompletionBlock = [requestHandle finish];
+            pendingCompletionBlock ? pendingCompletionBlock(userName, accessToken, tokenType, domainName, expiresInSeconds, nil) : nil;
+        });
     }];
+    return requestHandle;
 }
 
 @end
@@ -23,6 +23,17 @@ NS_ASSUME_NONNULL_BEGIN
                      userName:(NSString *)userName
                expirationDate:(NSDate *)expirationDate;
 
+/**
+ * Create a token from data saved to the keychain, either its binary representation or a keyed archive made by earlier
+ * versions of the library. Return nil if the data is invalid
+ */
++ (nullable CPAToken *)tokenWithStoredData:(NSData *)data;
+
+/**
+ * Compact binary representation, used when saving the token to the keychain
+ */
+- (NSData *)binaryRepresentation;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -53,6 +53,16 @@ typedef NS_ENUM(NSInteger, CPATokenType) {
  */
 @property (nonatomic, readonly) NSDate *expirationDate;
 
+/**
+ * Return YES iff the token has expired at the specified date
+ */
+- (BOOL)isExpiredAtDate:(NSDate *)date;
+
+/**
+ * Return YES iff the token has currently expired
+ */
+@property (nonatomic, readonly, getter=isExpired) BOOL expired;
+
 @end
 
 @interface CPAToken (UnavailableMethods)
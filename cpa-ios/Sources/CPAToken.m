@@ -6,6 +6,8 @@
 
 #import "CPAToken.h"
 
+#import "CPABinaryCoding.h"
+
 @interface CPAToken ()
 
 @property (nonatomic, copy) NSString *value;
@@ -41,6 +43,47 @@
     return self;
 }
 
+#pragma mark Binary representation
+
++ (CPAToken *)tokenWithStoredData:(NSData *)data
+{
+    NSParameterAssert(data);
+    
+    if (! [CPABinaryReader isBinaryRecordData:data]) {
+        id object = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+        return [object isKindOfClass:[CPAToken class]] ? object : nil;
+    }
+    
+    CPABinaryReader *reader = [[CPABinaryReader alloc] initWithData:data recordType:CPABinaryRecordTypeToken];
+    if (! reader) {
+        return nil;
+    }
+    
+    CPAToken *token = [CPAToken new];
+    token.value = [reader readString];
+    token.domain = [reader readString];
+    token.domainName = [reader readString];
+    token.userName = [reader readString];
+    token.expirationDate = [reader readDate];
+    
+    if (! reader.valid || ! token.value || ! token.domain || ! token.expirationDate) {
+        return nil;
+    }
+    return token;
+}
+
+- (NSData *)binaryRepresentation
+{
+    // Fields must always be written in the same order. Append new fields at the end and bump the format version
+    CPABinaryWriter *writer = [[CPABinaryWriter alloc] initWithRecordType:CPABinaryRecordTypeToken];
+    [writer writeString:self.value];
+    [writer writeString:self.domain];
+    [writer writeString:self.domainName];
+    [writer writeString:self.userName];
+    [writer writeDate:self.expirationDate];
+    return writer.data;
+}
+
 #pragma mark Accessors and mutators
 
 - (CPATokenType)type
@@ -48,6 +91,20 @@
     return (self.userName != nil) ? CPATokenTypeUser : CPATokenTypeClient;
 }
 
+- (BOOL)isExpired
+{
+    return [self isExpiredAtDate:[NSDate date]];
+}
+
+#pragma mark Expiration
+
+- (BOOL)isExpiredAtDate:(NSDate *)date
+{
+    NSParameterAssert(date);
+    
+    return [self.expirationDate compare:date] != NSOrderedDescending;
+}
+
 #pragma mark NSCoding protocol
 
 - (instancetype)initWithCoder:(NSCoder *)aDecoder
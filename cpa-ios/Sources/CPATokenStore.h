@@ -0,0 +1,71 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Types
+typedef void (^CPATokenStoreCompletionBlock)(void);
+typedef void (^CPATokenStoreDataCompletionBlock)(NSData * __nullable data);
+typedef void (^CPATokenStoreKeysCompletionBlock)(NSArray<NSString *> *keys);
+typedef void (^CPATokenStoreAllDataCompletionBlock)(NSDictionary<NSString *, NSData *> *allData);
+
+/**
+ * Storage backend in which authentication providers save their identity and tokens, as opaque data associated with
+ * string keys. Several providers can share the same store
+ *
+ * Implementations must be thread-safe. Providers call synchronous methods from their internal queue, which is why
+ * these methods should return quickly. Asynchronous variants call their completion block on the main thread once the
+ * operation is complete
+ */
+@protocol CPATokenStore <NSObject>
+
+/**
+ * Return the data associated with a key, nil if none
+ */
+- (nullable NSData *)dataForKey:(NSString *)key;
+
+/**
+ * Associate data with a key, replacing existing data if any
+ */
+- (void)setData:(NSData *)data forKey:(NSString *)key;
+
+/**
+ * Remove the data associated with a key, if any
+ */
+- (void)removeDataForKey:(NSString *)key;
+
+/**
+ * Return all keys with which data is associated
+ */
+- (NSArray<NSString *> *)allKeys;
+
+/**
+ * Return all data in the store, per key. Implementations should read the store at once
+ */
+- (NSDictionary<NSString *, NSData *> *)allData;
+
+/**
+ * Remove all data from the store
+ */
+- (void)removeAllData;
+
+/**
+ * Asynchronous variants of the methods above
+ */
+- (void)dataForKey:(NSString *)key completionBlock:(CPATokenStoreDataCompletionBlock)completionBlock;
+- (void)setData:(NSData *)data forKey:(NSString *)key completionBlock:(nullable CPATokenStoreCompletionBlock)completionBlock;
+- (void)removeDataForKey:(NSString *)key completionBlock:(nullable CPATokenStoreCompletionBlock)completionBlock;
+- (void)allKeysWithCompletionBlock:(CPATokenStoreKeysCompletionBlock)completionBlock;
+- (void)allDataWithCompletionBlock:(CPATokenStoreAllDataCompletionBlock)completionBlock;
+- (void)removeAllDataWithCompletionBlock:(nullable CPATokenStoreCompletionBlock)completionBlock;
+
+@end
+
+NS_ASSUME_NONNULL_END
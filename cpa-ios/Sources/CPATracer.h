@@ -0,0 +1,106 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * A timed operation, possibly part of a larger one (its parent). Spans without parent are the roots of traces. All
+ * spans of a trace share the identifier of its root span
+ *
+ * Spans are thread-safe
+ */
+@interface CPATraceSpan : NSObject
+
+/**
+ * The span name and category (request, storage, ui or provider for spans created by the library)
+ */
+@property (nonatomic, readonly, copy) NSString *name;
+@property (nonatomic, readonly, copy) NSString *category;
+
+/**
+ * The identifiers of the span, of its parent (0 if none) and of the trace it belongs to
+ */
+@property (nonatomic, readonly) uint64_t spanIdentifier;
+@property (nonatomic, readonly) uint64_t parentSpanIdentifier;
+@property (nonatomic, readonly) uint64_t traceIdentifier;
+
+/**
+ * The time at which the span started, relative to the creation of its tracer, and its duration (negative until it
+ * has finished)
+ */
+@property (nonatomic, readonly) NSTimeInterval startTime;
+@property (atomic, readonly) NSTimeInterval duration;
+
+/**
+ * The error with which the span finished, if any
+ */
+@property (atomic, readonly, nullable) NSError *error;
+
+/**
+ * Values describing the span (e.g. the domain for which a token is requested). Values must be valid JSON objects
+ */
+@property (atomic, readonly, copy) NSDictionary<NSString *, id> *attributes;
+
+/**
+ * Set an attribute value. Set to nil to remove it
+ */
+- (void)setAttribute:(nullable id)value forKey:(NSString *)key;
+
+/**
+ * Finish the span, successfully or with an error, and record it to its tracer. Only the first call has an effect
+ */
+- (void)finish;
+- (void)finishWithError:(nullable NSError *)error;
+
+@end
+
+@interface CPATraceSpan (UnavailableMethods)
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+/**
+ * Record spans, and export them in the Chrome trace event format, which can be loaded into chrome://tracing or
+ * https://ui.perfetto.dev. Tracers are thread-safe
+ */
+@interface CPATracer : NSObject
+
+/**
+ * The maximum number of finished spans which are kept, the oldest ones being discarded first (default: 10000)
+ */
+@property (atomic) NSUInteger maximumSpanCount;
+
+/**
+ * Start a span, as a child of the specified span if any
+ */
+- (CPATraceSpan *)startSpanWithName:(NSString *)name category:(NSString *)category parentSpan:(nullable CPATraceSpan *)parentSpan;
+
+/**
+ * Finished spans, in the order in which they finished
+ */
+@property (nonatomic, readonly) NSArray<CPATraceSpan *> *spans;
+
+/**
+ * Discard all finished spans
+ */
+- (void)reset;
+
+/**
+ * Return finished spans as Chrome trace event JSON. Each span is a complete event ("ph": "X"), with timestamps and
+ * durations in microseconds. The events of a trace share the same thread identifier (the trace identifier), so that
+ * each trace is displayed on its own track. Span identifiers, parent links, errors and attributes are available as
+ * event arguments
+ */
+- (nullable NSData *)chromeTraceJSONData;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,224 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPATracer.h"
+
+#import <stdatomic.h>
+
+@interface CPATracer () {
+@private
+    _Atomic(uint64_t) _lastSpanIdentifier;
+}
+
+@property (nonatomic) NSTimeInterval originTime;
+
+// Must be accessed within a @synchronized(self) block
+@property (nonatomic) NSMutableArray<CPATraceSpan *> *finishedSpans;
+
+- (void)recordSpan:(CPATraceSpan *)span;
+
+@end
+
+@interface CPATraceSpan ()
+
+@property (nonatomic, weak) CPATracer *tracer;
+@property (nonatomic, copy) NSString *name;
+@property (nonatomic, copy) NSString *category;
+@property (nonatomic) uint64_t spanIdentifier;
+@property (nonatomic) uint64_t parentSpanIdentifier;
+@property (nonatomic) uint64_t traceIdentifier;
+@property (nonatomic) NSTimeInterval startTime;
+@property (atomic) NSTimeInterval duration;
+@property (atomic) NSError *error;
+
+// Must be accessed within a @synchronized(self) block
+@property (nonatomic) NSMutableDictionary<NSString *, id> *mutableAttributes;
+
+@end
+
+@implementation CPATraceSpan
+
+#pragma mark Object lifecycle
+
+- (instancetype)initWithTracer:(CPATracer *)tracer
+                          name:(NSString *)name
+                      category:(NSString *)category
+                    parentSpan:(CPATraceSpan *)parentSpan
+                spanIdentifier:(uint64_t)spanIdentifier
+{
+    NSParameterAssert(tracer);
+    NSParameterAssert(name);
+    NSParameterAssert(category);
+    
+    if (self = [super init]) {
+        self.tracer = tracer;
+        self.name = name;
+        self.category = category;
+        self.spanIdentifier = spanIdentifier;
+        self.parentSpanIdentifier = parentSpan.spanIdentifier;
+        self.traceIdentifier = parentSpan ? parentSpan.traceIdentifier : spanIdentifier;
+        self.startTime = [NSProcessInfo processInfo].systemUptime - tracer.originTime;
+        self.duration = -1.;
+        self.mutableAttributes = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (instancetype)init
+{
+    [self doesNotRecognizeSelector:_cmd];
+    return nil;
+}
+
+#pragma mark Accessors and mutators
+
+- (NSDictionary<NSString *, id> *)attributes
+{
+    @synchronized(self) {
+        return [self.mutableAttributes copy];
+    }
+}
+
+- (void)setAttribute:(id)value forKey:(NSString *)key
+{
+    NSParameterAssert(key);
+    
+    @synchronized(self) {
+        self.mutableAttributes[key] = value;
+    }
+}
+
+#pragma mark Finishing
+
+- (void)finish
+{
+    [self finishWithError:nil];
+}
+
+- (void)finishWithError:(NSError *)error
+{
+    CPATracer *tracer = self.tracer;
+    
+    @synchronized(self) {
+        if (self.duration >= 0.) {
+            return;
+        }
+        
+        self.error = error;
+        self.duration = fmax([NSProcessInfo processInfo].systemUptime - tracer.originTime - self.startTime, 0.);
+    }
+    
+    [tracer recordSpan:self];
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; name: %@; category: %@; spanIdentifier: %@; parentSpanIdentifier: %@; duration: %@; error: %@>",
+            [self class],
+            self,
+            self.name,
+            self.category,
+            @(self.spanIdentifier),
+            @(self.parentSpanIdentifier),
+            @(self.duration),
+            self.error];
+}
+
+@end
+
+@implementation CPATracer
+
+#pragma mark Object lifecycle
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        self.originTime = [NSProcessInfo processInfo].systemUptime;
+        self.maximumSpanCount = 10000;
+        self.finishedSpans = [NSMutableArray array];
+    }
+    return self;
+}
+
+#pragma mark Spans
+
+- (CPATraceSpan *)startSpanWithName:(NSString *)name category:(NSString *)category parentSpan:(CPATraceSpan *)parentSpan
+{
+    uint64_t spanIdentifier = atomic_fetch_add(&_lastSpanIdentifier, 1) + 1;
+    return [[CPATraceSpan alloc] initWithTracer:self name:name category:category parentSpan:parentSpan spanIdentifier:spanIdentifier];
+}
+
+- (NSArray<CPATraceSpan *> *)spans
+{
+    @synchronized(self) {
+        return [self.finishedSpans copy];
+    }
+}
+
+- (void)recordSpan:(CPATraceSpan *)span
+{
+    NSParameterAssert(span);
+    
+    @synchronized(self) {
+        [self.finishedSpans addObject:span];
+        
+        NSUInteger maximumSpanCount = self.maximumSpanCount;
+        if (self.finishedSpans.count > maximumSpanCount) {
+            [self.finishedSpans removeObjectsInRange:NSMakeRange(0, self.finishedSpans.count - maximumSpanCount)];
+        }
+    }
+}
+
+- (void)reset
+{
+    @synchronized(self) {
+        [self.finishedSpans removeAllObjects];
+    }
+}
+
+#pragma mark Export
+
+- (NSData *)chromeTraceJSONData
+{
+    int processIdentifier = [NSProcessInfo processInfo].processIdentifier;
+    
+    NSMutableArray<NSDictionary<NSString *, id> *> *events = [NSMutableArray array];
+    for (CPATraceSpan *span in self.spans) {
+        NSMutableDictionary<NSString *, id> *arguments = [span.attributes mutableCopy];
+        arguments[@"span_id"] = @(span.spanIdentifier);
+        arguments[@"parent_id"] = @(span.parentSpanIdentifier);
+        if (span.error) {
+            arguments[@"error"] = [NSString stringWithFormat:@"%@ (%@)", span.error.domain, @(span.error.code)];
+        }
+        
+        [events addObject:@{ @"name" : span.name,
+                             @"cat" : span.category,
+                             @"ph" : @"X",
+                             @"ts" : @((uint64_t)(span.startTime * 1000000.)),
+                             @"dur" : @((uint64_t)(span.duration * 1000000.)),
+                             @"pid" : @(processIdentifier),
+                             @"tid" : @(span.traceIdentifier),
+                             @"args" : [arguments copy] }];
+    }
+    
+    NSDictionary<NSString *, id> *trace = @{ @"traceEvents" : [events copy],
+                                             @"displayTimeUnit" : @"ms" };
+    return [NSJSONSerialization dataWithJSONObject:trace options:0 error:NULL];
+}
+
+#pragma mark Description
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p; spans: %@>",
+            [self class],
+            self,
+            @(self.spans.count)];
+}
+
+@end
@@ -0,0 +1,46 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "CPANullability.h"
+#import "CPAResponse.h"
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Types
+typedef void (^CPADictionaryCompletionHandler)(NSDictionary * __nullable responseDictionary, NSURLResponse * __nullable response, NSError * __nullable error);
+typedef void (^CPAResponseCompletionHandler)(__kindof CPAResponse * __nullable decodedResponse, NSURLResponse * __nullable response, NSError * __nullable error, NSTimeInterval decodingDuration);
+
+/**
+ * Convenience NSURLSession additions
+ */
+@interface NSURLSession (CPAExtensions)
+
+/**
+ * Helper method to conveniently get a response as a JSON dictionary, with a completion handler called on the session
+ * delegate queue. The returned task has already been resumed
+ */
+- (NSURLSessionDataTask *)cpa_JSONDictionaryWithRequest:(NSURLRequest *)request completionHandler:(nullable CPADictionaryCompletionHandler)completionHandler;
+
+/**
+ * Helper method to get a response decoded as an instance of the specified CPAResponse subclass, with a completion
+ * handler called on the session delegate queue. The time spent decoding the response is provided as well (-1 if no
+ * response was decoded). The returned task must be resumed
+ *
+ * Unlike -cpa_JSONDictionaryWithRequest:completionHandler:, no intermediate JSON dictionary is built
+ */
+- (NSURLSessionDataTask *)cpa_responseTaskWithRequest:(NSURLRequest *)request responseClass:(Class)responseClass completionHandler:(CPAResponseCompletionHandler)completionHandler;
+
+@end
+
+/**
+ * Parse response data into a JSON dictionary without null values, as -cpa_JSONDictionaryWithRequest:completionHandler:
+ * does. Return nil and an error if the data is not a JSON object or if it contains an error
+ */
+NSDictionary * __nullable CPAJSONDictionaryFromData(NSData * __nullable data, NSError * __nullable * __nullable pError);
+
+NS_ASSUME_NONNULL_END
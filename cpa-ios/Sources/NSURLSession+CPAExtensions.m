@@ -0,0 +1,112 @@
+//
+//  Copyright (c) European Broadcasting Union. All rights reserved.
+//
+//  License information is available from the LICENSE file.
+//
+
+#import "NSURLSession+CPAExtensions.h"
+
+#import "CPAErrors+Private.h"
+
+// Static functions
+static NSError *CPANetworkErrorWithBetterDescription(NSError *error);
+
+@implementation NSURLSession (CPAExtensions)
+
+- (NSURLSessionDataTask *)cpa_JSONDictionaryWithRequest:(NSURLRequest *)request completionHandler:(nullable CPADictionaryCompletionHandler)completionHandler
+{
+    NSURLSessionDataTask *dataTask = [self dataTaskWithRequest:request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+        if (error) {
+            completionHandler ? completionHandler(nil, response, CPANetworkErrorWithBetterDescription(error)) : nil;
+            return;
+        }
+        
+        NSError *responseError = nil;
+        NSDictionary *responseDictionary = CPAJSONDictionaryFromData(data, &responseError);
+        completionHandler ? completionHandler(responseDictionary, response, responseError) : nil;
+    }];
+    [dataTask resume];
+    return dataTask;
+}
+
+- (NSURLSessionDataTask *)cpa_responseTaskWithRequest:(NSURLRequest *)request responseClass:(Class)responseClass completionHandler:(CPAResponseCompletionHandler)completionHandler
+{
+    NSParameterAssert([responseClass isSubclassOfClass:[CPAResponse class]]);
+    NSParameterAssert(completionHandler);
+    
+    NSURLSessionDataTask *dataTask = [self dataTaskWithRequest:request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+        if (error) {
+            completionHandler(nil, response, CPANetworkErrorWithBetterDescription(error), -1.);
+            return;
+        }
+        
+        NSTimeInterval decodingStartTime = [NSProcessInfo processInfo].systemUptime;
+        CPAResponse *decodedResponse = data ? [responseClass responseWithData:data] : nil;
+        NSTimeInterval decodingDuration = [NSProcessInfo processInfo].systemUptime - decodingStartTime;
+        
+        if (! decodedResponse) {
+            completionHandler(nil, response, CPAErrorFromCode(CPAErrorInvalidResponse), decodingDuration);
+            return;
+        }
+        
+        // Deal with errors which might have been returned in the response JSON
+        NSString *errorIdentifier = decodedResponse.errorIdentifier;
+        if (errorIdentifier) {
+            completionHandler(nil, response, CPAErrorFromIdentifier(errorIdentifier), decodingDuration);
+            return;
+        }
+        
+        completionHandler(decodedResponse, response, nil, decodingDuration);
+    }];
+    return dataTask;
+}
+
+@end
+
+#pragma mark Functions
+
+NSDictionary *CPAJSONDictionaryFromData(NSData *data, NSError **pError)
+{
+    id responseJSON = data ? [NSJSONSerialization JSONObjectWithData:data options:NSJSONReadingMutableContainers error:NULL] : nil;
+    if (! responseJSON || ! [responseJSON isKindOfClass:[NSMutableDictionary class]]) {
+        if (pError) {
+            *pError = CPAErrorFromCode(CPAErrorInvalidResponse);
+        }
+        return nil;
+    }
+    
+    NSMutableDictionary *responseDictionary = responseJSON;
+    [[responseDictionary copy] enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+        if (obj == [NSNull null]) {
+            [responseDictionary removeObjectForKey:key];
+        }
+    }];
+    
+    // Deal with errors which might have been returned in the response JSON
+    NSString *errorIdentifier = responseDictionary[@"error"] ?: responseDictionary[@"reason"];
+    if (errorIdentifier) {
+        if (pError) {
+            *pError = CPAErrorFromIdentifier(errorIdentifier);
+        }
+        return nil;
+    }
+    
+    return responseDictionary;
+}
+
+#pragma mark Static functions
+
+/**
+ * Replace the description of CFNetwork errors with a nicer one, if available
+ */
+static NSError *CPANetworkErrorWithBetterDescription(NSError *error)
+{
+    NSString *betterLocalizedDescription = CPALocalizedDescriptionForCFNetworkError(error.code);
+    if (! betterLocalizedDescription) {
+        return error;
+    }
+    
+    NSMutableDictionary *betterUserInfo = [NSMutableDictionary dictionaryWithDictionary:error.userInfo];
+    betterUserInfo[NSLocalizedDescriptionKey] = betterLocalizedDescription;
+    return [NSError errorWithDomain:error.domain code:error.code userInfo:betterUserInfo];
+}